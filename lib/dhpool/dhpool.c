@@ -0,0 +1,344 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "crypto_dh.h"
+#include "insecure_memzero.h"
+#include "warnp.h"
+
+#include "dhpool.h"
+
+/* A pre-generated diffie-hellman keypair. */
+struct dhpool_pair {
+	uint8_t pub[CRYPTO_DH_PUBLEN];
+	uint8_t priv[CRYPTO_DH_PRIVLEN];
+};
+
+/* Pool management structure. */
+struct dhpool {
+	/* Threading glue. */
+	pthread_t thr;		/* Thread ID. */
+	pthread_mutex_t mtx;	/* Controls access to this structure. */
+	pthread_cond_t cv;	/* Thread sleeps on this. */
+
+	/* State management. */
+	int stop;		/* Non-zero if the thread should exit. */
+	double rate;		/* Maximum keypairs per second, or 0. */
+	struct timespec next;	/* Earliest time for the next keypair. */
+
+	/* The pool itself. */
+	struct dhpool_pair * pairs;	/* Keypairs; [0, npairs) are valid. */
+	size_t npairs;		/* Number of keypairs in the pool. */
+	size_t depth;		/* Maximum number of keypairs in the pool. */
+};
+
+/* The pool, or NULL if dhpool_init() has not been called. */
+static struct dhpool * pool = NULL;
+
+/* Return non-zero if ${a} is earlier than ${b}. */
+static int
+ts_before(const struct timespec * a, const struct timespec * b)
+{
+
+	if (a->tv_sec != b->tv_sec)
+		return (a->tv_sec < b->tv_sec);
+	return (a->tv_nsec < b->tv_nsec);
+}
+
+/* Set ${ts} to ${t} seconds after the current (realtime clock) time. */
+static int
+ts_after(struct timespec * ts, double t)
+{
+	long nsec;
+
+	/* Get the current time. */
+	if (clock_gettime(CLOCK_REALTIME, ts)) {
+		warnp("clock_gettime");
+		goto err0;
+	}
+
+	/* Add ${t} seconds. */
+	ts->tv_sec += (time_t)t;
+	nsec = ts->tv_nsec + (long)((t - (double)(time_t)t) * 1000000000.0);
+	if (nsec >= 1000000000) {
+		ts->tv_sec += 1;
+		nsec -= 1000000000;
+	}
+	ts->tv_nsec = nsec;
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* Keypair generation thread. */
+static void *
+workthread(void * cookie)
+{
+	struct dhpool * D = cookie;
+	struct dhpool_pair pair;
+	struct timespec now;
+	int rc;
+
+	/* Grab the mutex. */
+	if ((rc = pthread_mutex_lock(&D->mtx)) != 0) {
+		warn0("pthread_mutex_lock: %s", strerror(rc));
+		exit(1);
+	}
+
+	/* Fill the pool until told to stop. */
+	while (D->stop == 0) {
+		/* If the pool is full, sleep until a keypair is taken. */
+		if (D->npairs == D->depth) {
+			if ((rc = pthread_cond_wait(&D->cv, &D->mtx)) != 0) {
+				warn0("pthread_cond_wait: %s", strerror(rc));
+				exit(1);
+			}
+			continue;
+		}
+
+		/* If we're rate-limited, sleep until we can proceed. */
+		if (D->rate > 0.0) {
+			if (clock_gettime(CLOCK_REALTIME, &now)) {
+				warnp("clock_gettime");
+				exit(1);
+			}
+			if (ts_before(&now, &D->next)) {
+				rc = pthread_cond_timedwait(&D->cv, &D->mtx,
+				    &D->next);
+				if ((rc != 0) && (rc != ETIMEDOUT)) {
+					warn0("pthread_cond_timedwait: %s",
+					    strerror(rc));
+					exit(1);
+				}
+				continue;
+			}
+		}
+
+		/* Release the mutex. */
+		if ((rc = pthread_mutex_unlock(&D->mtx)) != 0) {
+			warn0("pthread_mutex_unlock: %s", strerror(rc));
+			exit(1);
+		}
+
+		/* Generate a keypair. */
+		if (crypto_dh_generate(pair.pub, pair.priv)) {
+			/* Handshakes will generate their own keypairs. */
+			warnp("Could not generate diffie-hellman keypair");
+			goto done;
+		}
+
+		/* Grab the mutex again. */
+		if ((rc = pthread_mutex_lock(&D->mtx)) != 0) {
+			warn0("pthread_mutex_lock: %s", strerror(rc));
+			exit(1);
+		}
+
+		/* Add the keypair to the pool. */
+		memcpy(&D->pairs[D->npairs], &pair, sizeof(pair));
+		D->npairs++;
+		insecure_memzero(&pair, sizeof(pair));
+
+		/* When can we generate another keypair? */
+		if ((D->rate > 0.0) && ts_after(&D->next, 1.0 / D->rate))
+			exit(1);
+	}
+
+	/* Release the mutex. */
+	if ((rc = pthread_mutex_unlock(&D->mtx)) != 0) {
+		warn0("pthread_mutex_unlock: %s", strerror(rc));
+		exit(1);
+	}
+
+done:
+	/* Clean up. */
+	insecure_memzero(&pair, sizeof(pair));
+
+	/* Successful thread termination. */
+	return (NULL);
+}
+
+/**
+ * dhpool_init(depth, rate):
+ * Spawn a thread which keeps a pool of up to ${depth} diffie-hellman
+ * keypairs generated in advance.  If ${rate} is non-zero, generate at most
+ * ${rate} keypairs per second.
+ */
+int
+dhpool_init(size_t depth, double rate)
+{
+	struct dhpool * D;
+	int rc;
+
+	/* Sanity check. */
+	if ((pool != NULL) || (depth == 0) || (rate < 0.0)) {
+		warn0("Programmer error: invalid call to dhpool_init");
+		goto err0;
+	}
+
+	/* Allocate a pool management structure. */
+	if ((D = malloc(sizeof(struct dhpool))) == NULL)
+		goto err0;
+	D->stop = 0;
+	D->rate = rate;
+	D->next.tv_sec = 0;
+	D->next.tv_nsec = 0;
+	D->npairs = 0;
+	D->depth = depth;
+
+	/* Allocate the pool. */
+	if (depth > SIZE_MAX / sizeof(struct dhpool_pair)) {
+		errno = ENOMEM;
+		goto err1;
+	}
+	if ((D->pairs = malloc(depth * sizeof(struct dhpool_pair))) == NULL)
+		goto err1;
+
+	/* Create a mutex and a condition variable. */
+	if ((rc = pthread_mutex_init(&D->mtx, NULL)) != 0) {
+		warn0("pthread_mutex_init: %s", strerror(rc));
+		goto err2;
+	}
+	if ((rc = pthread_cond_init(&D->cv, NULL)) != 0) {
+		warn0("pthread_cond_init: %s", strerror(rc));
+		goto err3;
+	}
+
+	/* Create the thread. */
+	if ((rc = pthread_create(&D->thr, NULL, workthread, D)) != 0) {
+		warn0("pthread_create: %s", strerror(rc));
+		goto err4;
+	}
+
+	/* Handshakes can now use the pool. */
+	pool = D;
+
+	/* Success! */
+	return (0);
+
+err4:
+	if ((rc = pthread_cond_destroy(&D->cv)) != 0)
+		warn0("pthread_cond_destroy: %s", strerror(rc));
+err3:
+	if ((rc = pthread_mutex_destroy(&D->mtx)) != 0)
+		warn0("pthread_mutex_destroy: %s", strerror(rc));
+err2:
+	free(D->pairs);
+err1:
+	free(D);
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/**
+ * dhpool_get(pub, priv):
+ * Remove a keypair from the pool, storing the public value in ${pub} and the
+ * private value in ${priv}; each keypair is handed out only once.  Return 0
+ * on success, 1 if the pool is empty or has not been initialized, or -1 on
+ * error.
+ */
+int
+dhpool_get(uint8_t pub[CRYPTO_DH_PUBLEN], uint8_t priv[CRYPTO_DH_PRIVLEN])
+{
+	struct dhpool * D = pool;
+	struct dhpool_pair * pair;
+	int found = 0;
+	int rc;
+
+	/* If we don't have a pool, we don't have any keypairs. */
+	if (D == NULL)
+		return (1);
+
+	/* Grab the mutex. */
+	if ((rc = pthread_mutex_lock(&D->mtx)) != 0) {
+		warn0("pthread_mutex_lock: %s", strerror(rc));
+		goto err0;
+	}
+
+	/* Take the most recently generated keypair, if there is one. */
+	if (D->npairs > 0) {
+		pair = &D->pairs[--D->npairs];
+		memcpy(pub, pair->pub, CRYPTO_DH_PUBLEN);
+		memcpy(priv, pair->priv, CRYPTO_DH_PRIVLEN);
+		insecure_memzero(pair, sizeof(struct dhpool_pair));
+		found = 1;
+
+		/* Wake up the thread so that it can refill the pool. */
+		if ((rc = pthread_cond_signal(&D->cv)) != 0) {
+			warn0("pthread_cond_signal: %s", strerror(rc));
+			goto err1;
+		}
+	}
+
+	/* Release the mutex. */
+	if ((rc = pthread_mutex_unlock(&D->mtx)) != 0) {
+		warn0("pthread_mutex_unlock: %s", strerror(rc));
+		goto err0;
+	}
+
+	/* Did we get a keypair? */
+	return (found ? 0 : 1);
+
+err1:
+	if ((rc = pthread_mutex_unlock(&D->mtx)) != 0)
+		warn0("pthread_mutex_unlock: %s", strerror(rc));
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/**
+ * dhpool_shutdown(void):
+ * Stop the thread spawned by dhpool_init() (if any), and erase and free any
+ * keypairs remaining in the pool.
+ */
+void
+dhpool_shutdown(void)
+{
+	struct dhpool * D = pool;
+	int rc;
+
+	/* Nothing to do if we don't have a pool. */
+	if (D == NULL)
+		return;
+
+	/* Tell the thread to stop, and wait for it to do so. */
+	if ((rc = pthread_mutex_lock(&D->mtx)) != 0) {
+		warn0("pthread_mutex_lock: %s", strerror(rc));
+		exit(1);
+	}
+	D->stop = 1;
+	if ((rc = pthread_cond_signal(&D->cv)) != 0) {
+		warn0("pthread_cond_signal: %s", strerror(rc));
+		exit(1);
+	}
+	if ((rc = pthread_mutex_unlock(&D->mtx)) != 0) {
+		warn0("pthread_mutex_unlock: %s", strerror(rc));
+		exit(1);
+	}
+	if ((rc = pthread_join(D->thr, NULL)) != 0) {
+		warn0("pthread_join: %s", strerror(rc));
+		exit(1);
+	}
+
+	/* Destroy the condition variable and mutex. */
+	if ((rc = pthread_cond_destroy(&D->cv)) != 0)
+		warn0("pthread_cond_destroy: %s", strerror(rc));
+	if ((rc = pthread_mutex_destroy(&D->mtx)) != 0)
+		warn0("pthread_mutex_destroy: %s", strerror(rc));
+
+	/* Erase and free the unused keypairs. */
+	insecure_memzero(D->pairs, D->npairs * sizeof(struct dhpool_pair));
+	free(D->pairs);
+	free(D);
+
+	/* We no longer have a pool. */
+	pool = NULL;
+}
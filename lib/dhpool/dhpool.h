@@ -0,0 +1,33 @@
+#ifndef DHPOOL_H_
+#define DHPOOL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "crypto_dh.h"
+
+/**
+ * dhpool_init(depth, rate):
+ * Spawn a thread which keeps a pool of up to ${depth} diffie-hellman
+ * keypairs generated in advance.  If ${rate} is non-zero, generate at most
+ * ${rate} keypairs per second.
+ */
+int dhpool_init(size_t, double);
+
+/**
+ * dhpool_get(pub, priv):
+ * Remove a keypair from the pool, storing the public value in ${pub} and the
+ * private value in ${priv}; each keypair is handed out only once.  Return 0
+ * on success, 1 if the pool is empty or has not been initialized, or -1 on
+ * error.
+ */
+int dhpool_get(uint8_t[CRYPTO_DH_PUBLEN], uint8_t[CRYPTO_DH_PRIVLEN]);
+
+/**
+ * dhpool_shutdown(void):
+ * Stop the thread spawned by dhpool_init() (if any), and erase and free any
+ * keypairs remaining in the pool.
+ */
+void dhpool_shutdown(void);
+
+#endif /* !DHPOOL_H_ */
@@ -0,0 +1,507 @@
+#include <sys/socket.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "events.h"
+#include "noeintr.h"
+#include "queue.h"
+#include "warnp.h"
+
+#include "dhthread.h"
+
+/* A computation to be performed by one of the threads. */
+struct dhthread_job {
+	int (* func)(void *);
+	int (* callback)(void *, int);
+	void * cookie;
+	int state;		/* JOB_* as below. */
+	int rc;			/* Value returned by func. */
+	TAILQ_ENTRY(dhthread_job) entries;
+};
+
+/*
+ * Job states.  dhthread_run places the job on the queue in the QUEUED state;
+ * a thread takes it from there and moves it to RUNNING; and once the thread
+ * has finished with it, it moves to DONE and is placed on the done list.
+ */
+#define JOB_QUEUED 0
+#define JOB_RUNNING 1
+#define JOB_DONE 2
+
+/* Thread pool management structure. */
+struct dhthread_pool {
+	/* Threading glue. */
+	pthread_t * thr;	/* Thread IDs. */
+	size_t nthreads;	/* Number of threads. */
+	pthread_mutex_t mtx;	/* Controls access to this structure. */
+	pthread_cond_t cv;	/* Threads sleep on this. */
+	pthread_cond_t cv_done;	/* dhthread_cancel sleeps on this. */
+
+	/* State management. */
+	int stop;		/* Non-zero if the threads should exit. */
+	int wakeupsock[2];	/* Writes to [0], reads from [1]. */
+
+	/* Jobs which have not started, and jobs which have finished. */
+	TAILQ_HEAD(, dhthread_job) queue;
+	TAILQ_HEAD(, dhthread_job) done;
+
+	/* Only accessed from the event loop. */
+	size_t njobs;		/* Jobs which have not been called back. */
+	int wakeup_registered;	/* Waiting for the wakeup socket. */
+};
+
+/* The thread pool, or NULL if dhthread_init() has not been called. */
+static struct dhthread_pool * pool = NULL;
+
+/* Callback functions used below. */
+static int callback_wakeup(void *);
+
+/* Computation thread. */
+static void *
+workthread(void * cookie)
+{
+	struct dhthread_pool * D = cookie;
+	struct dhthread_job * J;
+	uint8_t zero = 0;
+	int rc;
+
+	/* Grab the mutex. */
+	if ((rc = pthread_mutex_lock(&D->mtx)) != 0) {
+		warn0("pthread_mutex_lock: %s", strerror(rc));
+		exit(1);
+	}
+
+	/* Run jobs until told to stop. */
+	while (D->stop == 0) {
+		/* Sleep until there is a job to run. */
+		if ((J = TAILQ_FIRST(&D->queue)) == NULL) {
+			if ((rc = pthread_cond_wait(&D->cv, &D->mtx)) != 0) {
+				warn0("pthread_cond_wait: %s", strerror(rc));
+				exit(1);
+			}
+			continue;
+		}
+
+		/* Take the job. */
+		TAILQ_REMOVE(&D->queue, J, entries);
+		J->state = JOB_RUNNING;
+
+		/* Release the mutex. */
+		if ((rc = pthread_mutex_unlock(&D->mtx)) != 0) {
+			warn0("pthread_mutex_unlock: %s", strerror(rc));
+			exit(1);
+		}
+
+		/* Perform the computation. */
+		J->rc = (J->func)(J->cookie);
+
+		/* Grab the mutex again. */
+		if ((rc = pthread_mutex_lock(&D->mtx)) != 0) {
+			warn0("pthread_mutex_lock: %s", strerror(rc));
+			exit(1);
+		}
+
+		/* Poke the event loop if it has nothing else to pick up. */
+		if (TAILQ_EMPTY(&D->done) &&
+		    (noeintr_write(D->wakeupsock[0], &zero, 1) != 1)) {
+			warnp("Error writing to wakeup socket");
+			exit(1);
+		}
+
+		/* Hand the job back. */
+		J->state = JOB_DONE;
+		TAILQ_INSERT_TAIL(&D->done, J, entries);
+
+		/* Wake up dhthread_cancel if it is waiting for this job. */
+		if ((rc = pthread_cond_broadcast(&D->cv_done)) != 0) {
+			warn0("pthread_cond_broadcast: %s", strerror(rc));
+			exit(1);
+		}
+	}
+
+	/* Release the mutex. */
+	if ((rc = pthread_mutex_unlock(&D->mtx)) != 0) {
+		warn0("pthread_mutex_unlock: %s", strerror(rc));
+		exit(1);
+	}
+
+	/* Successful thread termination. */
+	return (NULL);
+}
+
+/* Stop and join the first ${n} threads in ${D}. */
+static void
+stopthreads(struct dhthread_pool * D, size_t n)
+{
+	size_t i;
+	int rc;
+
+	/* Tell the threads to stop, and wake them up. */
+	if ((rc = pthread_mutex_lock(&D->mtx)) != 0) {
+		warn0("pthread_mutex_lock: %s", strerror(rc));
+		exit(1);
+	}
+	D->stop = 1;
+	if ((rc = pthread_cond_broadcast(&D->cv)) != 0) {
+		warn0("pthread_cond_broadcast: %s", strerror(rc));
+		exit(1);
+	}
+	if ((rc = pthread_mutex_unlock(&D->mtx)) != 0) {
+		warn0("pthread_mutex_unlock: %s", strerror(rc));
+		exit(1);
+	}
+
+	/* Wait for them to do so. */
+	for (i = 0; i < n; i++) {
+		if ((rc = pthread_join(D->thr[i], NULL)) != 0) {
+			warn0("pthread_join: %s", strerror(rc));
+			exit(1);
+		}
+	}
+}
+
+/**
+ * dhthread_init(nthreads):
+ * Spawn ${nthreads} threads for performing diffie-hellman computations off
+ * the event loop.
+ */
+int
+dhthread_init(size_t nthreads)
+{
+	struct dhthread_pool * D;
+	size_t i;
+	int rc;
+
+	/* Sanity check. */
+	if ((pool != NULL) || (nthreads == 0)) {
+		warn0("Programmer error: invalid call to dhthread_init");
+		goto err0;
+	}
+
+	/* Allocate a pool management structure. */
+	if ((D = malloc(sizeof(struct dhthread_pool))) == NULL)
+		goto err0;
+	D->stop = 0;
+	TAILQ_INIT(&D->queue);
+	TAILQ_INIT(&D->done);
+	D->njobs = 0;
+	D->wakeup_registered = 0;
+
+	/* Allocate space for thread IDs. */
+	if (nthreads > SIZE_MAX / sizeof(pthread_t)) {
+		errno = ENOMEM;
+		goto err1;
+	}
+	if ((D->thr = malloc(nthreads * sizeof(pthread_t))) == NULL)
+		goto err1;
+
+	/* Create a mutex and condition variables. */
+	if ((rc = pthread_mutex_init(&D->mtx, NULL)) != 0) {
+		warn0("pthread_mutex_init: %s", strerror(rc));
+		goto err2;
+	}
+	if ((rc = pthread_cond_init(&D->cv, NULL)) != 0) {
+		warn0("pthread_cond_init: %s", strerror(rc));
+		goto err3;
+	}
+	if ((rc = pthread_cond_init(&D->cv_done, NULL)) != 0) {
+		warn0("pthread_cond_init: %s", strerror(rc));
+		goto err4;
+	}
+
+	/* Create wakeup socketpair. */
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, D->wakeupsock)) {
+		warnp("socketpair");
+		goto err5;
+	}
+
+	/* Create the threads. */
+	for (D->nthreads = 0; D->nthreads < nthreads; D->nthreads++) {
+		if ((rc = pthread_create(&D->thr[D->nthreads], NULL,
+		    workthread, D)) != 0) {
+			warn0("pthread_create: %s", strerror(rc));
+			goto err6;
+		}
+	}
+
+	/* Handshakes can now use the threads. */
+	pool = D;
+
+	/* Success! */
+	return (0);
+
+err6:
+	stopthreads(D, D->nthreads);
+	for (i = 0; i < 2; i++) {
+		if (close(D->wakeupsock[i]))
+			warnp("close");
+	}
+err5:
+	pthread_cond_destroy(&D->cv_done);
+err4:
+	pthread_cond_destroy(&D->cv);
+err3:
+	pthread_mutex_destroy(&D->mtx);
+err2:
+	free(D->thr);
+err1:
+	free(D);
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/**
+ * dhthread_enabled(void):
+ * Return non-zero if dhthread_init() has been called (and dhthread_shutdown()
+ * has not been called since then).
+ */
+int
+dhthread_enabled(void)
+{
+
+	return (pool != NULL);
+}
+
+/* Wait for the wakeup socket if we have jobs outstanding, or stop if not. */
+static int
+wakeup_update(struct dhthread_pool * D)
+{
+
+	if ((D->njobs > 0) && !D->wakeup_registered) {
+		if (events_network_register(callback_wakeup, D,
+		    D->wakeupsock[1], EVENTS_NETWORK_OP_READ)) {
+			warnp("Error registering wakeup listener");
+			goto err0;
+		}
+		D->wakeup_registered = 1;
+	} else if ((D->njobs == 0) && D->wakeup_registered) {
+		if (events_network_cancel(D->wakeupsock[1],
+		    EVENTS_NETWORK_OP_READ)) {
+			warnp("Error cancelling wakeup listener");
+			goto err0;
+		}
+		D->wakeup_registered = 0;
+	}
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/**
+ * dhthread_run(func, callback, cookie):
+ * Run ${func}(${cookie}) in one of the threads spawned by dhthread_init().
+ * Upon completion, invoke ${callback}(${cookie}, rc) from the event loop,
+ * where ${rc} is the value returned by ${func}.  Return a cookie which can be
+ * passed to dhthread_cancel() to cancel the computation.
+ */
+void *
+dhthread_run(int (* func)(void *), int (* callback)(void *, int),
+    void * cookie)
+{
+	struct dhthread_pool * D = pool;
+	struct dhthread_job * J;
+	int rc;
+
+	/* Sanity check. */
+	if (D == NULL) {
+		warn0("Programmer error: dhthread_run called before init");
+		goto err0;
+	}
+
+	/* Bake a cookie. */
+	if ((J = malloc(sizeof(struct dhthread_job))) == NULL)
+		goto err0;
+	J->func = func;
+	J->callback = callback;
+	J->cookie = cookie;
+	J->state = JOB_QUEUED;
+
+	/* We want a callback when a thread pokes us. */
+	D->njobs++;
+	if (wakeup_update(D))
+		goto err1;
+
+	/* Queue the job and wake up a thread. */
+	if ((rc = pthread_mutex_lock(&D->mtx)) != 0) {
+		warn0("pthread_mutex_lock: %s", strerror(rc));
+		goto err1;
+	}
+	TAILQ_INSERT_TAIL(&D->queue, J, entries);
+	if ((rc = pthread_cond_signal(&D->cv)) != 0) {
+		warn0("pthread_cond_signal: %s", strerror(rc));
+		goto err2;
+	}
+	if ((rc = pthread_mutex_unlock(&D->mtx)) != 0) {
+		warn0("pthread_mutex_unlock: %s", strerror(rc));
+		exit(1);
+	}
+
+	/* Success! */
+	return (J);
+
+err2:
+	TAILQ_REMOVE(&D->queue, J, entries);
+	pthread_mutex_unlock(&D->mtx);
+err1:
+	D->njobs--;
+	wakeup_update(D);
+	free(J);
+err0:
+	/* Failure! */
+	return (NULL);
+}
+
+/* Callback from the wakeup socket: some jobs are done. */
+static int
+callback_wakeup(void * cookie)
+{
+	struct dhthread_pool * D = cookie;
+	struct dhthread_job * J;
+	uint8_t zero;
+	int rc;
+
+	/* This callback is no longer registered. */
+	D->wakeup_registered = 0;
+
+	/* Drain a byte from the socketpair. */
+	if (read(D->wakeupsock[1], &zero, 1) != 1) {
+		warn0("Error reading from wakeup socket");
+		goto err0;
+	}
+
+	/* Call back for each job which is done. */
+	do {
+		/* Take a job off the done list, if there are any. */
+		if ((rc = pthread_mutex_lock(&D->mtx)) != 0) {
+			warn0("pthread_mutex_lock: %s", strerror(rc));
+			goto err0;
+		}
+		if ((J = TAILQ_FIRST(&D->done)) != NULL)
+			TAILQ_REMOVE(&D->done, J, entries);
+		if ((rc = pthread_mutex_unlock(&D->mtx)) != 0) {
+			warn0("pthread_mutex_unlock: %s", strerror(rc));
+			goto err0;
+		}
+		if (J == NULL)
+			break;
+
+		/* This job is no longer outstanding. */
+		D->njobs--;
+
+		/* Perform the callback and free the job. */
+		rc = (J->callback)(J->cookie, J->rc);
+		free(J);
+		if (rc)
+			goto err0;
+	} while (1);
+
+	/* Wait for more jobs to finish (if necessary). */
+	if (wakeup_update(D))
+		goto err0;
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/**
+ * dhthread_cancel(cookie):
+ * Cancel the computation for which dhthread_run() returned ${cookie}; the
+ * callback will not be invoked.  If the computation is in progress, wait for
+ * it to finish before returning.
+ */
+void
+dhthread_cancel(void * cookie)
+{
+	struct dhthread_pool * D = pool;
+	struct dhthread_job * J = cookie;
+	int rc;
+
+	/* Grab the mutex. */
+	if ((rc = pthread_mutex_lock(&D->mtx)) != 0) {
+		warn0("pthread_mutex_lock: %s", strerror(rc));
+		exit(1);
+	}
+
+	/* If a thread is working on this job, wait for it to finish. */
+	while (J->state == JOB_RUNNING) {
+		if ((rc = pthread_cond_wait(&D->cv_done, &D->mtx)) != 0) {
+			warn0("pthread_cond_wait: %s", strerror(rc));
+			exit(1);
+		}
+	}
+
+	/* Remove the job from whichever list it is on. */
+	if (J->state == JOB_QUEUED)
+		TAILQ_REMOVE(&D->queue, J, entries);
+	else
+		TAILQ_REMOVE(&D->done, J, entries);
+
+	/* Release the mutex. */
+	if ((rc = pthread_mutex_unlock(&D->mtx)) != 0) {
+		warn0("pthread_mutex_unlock: %s", strerror(rc));
+		exit(1);
+	}
+
+	/* This job is no longer outstanding. */
+	D->njobs--;
+	if (wakeup_update(D))
+		warn0("Failed to update wakeup listener");
+
+	/* Free the job. */
+	free(J);
+}
+
+/**
+ * dhthread_shutdown(void):
+ * Stop the threads spawned by dhthread_init() (if any).  There must be no
+ * computations pending.
+ */
+void
+dhthread_shutdown(void)
+{
+	struct dhthread_pool * D = pool;
+	size_t i;
+
+	/* Nothing to do if we don't have a pool. */
+	if (D == NULL)
+		return;
+
+	/* Sanity check. */
+	if (D->njobs > 0)
+		warn0("Programmer error: dhthread_shutdown with jobs pending");
+
+	/* Stop the threads. */
+	stopthreads(D, D->nthreads);
+
+	/* Close the socket pair. */
+	for (i = 0; i < 2; i++) {
+		if (close(D->wakeupsock[i]))
+			warnp("close");
+	}
+
+	/* Destroy the condition variables and mutex. */
+	pthread_cond_destroy(&D->cv_done);
+	pthread_cond_destroy(&D->cv);
+	pthread_mutex_destroy(&D->mtx);
+
+	/* Free the pool management structure. */
+	free(D->thr);
+	free(D);
+
+	/* We no longer have a pool. */
+	pool = NULL;
+}
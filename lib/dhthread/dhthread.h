@@ -0,0 +1,44 @@
+#ifndef DHTHREAD_H_
+#define DHTHREAD_H_
+
+#include <stddef.h>
+
+/**
+ * dhthread_init(nthreads):
+ * Spawn ${nthreads} threads for performing diffie-hellman computations off
+ * the event loop.
+ */
+int dhthread_init(size_t);
+
+/**
+ * dhthread_enabled(void):
+ * Return non-zero if dhthread_init() has been called (and dhthread_shutdown()
+ * has not been called since then).
+ */
+int dhthread_enabled(void);
+
+/**
+ * dhthread_run(func, callback, cookie):
+ * Run ${func}(${cookie}) in one of the threads spawned by dhthread_init().
+ * Upon completion, invoke ${callback}(${cookie}, rc) from the event loop,
+ * where ${rc} is the value returned by ${func}.  Return a cookie which can be
+ * passed to dhthread_cancel() to cancel the computation.
+ */
+void * dhthread_run(int (*)(void *), int (*)(void *, int), void *);
+
+/**
+ * dhthread_cancel(cookie):
+ * Cancel the computation for which dhthread_run() returned ${cookie}; the
+ * callback will not be invoked.  If the computation is in progress, wait for
+ * it to finish before returning.
+ */
+void dhthread_cancel(void *);
+
+/**
+ * dhthread_shutdown(void):
+ * Stop the threads spawned by dhthread_init() (if any).  There must be no
+ * computations pending.
+ */
+void dhthread_shutdown(void);
+
+#endif /* !DHTHREAD_H_ */
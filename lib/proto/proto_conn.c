@@ -4,6 +4,7 @@
 #include <netinet/tcp.h>
 
 #include <assert.h>
+#include <errno.h>
 #include <stdlib.h>
 #include <unistd.h>
 
@@ -19,15 +20,12 @@
 #include "proto_conn.h"
 
 struct conn_state {
+	int (* callback_report)(void *, const struct sock_addr *, int);
+	void * cookie_report;
 	int (* callback_dead)(void *, int);
 	void * cookie;
 	struct sock_addr ** sas;
-	int decr;
-	int nopfs;
-	int requirepfs;
-	int nokeepalive;
-	const struct proto_secret * K;
-	double timeo;
+	struct proto_conn_opts opts;
 	int s;
 	int t;
 	void * connect_cookie;
@@ -40,13 +38,16 @@ struct conn_state {
 	void * pipe_r;
 	int stat_f;
 	int stat_r;
+	int idle;
 };
 
+static int callback_connect_report(void *, const struct sock_addr *, int);
 static int callback_connect_done(void *, int);
 static int callback_connect_timeout(void *);
 static int callback_handshake_done(void *, struct proto_keys *,
     struct proto_keys *);
 static int callback_handshake_timeout(void *);
+static int callback_idle(void *);
 static int callback_pipestatus(void *);
 
 /* Start a handshake. */
@@ -56,12 +57,13 @@ starthandshake(struct conn_state * C, int s, int decr)
 
 	/* Start the handshake timer. */
 	if ((C->handshake_timeout_cookie = events_timer_register_double(
-	    callback_handshake_timeout, C, C->timeo)) == NULL)
+	    callback_handshake_timeout, C, C->opts.timeo)) == NULL)
 		goto err0;
 
 	/* Start the handshake. */
-	if ((C->handshake_cookie = proto_handshake(s, decr, C->nopfs,
-	    C->requirepfs, C->K, callback_handshake_done, C)) == NULL)
+	if ((C->handshake_cookie = proto_handshake(s, decr, C->opts.nopfs,
+	    C->opts.requirepfs, C->opts.jumbo, C->opts.x25519, C->opts.early,
+	    C->opts.K, callback_handshake_done, C)) == NULL)
 		goto err1;
 
 	/* Success! */
@@ -75,13 +77,38 @@ err0:
 	return (-1);
 }
 
+/* Wait for the other end to close a connection which has no source yet. */
+static int
+idlewait(struct conn_state * C)
+{
+
+	/* Wait until the target socket is readable. */
+	if (events_network_register(callback_idle, C, C->t,
+	    EVENTS_NETWORK_OP_READ)) {
+		warnp("events_network_register");
+		goto err0;
+	}
+	C->idle = 1;
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
 /* Launch the two pipes. */
 static int
 launchpipes(struct conn_state * C)
 {
-	int on = C->nokeepalive ? 0 : 1;
+	int on = C->opts.nokeepalive ? 0 : 1;
 	int one = 1;
 
+	/* If we don't have a source socket yet, wait until we get one. */
+	if (C->s == -1)
+		return (idlewait(C));
+
 	/*
 	 * Attempt to turn keepalives on or off as requested.  We ignore
 	 * failures here since the sockets might not be of a type for which
@@ -121,11 +148,11 @@ launchpipes(struct conn_state * C)
 	(void)setsockopt(C->t, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
 
 	/* Create two pipes. */
-	if ((C->pipe_f = proto_pipe(C->s, C->t, C->decr, C->k_f,
-	    &C->stat_f, callback_pipestatus, C)) == NULL)
+	if ((C->pipe_f = proto_pipe(C->s, C->t, C->opts.decr, C->k_f,
+	    C->opts.coalesce, &C->stat_f, callback_pipestatus, C)) == NULL)
 		goto err0;
-	if ((C->pipe_r = proto_pipe(C->t, C->s, !C->decr, C->k_r,
-	    &C->stat_r, callback_pipestatus, C)) == NULL)
+	if ((C->pipe_r = proto_pipe(C->t, C->s, !C->opts.decr, C->k_r,
+	    C->opts.coalesce, &C->stat_r, callback_pipestatus, C)) == NULL)
 		goto err0;
 
 	/* Success! */
@@ -147,8 +174,12 @@ proto_conn_drop(void * conn_cookie, int reason)
 	struct conn_state * C = conn_cookie;
 	int rc;
 
-	/* Close the incoming connection. */
-	if (close(C->s))
+	/* Stop waiting for the target to close the connection. */
+	if (C->idle && events_network_cancel(C->t, EVENTS_NETWORK_OP_READ))
+		warnp("events_network_cancel");
+
+	/* Close the incoming connection if we have one. */
+	if ((C->s != -1) && close(C->s))
 		warnp("close");
 
 	/* Close the outgoing connection if it is open. */
@@ -193,42 +224,59 @@ proto_conn_drop(void * conn_cookie, int reason)
 }
 
 /**
- * proto_conn_create(s, sas, sa_b, decr, nopfs, requirepfs, nokeepalive, K,
- *     timeo, callback_dead, cookie):
- * Create a connection with one end at ${s} and the other end connecting to
- * the target addresses ${sas}.  Bind outgoing address to ${sa_b} if it
- * is not NULL.  If ${decr} is 0, encrypt the outgoing data; if ${decr} is
- * nonzero, decrypt the incoming data.  If ${nopfs} is non-zero,
- * don't use perfect forward secrecy.  If ${requirepfs} is non-zero, drop
- * the connection if the other end tries to disable perfect forward secrecy.
- * Enable transport layer keep-alives (if applicable) on both sockets if and
- * only if ${nokeepalive} is zero.  Drop the connection if the handshake or
- * connecting to the target takes more than ${timeo} seconds.  When the
- * connection is dropped, invoke ${callback_dead}(${cookie}).  Free ${sas}
- * once it is no longer needed.  Return a cookie which can be passed to
- * proto_conn_drop().  If there is a connection error after this
- * function returns, close ${s}.
+ * proto_conn_create(s, sas, sa_b, opts, callback_report, cookie_report,
+ *     callback_dead, cookie):
+ * Create a connection with one end at ${s} and the other end connecting to the
+ * target addresses ${sas}.  Bind outgoing address to ${sa_b} if it is not NULL.
+ * If ${opts}->decr is 0, encrypt the outgoing data; if ${opts}->decr is
+ * nonzero, decrypt the incoming data.  If ${opts}->nopfs is non-zero, don't use
+ * perfect forward secrecy.  If ${opts}->requirepfs is non-zero, drop the
+ * connection if the other end tries to disable perfect forward secrecy.  If
+ * ${opts}->jumbo is non-zero, use jumbo packets if encrypting, or allow the
+ * other end to use them if decrypting.  If ${opts}->x25519 is non-zero,
+ * likewise use or allow an X25519 key exchange.  If ${opts}->early is non-zero
+ * and ${opts}->decr is nonzero, send our handshake parameter without waiting
+ * for the other end's.  Enable transport layer keep-alives (if applicable) on
+ * both sockets if and only if ${opts}->nokeepalive is zero.  Drop the
+ * connection if the handshake or connecting to the target takes more than
+ * ${opts}->timeo seconds.  If ${opts}->race is positive, race the target
+ * addresses as network_connect_bind_race() does, starting the next address if
+ * one has not connected after ${opts}->race seconds; otherwise try them one at
+ * a time.  If ${opts}->coalesce is positive, wait up to ${opts}->coalesce
+ * seconds for data to fill a packet before encrypting it.  The options are
+ * copied, but ${opts}->K must remain valid until the connection is dropped.
+ * If ${callback_report} is not NULL, invoke
+ * ${callback_report}(${cookie_report}, sa, connected) for the target
+ * addresses as network_connect_bind_report() does, and if connecting times
+ * out, report the addresses which were still being attempted as having
+ * failed.  When the connection is dropped, invoke
+ * ${callback_dead}(${cookie}).  Free ${sas} once it is no longer needed.
+ * Return a cookie which can be passed to proto_conn_drop().  If there is a
+ * connection error after this function returns, close ${s}.  If ${s} is -1
+ * (which is only permitted if ${opts}->decr is 0), connect to the target and
+ * perform the handshake, but don't move any data until proto_conn_attach()
+ * provides a source socket; until then, drop the connection if the target
+ * closes it or sends any data.
  */
 void *
 proto_conn_create(int s, struct sock_addr ** sas,
-    const struct sock_addr * sa_b, int decr, int nopfs,
-    int requirepfs, int nokeepalive, const struct proto_secret * K,
-    double timeo, int (* callback_dead)(void *, int), void * cookie)
+    const struct sock_addr * sa_b, const struct proto_conn_opts * opts,
+    int (* callback_report)(void *, const struct sock_addr *, int),
+    void * cookie_report, int (* callback_dead)(void *, int), void * cookie)
 {
 	struct conn_state * C;
+	struct timeval stagger;
+	struct timeval * stagger_p = NULL;
 
 	/* Bake a cookie for this connection. */
 	if ((C = malloc(sizeof(struct conn_state))) == NULL)
 		goto err0;
+	C->callback_report = callback_report;
+	C->cookie_report = cookie_report;
 	C->callback_dead = callback_dead;
 	C->cookie = cookie;
 	C->sas = sas;
-	C->decr = decr;
-	C->nopfs = nopfs;
-	C->requirepfs = requirepfs;
-	C->nokeepalive = nokeepalive;
-	C->K = K;
-	C->timeo = timeo;
+	C->opts = *opts;
 	C->s = s;
 	C->t = -1;
 	C->connect_cookie = NULL;
@@ -238,21 +286,36 @@ proto_conn_create(int s, struct sock_addr ** sas,
 	C->k_f = C->k_r = NULL;
 	C->pipe_f = C->pipe_r = NULL;
 	C->stat_f = C->stat_r = 1;
+	C->idle = 0;
 
 	/* Start the connect timer. */
 	if ((C->connect_timeout_cookie = events_timer_register_double(
-	    callback_connect_timeout, C, C->timeo)) == NULL)
+	    callback_connect_timeout, C, C->opts.timeo)) == NULL)
 		goto err1;
 
-	/* Connect to target. */
-	if ((C->connect_cookie =
-	    network_connect_bind(C->sas, sa_b, callback_connect_done, C))
-	    == NULL)
+	/* Race the target addresses if we've been asked to. */
+	if (C->opts.race > 0.0) {
+		stagger.tv_sec = (time_t)C->opts.race;
+		stagger.tv_usec = (suseconds_t)((C->opts.race -
+		    (double)stagger.tv_sec) * 1000000.0);
+		stagger_p = &stagger;
+	}
+
+	/* Connect to target, reporting on each address if requested. */
+	if ((stagger_p != NULL) || (C->callback_report != NULL)) {
+		C->connect_cookie = network_connect_bind_report(C->sas, sa_b,
+		    stagger_p, callback_connect_report, callback_connect_done,
+		    C);
+	} else {
+		C->connect_cookie = network_connect_bind(C->sas, sa_b,
+		    callback_connect_done, C);
+	}
+	if (C->connect_cookie == NULL)
 		goto err2;
 
 	/* If we're decrypting, start the handshake. */
-	if (C->decr) {
-		if (starthandshake(C, C->s, C->decr))
+	if (C->opts.decr) {
+		if (starthandshake(C, C->s, C->opts.decr))
 			goto err3;
 	}
 
@@ -270,6 +333,67 @@ err0:
 	return (NULL);
 }
 
+/**
+ * proto_conn_attach(conn_cookie, s, callback_dead, cookie):
+ * Use ${s} as the source socket for the connection ${conn_cookie}, which was
+ * created by proto_conn_create() without one, and start moving data once the
+ * connection and handshake have completed.  When the connection is dropped,
+ * invoke ${callback_dead}(${cookie}) instead of the callback originally
+ * provided.  On failure, drop the connection (invoking ${callback_dead}) and
+ * return -1.
+ */
+int
+proto_conn_attach(void * conn_cookie, int s,
+    int (* callback_dead)(void *, int), void * cookie)
+{
+	struct conn_state * C = conn_cookie;
+
+	/* Sanity-check: we shouldn't already have a source socket. */
+	assert(C->s == -1);
+
+	/* We're no longer waiting for the target to close the connection. */
+	if (C->idle) {
+		if (events_network_cancel(C->t, EVENTS_NETWORK_OP_READ))
+			warnp("events_network_cancel");
+		C->idle = 0;
+	}
+
+	/* Record the source socket and the new owner of the connection. */
+	C->s = s;
+	C->callback_dead = callback_dead;
+	C->cookie = cookie;
+
+	/* If we're ready, start shuttling data. */
+	if ((C->t != -1) && (C->k_f != NULL) && (C->k_r != NULL)) {
+		if (launchpipes(C))
+			goto err1;
+	}
+
+	/* Success! */
+	return (0);
+
+err1:
+	proto_conn_drop(C, PROTO_CONN_ERROR);
+
+	/* Failure! */
+	return (-1);
+}
+
+/* We have tried to connect to the target address ${sa}. */
+static int
+callback_connect_report(void * cookie, const struct sock_addr * sa,
+    int connected)
+{
+	struct conn_state * C = cookie;
+
+	/* Nothing to do if nobody asked. */
+	if (C->callback_report == NULL)
+		return (0);
+
+	/* Pass the news along. */
+	return ((C->callback_report)(C->cookie_report, sa, connected));
+}
+
 /* We have connected to the target. */
 static int
 callback_connect_done(void * cookie, int t)
@@ -292,8 +416,8 @@ callback_connect_done(void * cookie, int t)
 		return (proto_conn_drop(C, PROTO_CONN_CONNECT_FAILED));
 
 	/* If we're encrypting, start the handshake. */
-	if (!C->decr) {
-		if (starthandshake(C, C->t, C->decr))
+	if (!C->opts.decr) {
+		if (starthandshake(C, C->t, C->opts.decr))
 			goto err1;
 	}
 
@@ -318,10 +442,20 @@ static int
 callback_connect_timeout(void * cookie)
 {
 	struct conn_state * C = cookie;
+	int rc = 0;
 
 	/* This timeout is no longer pending. */
 	C->connect_timeout_cookie = NULL;
 
+	/*
+	 * Stop connecting; if we're reporting on target addresses, the ones
+	 * we were still waiting for have failed.
+	 */
+	if (C->callback_report != NULL) {
+		rc = network_connect_giveup(C->connect_cookie);
+		C->connect_cookie = NULL;
+	}
+
 	/*
 	 * We could free C->sas here, but from a semantic point of view it
 	 * could still be in use by the not-yet-cancelled connect operation.
@@ -329,8 +463,12 @@ callback_connect_timeout(void * cookie)
 	 * connect.
 	 */
 
-	/* Drop the connection. */
-	return (proto_conn_drop(C, PROTO_CONN_ERROR));
+	/* Drop the connection; we couldn't connect in time. */
+	if (proto_conn_drop(C, PROTO_CONN_CONNECT_FAILED))
+		rc = -1;
+
+	/* Return success/fail status. */
+	return (rc);
 }
 
 /* We have performed the protocol handshake. */
@@ -388,6 +526,46 @@ callback_handshake_timeout(void * cookie)
 	return (proto_conn_drop(C, PROTO_CONN_ERROR));
 }
 
+/* The target socket of a connection without a source is readable. */
+static int
+callback_idle(void * cookie)
+{
+	struct conn_state * C = cookie;
+	char ch;
+	ssize_t len;
+
+	/* We're not waiting any more. */
+	C->idle = 0;
+
+	/* Peek to see if this is data or the connection being closed. */
+	len = recv(C->t, &ch, 1, MSG_PEEK);
+
+	/* Failure? */
+	if (len == -1) {
+		/* Was it really an error, or just a try-again? */
+		if ((errno == EAGAIN) ||
+#if EAGAIN != EWOULDBLOCK
+		    (errno == EWOULDBLOCK) ||
+#endif
+		    (errno == EINTR))
+			return (idlewait(C));
+
+		/* Something went wrong. */
+		return (proto_conn_drop(C, PROTO_CONN_ERROR));
+	} else if (len == 0) {
+		/* The target closed the connection. */
+		return (proto_conn_drop(C, PROTO_CONN_CLOSED));
+	}
+
+	/*
+	 * The target has sent us data.  We can't watch for the target closing
+	 * the connection any more (the socket will stay readable until we have
+	 * a source socket to send the data to), so rather than risk handing
+	 * out a connection which has died, drop it.
+	 */
+	return (proto_conn_drop(C, PROTO_CONN_ERROR));
+}
+
 /* The status of one of the directions has changed. */
 static int
 callback_pipestatus(void * cookie)
@@ -5,6 +5,21 @@
 struct proto_secret;
 struct sock_addr;
 
+/* Options which apply to every connection made by a server or client. */
+struct proto_conn_opts {
+	int decr;		/* Decrypt incoming data (else encrypt). */
+	int nopfs;		/* Don't use perfect forward secrecy. */
+	int requirepfs;		/* Require perfect forward secrecy. */
+	int jumbo;		/* Use (or allow) jumbo packets. */
+	int x25519;		/* Use (or allow) an X25519 key exchange. */
+	int early;		/* Send our handshake parameter early. */
+	int nokeepalive;	/* Don't enable transport layer keep-alives. */
+	const struct proto_secret * K;	/* Shared secret. */
+	double timeo;		/* Connect and handshake timeout. */
+	double race;		/* Stagger between target addresses, or 0. */
+	double coalesce;	/* Time to wait for a full packet, or 0. */
+};
+
 /* Reason why the connection was dropped. */
 enum {
 	PROTO_CONN_CLOSED = 0,		/* Normal exit */
@@ -15,26 +30,56 @@ enum {
 };
 
 /**
- * proto_conn_create(s, sas, sa_b, decr, nopfs, requirepfs, nokeepalive, K,
- *     timeo, callback_dead, cookie):
- * Create a connection with one end at ${s} and the other end connecting to
- * the target addresses ${sas}.  Bind outgoing address to ${sa_b} if it
- * is not NULL.  If ${decr} is 0, encrypt the outgoing data; if ${decr} is
- * nonzero, decrypt the incoming data.  If ${nopfs} is non-zero,
- * don't use perfect forward secrecy.  If ${requirepfs} is non-zero, drop
- * the connection if the other end tries to disable perfect forward secrecy.
- * Enable transport layer keep-alives (if applicable) on both sockets if and
- * only if ${nokeepalive} is zero.  Drop the connection if the handshake or
- * connecting to the target takes more than ${timeo} seconds.  When the
- * connection is dropped, invoke ${callback_dead}(${cookie}).  Free ${sas}
- * once it is no longer needed.  Return a cookie which can be passed to
- * proto_conn_drop().  If there is a connection error after this
- * function returns, close ${s}.
+ * proto_conn_create(s, sas, sa_b, opts, callback_report, cookie_report,
+ *     callback_dead, cookie):
+ * Create a connection with one end at ${s} and the other end connecting to the
+ * target addresses ${sas}.  Bind outgoing address to ${sa_b} if it is not NULL.
+ * If ${opts}->decr is 0, encrypt the outgoing data; if ${opts}->decr is
+ * nonzero, decrypt the incoming data.  If ${opts}->nopfs is non-zero, don't use
+ * perfect forward secrecy.  If ${opts}->requirepfs is non-zero, drop the
+ * connection if the other end tries to disable perfect forward secrecy.  If
+ * ${opts}->jumbo is non-zero, use jumbo packets if encrypting, or allow the
+ * other end to use them if decrypting.  If ${opts}->x25519 is non-zero,
+ * likewise use or allow an X25519 key exchange.  If ${opts}->early is non-zero
+ * and ${opts}->decr is nonzero, send our handshake parameter without waiting
+ * for the other end's.  Enable transport layer keep-alives (if applicable) on
+ * both sockets if and only if ${opts}->nokeepalive is zero.  Drop the
+ * connection if the handshake or connecting to the target takes more than
+ * ${opts}->timeo seconds.  If ${opts}->race is positive, race the target
+ * addresses as network_connect_bind_race() does, starting the next address if
+ * one has not connected after ${opts}->race seconds; otherwise try them one at
+ * a time.  If ${opts}->coalesce is positive, wait up to ${opts}->coalesce
+ * seconds for data to fill a packet before encrypting it.  The options are
+ * copied, but ${opts}->K must remain valid until the connection is dropped.
+ * If ${callback_report} is not NULL, invoke
+ * ${callback_report}(${cookie_report}, sa, connected) for the target
+ * addresses as network_connect_bind_report() does, and if connecting times
+ * out, report the addresses which were still being attempted as having
+ * failed.  When the connection is dropped, invoke
+ * ${callback_dead}(${cookie}).  Free ${sas} once it is no longer needed.
+ * Return a cookie which can be passed to proto_conn_drop().  If there is a
+ * connection error after this function returns, close ${s}.  If ${s} is -1
+ * (which is only permitted if ${opts}->decr is 0), connect to the target and
+ * perform the handshake, but don't move any data until proto_conn_attach()
+ * provides a source socket; until then, drop the connection if the target
+ * closes it or sends any data.
  */
 void * proto_conn_create(int, struct sock_addr **, const struct sock_addr *,
-    int, int, int, int, const struct proto_secret *, double,
+    const struct proto_conn_opts *,
+    int (*)(void *, const struct sock_addr *, int), void *,
     int (*)(void *, int), void *);
 
+/**
+ * proto_conn_attach(conn_cookie, s, callback_dead, cookie):
+ * Use ${s} as the source socket for the connection ${conn_cookie}, which was
+ * created by proto_conn_create() without one, and start moving data once the
+ * connection and handshake have completed.  When the connection is dropped,
+ * invoke ${callback_dead}(${cookie}) instead of the callback originally
+ * provided.  On failure, drop the connection (invoking ${callback_dead}) and
+ * return -1.
+ */
+int proto_conn_attach(void *, int, int (*)(void *, int), void *);
+
 /**
  * proto_conn_drop(conn_cookie, reason):
  * Drop connection and free memory associated with ${conn_cookie}, due to
@@ -1,3 +1,6 @@
+#include <sys/types.h>
+#include <sys/uio.h>
+
 #include <assert.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -7,9 +10,13 @@
 
 #include "crypto_aes.h"
 #include "crypto_aesctr.h"
+#include "crypto_aesctr_hmac.h"
 #include "crypto_verify_bytes.h"
+#include "crypto_x25519.h"
+#include "dhpool.h"
 #include "insecure_memzero.h"
 #include "sha256.h"
+#include "sha256_mb.h"
 #include "sysendian.h"
 #include "warnp.h"
 
@@ -21,10 +28,15 @@ struct proto_secret {
 
 struct proto_keys {
 	struct crypto_aes_key * k_aes;
+	struct crypto_aesctr * aesctr;
 	HMAC_SHA256_CTX ctx_init;
 	uint64_t pnum;
+	int jumbo;
 };
 
+/* Maximum number of packets to MAC at once in the _batch functions. */
+#define BATCHMAX 8
+
 /**
  * mkkeypair(kbuf):
  * Convert the 64 bytes of ${kbuf} into a protocol key structure.
@@ -47,15 +59,25 @@ mkkeypair(uint8_t kbuf[64])
 	if ((k->k_aes = crypto_aes_key_expand(&kbuf[0], 32)) == NULL)
 		goto err1;
 
+	/* Allocate an AES-CTR stream for encrypting in pieces. */
+	if ((k->aesctr = crypto_aesctr_alloc()) == NULL)
+		goto err2;
+	crypto_aesctr_init2(k->aesctr, k->k_aes, 0);
+
 	/* Initialize the HMAC_SHA256 context. */
 	HMAC_SHA256_Init(&k->ctx_init, &kbuf[32], 32);
 
 	/* The first packet will be packet number zero. */
 	k->pnum = 0;
 
+	/* Use normal packets unless told otherwise. */
+	k->jumbo = 0;
+
 	/* Success! */
 	return (k);
 
+err2:
+	crypto_aes_key_free(k->k_aes);
 err1:
 	free(k);
 err0:
@@ -168,6 +190,34 @@ proto_crypt_dhmac(const struct proto_secret * K,
 	memcpy(dhmac_s, &dk_1[PCRYPT_DHMAC_LEN], PCRYPT_DHMAC_LEN);
 }
 
+/**
+ * proto_crypt_dhmac_jumbo(dhmac, dhmac_j):
+ * Derive from the diffie-hellman parameter MAC key ${dhmac} the key
+ * ${dhmac_j} which is used instead by a party requesting jumbo packets.
+ */
+void
+proto_crypt_dhmac_jumbo(const uint8_t dhmac[PCRYPT_DHMAC_LEN],
+    uint8_t dhmac_j[PCRYPT_DHMAC_LEN])
+{
+
+	/* dhmac_j = HMAC(dhmac, "jumbo"). */
+	HMAC_SHA256_Buf(dhmac, PCRYPT_DHMAC_LEN, "jumbo", 5, dhmac_j);
+}
+
+/**
+ * proto_crypt_dhmac_x25519(dhmac, dhmac_x):
+ * Derive from the diffie-hellman parameter MAC key ${dhmac} the key
+ * ${dhmac_x} which is used instead by a party performing an X25519 exchange.
+ */
+void
+proto_crypt_dhmac_x25519(const uint8_t dhmac[PCRYPT_DHMAC_LEN],
+    uint8_t dhmac_x[PCRYPT_DHMAC_LEN])
+{
+
+	/* dhmac_x = HMAC(dhmac, "x25519"). */
+	HMAC_SHA256_Buf(dhmac, PCRYPT_DHMAC_LEN, "x25519", 6, dhmac_x);
+}
+
 /**
  * is_not_one(x, len):
  * Return non-zero if the big-endian value stored at (${x}, ${len}) is not
@@ -187,26 +237,55 @@ is_not_one(const uint8_t * x, size_t len)
 }
 
 /**
- * proto_crypt_dh_validate(yh_r, dhmac_r, requirepfs):
+ * is_not_zero(x, len):
+ * Return non-zero if the value stored at (${x}, ${len}) is not equal to 0.
+ */
+static int
+is_not_zero(const uint8_t * x, size_t len)
+{
+	size_t i;
+	char y;
+
+	for (i = 0, y = 0; i < len; i++) {
+		y |= x[i];
+	}
+
+	return (y);
+}
+
+/**
+ * proto_crypt_dh_validate(yh_r, dhmac_r, requirepfs, x25519):
  * Return non-zero if the value ${yh_r} received from the remote party is not
  * correctly MACed using the diffie-hellman parameter MAC key ${dhmac_r}, or
  * if the included y value is >= the diffie-hellman group modulus, or if
- * ${requirepfs} is non-zero and the included y value is 1.
+ * ${requirepfs} is non-zero and the included y value is 1.  If ${x25519} is
+ * non-zero, ${yh_r} is instead PCRYPT_X25519_YH_LEN bytes long and contains an
+ * X25519 public key, which must be non-zero if ${requirepfs} is non-zero.
  */
 int
 proto_crypt_dh_validate(const uint8_t yh_r[PCRYPT_YH_LEN],
-    const uint8_t dhmac_r[PCRYPT_DHMAC_LEN], int requirepfs)
+    const uint8_t dhmac_r[PCRYPT_DHMAC_LEN], int requirepfs, int x25519)
 {
 	uint8_t hbuf[32];
+	size_t ylen = x25519 ? CRYPTO_X25519_PUBLEN : CRYPTO_DH_PUBLEN;
 
 	/* Compute HMAC. */
-	HMAC_SHA256_Buf(dhmac_r, PCRYPT_DHMAC_LEN, yh_r, CRYPTO_DH_PUBLEN,
-	    hbuf);
+	HMAC_SHA256_Buf(dhmac_r, PCRYPT_DHMAC_LEN, yh_r, ylen, hbuf);
 
 	/* Check that the MAC matches. */
-	if (crypto_verify_bytes(&yh_r[CRYPTO_DH_PUBLEN], hbuf, 32))
+	if (crypto_verify_bytes(&yh_r[ylen], hbuf, 32))
 		return (1);
 
+	/* Every 32-byte string is a valid X25519 public key. */
+	if (x25519) {
+		/* If necessary, enforce that the value is != 0. */
+		if (requirepfs && !is_not_zero(&yh_r[0], ylen))
+			return (1);
+
+		/* Everything is good. */
+		return (0);
+	}
+
 	/* Sanity-check the diffie-hellman value. */
 	if (crypto_dh_sanitycheck(&yh_r[0]))
 		return (1);
@@ -222,30 +301,44 @@ proto_crypt_dh_validate(const uint8_t yh_r[PCRYPT_YH_LEN],
 }
 
 /**
- * proto_crypt_dh_generate(yh_l, x, dhmac_l, nopfs):
+ * proto_crypt_dh_generate(yh_l, x, dhmac_l, nopfs, x25519):
  * Using the MAC key ${dhmac_l}, generate the MACed diffie-hellman handshake
  * parameter ${yh_l}.  Store the diffie-hellman private value in ${x}.  If
- * ${nopfs} is non-zero, skip diffie-hellman generation and use y = 1.
+ * ${nopfs} is non-zero, skip diffie-hellman generation and use y = 1.  If
+ * ${x25519} is non-zero, generate a PCRYPT_X25519_YH_LEN byte parameter
+ * containing an X25519 public key instead (or y = 0 if ${nopfs} is non-zero).
  */
 int
 proto_crypt_dh_generate(uint8_t yh_l[PCRYPT_YH_LEN], uint8_t x[PCRYPT_X_LEN],
-    const uint8_t dhmac_l[PCRYPT_DHMAC_LEN], int nopfs)
+    const uint8_t dhmac_l[PCRYPT_DHMAC_LEN], int nopfs, int x25519)
 {
+	size_t ylen = x25519 ? CRYPTO_X25519_PUBLEN : CRYPTO_DH_PUBLEN;
+	int rc;
 
 	/* Are we skipping the diffie-hellman generation? */
-	if (nopfs) {
+	if (nopfs && x25519) {
+		/* Set y_l to 0. */
+		memset(yh_l, 0, CRYPTO_X25519_PUBLEN);
+	} else if (nopfs) {
 		/* Set y_l to a big-endian 1. */
 		memset(yh_l, 0, CRYPTO_DH_PUBLEN - 1);
 		yh_l[CRYPTO_DH_PUBLEN - 1] = 1;
+	} else if (x25519) {
+		/* Generate x and y. */
+		if (crypto_x25519_generate(yh_l, x))
+			goto err0;
 	} else {
-		/* Generate diffie-hellman parameters x and y. */
-		if (crypto_dh_generate(yh_l, x))
+		/* Take x and y from the pool of pre-generated keypairs. */
+		if ((rc = dhpool_get(yh_l, x)) == -1)
+			goto err0;
+
+		/* If the pool is empty, generate x and y ourselves. */
+		if ((rc == 1) && crypto_dh_generate(yh_l, x))
 			goto err0;
 	}
 
 	/* Append an HMAC. */
-	HMAC_SHA256_Buf(dhmac_l, PCRYPT_DHMAC_LEN, yh_l, CRYPTO_DH_PUBLEN,
-	    &yh_l[CRYPTO_DH_PUBLEN]);
+	HMAC_SHA256_Buf(dhmac_l, PCRYPT_DHMAC_LEN, yh_l, ylen, &yh_l[ylen]);
 
 	/* Success! */
 	return (0);
@@ -256,25 +349,30 @@ err0:
 }
 
 /**
- * proto_crypt_mkkeys(K, nonce_l, nonce_r, yh_r, x, nopfs, decr, eh_c, eh_s):
+ * proto_crypt_mkkeys(K, nonce_l, nonce_r, yh_r, x, nopfs, jumbo, x25519, decr,
+ *     eh_c, eh_s):
  * Using the protocol secret ${K}, the local and remote nonces ${nonce_l} and
  * ${nonce_r}, the remote MACed diffie-hellman handshake parameter ${yh_r},
  * and the local diffie-hellman secret ${x}, generate the keys ${eh_c} and
  * ${eh_s}.  If ${nopfs} is non-zero, we are performing weak handshaking and
- * y_SC is set to 1 rather than being computed.  If ${decr} is non-zero,
- * "local" == "S" and "remote" == "C"; otherwise the assignments are opposite.
+ * y_SC is set to 1 rather than being computed.  If ${jumbo} is non-zero, the
+ * two parties have agreed to use jumbo packets.  If ${x25519} is non-zero, the
+ * parameters are X25519 values and y_SC is computed using X25519 (or set to 0
+ * if ${nopfs} is non-zero).  If ${decr} is non-zero, "local" == "S" and
+ * "remote" == "C"; otherwise the assignments are opposite.
  */
 int
 proto_crypt_mkkeys(const struct proto_secret * K,
     const uint8_t nonce_l[PCRYPT_NONCE_LEN],
     const uint8_t nonce_r[PCRYPT_NONCE_LEN],
     const uint8_t yh_r[PCRYPT_YH_LEN], const uint8_t x[PCRYPT_X_LEN],
-    int nopfs, int decr,
+    int nopfs, int jumbo, int x25519, int decr,
     struct proto_keys ** eh_c, struct proto_keys ** eh_s)
 {
 	uint8_t nonce_y[PCRYPT_NONCE_LEN * 2 + CRYPTO_DH_KEYLEN];
 	uint8_t dk_2[128];
 	const uint8_t * nonce_c, * nonce_s;
+	size_t keylen = x25519 ? CRYPTO_X25519_KEYLEN : CRYPTO_DH_KEYLEN;
 
 	/* Copy in nonces (in the right order). */
 	nonce_c = decr ? nonce_r : nonce_l;
@@ -283,11 +381,19 @@ proto_crypt_mkkeys(const struct proto_secret * K,
 	memcpy(&nonce_y[PCRYPT_NONCE_LEN], nonce_s, PCRYPT_NONCE_LEN);
 
 	/* Are we bypassing the diffie-hellman computation? */
-	if (nopfs) {
+	if (nopfs && x25519) {
+		/* We sent y_l = 0, so y_SC is also 0. */
+		memset(&nonce_y[PCRYPT_NONCE_LEN * 2], 0,
+		    CRYPTO_X25519_KEYLEN);
+	} else if (nopfs) {
 		/* We sent y_l = 1, so y_SC is also 1. */
 		memset(&nonce_y[PCRYPT_NONCE_LEN * 2], 0,
 		    CRYPTO_DH_KEYLEN - 1);
 		nonce_y[PCRYPT_NONCE_LEN * 2 + CRYPTO_DH_KEYLEN - 1] = 1;
+	} else if (x25519) {
+		/* Perform the X25519 computation. */
+		crypto_x25519_compute(yh_r, x,
+		    &nonce_y[PCRYPT_NONCE_LEN * 2]);
 	} else {
 		/* Perform the diffie-hellman computation. */
 		if (crypto_dh_compute(yh_r, x,
@@ -297,7 +403,7 @@ proto_crypt_mkkeys(const struct proto_secret * K,
 
 	/* Compute dk_2. */
 	PBKDF2_SHA256(K->K, 32, nonce_y,
-	    PCRYPT_NONCE_LEN * 2 + CRYPTO_DH_KEYLEN, 1, dk_2, 128);
+	    PCRYPT_NONCE_LEN * 2 + keylen, 1, dk_2, 128);
 
 	/* Create key structures. */
 	if ((*eh_c = mkkeypair(&dk_2[0])) == NULL)
@@ -305,6 +411,9 @@ proto_crypt_mkkeys(const struct proto_secret * K,
 	if ((*eh_s = mkkeypair(&dk_2[64])) == NULL)
 		goto err2;
 
+	/* Record the packet format. */
+	(*eh_c)->jumbo = (*eh_s)->jumbo = jumbo;
+
 	/* Clear sensitive material from the stack. */
 	insecure_memzero(dk_2, sizeof(dk_2));
 	insecure_memzero(nonce_y, sizeof(nonce_y));
@@ -322,10 +431,21 @@ err1:
 	return (-1);
 }
 
+/**
+ * proto_crypt_jumbo(k):
+ * Return non-zero if the keys ${k} are for a connection using jumbo packets.
+ */
+int
+proto_crypt_jumbo(const struct proto_keys * k)
+{
+
+	return (k->jumbo);
+}
+
 /**
  * proto_crypt_enc(ibuf, len, obuf, k):
  * Encrypt ${len} bytes from ${ibuf} into PCRYPT_ESZ bytes using the keys in
- * ${k}, and write the result into ${obuf}.
+ * ${k}, and write the result into ${obuf}.  The buffers must not overlap.
  */
 void
 proto_crypt_enc(uint8_t * ibuf, size_t len, uint8_t obuf[PCRYPT_ESZ],
@@ -337,24 +457,25 @@ proto_crypt_enc(uint8_t * ibuf, size_t len, uint8_t obuf[PCRYPT_ESZ],
 	/* Sanity-check the length. */
 	assert(len <= PCRYPT_MAXDSZ);
 
-	/* Copy the decrypted data into the encrypted buffer. */
-	memcpy(obuf, ibuf, len);
-
 	/* Pad up to PCRYPT_MAXDSZ with zeroes. */
 	memset(&obuf[len], 0, PCRYPT_MAXDSZ - len);
 
 	/* Add the length. */
 	be32enc(&obuf[PCRYPT_MAXDSZ], (uint32_t)len);
 
-	/* Encrypt the buffer in-place. */
-	crypto_aesctr_buf(k->k_aes, k->pnum, obuf, obuf, PCRYPT_MAXDSZ + 4);
-
 	/* Copy the original (initialized) context. */
 	memcpy(&ctx, &k->ctx_init, sizeof(HMAC_SHA256_CTX));
 
+	/*
+	 * Encrypt the data from ${ibuf} followed by the padding and length
+	 * into the encrypted buffer, and feed it into the HMAC.  This avoids
+	 * copying the data into the encrypted buffer first where possible.
+	 */
+	crypto_aesctr_hmac_enc_copy(k->k_aes, k->pnum, ibuf, len, obuf,
+	    PCRYPT_MAXDSZ + 4, &ctx);
+
 	/* Append an HMAC. */
 	be64enc(pnum_exp, k->pnum);
-	HMAC_SHA256_Update(&ctx, obuf, PCRYPT_MAXDSZ + 4);
 	HMAC_SHA256_Update(&ctx, pnum_exp, 8);
 	HMAC_SHA256_Final(&obuf[PCRYPT_MAXDSZ + 4], &ctx);
 
@@ -362,6 +483,49 @@ proto_crypt_enc(uint8_t * ibuf, size_t len, uint8_t obuf[PCRYPT_ESZ],
 	k->pnum += 1;
 }
 
+/* Decrypt the packet ${ibuf} in place; return the length or -1. */
+static ssize_t
+dec_inplace(uint8_t ibuf[PCRYPT_ESZ], struct proto_keys * k)
+{
+	HMAC_SHA256_CTX ctx;
+	uint8_t hbuf[32];
+	uint8_t pnum_exp[8];
+	size_t len;
+
+	/* Copy the original (initialized) context. */
+	memcpy(&ctx, &k->ctx_init, sizeof(HMAC_SHA256_CTX));
+
+	/*
+	 * Feed the buffer into the HMAC and decrypt it in-place.  We do this
+	 * in a single pass for performance; if the HMAC turns out to be
+	 * invalid, we wipe the decrypted buffer without looking at it.
+	 */
+	crypto_aesctr_hmac_dec(k->k_aes, k->pnum, ibuf, PCRYPT_MAXDSZ + 4,
+	    &ctx);
+
+	/* Verify HMAC. */
+	be64enc(pnum_exp, k->pnum);
+	HMAC_SHA256_Update(&ctx, pnum_exp, 8);
+	HMAC_SHA256_Final(hbuf, &ctx);
+	if (crypto_verify_bytes(hbuf, &ibuf[PCRYPT_MAXDSZ + 4], 32)) {
+		insecure_memzero(ibuf, PCRYPT_MAXDSZ + 4);
+		return (-1);
+	}
+
+	/* Increment packet number. */
+	k->pnum += 1;
+
+	/* Parse length. */
+	len = be32dec(&ibuf[PCRYPT_MAXDSZ]);
+
+	/* Make sure nobody is being evil here... */
+	if ((len == 0) || (len > PCRYPT_MAXDSZ))
+		return (-1);
+
+	/* Return the decrypted length. */
+	return ((ssize_t)len);
+}
+
 /**
  * proto_crypt_dec(ibuf, obuf, k):
  * Decrypt PCRYPT_ESZ bytes from ${ibuf} using the keys in ${k}.  If the data
@@ -371,39 +535,345 @@ proto_crypt_enc(uint8_t * ibuf, size_t len, uint8_t obuf[PCRYPT_ESZ],
 ssize_t
 proto_crypt_dec(uint8_t ibuf[PCRYPT_ESZ], uint8_t * obuf,
     struct proto_keys * k)
+{
+	ssize_t len;
+
+	/* Decrypt the packet in place. */
+	if ((len = dec_inplace(ibuf, k)) == -1)
+		return (-1);
+
+	/* Copy the bytes into the output buffer. */
+	memcpy(obuf, ibuf, (size_t)len);
+
+	/* Return the decrypted length. */
+	return (len);
+}
+
+/**
+ * proto_crypt_enc_batch(iov, iovcnt, obuf, k):
+ * For each i in [0, ${iovcnt}), encrypt the ${iov}[i].iov_len bytes (which
+ * must be at most PCRYPT_MAXDSZ) from ${iov}[i].iov_base into the PCRYPT_ESZ
+ * bytes at &${obuf}[i * PCRYPT_ESZ], using the keys in ${k} and consecutive
+ * packet numbers starting from the next packet number of ${k}.  This is
+ * equivalent to calling proto_crypt_enc() on each packet in turn, but may
+ * compute the HMACs of several packets at once.
+ */
+void
+proto_crypt_enc_batch(const struct iovec * iov, size_t iovcnt, uint8_t * obuf,
+    struct proto_keys * k)
+{
+	HMAC_SHA256_CTX ctx[BATCHMAX];
+	HMAC_SHA256_CTX * ctxs[BATCHMAX];
+	const uint8_t * ins[BATCHMAX];
+	uint8_t * digests[BATCHMAX];
+	uint8_t pnum_exp[BATCHMAX][8];
+	uint8_t * pbuf;
+	size_t plen;
+	size_t n, i;
+
+	/* If we can't MAC several packets at once, do them one at a time. */
+	if (HMAC_SHA256_mb_lanes() == 1) {
+		for (i = 0; i < iovcnt; i++)
+			proto_crypt_enc(iov[i].iov_base, iov[i].iov_len,
+			    &obuf[i * PCRYPT_ESZ], k);
+		return;
+	}
+
+	for (; iovcnt > 0; iovcnt -= n, iov += n, obuf += n * PCRYPT_ESZ) {
+		n = (iovcnt > BATCHMAX) ? BATCHMAX : iovcnt;
+
+		/* Encrypt up to BATCHMAX packets. */
+		for (i = 0; i < n; i++) {
+			pbuf = &obuf[i * PCRYPT_ESZ];
+			plen = iov[i].iov_len;
+
+			/* Sanity-check the length. */
+			assert(plen <= PCRYPT_MAXDSZ);
+
+			/* Pad and add the length, as proto_crypt_enc. */
+			memset(&pbuf[plen], 0, PCRYPT_MAXDSZ - plen);
+			be32enc(&pbuf[PCRYPT_MAXDSZ], (uint32_t)plen);
+
+			/* Encrypt the data, then the padding and length. */
+			crypto_aesctr_init2(k->aesctr, NULL, k->pnum + i);
+			crypto_aesctr_stream(k->aesctr, iov[i].iov_base, pbuf,
+			    plen);
+			crypto_aesctr_stream(k->aesctr, &pbuf[plen], &pbuf[plen],
+			    PCRYPT_MAXDSZ + 4 - plen);
+
+			/* Prepare to compute the HMAC. */
+			memcpy(&ctx[i], &k->ctx_init, sizeof(HMAC_SHA256_CTX));
+			ctxs[i] = &ctx[i];
+			ins[i] = pbuf;
+			digests[i] = &pbuf[PCRYPT_MAXDSZ + 4];
+		}
+
+		/* Append HMACs. */
+		HMAC_SHA256_Update_mb(ctxs, ins, PCRYPT_MAXDSZ + 4, n);
+		for (i = 0; i < n; i++) {
+			be64enc(pnum_exp[i], k->pnum + i);
+			ins[i] = pnum_exp[i];
+		}
+		HMAC_SHA256_Update_mb(ctxs, ins, 8, n);
+		HMAC_SHA256_Final_mb(digests, ctxs, n);
+
+		/* Increment packet number. */
+		k->pnum += n;
+	}
+}
+
+/**
+ * proto_crypt_dec_batch(iov, iovcnt, obuf, k):
+ * For each i in [0, ${iovcnt}), decrypt the PCRYPT_ESZ-byte packet at
+ * ${iov}[i].iov_base using the keys in ${k} and consecutive packet numbers
+ * starting from the next packet number of ${k}.  If the data is all valid,
+ * write it consecutively into ${obuf} and return the total length; otherwise,
+ * return -1.  This is equivalent to calling proto_crypt_dec() on each packet
+ * in turn, but may compute the HMACs of several packets at once.
+ */
+ssize_t
+proto_crypt_dec_batch(const struct iovec * iov, size_t iovcnt, uint8_t * obuf,
+    struct proto_keys * k)
+{
+	struct iovec piov[BATCHMAX];
+	size_t opos = 0;
+	size_t n, i;
+
+	for (; iovcnt > 0; iovcnt -= n, iov += n) {
+		n = (iovcnt > BATCHMAX) ? BATCHMAX : iovcnt;
+
+		/* Decrypt up to BATCHMAX packets in place. */
+		memcpy(piov, iov, n * sizeof(struct iovec));
+		if (proto_crypt_dec_batch_inplace(piov, n, k) == -1)
+			goto err0;
+
+		/* Copy the bytes into the output buffer. */
+		for (i = 0; i < n; i++) {
+			memcpy(&obuf[opos], piov[i].iov_base, piov[i].iov_len);
+			opos += piov[i].iov_len;
+		}
+	}
+
+	/* Return the decrypted length. */
+	return ((ssize_t)opos);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/**
+ * proto_crypt_dec_batch_inplace(iov, iovcnt, k):
+ * Decrypt the packets described by ${iov} and ${iovcnt} as
+ * proto_crypt_dec_batch(), but leave the data in place: on success, set each
+ * ${iov}[i].iov_len to the length of the data at the start of
+ * ${iov}[i].iov_base, and return the total length.  If any packet is invalid,
+ * return -1.
+ */
+ssize_t
+proto_crypt_dec_batch_inplace(struct iovec * iov, size_t iovcnt,
+    struct proto_keys * k)
+{
+	HMAC_SHA256_CTX ctx[BATCHMAX];
+	HMAC_SHA256_CTX * ctxs[BATCHMAX];
+	const uint8_t * ins[BATCHMAX];
+	uint8_t * digests[BATCHMAX];
+	uint8_t pnum_exp[BATCHMAX][8];
+	uint8_t hbuf[BATCHMAX][32];
+	uint8_t * pbuf;
+	size_t total = 0;
+	ssize_t plen;
+	size_t len;
+	size_t n, i;
+
+	/* If we can't MAC several packets at once, do them one at a time. */
+	if (HMAC_SHA256_mb_lanes() == 1) {
+		for (i = 0; i < iovcnt; i++) {
+			assert(iov[i].iov_len == PCRYPT_ESZ);
+			if ((plen = dec_inplace(iov[i].iov_base, k)) == -1)
+				goto err0;
+			iov[i].iov_len = (size_t)plen;
+			total += (size_t)plen;
+		}
+		return ((ssize_t)total);
+	}
+
+	for (; iovcnt > 0; iovcnt -= n, iov += n) {
+		n = (iovcnt > BATCHMAX) ? BATCHMAX : iovcnt;
+
+		/* Compute the HMACs of up to BATCHMAX packets. */
+		for (i = 0; i < n; i++) {
+			assert(iov[i].iov_len == PCRYPT_ESZ);
+			memcpy(&ctx[i], &k->ctx_init, sizeof(HMAC_SHA256_CTX));
+			ctxs[i] = &ctx[i];
+			ins[i] = iov[i].iov_base;
+			digests[i] = hbuf[i];
+		}
+		HMAC_SHA256_Update_mb(ctxs, ins, PCRYPT_MAXDSZ + 4, n);
+		for (i = 0; i < n; i++) {
+			be64enc(pnum_exp[i], k->pnum + i);
+			ins[i] = pnum_exp[i];
+		}
+		HMAC_SHA256_Update_mb(ctxs, ins, 8, n);
+		HMAC_SHA256_Final_mb(digests, ctxs, n);
+
+		/* Verify HMACs. */
+		for (i = 0; i < n; i++) {
+			pbuf = iov[i].iov_base;
+			if (crypto_verify_bytes(hbuf[i],
+			    &pbuf[PCRYPT_MAXDSZ + 4], 32))
+				goto err0;
+		}
+
+		/* Decrypt the packets. */
+		for (i = 0; i < n; i++) {
+			pbuf = iov[i].iov_base;
+
+			/* Decrypt the buffer in-place. */
+			crypto_aesctr_buf(k->k_aes, k->pnum, pbuf, pbuf,
+			    PCRYPT_MAXDSZ + 4);
+
+			/* Increment packet number. */
+			k->pnum += 1;
+
+			/* Parse length. */
+			len = be32dec(&pbuf[PCRYPT_MAXDSZ]);
+
+			/* Make sure nobody is being evil here... */
+			if ((len == 0) || (len > PCRYPT_MAXDSZ))
+				goto err0;
+
+			/* Record where the data is. */
+			iov[i].iov_len = len;
+			total += len;
+		}
+	}
+
+	/* Return the decrypted length. */
+	return ((ssize_t)total);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/**
+ * proto_crypt_enc_jumbo(ibuf, len, obuf, k):
+ * Encrypt ${len} bytes (which must be at most PCRYPT_JUMBO_MAXDSZ) from
+ * ${ibuf} into a jumbo packet using the keys in ${k}, and write the result
+ * into ${obuf}, which must have room for PCRYPT_JUMBO_ESZ bytes.  The data is
+ * padded to a multiple of PCRYPT_MAXDSZ bytes.  Return the size of the
+ * encrypted packet.  The buffers must not overlap.
+ */
+size_t
+proto_crypt_enc_jumbo(const uint8_t * ibuf, size_t len, uint8_t * obuf,
+    struct proto_keys * k)
+{
+	HMAC_SHA256_CTX ctx;
+	uint8_t pnum_exp[8];
+	uint8_t * cbuf = &obuf[PCRYPT_JUMBO_HLEN];
+	size_t nblk;
+	size_t dsz;
+
+	/* Sanity-check the length. */
+	assert((len > 0) && (len <= PCRYPT_JUMBO_MAXDSZ));
+
+	/* Round the size of the data up to a whole number of blocks. */
+	nblk = (len + PCRYPT_MAXDSZ - 1) / PCRYPT_MAXDSZ;
+	dsz = nblk * PCRYPT_MAXDSZ;
+
+	/* The header (in the clear) says how many blocks there are. */
+	be32enc(obuf, (uint32_t)nblk);
+
+	/* Pad with zeroes, and add the length. */
+	memset(&cbuf[len], 0, dsz - len);
+	be32enc(&cbuf[dsz], (uint32_t)len);
+
+	/* Encrypt and MAC the data, padding, and length, as proto_crypt_enc. */
+	memcpy(&ctx, &k->ctx_init, sizeof(HMAC_SHA256_CTX));
+	crypto_aesctr_hmac_enc_copy(k->k_aes, k->pnum, ibuf, len, cbuf,
+	    dsz + 4, &ctx);
+
+	/* Append an HMAC which also covers the header. */
+	be64enc(pnum_exp, k->pnum);
+	HMAC_SHA256_Update(&ctx, obuf, PCRYPT_JUMBO_HLEN);
+	HMAC_SHA256_Update(&ctx, pnum_exp, 8);
+	HMAC_SHA256_Final(&cbuf[dsz + 4], &ctx);
+
+	/* Increment packet number. */
+	k->pnum += 1;
+
+	/* Return the size of the encrypted packet. */
+	return (PCRYPT_JUMBO_HLEN + dsz + 4 + 32);
+}
+
+/**
+ * proto_crypt_jumbo_esz(hbuf):
+ * Return the size of the encrypted jumbo packet which starts with the
+ * PCRYPT_JUMBO_HLEN bytes ${hbuf}, or -1 if the header is invalid.
+ */
+ssize_t
+proto_crypt_jumbo_esz(const uint8_t hbuf[PCRYPT_JUMBO_HLEN])
+{
+	uint32_t nblk;
+
+	/* Parse the number of blocks. */
+	nblk = be32dec(hbuf);
+
+	/* Make sure nobody is being evil here... */
+	if ((nblk == 0) || (nblk > PCRYPT_JUMBO_MAXDSZ / PCRYPT_MAXDSZ))
+		return (-1);
+
+	/* Return the size of the encrypted packet. */
+	return ((ssize_t)(PCRYPT_JUMBO_HLEN + nblk * PCRYPT_MAXDSZ + 4 + 32));
+}
+
+/**
+ * proto_crypt_dec_jumbo_inplace(ibuf, k):
+ * Decrypt the jumbo packet ${ibuf}, of the size indicated by its header,
+ * in place using the keys in ${k}.  If the data is valid, return its length;
+ * the data is left at &${ibuf}[PCRYPT_JUMBO_HLEN].  Otherwise, return -1.
+ */
+ssize_t
+proto_crypt_dec_jumbo_inplace(uint8_t * ibuf, struct proto_keys * k)
 {
 	HMAC_SHA256_CTX ctx;
 	uint8_t hbuf[32];
 	uint8_t pnum_exp[8];
+	uint8_t * cbuf = &ibuf[PCRYPT_JUMBO_HLEN];
+	ssize_t esz;
+	size_t dsz;
 	size_t len;
 
-	/* Copy the original (initialized) context. */
+	/* Figure out how much data the packet holds. */
+	if ((esz = proto_crypt_jumbo_esz(ibuf)) == -1)
+		return (-1);
+	dsz = (size_t)esz - PCRYPT_JUMBO_HLEN - 4 - 32;
+
+	/* MAC and decrypt in a single pass, as proto_crypt_dec. */
 	memcpy(&ctx, &k->ctx_init, sizeof(HMAC_SHA256_CTX));
+	crypto_aesctr_hmac_dec(k->k_aes, k->pnum, cbuf, dsz + 4, &ctx);
 
 	/* Verify HMAC. */
 	be64enc(pnum_exp, k->pnum);
-	HMAC_SHA256_Update(&ctx, ibuf, PCRYPT_MAXDSZ + 4);
+	HMAC_SHA256_Update(&ctx, ibuf, PCRYPT_JUMBO_HLEN);
 	HMAC_SHA256_Update(&ctx, pnum_exp, 8);
 	HMAC_SHA256_Final(hbuf, &ctx);
-	if (crypto_verify_bytes(hbuf, &ibuf[PCRYPT_MAXDSZ + 4], 32))
+	if (crypto_verify_bytes(hbuf, &cbuf[dsz + 4], 32)) {
+		insecure_memzero(cbuf, dsz + 4);
 		return (-1);
-
-	/* Decrypt the buffer in-place. */
-	crypto_aesctr_buf(k->k_aes, k->pnum, ibuf, ibuf, PCRYPT_MAXDSZ + 4);
+	}
 
 	/* Increment packet number. */
 	k->pnum += 1;
 
 	/* Parse length. */
-	len = be32dec(&ibuf[PCRYPT_MAXDSZ]);
+	len = be32dec(&cbuf[dsz]);
 
 	/* Make sure nobody is being evil here... */
-	if ((len == 0) || (len > PCRYPT_MAXDSZ))
+	if ((len == 0) || (len > dsz))
 		return (-1);
 
-	/* Copy the bytes into the output buffer. */
-	memcpy(obuf, ibuf, len);
-
 	/* Return the decrypted length. */
 	return ((ssize_t)len);
 }
@@ -439,7 +909,8 @@ proto_crypt_free(struct proto_keys * k)
 	if (k == NULL)
 		return;
 
-	/* Free the AES key. */
+	/* Free the AES-CTR stream and AES key. */
+	crypto_aesctr_free(k->aesctr);
 	crypto_aes_key_free(k->k_aes);
 
 	/* Free the key structure. */
@@ -5,8 +5,10 @@
 #include <unistd.h>
 
 #include "crypto_dh.h"
+#include "crypto_x25519.h"
 
 /* Opaque structures. */
+struct iovec;
 struct proto_keys;
 struct proto_secret;
 
@@ -22,6 +24,9 @@ struct proto_secret;
 /* Size of MACed Diffie-Hellman parameter. */
 #define PCRYPT_YH_LEN (CRYPTO_DH_PUBLEN + 32)
 
+/* Size of MACed X25519 parameter. */
+#define PCRYPT_X25519_YH_LEN (CRYPTO_X25519_PUBLEN + 32)
+
 /* Filename for stdin. */
 #define STDIN_FILENAME "-"
 
@@ -43,37 +48,67 @@ void proto_crypt_dhmac(const struct proto_secret *,
     uint8_t[PCRYPT_DHMAC_LEN], uint8_t[PCRYPT_DHMAC_LEN], int);
 
 /**
- * proto_crypt_dh_validate(yh_r, dhmac_r, requirepfs):
+ * proto_crypt_dhmac_jumbo(dhmac, dhmac_j):
+ * Derive from the diffie-hellman parameter MAC key ${dhmac} the key
+ * ${dhmac_j} which is used instead by a party requesting jumbo packets.
+ */
+void proto_crypt_dhmac_jumbo(const uint8_t[PCRYPT_DHMAC_LEN],
+    uint8_t[PCRYPT_DHMAC_LEN]);
+
+/**
+ * proto_crypt_dhmac_x25519(dhmac, dhmac_x):
+ * Derive from the diffie-hellman parameter MAC key ${dhmac} the key
+ * ${dhmac_x} which is used instead by a party performing an X25519 exchange.
+ */
+void proto_crypt_dhmac_x25519(const uint8_t[PCRYPT_DHMAC_LEN],
+    uint8_t[PCRYPT_DHMAC_LEN]);
+
+/**
+ * proto_crypt_dh_validate(yh_r, dhmac_r, requirepfs, x25519):
  * Return non-zero if the value ${yh_r} received from the remote party is not
  * correctly MACed using the diffie-hellman parameter MAC key ${dhmac_r}, or
  * if the included y value is >= the diffie-hellman group modulus, or if
- * ${requirepfs} is non-zero and the included y value is 1.
+ * ${requirepfs} is non-zero and the included y value is 1.  If ${x25519} is
+ * non-zero, ${yh_r} is instead PCRYPT_X25519_YH_LEN bytes long and contains an
+ * X25519 public key, which must be non-zero if ${requirepfs} is non-zero.
  */
 int proto_crypt_dh_validate(const uint8_t[PCRYPT_YH_LEN],
-    const uint8_t[PCRYPT_DHMAC_LEN], int);
+    const uint8_t[PCRYPT_DHMAC_LEN], int, int);
 
 /**
- * proto_crypt_dh_generate(yh_l, x, dhmac_l, nopfs):
+ * proto_crypt_dh_generate(yh_l, x, dhmac_l, nopfs, x25519):
  * Using the MAC key ${dhmac_l}, generate the MACed diffie-hellman handshake
  * parameter ${yh_l}.  Store the diffie-hellman private value in ${x}.  If
- * ${nopfs} is non-zero, skip diffie-hellman generation and use y = 1.
+ * ${nopfs} is non-zero, skip diffie-hellman generation and use y = 1.  If
+ * ${x25519} is non-zero, generate a PCRYPT_X25519_YH_LEN byte parameter
+ * containing an X25519 public key instead (or y = 0 if ${nopfs} is non-zero).
  */
 int proto_crypt_dh_generate(uint8_t[PCRYPT_YH_LEN], uint8_t[PCRYPT_X_LEN],
-    const uint8_t[PCRYPT_DHMAC_LEN], int);
+    const uint8_t[PCRYPT_DHMAC_LEN], int, int);
 
 /**
- * proto_crypt_mkkeys(K, nonce_l, nonce_r, yh_r, x, nopfs, decr, eh_c, eh_s):
+ * proto_crypt_mkkeys(K, nonce_l, nonce_r, yh_r, x, nopfs, jumbo, x25519, decr,
+ *     eh_c, eh_s):
  * Using the protocol secret ${K}, the local and remote nonces ${nonce_l} and
  * ${nonce_r}, the remote MACed diffie-hellman handshake parameter ${yh_r},
  * and the local diffie-hellman secret ${x}, generate the keys ${eh_c} and
  * ${eh_s}.  If ${nopfs} is non-zero, we are performing weak handshaking and
- * y_SC is set to 1 rather than being computed.  If ${decr} is non-zero,
- * "local" == "S" and "remote" == "C"; otherwise the assignments are opposite.
+ * y_SC is set to 1 rather than being computed.  If ${jumbo} is non-zero, the
+ * two parties have agreed to use jumbo packets.  If ${x25519} is non-zero, the
+ * parameters are X25519 values and y_SC is computed using X25519 (or set to 0
+ * if ${nopfs} is non-zero).  If ${decr} is non-zero, "local" == "S" and
+ * "remote" == "C"; otherwise the assignments are opposite.
  */
 int proto_crypt_mkkeys(const struct proto_secret *,
     const uint8_t[PCRYPT_NONCE_LEN], const uint8_t[PCRYPT_NONCE_LEN],
-    const uint8_t[PCRYPT_YH_LEN], const uint8_t[PCRYPT_X_LEN], int, int,
-    struct proto_keys **, struct proto_keys **);
+    const uint8_t[PCRYPT_YH_LEN], const uint8_t[PCRYPT_X_LEN], int, int, int,
+    int, struct proto_keys **, struct proto_keys **);
+
+/**
+ * proto_crypt_jumbo(k):
+ * Return non-zero if the keys ${k} are for a connection using jumbo packets.
+ */
+int proto_crypt_jumbo(const struct proto_keys *);
 
 /* Maximum size of an unencrypted packet. */
 #define PCRYPT_MAXDSZ 1024
@@ -84,7 +119,7 @@ int proto_crypt_mkkeys(const struct proto_secret *,
 /**
  * proto_crypt_enc(ibuf, len, obuf, k):
  * Encrypt ${len} bytes from ${ibuf} into PCRYPT_ESZ bytes using the keys in
- * ${k}, and write the result into ${obuf}.
+ * ${k}, and write the result into ${obuf}.  The buffers must not overlap.
  */
 void proto_crypt_enc(uint8_t *, size_t, uint8_t[PCRYPT_ESZ],
     struct proto_keys *);
@@ -97,6 +132,77 @@ void proto_crypt_enc(uint8_t *, size_t, uint8_t[PCRYPT_ESZ],
  */
 ssize_t proto_crypt_dec(uint8_t[PCRYPT_ESZ], uint8_t *, struct proto_keys *);
 
+/**
+ * proto_crypt_enc_batch(iov, iovcnt, obuf, k):
+ * For each i in [0, ${iovcnt}), encrypt the ${iov}[i].iov_len bytes (which
+ * must be at most PCRYPT_MAXDSZ) from ${iov}[i].iov_base into the PCRYPT_ESZ
+ * bytes at &${obuf}[i * PCRYPT_ESZ], using the keys in ${k} and consecutive
+ * packet numbers starting from the next packet number of ${k}.  This is
+ * equivalent to calling proto_crypt_enc() on each packet in turn, but may
+ * compute the HMACs of several packets at once.
+ */
+void proto_crypt_enc_batch(const struct iovec *, size_t, uint8_t *,
+    struct proto_keys *);
+
+/**
+ * proto_crypt_dec_batch(iov, iovcnt, obuf, k):
+ * For each i in [0, ${iovcnt}), decrypt the PCRYPT_ESZ-byte packet at
+ * ${iov}[i].iov_base using the keys in ${k} and consecutive packet numbers
+ * starting from the next packet number of ${k}.  If the data is all valid,
+ * write it consecutively into ${obuf} and return the total length; otherwise,
+ * return -1.  This is equivalent to calling proto_crypt_dec() on each packet
+ * in turn, but may compute the HMACs of several packets at once.
+ */
+ssize_t proto_crypt_dec_batch(const struct iovec *, size_t, uint8_t *,
+    struct proto_keys *);
+
+/**
+ * proto_crypt_dec_batch_inplace(iov, iovcnt, k):
+ * Decrypt the packets described by ${iov} and ${iovcnt} as
+ * proto_crypt_dec_batch(), but leave the data in place: on success, set each
+ * ${iov}[i].iov_len to the length of the data at the start of
+ * ${iov}[i].iov_base, and return the total length.  If any packet is invalid,
+ * return -1.
+ */
+ssize_t proto_crypt_dec_batch_inplace(struct iovec *, size_t,
+    struct proto_keys *);
+
+/* Maximum size of the unencrypted data in a jumbo packet. */
+#define PCRYPT_JUMBO_MAXDSZ (16 * PCRYPT_MAXDSZ)
+
+/* Size of the (unencrypted) header of a jumbo packet. */
+#define PCRYPT_JUMBO_HLEN 4
+
+/* Maximum size of an encrypted jumbo packet. */
+#define PCRYPT_JUMBO_ESZ (PCRYPT_JUMBO_HLEN + PCRYPT_JUMBO_MAXDSZ +	\
+    4 /* len */ + 32 /* hmac */)
+
+/**
+ * proto_crypt_enc_jumbo(ibuf, len, obuf, k):
+ * Encrypt ${len} bytes (which must be at most PCRYPT_JUMBO_MAXDSZ) from
+ * ${ibuf} into a jumbo packet using the keys in ${k}, and write the result
+ * into ${obuf}, which must have room for PCRYPT_JUMBO_ESZ bytes.  The data is
+ * padded to a multiple of PCRYPT_MAXDSZ bytes.  Return the size of the
+ * encrypted packet.  The buffers must not overlap.
+ */
+size_t proto_crypt_enc_jumbo(const uint8_t *, size_t, uint8_t *,
+    struct proto_keys *);
+
+/**
+ * proto_crypt_jumbo_esz(hbuf):
+ * Return the size of the encrypted jumbo packet which starts with the
+ * PCRYPT_JUMBO_HLEN bytes ${hbuf}, or -1 if the header is invalid.
+ */
+ssize_t proto_crypt_jumbo_esz(const uint8_t[PCRYPT_JUMBO_HLEN]);
+
+/**
+ * proto_crypt_dec_jumbo_inplace(ibuf, k):
+ * Decrypt the jumbo packet ${ibuf}, of the size indicated by its header,
+ * in place using the keys in ${k}.  If the data is valid, return its length;
+ * the data is left at &${ibuf}[PCRYPT_JUMBO_HLEN].  Otherwise, return -1.
+ */
+ssize_t proto_crypt_dec_jumbo_inplace(uint8_t *, struct proto_keys *);
+
 /**
  * proto_crypt_secret_free(K):
  * Free the protocol secret structure ${K}.
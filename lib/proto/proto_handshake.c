@@ -1,9 +1,11 @@
 #include <assert.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
 #include "crypto_entropy.h"
+#include "dhthread.h"
 #include "network.h"
 
 #include "proto_crypt.h"
@@ -17,6 +19,9 @@ struct handshake_cookie {
 	int decr;
 	int nopfs;
 	int requirepfs;
+	int jumbo;
+	int x25519;
+	int early;
 	const struct proto_secret * K;
 	uint8_t nonce_local[PCRYPT_NONCE_LEN];
 	uint8_t nonce_remote[PCRYPT_NONCE_LEN];
@@ -25,8 +30,12 @@ struct handshake_cookie {
 	uint8_t x[PCRYPT_X_LEN];
 	uint8_t yh_local[PCRYPT_YH_LEN];
 	uint8_t yh_remote[PCRYPT_YH_LEN];
+	size_t yh_remote_len;
+	struct proto_keys * keys_c;
+	struct proto_keys * keys_s;
 	void * read_cookie;
 	void * write_cookie;
+	void * dh_cookie;
 };
 
 static int callback_nonce_write(void *, ssize_t);
@@ -35,14 +44,43 @@ static int gotnonces(struct handshake_cookie *);
 static int dhread(struct handshake_cookie *);
 static int callback_dh_read(void *, ssize_t);
 static int dhwrite(struct handshake_cookie *);
+static int dh_generate(void *);
+static int callback_dh_generate(void *, int);
 static int callback_dh_write(void *, ssize_t);
 static int handshakedone(struct handshake_cookie *);
+static int mkkeys(void *);
+static int callback_mkkeys(void *, int);
 
-/* The handshake failed.  Call back and clean up. */
+/*
+ * Run ${func}(${H}) and then ${callback}(${H}, rc), in a diffie-hellman
+ * computation thread if we have them and there is work worth offloading, or
+ * immediately otherwise.
+ */
 static int
-handshakefail(struct handshake_cookie * H)
+dhcompute(struct handshake_cookie * H, int (* func)(void *),
+    int (* callback)(void *, int))
+{
+
+	/* Perform the computation here if it is cheap or we have no threads. */
+	if (H->nopfs || !dhthread_enabled())
+		return ((callback)(H, (func)(H)));
+
+	/* Hand the computation to a thread. */
+	if ((H->dh_cookie = dhthread_run(func, callback, H)) == NULL)
+		goto err0;
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* Cancel any pending network operations and computations. */
+static void
+handshakestop(struct handshake_cookie * H)
 {
-	int rc;
 
 	/* Cancel any pending network read or write. */
 	if (H->read_cookie != NULL)
@@ -50,6 +88,24 @@ handshakefail(struct handshake_cookie * H)
 	if (H->write_cookie != NULL)
 		network_write_cancel(H->write_cookie);
 
+	/* Cancel any pending computation. */
+	if (H->dh_cookie != NULL)
+		dhthread_cancel(H->dh_cookie);
+
+	/* Free keys computed by a cancelled computation. */
+	proto_crypt_free(H->keys_c);
+	proto_crypt_free(H->keys_s);
+}
+
+/* The handshake failed.  Call back and clean up. */
+static int
+handshakefail(struct handshake_cookie * H)
+{
+	int rc;
+
+	/* Cancel any pending operations. */
+	handshakestop(H);
+
 	/* Perform the callback. */
 	rc = (H->callback)(H->cookie, NULL, NULL);
 
@@ -61,21 +117,28 @@ handshakefail(struct handshake_cookie * H)
 }
 
 /**
- * proto_handshake(s, decr, nopfs, requirepfs, K, callback, cookie):
+ * proto_handshake(s, decr, nopfs, requirepfs, jumbo, x25519, early, K,
+ *     callback, cookie):
  * Perform a protocol handshake on socket ${s}.  If ${decr} is non-zero we are
  * at the receiving end of the connection; otherwise at the sending end.  If
  * ${nopfs} is non-zero, perform a "weak" handshake without perfect forward
- * secrecy.  If ${requirepfs} is non-zero, drop the connection if the other
- * end attempts to perform a "weak" handshake.  The shared protocol secret is
- * ${K}.  Upon completion, invoke ${callback}(${cookie}, f, r), where f
- * contains the keys needed for the forward direction and r contains the keys
+ * secrecy.  If ${requirepfs} is non-zero, drop the connection if the other end
+ * attempts to perform a "weak" handshake.  If ${jumbo} is non-zero, allow jumbo
+ * packets: at the sending end, require the other end to agree to use them; at
+ * the receiving end, use them if the other end asks to.  If ${x25519} is
+ * non-zero, allow an X25519 key exchange in the same way.  If ${early} is
+ * non-zero and we are at the receiving end, send our diffie-hellman parameter
+ * without waiting for the other end's, and require the other end to use exactly
+ * the options (jumbo packets and X25519) which we allow.  The shared protocol
+ * secret is ${K}.  Upon completion, invoke ${callback}(${cookie}, f, r), where
+ * f contains the keys needed for the forward direction and r contains the keys
  * needed for the reverse direction; or f = r = NULL if the handshake failed.
  * Return a cookie which can be passed to proto_handshake_cancel() to cancel the
  * handshake.
  */
 void *
-proto_handshake(int s, int decr, int nopfs, int requirepfs,
-    const struct proto_secret * K,
+proto_handshake(int s, int decr, int nopfs, int requirepfs, int jumbo,
+    int x25519, int early, const struct proto_secret * K,
     int (* callback)(void *, struct proto_keys *, struct proto_keys *),
     void * cookie)
 {
@@ -90,7 +153,12 @@ proto_handshake(int s, int decr, int nopfs, int requirepfs,
 	H->decr = decr;
 	H->nopfs = nopfs;
 	H->requirepfs = requirepfs;
+	H->jumbo = jumbo;
+	H->x25519 = x25519;
+	H->early = early;
 	H->K = K;
+	H->keys_c = H->keys_s = NULL;
+	H->read_cookie = H->write_cookie = H->dh_cookie = NULL;
 
 	/* Generate a 32-byte connection nonce. */
 	if (crypto_entropy_read(H->nonce_local, 32))
@@ -160,6 +228,32 @@ callback_nonce_read(void * cookie, ssize_t len)
 	return (0);
 }
 
+/* Switch to the diffie-hellman parameter MAC keys for jumbo packets. */
+static void
+usejumbo(struct handshake_cookie * H)
+{
+
+	proto_crypt_dhmac_jumbo(H->dhmac_local, H->dhmac_local);
+	proto_crypt_dhmac_jumbo(H->dhmac_remote, H->dhmac_remote);
+}
+
+/* Switch to the diffie-hellman parameter MAC keys for X25519. */
+static void
+usex25519(struct handshake_cookie * H)
+{
+
+	proto_crypt_dhmac_x25519(H->dhmac_local, H->dhmac_local);
+	proto_crypt_dhmac_x25519(H->dhmac_remote, H->dhmac_remote);
+}
+
+/* Return the size of our MACed diffie-hellman parameters. */
+static size_t
+yhlen(struct handshake_cookie * H)
+{
+
+	return (H->x25519 ? PCRYPT_X25519_YH_LEN : PCRYPT_YH_LEN);
+}
+
 /* We have two nonces.  Start the DH exchange. */
 static int
 gotnonces(struct handshake_cookie * H)
@@ -169,6 +263,34 @@ gotnonces(struct handshake_cookie * H)
 	proto_crypt_dhmac(H->K, H->nonce_local, H->nonce_remote,
 	    H->dhmac_local, H->dhmac_remote, H->decr);
 
+	/*
+	 * A client which wants jumbo packets or X25519 says so by using
+	 * different MAC keys, and expects the server to agree by doing the same.
+	 * A server which sends its parameter early can't wait to find out what
+	 * the client wants, so it uses the keys for the options it allows and
+	 * expects the client to have done the same.
+	 */
+	if (!H->decr || H->early) {
+		if (H->jumbo)
+			usejumbo(H);
+		if (H->x25519)
+			usex25519(H);
+	}
+
+	/* We haven't read any of the other party's parameter yet. */
+	H->yh_remote_len = 0;
+
+	/*
+	 * If we're a server sending its parameter early, we need to read the
+	 * client's diffie-hellman parameter and at the same time generate and
+	 * send ours.
+	 */
+	if (H->decr && H->early) {
+		if (dhread(H))
+			goto err0;
+		return (dhwrite(H));
+	}
+
 	/*
 	 * If we're the server, we need to read the client's diffie-hellman
 	 * parameter.  If we're the client, we need to generate and send our
@@ -179,17 +301,25 @@ gotnonces(struct handshake_cookie * H)
 	else
 		return (dhwrite(H));
 
-	/* NOTREACHED */
+err0:
+	/* Failure! */
+	return (-1);
 }
 
-/* Read a diffie-hellman parameter. */
+/*
+ * Read a diffie-hellman parameter.  A server which allows X25519 reads the
+ * length of an X25519 parameter first, and the rest of a group #14 parameter
+ * later if it turns out that the client isn't using X25519.
+ */
 static int
 dhread(struct handshake_cookie * H)
 {
+	size_t len = yhlen(H) - H->yh_remote_len;
 
-	/* Read the remote signed diffie-hellman parameter. */
-	if ((H->read_cookie = network_read(H->s, H->yh_remote, PCRYPT_YH_LEN,
-	    PCRYPT_YH_LEN, callback_dh_read, H)) == NULL)
+	/* Read (the rest of) the remote signed diffie-hellman parameter. */
+	if ((H->read_cookie = network_read(H->s,
+	    &H->yh_remote[H->yh_remote_len], len, len, callback_dh_read,
+	    H)) == NULL)
 		goto err0;
 
 	/* Success! */
@@ -200,7 +330,41 @@ err0:
 	return (-1);
 }
 
-/* We have read a diffie-hellman parameter. */
+/*
+ * Return non-zero if the client's parameter is not valid with the MAC keys
+ * used by a client asking for jumbo packets iff ${jumbo} is non-zero and for
+ * X25519 iff ${x25519} is non-zero.  Otherwise, agree to those options.
+ */
+static int
+tryopts(struct handshake_cookie * H, int jumbo, int x25519)
+{
+	uint8_t dhmac_remote[PCRYPT_DHMAC_LEN];
+
+	/* Compute the MAC key the client would use. */
+	memcpy(dhmac_remote, H->dhmac_remote, PCRYPT_DHMAC_LEN);
+	if (jumbo)
+		proto_crypt_dhmac_jumbo(dhmac_remote, dhmac_remote);
+	if (x25519)
+		proto_crypt_dhmac_x25519(dhmac_remote, dhmac_remote);
+
+	/* Is the value we read valid with this key? */
+	if (proto_crypt_dh_validate(H->yh_remote, dhmac_remote,
+	    H->requirepfs, x25519))
+		return (1);
+
+	/* Agree to the options. */
+	H->jumbo = jumbo;
+	H->x25519 = x25519;
+	if (jumbo)
+		usejumbo(H);
+	if (x25519)
+		usex25519(H);
+
+	/* Success! */
+	return (0);
+}
+
+/* We have read (part of) a diffie-hellman parameter. */
 static int
 callback_dh_read(void * cookie, ssize_t len)
 {
@@ -210,24 +374,45 @@ callback_dh_read(void * cookie, ssize_t len)
 	H->read_cookie = NULL;
 
 	/* Did we successfully read? */
-	if (len < PCRYPT_YH_LEN)
+	if ((len <= 0) || ((size_t)len < yhlen(H) - H->yh_remote_len))
 		return (handshakefail(H));
+	H->yh_remote_len = yhlen(H);
 
-	/* Is the value we read valid? */
-	if (proto_crypt_dh_validate(H->yh_remote, H->dhmac_remote,
-	    H->requirepfs))
-		return (handshakefail(H));
+	/*
+	 * If we're the server, find out which of the options we allow the
+	 * client is asking for; we agree to use them.  If we're the client, or
+	 * a server which sent its parameter early, the other party must be
+	 * using the options we have already committed to.
+	 */
+	if (H->decr && !H->early && H->x25519) {
+		/* Is the client using X25519? */
+		if (tryopts(H, 0, 1) && (!H->jumbo || tryopts(H, 1, 1))) {
+			/* No; read the rest of its group #14 parameter. */
+			H->x25519 = 0;
+			return (dhread(H));
+		}
+	} else if (H->decr && !H->early) {
+		if (tryopts(H, 0, 0) && (!H->jumbo || tryopts(H, 1, 0)))
+			return (handshakefail(H));
+	} else {
+		if (proto_crypt_dh_validate(H->yh_remote, H->dhmac_remote,
+		    H->requirepfs, H->x25519))
+			return (handshakefail(H));
+	}
 
 	/*
-	 * If we're the server, we need to send our diffie-hellman parameter
-	 * next.  If we're the client, move on to the final computation.
+	 * If we're a server which hasn't sent its diffie-hellman parameter
+	 * yet, we need to do that next.
 	 */
-	if (H->decr)
+	if (H->decr && !H->early)
 		return (dhwrite(H));
-	else
+
+	/* Once our parameter has been sent, do the final computation. */
+	if ((H->dh_cookie == NULL) && (H->write_cookie == NULL))
 		return (handshakedone(H));
 
-	/* NOTREACHED */
+	/* Nothing to do. */
+	return (0);
 }
 
 /* Generate and write a diffie-hellman parameter. */
@@ -236,13 +421,35 @@ dhwrite(struct handshake_cookie * H)
 {
 
 	/* Generate a signed diffie-hellman parameter. */
-	if (proto_crypt_dh_generate(H->yh_local, H->x, H->dhmac_local,
-	    H->nopfs))
+	return (dhcompute(H, dh_generate, callback_dh_generate));
+}
+
+/* Generate a signed diffie-hellman parameter. */
+static int
+dh_generate(void * cookie)
+{
+	struct handshake_cookie * H = cookie;
+
+	return (proto_crypt_dh_generate(H->yh_local, H->x, H->dhmac_local,
+	    H->nopfs, H->x25519));
+}
+
+/* We have generated a signed diffie-hellman parameter. */
+static int
+callback_dh_generate(void * cookie, int rc)
+{
+	struct handshake_cookie * H = cookie;
+
+	/* This computation is no longer pending. */
+	H->dh_cookie = NULL;
+
+	/* Did we succeed? */
+	if (rc)
 		goto err0;
 
 	/* Write our signed diffie-hellman parameter. */
-	if ((H->write_cookie = network_write(H->s, H->yh_local, PCRYPT_YH_LEN,
-	    PCRYPT_YH_LEN, callback_dh_write, H)) == NULL)
+	if ((H->write_cookie = network_write(H->s, H->yh_local, yhlen(H),
+	    yhlen(H), callback_dh_write, H)) == NULL)
 		goto err0;
 
 	/* Success! */
@@ -263,38 +470,84 @@ callback_dh_write(void * cookie, ssize_t len)
 	H->write_cookie = NULL;
 
 	/* Did we successfully write? */
-	if (len < PCRYPT_YH_LEN)
+	if ((len < 0) || ((size_t)len < yhlen(H)))
 		return (handshakefail(H));
 
+	/* If we're the client, we need to read the server's parameter next. */
+	if (!H->decr)
+		return (dhread(H));
+
 	/*
-	 * If we're the server, move on to the final computation.  If we're
-	 * the client, we need to read the server's parameter next.
+	 * If we're the server, once we have read the client's parameter, move
+	 * on to the final computation.
 	 */
-	if (H->decr)
+	if (H->read_cookie == NULL)
 		return (handshakedone(H));
-	else
-		return (dhread(H));
 
-	/* NOTREACHED */
+	/* Nothing to do. */
+	return (0);
 }
 
 /* We've got all the bits; do the final computation and callback. */
 static int
 handshakedone(struct handshake_cookie * H)
 {
-	struct proto_keys * c;
-	struct proto_keys * s;
-	int rc;
 
 	/* Sanity-check: There should be no callbacks in progress. */
 	assert(H->read_cookie == NULL);
 	assert(H->write_cookie == NULL);
 
+	/* Perform the final computation. */
+	return (dhcompute(H, mkkeys, callback_mkkeys));
+}
+
+/* Compute the keys. */
+static int
+mkkeys(void * cookie)
+{
+	struct handshake_cookie * H = cookie;
+	struct proto_keys * c;
+	struct proto_keys * s;
+
 	/* Perform the final computation. */
 	if (proto_crypt_mkkeys(H->K, H->nonce_local, H->nonce_remote,
-	    H->yh_remote, H->x, H->nopfs, H->decr, &c, &s))
+	    H->yh_remote, H->x, H->nopfs, H->jumbo, H->x25519, H->decr, &c,
+	    &s))
+		goto err0;
+
+	/* Record the keys. */
+	H->keys_c = c;
+	H->keys_s = s;
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* We have computed the keys; perform the callback. */
+static int
+callback_mkkeys(void * cookie, int status)
+{
+	struct handshake_cookie * H = cookie;
+	struct proto_keys * c;
+	struct proto_keys * s;
+	int rc;
+
+	/* This computation is no longer pending. */
+	H->dh_cookie = NULL;
+
+	/* Did we succeed? */
+	if (status)
 		goto err1;
 
+	/* The keys now belong to the callback. */
+	c = H->keys_c;
+	s = H->keys_s;
+	H->keys_c = H->keys_s = NULL;
+
 	/* Perform the callback. */
 	rc = (H->callback)(H->cookie, c, s);
 
@@ -320,11 +573,8 @@ proto_handshake_cancel(void * cookie)
 {
 	struct handshake_cookie * H = cookie;
 
-	/* Cancel any in-progress network operations. */
-	if (H->read_cookie != NULL)
-		network_read_cancel(H->read_cookie);
-	if (H->write_cookie != NULL)
-		network_write_cancel(H->write_cookie);
+	/* Cancel any in-progress operations. */
+	handshakestop(H);
 
 	/* Free the cookie. */
 	free(H);
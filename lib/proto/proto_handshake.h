@@ -6,19 +6,27 @@ struct proto_keys;
 struct proto_secret;
 
 /**
- * proto_handshake(s, decr, nopfs, requirepfs, K, callback, cookie):
+ * proto_handshake(s, decr, nopfs, requirepfs, jumbo, x25519, early, K,
+ *     callback, cookie):
  * Perform a protocol handshake on socket ${s}.  If ${decr} is non-zero we are
  * at the receiving end of the connection; otherwise at the sending end.  If
  * ${nopfs} is non-zero, perform a "weak" handshake without perfect forward
- * secrecy.  If ${requirepfs} is non-zero, drop the connection if the other
- * end attempts to perform a "weak" handshake.  The shared protocol secret is
- * ${K}.  Upon completion, invoke ${callback}(${cookie}, f, r), where f
- * contains the keys needed for the forward direction and r contains the keys
+ * secrecy.  If ${requirepfs} is non-zero, drop the connection if the other end
+ * attempts to perform a "weak" handshake.  If ${jumbo} is non-zero, allow jumbo
+ * packets: at the sending end, require the other end to agree to use them; at
+ * the receiving end, use them if the other end asks to.  If ${x25519} is
+ * non-zero, allow an X25519 key exchange in the same way.  If ${early} is
+ * non-zero and we are at the receiving end, send our diffie-hellman parameter
+ * without waiting for the other end's, and require the other end to use exactly
+ * the options (jumbo packets and X25519) which we allow.  The shared protocol
+ * secret is ${K}.  Upon completion, invoke ${callback}(${cookie}, f, r), where
+ * f contains the keys needed for the forward direction and r contains the keys
  * needed for the reverse direction; or f = r = NULL if the handshake failed.
  * Return a cookie which can be passed to proto_handshake_cancel() to cancel the
  * handshake.
  */
-void * proto_handshake(int, int, int, int, const struct proto_secret *,
+void * proto_handshake(int, int, int, int, int, int, int,
+    const struct proto_secret *,
     int (*)(void *, struct proto_keys *, struct proto_keys *), void *);
 
 /**
@@ -0,0 +1,1349 @@
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "elasticarray.h"
+#include "events.h"
+#include "netbuf.h"
+#include "network.h"
+#include "queue.h"
+#include "sock.h"
+#include "sock_util.h"
+#include "sysendian.h"
+#include "warnp.h"
+
+#include "proto_conn.h"
+#include "proto_crypt.h"
+#include "proto_handshake.h"
+
+#include "proto_mux.h"
+
+/*-
+ * Each packet sent over a multiplexed connection carries one frame, made up
+ * of a 1-byte type, a 4-byte big-endian stream ID, and a payload:
+ * FRAME_DATA: One or more bytes of data for the stream.
+ * FRAME_OPEN: Nothing.  Only the sending end opens streams, and each stream
+ *     ID is larger than all of those used before it.
+ * FRAME_EOF: Nothing.  No more data will be sent on the stream.
+ * FRAME_RESET: Nothing.  The stream has been aborted.
+ * FRAME_WINDOW: A 4-byte big-endian number of bytes of the stream's data
+ *     which have been written out, and which the other end may now replace.
+ * Each end may have up to STREAM_WINDOW bytes of data in flight on each
+ * stream; a stream is closed once both ends have sent FRAME_EOF and written
+ * out all of the data they received, or either end has sent FRAME_RESET.
+ */
+#define FRAME_DATA	0
+#define FRAME_OPEN	1
+#define FRAME_EOF	2
+#define FRAME_RESET	3
+#define FRAME_WINDOW	4
+
+/* Size of a frame header. */
+#define FRAME_HLEN 5
+
+/* Bytes which may be in flight on each stream in each direction. */
+#define STREAM_WINDOW (128 * 1024)
+
+/* Stop reading from streams while this much encrypted data is queued. */
+#define QUEUE_MAX (64 * 1024)
+
+struct mux_stream {
+	struct mux_state * M;
+	uint32_t id;
+	int s;
+	int (* callback_dead)(void *, int);
+	void * cookie;
+	struct sock_addr ** sas;
+	void * connect_cookie;
+	void * connect_timeout_cookie;
+	void * read_cookie;
+	void * write_cookie;
+	uint8_t * sbuf;
+	size_t swnd;
+	int sent_eof;
+	int blocked;
+	TAILQ_ENTRY(mux_stream) blocked_entries;
+	int waiting;
+	TAILQ_ENTRY(mux_stream) waiting_entries;
+	uint8_t * rbuf;
+	size_t rlen;
+	size_t wlen;
+	size_t credit;
+	int got_eof;
+	int wrote_eof;
+};
+
+ELASTICARRAY_DECL(STREAMLIST, streamlist, struct mux_stream *);
+
+struct mux_state {
+	int (* callback_dead)(void *, int);
+	void * cookie;
+	struct sock_addr ** const * sas;
+	const struct sock_addr * sa_b;
+	struct proto_conn_opts opts;
+	size_t nstreams_max;
+	size_t nconnecting;
+	int t;
+	struct sock_addr ** sas_t;
+	void * connect_cookie;
+	void * handshake_cookie;
+	void * timeout_cookie;
+	void * idle_cookie;
+	struct proto_keys * k_s;
+	struct proto_keys * k_r;
+	int started;
+	int shutdown;
+	int jumbopkts;
+	size_t maxdsz;
+	size_t esz;
+	uint32_t lastid;
+	STREAMLIST streams;
+	TAILQ_HEAD(blocked_head, mux_stream) blocked;
+	TAILQ_HEAD(waiting_head, mux_stream) waiting;
+	struct netbuf_read * R;
+	size_t minread;
+	uint8_t * qbuf;
+	size_t qlen;
+	size_t qcap;
+	uint8_t * wbuf;
+	size_t wlen;
+	size_t wcap;
+	void * write_cookie;
+};
+
+static int callback_mux_connected(void *, int);
+static int callback_mux_handshake(void *, struct proto_keys *,
+    struct proto_keys *);
+static int callback_mux_idle(void *);
+static int callback_mux_read(void *, int);
+static int callback_mux_timeout(void *);
+static int callback_mux_write(void *, ssize_t);
+static int callback_stream_connected(void *, int);
+static int callback_stream_read(void *, ssize_t);
+static int callback_stream_timeout(void *);
+static int callback_stream_write(void *, ssize_t);
+static int stream_connect(struct mux_stream *);
+
+/* Set keep-alives and disable nagling on ${s}, as proto_conn does. */
+static void
+setsockopts(struct mux_state * M, int s)
+{
+	int on = M->opts.nokeepalive ? 0 : 1;
+	int one = 1;
+
+	/* Ignore failures, since ${s} might not be a TCP socket. */
+	(void)setsockopt(s, SOL_SOCKET, SO_KEEPALIVE, &on, sizeof(on));
+	(void)setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
+/* Find the position of stream ${id} in the list, or the size of the list. */
+static size_t
+stream_pos(struct mux_state * M, uint32_t id)
+{
+	size_t lo = 0;
+	size_t hi = streamlist_getsize(M->streams);
+	size_t mid;
+	struct mux_stream * S;
+
+	/* Streams are kept in order of increasing ID. */
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		S = *streamlist_get(M->streams, mid);
+		if (S->id == id)
+			return (mid);
+		else if (S->id < id)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	/* Not found. */
+	return (streamlist_getsize(M->streams));
+}
+
+/* Look up stream ${id}; return NULL if there is no such stream. */
+static struct mux_stream *
+stream_lookup(struct mux_state * M, uint32_t id)
+{
+	size_t pos = stream_pos(M, id);
+
+	if (pos == streamlist_getsize(M->streams))
+		return (NULL);
+	return (*streamlist_get(M->streams, pos));
+}
+
+/* Send everything we have queued, unless we're already writing. */
+static int
+mux_flush(struct mux_state * M)
+{
+	uint8_t * buf;
+	size_t cap;
+
+	/* Nothing to do if we're already writing or have nothing to write. */
+	if ((M->write_cookie != NULL) || (M->qlen == 0))
+		return (0);
+
+	/* Swap the queue into the write buffer, and start a new queue. */
+	buf = M->wbuf;
+	cap = M->wcap;
+	M->wbuf = M->qbuf;
+	M->wcap = M->qcap;
+	M->wlen = M->qlen;
+	M->qbuf = buf;
+	M->qcap = cap;
+	M->qlen = 0;
+
+	/* Write the data. */
+	if ((M->write_cookie = network_write(M->t, M->wbuf, M->wlen, M->wlen,
+	    callback_mux_write, M)) == NULL)
+		goto err0;
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* Encrypt the ${len}-byte frame ${buf} and send it. */
+static int
+mux_send(struct mux_state * M, uint8_t * buf, size_t len)
+{
+	uint8_t * nbuf;
+	size_t ncap;
+
+	/* Make sure we have room for another packet. */
+	if (M->qcap - M->qlen < M->esz) {
+		ncap = M->qcap * 2;
+		if (ncap < M->qlen + M->esz)
+			ncap = M->qlen + M->esz;
+		if ((nbuf = realloc(M->qbuf, ncap)) == NULL) {
+			warnp("realloc");
+			goto err0;
+		}
+		M->qbuf = nbuf;
+		M->qcap = ncap;
+	}
+
+	/* Encrypt the frame onto the end of the queue. */
+	if (M->jumbopkts) {
+		M->qlen += proto_crypt_enc_jumbo(buf, len, &M->qbuf[M->qlen],
+		    M->k_s);
+	} else {
+		proto_crypt_enc(buf, len, &M->qbuf[M->qlen], M->k_s);
+		M->qlen += PCRYPT_ESZ;
+	}
+
+	/* Send it. */
+	return (mux_flush(M));
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* Send a frame of type ${type} on stream ${id}, with payload ${n} if any. */
+static int
+mux_sendctl(struct mux_state * M, uint8_t type, uint32_t id, uint32_t n)
+{
+	uint8_t buf[FRAME_HLEN + 4];
+	size_t len = FRAME_HLEN;
+
+	/* Construct the frame. */
+	buf[0] = type;
+	be32enc(&buf[1], id);
+	if (type == FRAME_WINDOW) {
+		be32enc(&buf[FRAME_HLEN], n);
+		len += 4;
+	}
+
+	/* Send it. */
+	return (mux_send(M, buf, len));
+}
+
+/* Create stream ${id} with the source socket ${s}, and add it to the list. */
+static struct mux_stream *
+stream_create(struct mux_state * M, uint32_t id, int s)
+{
+	struct mux_stream * S;
+
+	/* Bake a cookie. */
+	if ((S = malloc(sizeof(struct mux_stream))) == NULL)
+		goto err0;
+	S->M = M;
+	S->id = id;
+	S->s = s;
+	S->callback_dead = NULL;
+	S->cookie = NULL;
+	S->sas = NULL;
+	S->connect_cookie = NULL;
+	S->connect_timeout_cookie = NULL;
+	S->read_cookie = NULL;
+	S->write_cookie = NULL;
+	S->sbuf = NULL;
+	S->swnd = STREAM_WINDOW;
+	S->sent_eof = 0;
+	S->blocked = 0;
+	S->waiting = 0;
+	S->rbuf = NULL;
+	S->rlen = 0;
+	S->wlen = 0;
+	S->credit = 0;
+	S->got_eof = 0;
+	S->wrote_eof = 0;
+
+	/* Stream IDs only increase, so this keeps the list in order. */
+	if (streamlist_append(M->streams, &S, 1))
+		goto err1;
+
+	/* Success! */
+	return (S);
+
+err1:
+	free(S);
+err0:
+	/* Failure! */
+	return (NULL);
+}
+
+/* Close and free the stream ${S}. */
+static int
+stream_free(struct mux_stream * S, int reason)
+{
+	struct mux_state * M = S->M;
+	int (* callback_dead)(void *, int) = S->callback_dead;
+	void * cookie = S->cookie;
+	struct mux_stream * W;
+	struct mux_stream ** streams;
+	size_t nstreams;
+	size_t pos;
+	int rc = 0;
+
+	/* Stop connecting, if we are. */
+	if (S->connect_cookie != NULL)
+		network_connect_cancel(S->connect_cookie);
+	sock_addr_freelist(S->sas);
+	if (S->connect_timeout_cookie != NULL)
+		events_timer_cancel(S->connect_timeout_cookie);
+
+	/* Stop reading and writing, if we are. */
+	if (S->read_cookie != NULL)
+		network_read_cancel(S->read_cookie);
+	if (S->write_cookie != NULL)
+		network_write_cancel(S->write_cookie);
+	if (S->blocked)
+		TAILQ_REMOVE(&M->blocked, S, blocked_entries);
+
+	/* This stream is no longer waiting to connect, or connecting. */
+	if (S->waiting)
+		TAILQ_REMOVE(&M->waiting, S, waiting_entries);
+	else if (M->opts.decr)
+		M->nconnecting -= 1;
+
+	/* Close the socket if we have one. */
+	if ((S->s != -1) && close(S->s))
+		warnp("close");
+
+	/* Remove the stream from the list. */
+	nstreams = streamlist_getsize(M->streams);
+	pos = stream_pos(M, S->id);
+	streams = streamlist_get(M->streams, 0);
+	memmove(&streams[pos], &streams[pos + 1],
+	    (nstreams - pos - 1) * sizeof(struct mux_stream *));
+	streamlist_shrink(M->streams, 1);
+
+	/* Free the stream. */
+	free(S->sbuf);
+	free(S->rbuf);
+	free(S);
+
+	/* Notify the upstream that we've closed the stream. */
+	if (callback_dead != NULL)
+		rc = (callback_dead)(cookie, reason);
+
+	/* Connect a stream which was waiting, if we can. */
+	if ((M->nconnecting < M->nstreams_max) &&
+	    ((W = TAILQ_FIRST(&M->waiting)) != NULL)) {
+		TAILQ_REMOVE(&M->waiting, W, waiting_entries);
+		W->waiting = 0;
+		M->nconnecting += 1;
+		if (stream_connect(W))
+			rc = -1;
+	}
+
+	/* If we're shutting down and that was the last stream, drop soon. */
+	if (M->shutdown && (streamlist_getsize(M->streams) == 0) &&
+	    (M->idle_cookie == NULL)) {
+		if ((M->idle_cookie = events_immediate_register(
+		    callback_mux_idle, M, 0)) == NULL)
+			rc = -1;
+	}
+
+	/* Return success/fail status. */
+	return (rc);
+}
+
+/* Abort the stream ${S}, telling the other end. */
+static int
+stream_reset(struct mux_stream * S)
+{
+
+	/* Tell the other end. */
+	if (S->M->started && mux_sendctl(S->M, FRAME_RESET, S->id, 0))
+		goto err0;
+
+	/* Free the stream. */
+	return (stream_free(S, PROTO_CONN_ERROR));
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* Free the stream ${S} if we're done with it in both directions. */
+static int
+stream_done(struct mux_stream * S)
+{
+
+	if (S->sent_eof && S->wrote_eof)
+		return (stream_free(S, PROTO_CONN_CLOSED));
+
+	/* Nothing to do. */
+	return (0);
+}
+
+/* Read from the stream's socket if we're allowed to. */
+static int
+stream_read(struct mux_stream * S)
+{
+	struct mux_state * M = S->M;
+	size_t len;
+
+	/* Nothing to do if we're reading, done reading, or not ready. */
+	if ((S->read_cookie != NULL) || S->sent_eof || (S->s == -1) ||
+	    !M->started || S->blocked)
+		return (0);
+
+	/* Wait until the other end allows us to send more. */
+	if (S->swnd == 0)
+		return (0);
+
+	/* Wait until the queue drains. */
+	if (M->qlen >= QUEUE_MAX) {
+		TAILQ_INSERT_TAIL(&M->blocked, S, blocked_entries);
+		S->blocked = 1;
+		return (0);
+	}
+
+	/* Allocate a buffer to construct frames in, if necessary. */
+	if ((S->sbuf == NULL) && ((S->sbuf = malloc(M->maxdsz)) == NULL))
+		goto err0;
+
+	/* Read up to one frame of data. */
+	len = M->maxdsz - FRAME_HLEN;
+	if (len > S->swnd)
+		len = S->swnd;
+	if ((S->read_cookie = network_read(S->s, &S->sbuf[FRAME_HLEN], len, 1,
+	    callback_stream_read, S)) == NULL)
+		goto err0;
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* Data has been read from the stream's socket. */
+static int
+callback_stream_read(void * cookie, ssize_t len)
+{
+	struct mux_stream * S = cookie;
+	struct mux_state * M = S->M;
+
+	/* This read is no longer in progress. */
+	S->read_cookie = NULL;
+
+	/* Did the read fail? */
+	if (len == -1)
+		return (stream_reset(S));
+
+	/* Did we read EOF? */
+	if (len == 0) {
+		/* Tell the other end that we won't send any more. */
+		if (mux_sendctl(M, FRAME_EOF, S->id, 0))
+			goto err0;
+		S->sent_eof = 1;
+
+		/* We might be done with this stream. */
+		return (stream_done(S));
+	}
+
+	/* Send the data. */
+	S->sbuf[0] = FRAME_DATA;
+	be32enc(&S->sbuf[1], S->id);
+	if (mux_send(M, S->sbuf, FRAME_HLEN + (size_t)len))
+		goto err0;
+	S->swnd -= (size_t)len;
+
+	/* Read more. */
+	return (stream_read(S));
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* Write data (or EOF) received from the other end to the stream's socket. */
+static int
+stream_write(struct mux_stream * S)
+{
+
+	/* Nothing to do if we're writing or don't have a socket yet. */
+	if ((S->write_cookie != NULL) || (S->s == -1))
+		return (0);
+
+	/* Write everything we have buffered. */
+	if (S->rlen > 0) {
+		S->wlen = S->rlen;
+		if ((S->write_cookie = network_write(S->s, S->rbuf, S->wlen,
+		    S->wlen, callback_stream_write, S)) == NULL)
+			goto err0;
+		return (0);
+	}
+
+	/* Pass on an EOF once we have written all the data. */
+	if (S->got_eof && !S->wrote_eof) {
+		if (shutdown(S->s, SHUT_WR)) {
+			switch (errno) {
+			case EBADF:
+			case EINVAL:
+			case ENOTSOCK:
+				/* Should never happen. */
+				goto err0;
+			case ENOTCONN:
+			case ECONNRESET:
+				/* Simultaneous closes; not a problem. */
+				break;
+			default:
+				/* Treat this as a broken stream. */
+				return (stream_reset(S));
+			}
+		}
+		S->wrote_eof = 1;
+
+		/* We might be done with this stream. */
+		return (stream_done(S));
+	}
+
+	/* Nothing to do. */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* Data has been written to the stream's socket. */
+static int
+callback_stream_write(void * cookie, ssize_t len)
+{
+	struct mux_stream * S = cookie;
+
+	/* This write is no longer in progress. */
+	S->write_cookie = NULL;
+
+	/* Did we fail to write everything? */
+	if (len < (ssize_t)S->wlen)
+		return (stream_reset(S));
+
+	/* Discard the data we've written. */
+	memmove(S->rbuf, &S->rbuf[S->wlen], S->rlen - S->wlen);
+	S->rlen -= S->wlen;
+	S->credit += S->wlen;
+
+	/*
+	 * Let the other end send more once we've written a quarter of the
+	 * window, or everything it has sent so far.
+	 */
+	if ((S->credit >= STREAM_WINDOW / 4) ||
+	    ((S->rlen == 0) && !S->got_eof)) {
+		if (mux_sendctl(S->M, FRAME_WINDOW, S->id,
+		    (uint32_t)S->credit))
+			goto err0;
+		S->credit = 0;
+	}
+
+	/* Write anything else we have. */
+	return (stream_write(S));
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/*
+ * Connect to the target addresses ${sas} and invoke ${callback}(${cookie}, s)
+ * as network_connect_bind() does, racing the addresses if we've been asked to.
+ */
+static void *
+mux_connect(struct mux_state * M, struct sock_addr * const * sas,
+    int (* callback)(void *, int), void * cookie)
+{
+	struct timeval stagger;
+
+	/* Try the addresses one at a time unless we're racing them. */
+	if (!(M->opts.race > 0.0))
+		return (network_connect_bind(sas, M->sa_b, callback, cookie));
+
+	/* Start the next address if one hasn't connected after ${race}. */
+	stagger.tv_sec = (time_t)M->opts.race;
+	stagger.tv_usec =
+	    (suseconds_t)((M->opts.race - (double)stagger.tv_sec) * 1000000.0);
+	return (network_connect_bind_race(sas, M->sa_b, &stagger, callback,
+	    cookie));
+}
+
+/* Connect the stream ${S} to the target. */
+static int
+stream_connect(struct mux_stream * S)
+{
+	struct mux_state * M = S->M;
+
+	/* Duplicate the target address list. */
+	if ((S->sas = sock_addr_duplist(*M->sas)) == NULL)
+		goto err0;
+
+	/* Start the connect timer. */
+	if ((S->connect_timeout_cookie = events_timer_register_double(
+	    callback_stream_timeout, S, M->opts.timeo)) == NULL)
+		goto err0;
+
+	/* Connect to the target. */
+	if ((S->connect_cookie = mux_connect(M, S->sas,
+	    callback_stream_connected, S)) == NULL)
+		goto err0;
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure!  stream_free() will clean up. */
+	return (-1);
+}
+
+/* The other end has opened stream ${id}; connect it to the target. */
+static int
+stream_accept(struct mux_state * M, uint32_t id)
+{
+	struct mux_stream * S;
+
+	/* Refuse the stream if we're shutting down. */
+	if (M->shutdown)
+		return (mux_sendctl(M, FRAME_RESET, id, 0));
+
+	/* Create the stream. */
+	if ((S = stream_create(M, id, -1)) == NULL)
+		goto err0;
+
+	/*
+	 * If we have too many streams connecting or connected to the target,
+	 * wait until one closes; otherwise, connect now.
+	 */
+	if (M->nconnecting >= M->nstreams_max) {
+		TAILQ_INSERT_TAIL(&M->waiting, S, waiting_entries);
+		S->waiting = 1;
+	} else {
+		M->nconnecting += 1;
+		if (stream_connect(S))
+			goto err1;
+	}
+
+	/* Success! */
+	return (0);
+
+err1:
+	stream_free(S, PROTO_CONN_ERROR);
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* A stream has connected to the target. */
+static int
+callback_stream_connected(void * cookie, int s)
+{
+	struct mux_stream * S = cookie;
+
+	/* This connection attempt is no longer pending. */
+	S->connect_cookie = NULL;
+
+	/* Don't need the target address any more. */
+	sock_addr_freelist(S->sas);
+	S->sas = NULL;
+
+	/* We beat the clock. */
+	events_timer_cancel(S->connect_timeout_cookie);
+	S->connect_timeout_cookie = NULL;
+
+	/* Did we manage to connect? */
+	if ((S->s = s) == -1)
+		return (stream_reset(S));
+	setsockopts(S->M, S->s);
+
+	/* Start reading, and write anything which has arrived already. */
+	if (stream_read(S))
+		goto err0;
+	return (stream_write(S));
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* Connecting a stream to the target took too long. */
+static int
+callback_stream_timeout(void * cookie)
+{
+	struct mux_stream * S = cookie;
+
+	/* This timeout is no longer pending. */
+	S->connect_timeout_cookie = NULL;
+
+	/* Abort the stream. */
+	return (stream_reset(S));
+}
+
+/*
+ * Handle the ${len}-byte frame ${buf}.  Return 1 if the other end has
+ * violated the protocol.
+ */
+static int
+mux_frame(struct mux_state * M, const uint8_t * buf, size_t len)
+{
+	struct mux_stream * S;
+	uint8_t type;
+	uint32_t id;
+	uint32_t n;
+
+	/* Parse the header. */
+	if (len < FRAME_HLEN)
+		goto bad;
+	type = buf[0];
+	id = be32dec(&buf[1]);
+	buf += FRAME_HLEN;
+	len -= FRAME_HLEN;
+
+	/* Opening a stream is special. */
+	if (type == FRAME_OPEN) {
+		if (!M->opts.decr || (len != 0) || (id <= M->lastid))
+			goto bad;
+		M->lastid = id;
+		return (stream_accept(M, id));
+	}
+
+	/* Ignore frames for streams which have been closed. */
+	if ((S = stream_lookup(M, id)) == NULL) {
+		if ((id == 0) || (id > M->lastid))
+			goto bad;
+		return (0);
+	}
+
+	/* Handle the frame. */
+	switch (type) {
+	case FRAME_DATA:
+		/* The other end must not send more than we allowed. */
+		if ((len == 0) || S->got_eof ||
+		    (len > STREAM_WINDOW - S->rlen - S->credit))
+			goto bad;
+
+		/* Buffer the data, and write it out. */
+		if ((S->rbuf == NULL) &&
+		    ((S->rbuf = malloc(STREAM_WINDOW)) == NULL))
+			goto err0;
+		memcpy(&S->rbuf[S->rlen], buf, len);
+		S->rlen += len;
+		return (stream_write(S));
+	case FRAME_WINDOW:
+		if (len != 4)
+			goto bad;
+		n = be32dec(buf);
+		if (n > STREAM_WINDOW - S->swnd)
+			goto bad;
+
+		/* We can send more. */
+		S->swnd += n;
+		return (stream_read(S));
+	case FRAME_EOF:
+		if ((len != 0) || S->got_eof)
+			goto bad;
+
+		/* Pass on the EOF once we have written all the data. */
+		S->got_eof = 1;
+		return (stream_write(S));
+	case FRAME_RESET:
+		if (len != 0)
+			goto bad;
+
+		/* The other end has aborted the stream. */
+		return (stream_free(S, PROTO_CONN_ERROR));
+	default:
+		goto bad;
+	}
+
+bad:
+	/* The other end is not following the protocol. */
+	return (1);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* Packets have arrived over the multiplexed connection. */
+static int
+callback_mux_read(void * cookie, int status)
+{
+	struct mux_state * M = cookie;
+	struct iovec iov;
+	uint8_t * inbuf;
+	size_t inlen;
+	size_t pos;
+	ssize_t esz;
+	ssize_t len;
+	uint8_t * frame;
+
+	/* Did we read EOF or fail? */
+	if (status == 1)
+		return (proto_mux_drop(M, PROTO_CONN_CLOSED));
+	if (status == -1)
+		return (proto_mux_drop(M, PROTO_CONN_ERROR));
+
+	/* Handle every whole packet we have. */
+	netbuf_read_peek(M->R, &inbuf, &inlen);
+	for (pos = 0; ; pos += (size_t)esz) {
+		if (M->jumbopkts) {
+			/* Do we have the whole of the next packet? */
+			if (inlen - pos < PCRYPT_JUMBO_HLEN) {
+				M->minread = PCRYPT_JUMBO_HLEN;
+				break;
+			}
+			if ((esz = proto_crypt_jumbo_esz(&inbuf[pos])) == -1)
+				goto bad;
+			if (inlen - pos < (size_t)esz) {
+				M->minread = (size_t)esz;
+				break;
+			}
+
+			/* Decrypt the packet in place. */
+			if ((len = proto_crypt_dec_jumbo_inplace(&inbuf[pos],
+			    M->k_r)) == -1)
+				goto bad;
+			frame = &inbuf[pos + PCRYPT_JUMBO_HLEN];
+		} else {
+			/* Do we have the whole of the next packet? */
+			esz = PCRYPT_ESZ;
+			if (inlen - pos < PCRYPT_ESZ) {
+				M->minread = PCRYPT_ESZ;
+				break;
+			}
+
+			/* Decrypt the packet in place. */
+			iov.iov_base = &inbuf[pos];
+			iov.iov_len = PCRYPT_ESZ;
+			if ((len = proto_crypt_dec_batch_inplace(&iov, 1,
+			    M->k_r)) == -1)
+				goto bad;
+			frame = iov.iov_base;
+		}
+
+		/* Handle the frame. */
+		switch (mux_frame(M, frame, (size_t)len)) {
+		case -1:
+			goto err0;
+		case 1:
+			goto bad;
+		}
+	}
+
+	/* We're done with those packets; wait for the next one. */
+	netbuf_read_consume(M->R, pos);
+	if (netbuf_read_wait(M->R, M->minread, callback_mux_read, M))
+		goto err0;
+
+	/* Success! */
+	return (0);
+
+bad:
+	/* Drop the connection. */
+	return (proto_mux_drop(M, PROTO_CONN_ERROR));
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* Packets have been written over the multiplexed connection. */
+static int
+callback_mux_write(void * cookie, ssize_t len)
+{
+	struct mux_state * M = cookie;
+	struct mux_stream * S;
+
+	/* This write is no longer in progress. */
+	M->write_cookie = NULL;
+
+	/* Did we fail to write everything? */
+	if (len < (ssize_t)M->wlen)
+		return (proto_mux_drop(M, PROTO_CONN_ERROR));
+
+	/* Send anything which was queued in the meantime. */
+	if (mux_flush(M))
+		goto err0;
+
+	/* Resume reading from streams which were waiting for the queue. */
+	while ((M->qlen < QUEUE_MAX) &&
+	    ((S = TAILQ_FIRST(&M->blocked)) != NULL)) {
+		TAILQ_REMOVE(&M->blocked, S, blocked_entries);
+		S->blocked = 0;
+		if (stream_read(S))
+			goto err0;
+	}
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* Start carrying streams once the handshake has completed. */
+static int
+mux_start(struct mux_state * M)
+{
+	struct mux_stream * S;
+	size_t i;
+
+	/* Set socket options. */
+	setsockopts(M, M->t);
+
+	/* Figure out how large our packets are. */
+	M->jumbopkts = proto_crypt_jumbo(M->k_s);
+	M->maxdsz = M->jumbopkts ? PCRYPT_JUMBO_MAXDSZ : PCRYPT_MAXDSZ;
+	M->esz = M->jumbopkts ? PCRYPT_JUMBO_ESZ : PCRYPT_ESZ;
+
+	/* Start reading packets. */
+	if ((M->R = netbuf_read_init(M->t)) == NULL)
+		goto err0;
+	if (M->jumbopkts && netbuf_read_reserve(M->R, 4 * PCRYPT_JUMBO_ESZ))
+		goto err0;
+	M->minread = M->jumbopkts ? PCRYPT_JUMBO_HLEN : PCRYPT_ESZ;
+	if (netbuf_read_wait(M->R, M->minread, callback_mux_read, M))
+		goto err0;
+	M->started = 1;
+
+	/* Open the streams which have been waiting for us. */
+	for (i = 0; i < streamlist_getsize(M->streams); i++) {
+		S = *streamlist_get(M->streams, i);
+		if (mux_sendctl(M, FRAME_OPEN, S->id, 0))
+			goto err0;
+		if (stream_read(S))
+			goto err0;
+	}
+
+	/* If we're shutting down and have no streams, drop soon. */
+	if (M->shutdown && (streamlist_getsize(M->streams) == 0) &&
+	    (M->idle_cookie == NULL)) {
+		if ((M->idle_cookie = events_immediate_register(
+		    callback_mux_idle, M, 0)) == NULL)
+			goto err0;
+	}
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* Start the handshake on the multiplexed connection. */
+static int
+mux_handshake(struct mux_state * M)
+{
+
+	/* Start the handshake timer. */
+	if ((M->timeout_cookie = events_timer_register_double(
+	    callback_mux_timeout, M, M->opts.timeo)) == NULL)
+		goto err0;
+
+	/* Start the handshake. */
+	if ((M->handshake_cookie = proto_handshake(M->t, M->opts.decr,
+	    M->opts.nopfs, M->opts.requirepfs, M->opts.jumbo, M->opts.x25519,
+	    M->opts.early, M->opts.K, callback_mux_handshake, M)) == NULL)
+		goto err1;
+
+	/* Success! */
+	return (0);
+
+err1:
+	events_timer_cancel(M->timeout_cookie);
+	M->timeout_cookie = NULL;
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/**
+ * proto_mux_create(s, sas, sa_b, opts, nstreams_max, callback_dead, cookie):
+ * Create a multiplexed connection, which carries many streams over a single
+ * encrypted connection.  If ${opts}->decr is 0, connect to the target
+ * addresses ${*sas} (binding the outgoing address to ${sa_b} if it is not NULL)
+ * and carry streams opened by proto_mux_open() over that connection; ${s} must
+ * be -1.  If ${opts}->decr is non-zero, carry streams opened by the other end
+ * over the connection ${s}, and connect each of them to the target addresses
+ * ${*sas}; connect at most ${nstreams_max} of them at once, leaving the others
+ * waiting until earlier streams close.  The caller may replace ${*sas} at any
+ * time.  The other options in ${opts} are as for proto_conn_create(), except
+ * that ${opts}->coalesce is ignored.  Drop the connection if the handshake or
+ * connecting to the target takes more than ${opts}->timeo seconds, or a stream
+ * if connecting it to the target does.  When the connection is dropped, invoke
+ * ${callback_dead}(${cookie}, reason).  Return a cookie which can be passed to
+ * proto_mux_open(), proto_mux_shutdown(), and proto_mux_drop().  If there is a
+ * connection error after this function returns, close ${s}.
+ */
+void *
+proto_mux_create(int s, struct sock_addr ** const * sas,
+    const struct sock_addr * sa_b, const struct proto_conn_opts * opts,
+    size_t nstreams_max, int (* callback_dead)(void *, int), void * cookie)
+{
+	struct mux_state * M;
+
+	/* Bake a cookie for this connection. */
+	if ((M = malloc(sizeof(struct mux_state))) == NULL)
+		goto err0;
+	M->callback_dead = callback_dead;
+	M->cookie = cookie;
+	M->sas = sas;
+	M->sa_b = sa_b;
+	M->opts = *opts;
+	M->nstreams_max = nstreams_max;
+	M->nconnecting = 0;
+	M->t = s;
+	M->sas_t = NULL;
+	M->connect_cookie = NULL;
+	M->handshake_cookie = NULL;
+	M->timeout_cookie = NULL;
+	M->idle_cookie = NULL;
+	M->k_s = M->k_r = NULL;
+	M->started = 0;
+	M->shutdown = 0;
+	M->lastid = 0;
+	TAILQ_INIT(&M->blocked);
+	TAILQ_INIT(&M->waiting);
+	M->R = NULL;
+	M->qbuf = M->wbuf = NULL;
+	M->qlen = M->qcap = M->wlen = M->wcap = 0;
+	M->write_cookie = NULL;
+
+	/* We don't have any streams yet. */
+	if ((M->streams = streamlist_init(0)) == NULL)
+		goto err1;
+
+	/* If we're decrypting, start the handshake. */
+	if (M->opts.decr) {
+		if (mux_handshake(M))
+			goto err2;
+
+		/* Success! */
+		return (M);
+	}
+
+	/* Duplicate the target address list. */
+	if ((M->sas_t = sock_addr_duplist(*M->sas)) == NULL)
+		goto err2;
+
+	/* Start the connect timer. */
+	if ((M->timeout_cookie = events_timer_register_double(
+	    callback_mux_timeout, M, M->opts.timeo)) == NULL)
+		goto err3;
+
+	/* Connect to the target. */
+	if ((M->connect_cookie = mux_connect(M, M->sas_t,
+	    callback_mux_connected, M)) == NULL)
+		goto err4;
+
+	/* Success! */
+	return (M);
+
+err4:
+	events_timer_cancel(M->timeout_cookie);
+err3:
+	sock_addr_freelist(M->sas_t);
+err2:
+	streamlist_free(M->streams);
+err1:
+	free(M);
+err0:
+	/* Failure! */
+	return (NULL);
+}
+
+/* We have connected to the target. */
+static int
+callback_mux_connected(void * cookie, int t)
+{
+	struct mux_state * M = cookie;
+
+	/* This connection attempt is no longer pending. */
+	M->connect_cookie = NULL;
+
+	/* Don't need the target address any more. */
+	sock_addr_freelist(M->sas_t);
+	M->sas_t = NULL;
+
+	/* We beat the clock. */
+	events_timer_cancel(M->timeout_cookie);
+	M->timeout_cookie = NULL;
+
+	/* Did we manage to connect? */
+	if ((M->t = t) == -1)
+		return (proto_mux_drop(M, PROTO_CONN_CONNECT_FAILED));
+
+	/* Start the handshake. */
+	if (mux_handshake(M))
+		goto err1;
+
+	/* Success! */
+	return (0);
+
+err1:
+	proto_mux_drop(M, PROTO_CONN_ERROR);
+
+	/* Failure! */
+	return (-1);
+}
+
+/* We have performed the protocol handshake. */
+static int
+callback_mux_handshake(void * cookie, struct proto_keys * f,
+    struct proto_keys * r)
+{
+	struct mux_state * M = cookie;
+
+	/* The handshake is no longer in progress. */
+	M->handshake_cookie = NULL;
+
+	/* We beat the clock. */
+	events_timer_cancel(M->timeout_cookie);
+	M->timeout_cookie = NULL;
+
+	/* If the protocol handshake failed, drop the connection. */
+	if ((f == NULL) && (r == NULL))
+		return (proto_mux_drop(M, PROTO_CONN_HANDSHAKE_FAILED));
+
+	/* The forward keys are for data travelling from encryptor to decryptor. */
+	if (M->opts.decr) {
+		M->k_r = f;
+		M->k_s = r;
+	} else {
+		M->k_s = f;
+		M->k_r = r;
+	}
+
+	/* Start carrying streams. */
+	if (mux_start(M))
+		goto err1;
+
+	/* Success! */
+	return (0);
+
+err1:
+	proto_mux_drop(M, PROTO_CONN_ERROR);
+
+	/* Failure! */
+	return (-1);
+}
+
+/* Connecting or the protocol handshake took too long. */
+static int
+callback_mux_timeout(void * cookie)
+{
+	struct mux_state * M = cookie;
+
+	/* This timeout is no longer pending. */
+	M->timeout_cookie = NULL;
+
+	/* Drop the connection. */
+	return (proto_mux_drop(M, PROTO_CONN_ERROR));
+}
+
+/* We're shutting down and have no streams left. */
+static int
+callback_mux_idle(void * cookie)
+{
+	struct mux_state * M = cookie;
+
+	/* This callback is no longer pending. */
+	M->idle_cookie = NULL;
+
+	/* Drop the connection. */
+	return (proto_mux_drop(M, PROTO_CONN_CLOSED));
+}
+
+/**
+ * proto_mux_open(mux_cookie, s, callback_dead, cookie):
+ * Open a new stream over the multiplexed connection ${mux_cookie}, which must
+ * have been created with ${opts}->decr equal to 0, carrying data to and from
+ * the socket ${s}.  When the stream is closed, close ${s} and invoke
+ * ${callback_dead}(${cookie}, reason); this happens for all streams before the
+ * multiplexed connection is dropped.  Return 0 on success; 1 if the
+ * multiplexed connection is shutting down or has run out of stream IDs, in
+ * which case the caller should use a new one; or -1 on error.  On failure,
+ * ${s} is not closed.
+ */
+int
+proto_mux_open(void * mux_cookie, int s, int (* callback_dead)(void *, int),
+    void * cookie)
+{
+	struct mux_state * M = mux_cookie;
+	struct mux_stream * S;
+
+	/* Can we open another stream? */
+	if (M->shutdown || (M->lastid == UINT32_MAX))
+		return (1);
+
+	/* Create the stream. */
+	if ((S = stream_create(M, M->lastid + 1, s)) == NULL)
+		goto err0;
+	M->lastid += 1;
+	S->callback_dead = callback_dead;
+	S->cookie = cookie;
+	setsockopts(M, s);
+
+	/* If we have finished the handshake, open the stream now. */
+	if (M->started) {
+		if (mux_sendctl(M, FRAME_OPEN, S->id, 0))
+			goto err1;
+		if (stream_read(S))
+			goto err1;
+	}
+
+	/* Success! */
+	return (0);
+
+err1:
+	/* Free the stream without closing ${s} or invoking the callback. */
+	S->s = -1;
+	S->callback_dead = NULL;
+	stream_free(S, PROTO_CONN_ERROR);
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/**
+ * proto_mux_shutdown(mux_cookie):
+ * Refuse any new streams on the multiplexed connection ${mux_cookie}, and drop
+ * it once it carries no streams.
+ */
+int
+proto_mux_shutdown(void * mux_cookie)
+{
+	struct mux_state * M = mux_cookie;
+
+	/* Refuse new streams. */
+	M->shutdown = 1;
+
+	/* If we have no streams, drop the connection soon. */
+	if ((streamlist_getsize(M->streams) == 0) && (M->idle_cookie == NULL)) {
+		if ((M->idle_cookie = events_immediate_register(
+		    callback_mux_idle, M, 0)) == NULL)
+			goto err0;
+	}
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/**
+ * proto_mux_drop(mux_cookie, reason):
+ * Drop the multiplexed connection ${mux_cookie} and all of its streams, due
+ * to ${reason}, and free the associated memory.  Return success or failure.
+ */
+int
+proto_mux_drop(void * mux_cookie, int reason)
+{
+	struct mux_state * M = mux_cookie;
+	size_t nstreams;
+	int rc = 0;
+
+	/* Don't wait for streams to close, or connect waiting streams. */
+	M->shutdown = 0;
+	M->nstreams_max = 0;
+
+	/* Close all of the streams. */
+	while ((nstreams = streamlist_getsize(M->streams)) > 0) {
+		if (stream_free(*streamlist_get(M->streams, nstreams - 1),
+		    reason))
+			rc = -1;
+	}
+
+	/* Kill callbacks if they are pending. */
+	if (M->idle_cookie != NULL)
+		events_immediate_cancel(M->idle_cookie);
+	if (M->timeout_cookie != NULL)
+		events_timer_cancel(M->timeout_cookie);
+
+	/* Stop connecting or handshaking if we are. */
+	if (M->connect_cookie != NULL)
+		network_connect_cancel(M->connect_cookie);
+	sock_addr_freelist(M->sas_t);
+	if (M->handshake_cookie != NULL)
+		proto_handshake_cancel(M->handshake_cookie);
+
+	/* Stop reading and writing. */
+	if (M->R != NULL) {
+		netbuf_read_wait_cancel(M->R);
+		netbuf_read_free(M->R);
+	}
+	if (M->write_cookie != NULL)
+		network_write_cancel(M->write_cookie);
+
+	/* Close the connection if it is open. */
+	if ((M->t != -1) && close(M->t))
+		warnp("close");
+
+	/* Free protocol keys and buffers. */
+	proto_crypt_free(M->k_s);
+	proto_crypt_free(M->k_r);
+	free(M->qbuf);
+	free(M->wbuf);
+	streamlist_free(M->streams);
+
+	/* Notify the upstream that we've dropped the connection. */
+	if ((M->callback_dead)(M->cookie, reason))
+		rc = -1;
+
+	/* Free the connection cookie. */
+	free(M);
+
+	/* Return success/fail status. */
+	return (rc);
+}
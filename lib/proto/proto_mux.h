@@ -0,0 +1,59 @@
+#ifndef PROTO_MUX_H_
+#define PROTO_MUX_H_
+
+#include <stddef.h>
+
+/* Opaque structures. */
+struct proto_conn_opts;
+struct sock_addr;
+
+/**
+ * proto_mux_create(s, sas, sa_b, opts, nstreams_max, callback_dead, cookie):
+ * Create a multiplexed connection, which carries many streams over a single
+ * encrypted connection.  If ${opts}->decr is 0, connect to the target
+ * addresses ${*sas} (binding the outgoing address to ${sa_b} if it is not NULL)
+ * and carry streams opened by proto_mux_open() over that connection; ${s} must
+ * be -1.  If ${opts}->decr is non-zero, carry streams opened by the other end
+ * over the connection ${s}, and connect each of them to the target addresses
+ * ${*sas}; connect at most ${nstreams_max} of them at once, leaving the others
+ * waiting until earlier streams close.  The caller may replace ${*sas} at any
+ * time.  The other options in ${opts} are as for proto_conn_create(), except
+ * that ${opts}->coalesce is ignored.  Drop the connection if the handshake or
+ * connecting to the target takes more than ${opts}->timeo seconds, or a stream
+ * if connecting it to the target does.  When the connection is dropped, invoke
+ * ${callback_dead}(${cookie}, reason).  Return a cookie which can be passed to
+ * proto_mux_open(), proto_mux_shutdown(), and proto_mux_drop().  If there is a
+ * connection error after this function returns, close ${s}.
+ */
+void * proto_mux_create(int, struct sock_addr ** const *,
+    const struct sock_addr *, const struct proto_conn_opts *, size_t,
+    int (*)(void *, int), void *);
+
+/**
+ * proto_mux_open(mux_cookie, s, callback_dead, cookie):
+ * Open a new stream over the multiplexed connection ${mux_cookie}, which must
+ * have been created with ${opts}->decr equal to 0, carrying data to and from
+ * the socket ${s}.  When the stream is closed, close ${s} and invoke
+ * ${callback_dead}(${cookie}, reason); this happens for all streams before the
+ * multiplexed connection is dropped.  Return 0 on success; 1 if the
+ * multiplexed connection is shutting down or has run out of stream IDs, in
+ * which case the caller should use a new one; or -1 on error.  On failure,
+ * ${s} is not closed.
+ */
+int proto_mux_open(void *, int, int (*)(void *, int), void *);
+
+/**
+ * proto_mux_shutdown(mux_cookie):
+ * Refuse any new streams on the multiplexed connection ${mux_cookie}, and drop
+ * it once it carries no streams.
+ */
+int proto_mux_shutdown(void *);
+
+/**
+ * proto_mux_drop(mux_cookie, reason):
+ * Drop the multiplexed connection ${mux_cookie} and all of its streams, due
+ * to ${reason}, and free the associated memory.  Return success or failure.
+ */
+int proto_mux_drop(void *, int);
+
+#endif /* !PROTO_MUX_H_ */
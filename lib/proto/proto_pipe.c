@@ -1,10 +1,12 @@
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 
 #include <errno.h>
 #include <stdint.h>
 #include <stdlib.h>
 
+#include "events.h"
 #include "netbuf.h"
 #include "network.h"
 #include "warnp.h"
@@ -13,8 +15,17 @@
 
 #include "proto_pipe.h"
 
+/* Maximum number of packets to process in a single callback_pipe_read(). */
+#define MAXPACKETS 8
+
 /* Maximum size of data to output in a single callback_pipe_read() call. */
-#define OUTBUFSIZE (8 * PCRYPT_ESZ)
+#define OUTBUFSIZE (MAXPACKETS * PCRYPT_ESZ)
+
+/* Maximum number of jumbo packets to process in one callback_pipe_read(). */
+#define MAXJUMBO 4
+
+/* Maximum size of jumbo packet data to output in one callback_pipe_read(). */
+#define JUMBO_OUTBUFSIZE (MAXJUMBO * PCRYPT_JUMBO_ESZ)
 
 struct pipe_cookie {
 	int (* callback)(void *);
@@ -23,29 +34,41 @@ struct pipe_cookie {
 	int s_in;
 	int s_out;
 	int decr;
+	int jumbo;
 	struct proto_keys * k;
-	uint8_t outbuf[OUTBUFSIZE];
+	size_t maxdsz;
+	double coalesce;
+	void * timer_cookie;
+	int polling;
+	int flush;
+	uint8_t * outbuf;
+	struct iovec iov[MAXPACKETS];
 	struct netbuf_read * R;
 	void * write_cookie;
 	ssize_t wlen;
+	size_t consume;
 	size_t minread;
-	size_t full_buflen;
 };
 
 static int callback_pipe_read(void *, int);
 static int callback_pipe_write(void *, ssize_t);
+static int callback_coalesce_readable(void *);
+static int callback_coalesce_timer(void *);
+static int pipe_enc(struct pipe_cookie *);
 
 /**
- * proto_pipe(s_in, s_out, decr, k, status, callback, cookie):
+ * proto_pipe(s_in, s_out, decr, k, coalesce, status, callback, cookie):
  * Read bytes from ${s_in} and write them to ${s_out}.  If ${decr} is non-zero
- * then use ${k} to decrypt the bytes; otherwise use ${k} to encrypt them.
- * If EOF is read, set ${status} to 0, and if an error is encountered set
- * ${status} to -1; in either case, invoke ${callback}(${cookie}).  Return a
- * cookie which can be passed to proto_pipe_cancel().
+ * then use ${k} to decrypt the bytes; otherwise use ${k} to encrypt them, and
+ * if ${coalesce} is positive, hold back data which would not fill a packet for
+ * up to ${coalesce} seconds in the hope that more will arrive.  If EOF is
+ * read, set ${status} to 0, and if an error is encountered set ${status} to
+ * -1; in either case, invoke ${callback}(${cookie}).  Return a cookie which
+ * can be passed to proto_pipe_cancel().
  */
 void *
 proto_pipe(int s_in, int s_out, int decr, struct proto_keys * k,
-    int * status, int (* callback)(void *), void * cookie)
+    double coalesce, int * status, int (* callback)(void *), void * cookie)
 {
 	struct pipe_cookie * P;
 
@@ -58,28 +81,48 @@ proto_pipe(int s_in, int s_out, int decr, struct proto_keys * k,
 	P->s_in = s_in;
 	P->s_out = s_out;
 	P->decr = decr;
+	P->jumbo = proto_crypt_jumbo(k);
 	P->k = k;
+	P->maxdsz = P->jumbo ? PCRYPT_JUMBO_MAXDSZ : PCRYPT_MAXDSZ;
+	P->coalesce = decr ? 0.0 : coalesce;
+	P->timer_cookie = NULL;
+	P->polling = 0;
+	P->flush = 0;
 	P->write_cookie = NULL;
 
+	/* We only need an output buffer if we're encrypting. */
+	if (P->decr) {
+		P->outbuf = NULL;
+	} else if ((P->outbuf =
+	    malloc(P->jumbo ? JUMBO_OUTBUFSIZE : OUTBUFSIZE)) == NULL)
+		goto err1;
+
 	/* Initialize reader. */
 	if ((P->R = netbuf_read_init(P->s_in)) == NULL)
-		goto err1;
+		goto err2;
 
-	/* Set the minimum number of bytes to read. */
-	P->minread = P->decr ? PCRYPT_ESZ : 1;
+	/* Make room to read several jumbo packets' worth of data at once. */
+	if (P->jumbo && netbuf_read_reserve(P->R, P->decr ?
+	    MAXJUMBO * PCRYPT_JUMBO_ESZ : MAXJUMBO * PCRYPT_JUMBO_MAXDSZ))
+		goto err3;
 
-	/* Set the number of bytes in a full buffer. */
-	P->full_buflen = P->decr ? PCRYPT_ESZ : PCRYPT_MAXDSZ;
+	/* Set the minimum number of bytes to read. */
+	if (P->decr)
+		P->minread = P->jumbo ? PCRYPT_JUMBO_HLEN : PCRYPT_ESZ;
+	else
+		P->minread = 1;
 
 	/* Start reading. */
 	if (netbuf_read_wait(P->R, P->minread, callback_pipe_read, P))
-		goto err2;
+		goto err3;
 
 	/* Success! */
 	return (P);
 
-err2:
+err3:
 	netbuf_read_free(P->R);
+err2:
+	free(P->outbuf);
 err1:
 	free(P);
 err0:
@@ -87,70 +130,294 @@ err0:
 	return (NULL);
 }
 
+/* Stop holding back data. */
+static void
+coalesce_stop(struct pipe_cookie * P)
+{
+
+	/* Cancel the deadline, if any. */
+	if (P->timer_cookie != NULL) {
+		events_timer_cancel(P->timer_cookie);
+		P->timer_cookie = NULL;
+	}
+
+	/* Stop waiting for more data, if we are. */
+	if (P->polling) {
+		events_network_cancel(P->s_in, EVENTS_NETWORK_OP_READ);
+		P->polling = 0;
+	}
+
+	/* We're not waiting to flush any more. */
+	P->flush = 0;
+}
+
+/*
+ * Wait until more data arrives or the coalescing deadline passes.  We wait
+ * for ${P}->s_in to become readable rather than reading from it, since
+ * cancelling a read when the deadline passes could lose data.
+ */
+static int
+coalesce_wait(struct pipe_cookie * P)
+{
+
+	/* Start the clock when we start holding back data. */
+	if ((P->timer_cookie == NULL) &&
+	    ((P->timer_cookie = events_timer_register_double(
+	    callback_coalesce_timer, P, P->coalesce)) == NULL))
+		goto err0;
+
+	/* Wait for more data. */
+	if (events_network_register(callback_coalesce_readable, P, P->s_in,
+	    EVENTS_NETWORK_OP_READ))
+		goto err0;
+	P->polling = 1;
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* More data is available while we're holding back data. */
+static int
+callback_coalesce_readable(void * cookie)
+{
+	struct pipe_cookie * P = cookie;
+	uint8_t * inbuf;
+	size_t inlen;
+
+	/* We're no longer waiting for the socket. */
+	P->polling = 0;
+
+	/* Read at least one more byte. */
+	netbuf_read_peek(P->R, &inbuf, &inlen);
+	if (netbuf_read_wait(P->R, inlen + 1, callback_pipe_read, P))
+		goto err0;
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* We've held back data for as long as we're allowed to. */
+static int
+callback_coalesce_timer(void * cookie)
+{
+	struct pipe_cookie * P = cookie;
+
+	/* This callback is no longer pending. */
+	P->timer_cookie = NULL;
+
+	/*
+	 * If we're reading, the read will complete promptly since the socket
+	 * was readable; send the data once it does.
+	 */
+	if (!P->polling) {
+		P->flush = 1;
+		return (0);
+	}
+
+	/* Send what we have. */
+	return (pipe_enc(P));
+}
+
+/* Encrypt and write all of the data we have read. */
+static int
+pipe_enc(struct pipe_cookie * P)
+{
+	struct iovec * iov = P->iov;
+	uint8_t * inbuf;
+	size_t inlen;
+	size_t inpos;
+	size_t npackets;
+	size_t i;
+	size_t len;
+
+	/* We're not holding back data any more. */
+	coalesce_stop(P);
+
+	/* Get data. */
+	netbuf_read_peek(P->R, &inbuf, &inlen);
+
+	if (P->jumbo) {
+		/* Encrypt into jumbo packets of up to 16 KiB. */
+		inpos = 0;
+		P->wlen = 0;
+		for (i = 0; (i < MAXJUMBO) && (inpos < inlen); i++) {
+			len = inlen - inpos;
+			if (len > PCRYPT_JUMBO_MAXDSZ)
+				len = PCRYPT_JUMBO_MAXDSZ;
+			P->wlen += (ssize_t)proto_crypt_enc_jumbo(&inbuf[inpos],
+			    len, &P->outbuf[P->wlen], P->k);
+			inpos += len;
+		}
+	} else {
+		/* Split the input into packets of up to 1 KiB. */
+		inpos = 0;
+		for (i = 0; (i < MAXPACKETS) && (inpos < inlen); i++) {
+			iov[i].iov_base = &inbuf[inpos];
+			iov[i].iov_len = inlen - inpos;
+			if (iov[i].iov_len > PCRYPT_MAXDSZ)
+				iov[i].iov_len = PCRYPT_MAXDSZ;
+			inpos += iov[i].iov_len;
+		}
+		npackets = i;
+
+		/* Encrypt the packets. */
+		proto_crypt_enc_batch(iov, npackets, P->outbuf, P->k);
+		P->wlen = (ssize_t)(npackets * PCRYPT_ESZ);
+	}
+
+	/* Let netbuf layer know what we've used. */
+	netbuf_read_consume(P->R, inpos);
+
+	/* Write the encrypted data. */
+	P->consume = 0;
+	if ((P->write_cookie = network_write(P->s_out, P->outbuf,
+	    (size_t)P->wlen, (size_t)P->wlen, callback_pipe_write,
+	    P)) == NULL)
+		goto err0;
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
 /* Some data has been read. */
 static int
 callback_pipe_read(void * cookie, int status)
 {
 	struct pipe_cookie * P = cookie;
+	struct iovec * iov = P->iov;
 	uint8_t * inbuf;
 	size_t inlen;
-	size_t inpos = 0;
-	size_t outpos = 0;
-	size_t loop_inlen;
-	ssize_t loop_outlen;
+	size_t inpos;
+	size_t npackets;
+	size_t i;
+	ssize_t esz;
+	ssize_t len;
 
 	/* Did we read EOF? */
-	if (status == 1)
+	if (status == 1) {
+		/* Send any data we were holding back first. */
+		netbuf_read_peek(P->R, &inbuf, &inlen);
+		if (!P->decr && (inlen > 0))
+			return (pipe_enc(P));
 		goto eof;
+	}
 
 	/* Did the read fail? */
-	if (status == -1)
+	if (status == -1) {
+		coalesce_stop(P);
 		goto fail;
+	}
 
 	/* Get data. */
 	netbuf_read_peek(P->R, &inbuf, &inlen);
 
-	/* Process as many packets as possible. */
-	while (inlen > 0) {
-		/* Stop processing if we don't have space for more output. */
-		if (outpos + P->full_buflen > OUTBUFSIZE)
-			break;
+	/* How many packets should we process? */
+	npackets = P->jumbo ? MAXJUMBO : MAXPACKETS;
+
+	/* Encrypt or decrypt as many packets as possible. */
+	if (P->decr && P->jumbo) {
+		/* Decrypt as many whole jumbo packets as we have. */
+		inpos = 0;
+		P->wlen = 0;
+		for (i = 0; i < npackets; i++) {
+			/* Do we have the header of the next packet? */
+			if (inlen - inpos < PCRYPT_JUMBO_HLEN)
+				break;
+
+			/* Do we have the rest of it? */
+			if ((esz = proto_crypt_jumbo_esz(&inbuf[inpos])) == -1)
+				goto fail;
+			if (inlen - inpos < (size_t)esz)
+				break;
+
+			/* Decrypt the packet in place. */
+			if ((len = proto_crypt_dec_jumbo_inplace(&inbuf[inpos],
+			    P->k)) == -1)
+				goto fail;
 
-		/* How many bytes should we process this time? */
-		loop_inlen = (inlen > P->full_buflen) ? P->full_buflen : inlen;
+			/* Record where the data is. */
+			iov[i].iov_base = &inbuf[inpos + PCRYPT_JUMBO_HLEN];
+			iov[i].iov_len = (size_t)len;
+			P->wlen += len;
+			inpos += (size_t)esz;
+		}
+		npackets = i;
 
 		/*
-		 * If we don't have enough data to decrypt, leave it until the
-		 * next time callback_pipe_read() is called.
+		 * If we don't have a whole packet yet, wait until we do; we
+		 * always have its header, since we waited for that much.
 		 */
-		if ((P->decr) && (loop_inlen < PCRYPT_ESZ))
-			break;
+		if (npackets == 0) {
+			P->minread = (size_t)proto_crypt_jumbo_esz(inbuf);
+			goto readmore;
+		}
+		P->minread = PCRYPT_JUMBO_HLEN;
 
-		/* Encrypt or decrypt the data. */
-		if (P->decr) {
-			if ((loop_outlen = proto_crypt_dec(&inbuf[inpos],
-			    &P->outbuf[outpos], P->k)) == -1)
-				goto fail;
-		} else {
-			proto_crypt_enc(&inbuf[inpos], loop_inlen,
-			    &P->outbuf[outpos], P->k);
-			loop_outlen = PCRYPT_ESZ;
+		/* Write the data from the netbuf; consume it afterwards. */
+		P->consume = inpos;
+		if ((P->write_cookie = network_writev(P->s_out, iov,
+		    (int)npackets, (size_t)P->wlen, callback_pipe_write,
+		    P)) == NULL)
+			goto err0;
+	} else if (P->decr) {
+		/*
+		 * If we don't have enough data to decrypt a packet, leave it
+		 * until the next time callback_pipe_read() is called.
+		 */
+		if (npackets > inlen / PCRYPT_ESZ)
+			npackets = inlen / PCRYPT_ESZ;
+
+		/* Split the input into packets. */
+		for (i = 0; i < npackets; i++) {
+			iov[i].iov_base = &inbuf[i * PCRYPT_ESZ];
+			iov[i].iov_len = PCRYPT_ESZ;
 		}
 
-		/* We've processed this data. */
-		inlen -= loop_inlen;
-		inpos += loop_inlen;
-		outpos += (size_t)loop_outlen;
+		/* Decrypt the packets in place. */
+		if ((P->wlen = proto_crypt_dec_batch_inplace(iov, npackets,
+		    P->k)) == -1)
+			goto fail;
+
+		/*
+		 * Write the decrypted data straight out of the netbuf; we'll
+		 * tell the netbuf layer that we've used it once the write is
+		 * done.
+		 */
+		P->consume = npackets * PCRYPT_ESZ;
+		if ((P->write_cookie = network_writev(P->s_out, iov,
+		    (int)npackets, (size_t)P->wlen, callback_pipe_write,
+		    P)) == NULL)
+			goto err0;
+	} else {
+		/*
+		 * If we're coalescing small writes and don't have a full
+		 * packet yet, wait (up to the deadline) for more data.
+		 */
+		if ((P->coalesce > 0.0) && (inlen < P->maxdsz) && !P->flush)
+			return (coalesce_wait(P));
+
+		/* Encrypt and write what we have. */
+		return (pipe_enc(P));
 	}
 
-	/* Let netbuf layer know what we've used. */
-	netbuf_read_consume(P->R, inpos);
+	/* Success! */
+	return (0);
 
-	/* Write the encrypted or decrypted data. */
-	P->wlen = (ssize_t)outpos;
-	if ((P->write_cookie = network_write(P->s_out, P->outbuf,
-	    (size_t)P->wlen, (size_t)P->wlen, callback_pipe_write,
-	    P)) == NULL)
+readmore:
+	/* Wait for more data. */
+	if (netbuf_read_wait(P->R, P->minread, callback_pipe_read, P))
 		goto err0;
 
 	/* Success! */
@@ -210,6 +477,9 @@ callback_pipe_write(void * cookie, ssize_t len)
 	if (len < P->wlen)
 		goto fail;
 
+	/* If we wrote from the netbuf, we're done with that data now. */
+	netbuf_read_consume(P->R, P->consume);
+
 	/* Launch another read. */
 	if (netbuf_read_wait(P->R, P->minread, callback_pipe_read, P))
 		goto err0;
@@ -238,13 +508,17 @@ proto_pipe_cancel(void * cookie)
 {
 	struct pipe_cookie * P = cookie;
 
+	/* Stop holding back data. */
+	coalesce_stop(P);
+
 	/* If a read or write is in progress, cancel it. */
 	netbuf_read_wait_cancel(P->R);
 	if (P->write_cookie)
 		network_write_cancel(P->write_cookie);
 
-	/* Clean up the buffered reader. */
+	/* Clean up the buffered reader and output buffer. */
 	netbuf_read_free(P->R);
+	free(P->outbuf);
 
 	/* Free the cookie. */
 	free(P);
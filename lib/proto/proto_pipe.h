@@ -5,14 +5,16 @@
 struct proto_keys;
 
 /**
- * proto_pipe(s_in, s_out, decr, k, status, callback, cookie):
+ * proto_pipe(s_in, s_out, decr, k, coalesce, status, callback, cookie):
  * Read bytes from ${s_in} and write them to ${s_out}.  If ${decr} is non-zero
- * then use ${k} to decrypt the bytes; otherwise use ${k} to encrypt them.
- * If EOF is read, set ${status} to 0, and if an error is encountered set
- * ${status} to -1; in either case, invoke ${callback}(${cookie}).  Return a
- * cookie which can be passed to proto_pipe_cancel().
+ * then use ${k} to decrypt the bytes; otherwise use ${k} to encrypt them, and
+ * if ${coalesce} is positive, hold back data which would not fill a packet for
+ * up to ${coalesce} seconds in the hope that more will arrive.  If EOF is
+ * read, set ${status} to 0, and if an error is encountered set ${status} to
+ * -1; in either case, invoke ${callback}(${cookie}).  Return a cookie which
+ * can be passed to proto_pipe_cancel().
  */
-void * proto_pipe(int, int, int, struct proto_keys *, int *,
+void * proto_pipe(int, int, int, struct proto_keys *, double, int *,
     int (*)(void *), void *);
 
 /**
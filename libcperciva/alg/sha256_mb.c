@@ -0,0 +1,446 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "cpusupport.h"
+#include "insecure_memzero.h"
+#include "sha256.h"
+#include "sha256_mb_avx2.h"
+#include "sha256_mb_sse2.h"
+#include "sysendian.h"
+#include "warnp.h"
+
+#include "sha256_mb.h"
+
+/**
+ * Multi-buffer SHA256 computes the block compression function for several
+ * independent messages at once, with one message in each 32-bit lane of a
+ * SIMD register.  This only helps when the messages are at the same position
+ * in their respective blocks (e.g., HMACs of equal-length packets computed
+ * using the same key) and when the CPU doesn't have dedicated SHA256
+ * instructions, which are faster than any of the SIMD code.
+ */
+
+/* Maximum number of lanes in any implementation. */
+#define MAXLANES 8
+
+#if defined(CPUSUPPORT_X86_AVX2) || defined(CPUSUPPORT_X86_SSE2)
+#define HWACCEL
+
+static enum {
+	HW_SOFTWARE = 0,
+#if defined(CPUSUPPORT_X86_AVX2)
+	HW_X86_AVX2,
+#endif
+#if defined(CPUSUPPORT_X86_SSE2)
+	HW_X86_SSE2,
+#endif
+	HW_UNSET
+} hwaccel = HW_UNSET;
+
+/* Test case: number of messages, and length of each. */
+#define TESTN 5
+#define TESTLEN 200
+
+static void hmac_update_mb(HMAC_SHA256_CTX * const *, const uint8_t * const *,
+    size_t, size_t);
+static void hmac_final_mb(uint8_t * const *, HMAC_SHA256_CTX * const *,
+    size_t);
+
+/*
+ * Test whether the serial and multi-buffer HMAC code produce the same
+ * results.  Must be called with (hwaccel == HW_SOFTWARE); this sets hwaccel
+ * to ${hw} temporarily.
+ */
+static int
+hwtest(int hw)
+{
+	HMAC_SHA256_CTX ctx_sw[TESTN];
+	HMAC_SHA256_CTX ctx_hw[TESTN];
+	HMAC_SHA256_CTX * ctxs[TESTN];
+	const uint8_t * ins[TESTN];
+	uint8_t * digests[TESTN];
+	uint8_t msgs[TESTN][TESTLEN];
+	uint8_t hbuf_sw[TESTN][32];
+	uint8_t hbuf_hw[TESTN][32];
+	size_t i, j;
+
+	/* Test case: Key "key", messages of bytes i * j. */
+	for (i = 0; i < TESTN; i++) {
+		for (j = 0; j < TESTLEN; j++)
+			msgs[i][j] = (uint8_t)(i * j);
+		HMAC_SHA256_Init(&ctx_sw[i], "key", 3);
+		HMAC_SHA256_Init(&ctx_hw[i], "key", 3);
+	}
+
+	/* Serial, splitting each message at an odd position. */
+	for (i = 0; i < TESTN; i++) {
+		HMAC_SHA256_Update(&ctx_sw[i], msgs[i], 3);
+		HMAC_SHA256_Update(&ctx_sw[i], &msgs[i][3], TESTLEN - 3);
+		HMAC_SHA256_Final(hbuf_sw[i], &ctx_sw[i]);
+	}
+
+	/* Multi-buffer. */
+	hwaccel = hw;
+	for (i = 0; i < TESTN; i++) {
+		ctxs[i] = &ctx_hw[i];
+		ins[i] = msgs[i];
+		digests[i] = hbuf_hw[i];
+	}
+	hmac_update_mb(ctxs, ins, 3, TESTN);
+	for (i = 0; i < TESTN; i++)
+		ins[i] = &msgs[i][3];
+	hmac_update_mb(ctxs, ins, TESTLEN - 3, TESTN);
+	hmac_final_mb(digests, ctxs, TESTN);
+	hwaccel = HW_SOFTWARE;
+
+	/* Do the results match? */
+	return (memcmp(hbuf_sw, hbuf_hw, sizeof(hbuf_sw)));
+}
+
+/* Which type of hardware acceleration should we use, if any? */
+static void
+hwaccel_init(void)
+{
+
+	/* If we've already set hwaccel, we're finished. */
+	if (hwaccel != HW_UNSET)
+		return;
+
+	/* Default to software. */
+	hwaccel = HW_SOFTWARE;
+
+	/* Dedicated SHA256 instructions beat processing lanes in parallel. */
+#if defined(CPUSUPPORT_X86_SHANI) && defined(CPUSUPPORT_X86_SSSE3)
+	if (cpusupport_x86_shani() && cpusupport_x86_ssse3())
+		return;
+#endif
+
+#if defined(CPUSUPPORT_X86_AVX2)
+	CPUSUPPORT_VALIDATE(hwaccel, HW_X86_AVX2, cpusupport_x86_avx2(),
+	    hwtest(HW_X86_AVX2));
+#endif
+#if defined(CPUSUPPORT_X86_SSE2)
+	CPUSUPPORT_VALIDATE(hwaccel, HW_X86_SSE2, cpusupport_x86_sse2(),
+	    hwtest(HW_X86_SSE2));
+#endif
+}
+
+/* Return the number of lanes used by the selected implementation. */
+static size_t
+lanes(void)
+{
+
+	switch (hwaccel) {
+#if defined(CPUSUPPORT_X86_AVX2)
+	case HW_X86_AVX2:
+		return (8);
+#endif
+#if defined(CPUSUPPORT_X86_SSE2)
+	case HW_X86_SSE2:
+		return (4);
+#endif
+	case HW_SOFTWARE:
+	case HW_UNSET:
+		break;
+	}
+
+	/* No multi-buffer implementation. */
+	return (1);
+}
+
+/*
+ * Compute the SHA256 block compression function over ${nblocks} consecutive
+ * blocks starting at each of ${blocks}[0 .. ${n} - 1], transforming the
+ * corresponding ${states}.  Requires ${n} <= lanes().
+ */
+static void
+transform_mb(uint32_t * const * states, const uint8_t * const * blocks,
+    size_t nblocks, size_t n)
+{
+	uint32_t dummy[MAXLANES][8];
+	uint32_t * s[MAXLANES];
+	const uint8_t * b[MAXLANES];
+	size_t i;
+
+	/* Fill any unused lanes with copies of the first message. */
+	for (i = 0; i < lanes(); i++) {
+		if (i < n) {
+			s[i] = states[i];
+			b[i] = blocks[i];
+		} else {
+			memcpy(dummy[i], states[0], 32);
+			s[i] = dummy[i];
+			b[i] = blocks[0];
+		}
+	}
+
+	/* Process all of the lanes. */
+	switch (hwaccel) {
+#if defined(CPUSUPPORT_X86_AVX2)
+	case HW_X86_AVX2:
+		SHA256_Transform_mb_avx2(s, b, nblocks);
+		break;
+#endif
+#if defined(CPUSUPPORT_X86_SSE2)
+	case HW_X86_SSE2:
+		SHA256_Transform_mb_sse2(s, b, nblocks);
+		break;
+#endif
+	default:
+		warn0("Programmer error: unexpected hwaccel value");
+		break;
+	}
+
+	/* Clean the stack. */
+	insecure_memzero(dummy, sizeof(dummy));
+}
+
+/*
+ * Input ${len} bytes from each of ${ins}[0 .. ${n} - 1] into the SHA256
+ * contexts ${ctxs}, which must all have processed the same number of bytes.
+ * Requires ${n} <= lanes().
+ */
+static void
+sha256_update_mb(SHA256_CTX * const * ctxs, const uint8_t * const * ins,
+    size_t len, size_t n)
+{
+	uint32_t * states[MAXLANES];
+	const uint8_t * blocks[MAXLANES];
+	size_t r, pos, i;
+
+	/* Return immediately if we have nothing to do. */
+	if (len == 0)
+		return;
+
+	/* Number of bytes left in the buffers from previous updates. */
+	r = (ctxs[0]->count >> 3) & 0x3f;
+
+	/* Update number of bits. */
+	for (i = 0; i < n; i++) {
+		ctxs[i]->count += (uint64_t)(len) << 3;
+		states[i] = ctxs[i]->state;
+	}
+
+	/* Handle the case where we don't need to perform any transforms. */
+	if (len < 64 - r) {
+		for (i = 0; i < n; i++)
+			memcpy(&ctxs[i]->buf[r], ins[i], len);
+		return;
+	}
+
+	/* Finish the current blocks. */
+	pos = 0;
+	if (r > 0) {
+		for (i = 0; i < n; i++) {
+			memcpy(&ctxs[i]->buf[r], ins[i], 64 - r);
+			blocks[i] = ctxs[i]->buf;
+		}
+		transform_mb(states, blocks, 1, n);
+		pos = 64 - r;
+	}
+
+	/* Perform complete blocks. */
+	if (len - pos >= 64) {
+		for (i = 0; i < n; i++)
+			blocks[i] = &ins[i][pos];
+		transform_mb(states, blocks, (len - pos) / 64, n);
+		pos += (len - pos) - (len - pos) % 64;
+	}
+
+	/* Copy left over data into buffers. */
+	for (i = 0; i < n; i++)
+		memcpy(ctxs[i]->buf, &ins[i][pos], len - pos);
+}
+
+/*
+ * Add padding and the terminating bit-count to the SHA256 contexts ${ctxs},
+ * which must all have processed the same number of bytes, and write the
+ * hashes into ${digests}.  Requires ${n} <= lanes().
+ */
+static void
+sha256_final_mb(uint8_t * const * digests, SHA256_CTX * const * ctxs,
+    size_t n)
+{
+	uint32_t * states[MAXLANES];
+	const uint8_t * blocks[MAXLANES];
+	size_t r, i, j;
+
+	/* Figure out how many bytes we have buffered. */
+	r = (ctxs[0]->count >> 3) & 0x3f;
+
+	/* Collect the states and buffers. */
+	for (i = 0; i < n; i++) {
+		states[i] = ctxs[i]->state;
+		blocks[i] = ctxs[i]->buf;
+	}
+
+	/* Pad to 56 mod 64, transforming if we finish a block en route. */
+	for (i = 0; i < n; i++) {
+		ctxs[i]->buf[r] = 0x80;
+		memset(&ctxs[i]->buf[r + 1], 0, ((r < 56) ? 55 : 63) - r);
+	}
+	if (r >= 56) {
+		transform_mb(states, blocks, 1, n);
+		for (i = 0; i < n; i++)
+			memset(ctxs[i]->buf, 0, 56);
+	}
+
+	/* Add the terminating bit-count, and mix in the final block. */
+	for (i = 0; i < n; i++)
+		be64enc(&ctxs[i]->buf[56], ctxs[i]->count);
+	transform_mb(states, blocks, 1, n);
+
+	/* Write the hashes. */
+	for (i = 0; i < n; i++) {
+		for (j = 0; j < 8; j++)
+			be32enc(&digests[i][4 * j], ctxs[i]->state[j]);
+	}
+}
+
+/* Return non-zero if ${ctxs} have all processed the same number of bytes. */
+static int
+same_counts(HMAC_SHA256_CTX * const * ctxs, size_t n)
+{
+	size_t i;
+
+	for (i = 1; i < n; i++) {
+		if ((ctxs[i]->ictx.count != ctxs[0]->ictx.count) ||
+		    (ctxs[i]->octx.count != ctxs[0]->octx.count))
+			return (0);
+	}
+	return (1);
+}
+
+/* Multi-buffer version of HMAC_SHA256_Update. */
+static void
+hmac_update_mb(HMAC_SHA256_CTX * const * ctxs, const uint8_t * const * ins,
+    size_t len, size_t n)
+{
+	SHA256_CTX * ictxs[MAXLANES];
+	size_t i, nl;
+
+	/* Process up to lanes() messages at once. */
+	for (; n > 0; ctxs += nl, ins += nl, n -= nl) {
+		nl = (n < lanes()) ? n : lanes();
+		for (i = 0; i < nl; i++)
+			ictxs[i] = &ctxs[i]->ictx;
+		sha256_update_mb(ictxs, ins, len, nl);
+	}
+}
+
+/* Multi-buffer version of HMAC_SHA256_Final. */
+static void
+hmac_final_mb(uint8_t * const * digests, HMAC_SHA256_CTX * const * ctxs,
+    size_t n)
+{
+	SHA256_CTX * ictxs[MAXLANES];
+	SHA256_CTX * octxs[MAXLANES];
+	uint8_t ihash[MAXLANES][32];
+	uint8_t * ihashes[MAXLANES];
+	const uint8_t * ins[MAXLANES];
+	size_t i, nl;
+
+	/* Process up to lanes() messages at once. */
+	for (; n > 0; digests += nl, ctxs += nl, n -= nl) {
+		nl = (n < lanes()) ? n : lanes();
+		for (i = 0; i < nl; i++) {
+			ictxs[i] = &ctxs[i]->ictx;
+			octxs[i] = &ctxs[i]->octx;
+			ihashes[i] = ihash[i];
+			ins[i] = ihash[i];
+		}
+
+		/* Finish the inner SHA256 operations. */
+		sha256_final_mb(ihashes, ictxs, nl);
+
+		/* Feed the inner hashes to the outer SHA256 operations. */
+		sha256_update_mb(octxs, ins, 32, nl);
+
+		/* Finish the outer SHA256 operations. */
+		sha256_final_mb(digests, octxs, nl);
+
+		/* Clear the context states. */
+		for (i = 0; i < nl; i++)
+			insecure_memzero(ctxs[i], sizeof(HMAC_SHA256_CTX));
+	}
+
+	/* Clean the stack. */
+	insecure_memzero(ihash, sizeof(ihash));
+}
+#endif /* HWACCEL */
+
+/**
+ * HMAC_SHA256_mb_lanes(void):
+ * Return the number of messages which HMAC_SHA256_Update_mb() and
+ * HMAC_SHA256_Final_mb() process in parallel, or 1 if this CPU has no
+ * multi-buffer implementation which is faster than processing the messages
+ * one at a time.
+ */
+size_t
+HMAC_SHA256_mb_lanes(void)
+{
+
+#ifdef HWACCEL
+	/* Pick an implementation if we haven't done so already. */
+	hwaccel_init();
+
+	return (lanes());
+#else
+	return (1);
+#endif
+}
+
+/**
+ * HMAC_SHA256_Update_mb(ctxs, ins, len, n):
+ * For each i in [0, ${n}), input ${len} bytes from ${ins}[i] into the
+ * HMAC-SHA256 context ${ctxs}[i].  This is equivalent to calling
+ * HMAC_SHA256_Update() on each context in turn, but if all of the contexts
+ * have processed the same number of bytes, several messages are hashed at
+ * once using SIMD instructions.
+ */
+void
+HMAC_SHA256_Update_mb(HMAC_SHA256_CTX * const * ctxs,
+    const uint8_t * const * ins, size_t len, size_t n)
+{
+	size_t i;
+
+#ifdef HWACCEL
+	/* Use the multi-buffer code if we can. */
+	if ((HMAC_SHA256_mb_lanes() > 1) && same_counts(ctxs, n)) {
+		hmac_update_mb(ctxs, ins, len, n);
+		return;
+	}
+#endif
+
+	/* Process the messages one at a time. */
+	for (i = 0; i < n; i++)
+		HMAC_SHA256_Update(ctxs[i], ins[i], len);
+}
+
+/**
+ * HMAC_SHA256_Final_mb(digests, ctxs, n):
+ * For each i in [0, ${n}), output the HMAC-SHA256 of the data input to the
+ * context ${ctxs}[i] into the buffer ${digests}[i], and clear the context
+ * state.  This is equivalent to calling HMAC_SHA256_Final() on each context
+ * in turn, but if all of the contexts have processed the same number of
+ * bytes, several messages are hashed at once using SIMD instructions.
+ */
+void
+HMAC_SHA256_Final_mb(uint8_t * const * digests, HMAC_SHA256_CTX * const * ctxs,
+    size_t n)
+{
+	size_t i;
+
+#ifdef HWACCEL
+	/* Use the multi-buffer code if we can. */
+	if ((HMAC_SHA256_mb_lanes() > 1) && same_counts(ctxs, n)) {
+		hmac_final_mb(digests, ctxs, n);
+		return;
+	}
+#endif
+
+	/* Process the messages one at a time. */
+	for (i = 0; i < n; i++)
+		HMAC_SHA256_Final(digests[i], ctxs[i]);
+}
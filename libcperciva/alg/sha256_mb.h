@@ -0,0 +1,40 @@
+#ifndef SHA256_MB_H_
+#define SHA256_MB_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sha256.h"
+
+/**
+ * HMAC_SHA256_mb_lanes(void):
+ * Return the number of messages which HMAC_SHA256_Update_mb() and
+ * HMAC_SHA256_Final_mb() process in parallel, or 1 if this CPU has no
+ * multi-buffer implementation which is faster than processing the messages
+ * one at a time.
+ */
+size_t HMAC_SHA256_mb_lanes(void);
+
+/**
+ * HMAC_SHA256_Update_mb(ctxs, ins, len, n):
+ * For each i in [0, ${n}), input ${len} bytes from ${ins}[i] into the
+ * HMAC-SHA256 context ${ctxs}[i].  This is equivalent to calling
+ * HMAC_SHA256_Update() on each context in turn, but if all of the contexts
+ * have processed the same number of bytes, several messages are hashed at
+ * once using SIMD instructions.
+ */
+void HMAC_SHA256_Update_mb(HMAC_SHA256_CTX * const *, const uint8_t * const *,
+    size_t, size_t);
+
+/**
+ * HMAC_SHA256_Final_mb(digests, ctxs, n):
+ * For each i in [0, ${n}), output the HMAC-SHA256 of the data input to the
+ * context ${ctxs}[i] into the buffer ${digests}[i], and clear the context
+ * state.  This is equivalent to calling HMAC_SHA256_Final() on each context
+ * in turn, but if all of the contexts have processed the same number of
+ * bytes, several messages are hashed at once using SIMD instructions.
+ */
+void HMAC_SHA256_Final_mb(uint8_t * const *, HMAC_SHA256_CTX * const *,
+    size_t);
+
+#endif /* !SHA256_MB_H_ */
@@ -0,0 +1,187 @@
+#include "cpusupport.h"
+#ifdef CPUSUPPORT_X86_AVX2
+/**
+ * CPUSUPPORT CFLAGS: X86_AVX2
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <immintrin.h>
+
+#include "insecure_memzero.h"
+
+#include "sha256_mb_avx2.h"
+
+/* SHA256 round constants. */
+static const uint32_t Krnd[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+	0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+	0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+	0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+	0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+	0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+	0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+	0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+	0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+/* Elementary functions used by SHA256, operating on eight lanes at once. */
+#define XOR(x, y)	_mm256_xor_si256(x, y)
+#define AND(x, y)	_mm256_and_si256(x, y)
+#define OR(x, y)	_mm256_or_si256(x, y)
+#define ADD(x, y)	_mm256_add_epi32(x, y)
+#define SHR(x, n)	_mm256_srli_epi32(x, n)
+#define ROTR(x, n)	OR(SHR(x, n), _mm256_slli_epi32(x, 32 - n))
+#define Ch(x, y, z)	XOR(AND(x, XOR(y, z)), z)
+#define Maj(x, y, z)	OR(AND(x, OR(y, z)), AND(y, z))
+#define S0(x)		XOR(XOR(ROTR(x, 2), ROTR(x, 13)), ROTR(x, 22))
+#define S1(x)		XOR(XOR(ROTR(x, 6), ROTR(x, 11)), ROTR(x, 25))
+#define s0(x)		XOR(XOR(ROTR(x, 7), ROTR(x, 18)), SHR(x, 3))
+#define s1(x)		XOR(XOR(ROTR(x, 17), ROTR(x, 19)), SHR(x, 10))
+
+/* SHA256 round function */
+#define RND(a, b, c, d, e, f, g, h, k)				\
+	h = ADD(h, ADD(ADD(S1(e), Ch(e, f, g)), k));		\
+	d = ADD(d, h);						\
+	h = ADD(h, ADD(S0(a), Maj(a, b, c)))
+
+/* Adjusted round function for rotating state */
+#define RNDr(S, W, i, ii)					\
+	RND(S[(64 - i) % 8], S[(65 - i) % 8],			\
+	    S[(66 - i) % 8], S[(67 - i) % 8],			\
+	    S[(68 - i) % 8], S[(69 - i) % 8],			\
+	    S[(70 - i) % 8], S[(71 - i) % 8],			\
+	    ADD(W[i + ii], _mm256_set1_epi32((int)Krnd[i + ii])))
+
+/**
+ * load_transpose(W, blocks, offset):
+ * Load the 32-byte rows at ${offset} within each of the eight ${blocks} and
+ * transpose them, so that W[i] holds big-endian word (${offset} / 4 + i) of
+ * each block, with the word from blocks[j] in lane j.
+ */
+static inline void
+load_transpose(__m256i W[8], const uint8_t * const blocks[8], size_t offset)
+{
+	const __m256i bswap = _mm256_set_epi8(
+	    12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3,
+	    12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3);
+	__m256i r[8], t[8];
+	size_t i;
+
+	/* Load rows, and convert the words to host order. */
+	for (i = 0; i < 8; i++) {
+		r[i] = _mm256_loadu_si256(
+		    (const __m256i *)(const void *)&blocks[i][offset]);
+		r[i] = _mm256_shuffle_epi8(r[i], bswap);
+	}
+
+	/* Interleave 32-bit words. */
+	for (i = 0; i < 4; i++) {
+		t[2 * i] = _mm256_unpacklo_epi32(r[2 * i], r[2 * i + 1]);
+		t[2 * i + 1] = _mm256_unpackhi_epi32(r[2 * i], r[2 * i + 1]);
+	}
+
+	/* Interleave 64-bit words. */
+	for (i = 0; i < 2; i++) {
+		r[4 * i] = _mm256_unpacklo_epi64(t[4 * i], t[4 * i + 2]);
+		r[4 * i + 1] = _mm256_unpackhi_epi64(t[4 * i], t[4 * i + 2]);
+		r[4 * i + 2] = _mm256_unpacklo_epi64(t[4 * i + 1],
+		    t[4 * i + 3]);
+		r[4 * i + 3] = _mm256_unpackhi_epi64(t[4 * i + 1],
+		    t[4 * i + 3]);
+	}
+
+	/* Swap 128-bit halves. */
+	for (i = 0; i < 4; i++) {
+		W[i] = _mm256_permute2x128_si256(r[i], r[i + 4], 0x20);
+		W[i + 4] = _mm256_permute2x128_si256(r[i], r[i + 4], 0x31);
+	}
+}
+
+/**
+ * SHA256_Transform_mb_avx2(states, blocks, nblocks):
+ * For each i in [0, 8), compute the SHA256 block compression function over
+ * the ${nblocks} consecutive 64-byte blocks starting at ${blocks}[i],
+ * transforming ${states}[i].  This implementation uses x86 AVX2 instructions,
+ * and should only be used if CPUSUPPORT_X86_AVX2 is defined and
+ * cpusupport_x86_avx2() returns nonzero.
+ */
+void
+SHA256_Transform_mb_avx2(uint32_t * const states[8],
+    const uint8_t * const blocks[8], size_t nblocks)
+{
+	const uint8_t * p[8];
+	uint32_t lanes[8][8];
+	__m256i state[8];
+	__m256i S[8];
+	__m256i W[64];
+	size_t i, j, n;
+
+	/* Transpose the states so that each vector holds one state word. */
+	for (j = 0; j < 8; j++) {
+		state[j] = _mm256_set_epi32((int)states[7][j],
+		    (int)states[6][j], (int)states[5][j], (int)states[4][j],
+		    (int)states[3][j], (int)states[2][j], (int)states[1][j],
+		    (int)states[0][j]);
+	}
+
+	/* Start at the beginning of each buffer. */
+	for (j = 0; j < 8; j++)
+		p[j] = blocks[j];
+
+	for (n = 0; n < nblocks; n++) {
+		/* 1. Prepare the message schedule W. */
+		load_transpose(&W[0], p, 0);
+		load_transpose(&W[8], p, 32);
+		for (i = 16; i < 64; i++)
+			W[i] = ADD(ADD(s1(W[i - 2]), W[i - 7]),
+			    ADD(s0(W[i - 15]), W[i - 16]));
+
+		/* 2. Initialize working variables. */
+		for (j = 0; j < 8; j++)
+			S[j] = state[j];
+
+		/* 3. Mix. */
+		for (i = 0; i < 64; i += 8) {
+			RNDr(S, W, 0, i);
+			RNDr(S, W, 1, i);
+			RNDr(S, W, 2, i);
+			RNDr(S, W, 3, i);
+			RNDr(S, W, 4, i);
+			RNDr(S, W, 5, i);
+			RNDr(S, W, 6, i);
+			RNDr(S, W, 7, i);
+		}
+
+		/* 4. Mix local working variables into global state. */
+		for (j = 0; j < 8; j++)
+			state[j] = ADD(state[j], S[j]);
+
+		/* Move on to the next block. */
+		for (j = 0; j < 8; j++)
+			p[j] += 64;
+	}
+
+	/* Transpose the states back. */
+	for (j = 0; j < 8; j++)
+		_mm256_storeu_si256((__m256i *)(void *)lanes[j], state[j]);
+	for (i = 0; i < 8; i++) {
+		for (j = 0; j < 8; j++)
+			states[i][j] = lanes[j][i];
+	}
+
+	/* Clean the stack. */
+	insecure_memzero(lanes, sizeof(lanes));
+	insecure_memzero(W, sizeof(W));
+	insecure_memzero(S, sizeof(S));
+}
+
+#endif /* CPUSUPPORT_X86_AVX2 */
@@ -0,0 +1,18 @@
+#ifndef SHA256_MB_AVX2_H_
+#define SHA256_MB_AVX2_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * SHA256_Transform_mb_avx2(states, blocks, nblocks):
+ * For each i in [0, 8), compute the SHA256 block compression function over
+ * the ${nblocks} consecutive 64-byte blocks starting at ${blocks}[i],
+ * transforming ${states}[i].  This implementation uses x86 AVX2 instructions,
+ * and should only be used if CPUSUPPORT_X86_AVX2 is defined and
+ * cpusupport_x86_avx2() returns nonzero.
+ */
+void SHA256_Transform_mb_avx2(uint32_t * const[8], const uint8_t * const[8],
+    size_t);
+
+#endif /* !SHA256_MB_AVX2_H_ */
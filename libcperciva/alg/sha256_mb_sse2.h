@@ -0,0 +1,18 @@
+#ifndef SHA256_MB_SSE2_H_
+#define SHA256_MB_SSE2_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * SHA256_Transform_mb_sse2(states, blocks, nblocks):
+ * For each i in [0, 4), compute the SHA256 block compression function over
+ * the ${nblocks} consecutive 64-byte blocks starting at ${blocks}[i],
+ * transforming ${states}[i].  This implementation uses x86 SSE2 instructions,
+ * and should only be used if CPUSUPPORT_X86_SSE2 is defined and
+ * cpusupport_x86_sse2() returns nonzero.
+ */
+void SHA256_Transform_mb_sse2(uint32_t * const[4], const uint8_t * const[4],
+    size_t);
+
+#endif /* !SHA256_MB_SSE2_H_ */
@@ -0,0 +1,28 @@
+#include <immintrin.h>
+
+static char a[32];
+
+/*
+ * Use a separate function for this, because that means that the alignment of
+ * the _mm256_loadu_si256() will move to function level, which may require
+ * -Wno-cast-align.
+ */
+static __m256i
+load_256(const char * src)
+{
+	__m256i x;
+
+	x = _mm256_loadu_si256((const __m256i *)src);
+	return (x);
+}
+
+int
+main(void)
+{
+	__m256i x;
+
+	x = load_256(a);
+	x = _mm256_add_epi32(x, _mm256_slli_epi32(x, 7));
+	_mm256_storeu_si256((__m256i *)a, x);
+	return (a[0]);
+}
@@ -81,6 +81,8 @@ feature X86 AESNI "" "-maes"						\
     "-maes -Wno-missing-prototypes -Wno-cast-qual -Wno-cast-align"	\
     "-maes -Wno-missing-prototypes -Wno-cast-qual -Wno-cast-align	\
     -DBROKEN_MM_LOADU_SI64"
+feature X86 AVX2 "" "-mavx2"						\
+    "-mavx2 -Wno-cast-align"
 feature X86 RDRAND "" "-mrdrnd"
 feature X86 SHANI "" "-msse2 -msha"					\
     "-msse2 -msha -Wno-cast-align"
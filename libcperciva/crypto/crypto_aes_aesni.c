@@ -218,6 +218,60 @@ crypto_aes_encrypt_block_aesni_m128i(__m128i in, const void * key)
 	return (aes_state);
 }
 
+/**
+ * crypto_aes_encrypt_block_aesni_m128i_x8(bufs, key):
+ * Using the expanded AES key ${key}, encrypt the eight blocks ${bufs} in
+ * place.  The rounds for the eight blocks are interleaved, so that the
+ * latency of each AESENC instruction is hidden behind the others.  This
+ * implementation uses x86 AESNI instructions, and should only be used if
+ * CPUSUPPORT_X86_AESNI is defined and cpusupport_x86_aesni() returns nonzero.
+ */
+void
+crypto_aes_encrypt_block_aesni_m128i_x8(__m128i bufs[8], const void * key)
+{
+	const struct crypto_aes_key_aesni * _key = key;
+	const __m128i * aes_key = _key->rkeys;
+	__m128i s0, s1, s2, s3, s4, s5, s6, s7;
+	__m128i rkey;
+	size_t nr = _key->nr;
+	size_t i;
+
+	/* Initial round key addition. */
+	rkey = aes_key[0];
+	s0 = _mm_xor_si128(bufs[0], rkey);
+	s1 = _mm_xor_si128(bufs[1], rkey);
+	s2 = _mm_xor_si128(bufs[2], rkey);
+	s3 = _mm_xor_si128(bufs[3], rkey);
+	s4 = _mm_xor_si128(bufs[4], rkey);
+	s5 = _mm_xor_si128(bufs[5], rkey);
+	s6 = _mm_xor_si128(bufs[6], rkey);
+	s7 = _mm_xor_si128(bufs[7], rkey);
+
+	/* Middle rounds. */
+	for (i = 1; i < nr; i++) {
+		rkey = aes_key[i];
+		s0 = _mm_aesenc_si128(s0, rkey);
+		s1 = _mm_aesenc_si128(s1, rkey);
+		s2 = _mm_aesenc_si128(s2, rkey);
+		s3 = _mm_aesenc_si128(s3, rkey);
+		s4 = _mm_aesenc_si128(s4, rkey);
+		s5 = _mm_aesenc_si128(s5, rkey);
+		s6 = _mm_aesenc_si128(s6, rkey);
+		s7 = _mm_aesenc_si128(s7, rkey);
+	}
+
+	/* Last round. */
+	rkey = aes_key[nr];
+	bufs[0] = _mm_aesenclast_si128(s0, rkey);
+	bufs[1] = _mm_aesenclast_si128(s1, rkey);
+	bufs[2] = _mm_aesenclast_si128(s2, rkey);
+	bufs[3] = _mm_aesenclast_si128(s3, rkey);
+	bufs[4] = _mm_aesenclast_si128(s4, rkey);
+	bufs[5] = _mm_aesenclast_si128(s5, rkey);
+	bufs[6] = _mm_aesenclast_si128(s6, rkey);
+	bufs[7] = _mm_aesenclast_si128(s7, rkey);
+}
+
 /**
  * crypto_aes_encrypt_block_aesni(in, out, key):
  * Using the expanded AES key ${key}, encrypt the block ${in} and write the
@@ -12,4 +12,14 @@
  */
 __m128i crypto_aes_encrypt_block_aesni_m128i(__m128i, const void *);
 
+/**
+ * crypto_aes_encrypt_block_aesni_m128i_x8(bufs, key):
+ * Using the expanded AES key ${key}, encrypt the eight blocks ${bufs} in
+ * place.  The rounds for the eight blocks are interleaved, so that the
+ * latency of each AESENC instruction is hidden behind the others.  This
+ * implementation uses x86 AESNI instructions, and should only be used if
+ * CPUSUPPORT_X86_AESNI is defined and cpusupport_x86_aesni() returns nonzero.
+ */
+void crypto_aes_encrypt_block_aesni_m128i_x8(__m128i[8], const void *);
+
 #endif /* !CRYPTO_AES_AESNI_M128I_H_ */
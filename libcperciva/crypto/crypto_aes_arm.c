@@ -271,6 +271,59 @@ crypto_aes_encrypt_block_arm_u8(uint8x16_t in, const void * key)
 	return (aes_state);
 }
 
+/**
+ * crypto_aes_encrypt_block_arm_u8_x8(bufs, key):
+ * Using the expanded AES key ${key}, encrypt the eight blocks ${bufs} in
+ * place.  The rounds for the eight blocks are interleaved, so that the
+ * latency of each AESE/AESMC pair is hidden behind the others.  This
+ * implementation uses ARM AES instructions, and should only be used if
+ * CPUSUPPORT_ARM_AES is defined and cpusupport_arm_aes() returns nonzero.
+ */
+void
+crypto_aes_encrypt_block_arm_u8_x8(uint8x16_t bufs[8], const void * key)
+{
+	const struct crypto_aes_key_arm * _key = key;
+	const uint8x16_t * aes_key = _key->rkeys;
+	uint8x16_t s0, s1, s2, s3, s4, s5, s6, s7;
+	uint8x16_t rkey;
+	size_t nr = _key->nr;
+	size_t i;
+
+	/* Load the blocks. */
+	s0 = bufs[0];
+	s1 = bufs[1];
+	s2 = bufs[2];
+	s3 = bufs[3];
+	s4 = bufs[4];
+	s5 = bufs[5];
+	s6 = bufs[6];
+	s7 = bufs[7];
+
+	/* All rounds except the last. */
+	for (i = 0; i < nr - 1; i++) {
+		rkey = aes_key[i];
+		s0 = vaesmcq_u8(vaeseq_u8(s0, rkey));
+		s1 = vaesmcq_u8(vaeseq_u8(s1, rkey));
+		s2 = vaesmcq_u8(vaeseq_u8(s2, rkey));
+		s3 = vaesmcq_u8(vaeseq_u8(s3, rkey));
+		s4 = vaesmcq_u8(vaeseq_u8(s4, rkey));
+		s5 = vaesmcq_u8(vaeseq_u8(s5, rkey));
+		s6 = vaesmcq_u8(vaeseq_u8(s6, rkey));
+		s7 = vaesmcq_u8(vaeseq_u8(s7, rkey));
+	}
+
+	/* Last round. */
+	rkey = aes_key[nr - 1];
+	bufs[0] = veorq_u8(vaeseq_u8(s0, rkey), aes_key[nr]);
+	bufs[1] = veorq_u8(vaeseq_u8(s1, rkey), aes_key[nr]);
+	bufs[2] = veorq_u8(vaeseq_u8(s2, rkey), aes_key[nr]);
+	bufs[3] = veorq_u8(vaeseq_u8(s3, rkey), aes_key[nr]);
+	bufs[4] = veorq_u8(vaeseq_u8(s4, rkey), aes_key[nr]);
+	bufs[5] = veorq_u8(vaeseq_u8(s5, rkey), aes_key[nr]);
+	bufs[6] = veorq_u8(vaeseq_u8(s6, rkey), aes_key[nr]);
+	bufs[7] = veorq_u8(vaeseq_u8(s7, rkey), aes_key[nr]);
+}
+
 /**
  * crypto_aes_encrypt_block_arm(in, out, key):
  * Using the expanded AES key ${key}, encrypt the block ${in} and write the
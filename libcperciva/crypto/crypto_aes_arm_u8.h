@@ -14,4 +14,14 @@
  */
 uint8x16_t crypto_aes_encrypt_block_arm_u8(uint8x16_t, const void *);
 
+/**
+ * crypto_aes_encrypt_block_arm_u8_x8(bufs, key):
+ * Using the expanded AES key ${key}, encrypt the eight blocks ${bufs} in
+ * place.  The rounds for the eight blocks are interleaved, so that the
+ * latency of each AESE/AESMC pair is hidden behind the others.  This
+ * implementation uses ARM AES instructions, and should only be used if
+ * CPUSUPPORT_ARM_AES is defined and cpusupport_arm_aes() returns nonzero.
+ */
+void crypto_aes_encrypt_block_arm_u8_x8(uint8x16_t[8], const void *);
+
 #endif /* !CRYPTO_AES_ARM_U8_H_ */
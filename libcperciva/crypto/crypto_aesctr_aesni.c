@@ -51,18 +51,29 @@ load_si64(const void * mem)
 #endif
 }
 
-/* Process multiple whole blocks by generating & using a cipherblock. */
+/* Prepare the counter block for ${block_counter} with the nonce ${nonce_be}. */
+static inline __m128i
+counter_block(__m128i nonce_be, uint64_t block_counter)
+{
+	uint8_t block_counter_be_arr[8];
+
+	/* Encode the counter and combine it with the nonce. */
+	be64enc(block_counter_be_arr, block_counter);
+	return (_mm_unpacklo_epi64(nonce_be, load_si64(block_counter_be_arr)));
+}
+
+/* Process multiple whole blocks by generating & using cipherblocks. */
 static void
 crypto_aesctr_aesni_stream_wholeblocks(struct crypto_aesctr * stream,
     const uint8_t ** inbuf, uint8_t ** outbuf, size_t * buflen)
 {
-	__m128i bufsse;
+	__m128i bufsse[8];
 	__m128i inbufsse;
 	__m128i nonce_be;
-	uint8_t block_counter_be_arr[8];
 	uint64_t block_counter;
 	size_t num_blocks;
 	size_t i;
+	size_t j;
 
 	/* Load local variables from stream. */
 	nonce_be = load_si64(stream->pblk);
@@ -72,39 +83,55 @@ crypto_aesctr_aesni_stream_wholeblocks(struct crypto_aesctr * stream,
 	num_blocks = (*buflen) / 16;
 
 	/*
-	 * This is 'for (i = num_blocks; i > 0; i--)', but ensuring that the
-	 * compiler knows that we will execute the loop at least once.
+	 * Process eight blocks at once, so that the AES rounds of independent
+	 * counter blocks can be executed in parallel.
 	 */
-	i = num_blocks;
-	do {
-		/* Prepare counter. */
-		be64enc(block_counter_be_arr, block_counter);
+	for (i = num_blocks; i >= 8; i -= 8) {
+		/* Prepare counters. */
+		for (j = 0; j < 8; j++)
+			bufsse[j] = counter_block(nonce_be, block_counter + j);
+
+		/* Encrypt the cipherblocks. */
+		crypto_aes_encrypt_block_aesni_m128i_x8(bufsse, stream->key);
+
+		/* Encrypt the bytes. */
+		for (j = 0; j < 8; j++) {
+			inbufsse = _mm_loadu_si128(
+			    (const __m128i *)(*inbuf + 16 * j));
+			bufsse[j] = _mm_xor_si128(inbufsse, bufsse[j]);
+			_mm_storeu_si128((__m128i *)(*outbuf + 16 * j),
+			    bufsse[j]);
+		}
 
+		/* Update the positions. */
+		block_counter += 8;
+		*inbuf += 128;
+		*outbuf += 128;
+	}
+
+	/* Process any remaining blocks one at a time. */
+	for (; i > 0; i--) {
 		/* Encrypt the cipherblock. */
-		bufsse = load_si64(block_counter_be_arr);
-		bufsse = _mm_unpacklo_epi64(nonce_be, bufsse);
-		bufsse = crypto_aes_encrypt_block_aesni_m128i(bufsse,
+		bufsse[0] = counter_block(nonce_be, block_counter);
+		bufsse[0] = crypto_aes_encrypt_block_aesni_m128i(bufsse[0],
 		    stream->key);
 
 		/* Encrypt the byte(s). */
 		inbufsse = _mm_loadu_si128((const __m128i *)(*inbuf));
-		bufsse = _mm_xor_si128(inbufsse, bufsse);
-		_mm_storeu_si128((__m128i *)(*outbuf), bufsse);
+		bufsse[0] = _mm_xor_si128(inbufsse, bufsse[0]);
+		_mm_storeu_si128((__m128i *)(*outbuf), bufsse[0]);
 
 		/* Update the positions. */
 		block_counter++;
 		*inbuf += 16;
 		*outbuf += 16;
-
-		/* Update the counter. */
-		i--;
-	} while (i > 0);
+	}
 
 	/* Update the overall buffer length. */
 	*buflen -= 16 * num_blocks;
 
-	/* Update variables in stream. */
-	memcpy(stream->pblk + 8, block_counter_be_arr, 8);
+	/* Update variables in stream; pblk holds the last counter used. */
+	be64enc(stream->pblk + 8, block_counter - 1);
 	stream->bytectr += 16 * num_blocks;
 }
 
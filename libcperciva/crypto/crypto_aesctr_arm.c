@@ -32,19 +32,29 @@
  */
 #include "crypto_aesctr_shared.c"
 
-/* Process multiple whole blocks by generating & using a cipherblock. */
+/* Prepare the counter block for ${block_counter} with the nonce ${nonce_be}. */
+static inline uint8x16_t
+counter_block(uint8x8_t nonce_be, uint64_t block_counter)
+{
+	uint8_t block_counter_be_arr[8];
+
+	/* Encode the counter and combine it with the nonce. */
+	be64enc(block_counter_be_arr, block_counter);
+	return (vcombine_u8(nonce_be, vld1_u8(block_counter_be_arr)));
+}
+
+/* Process multiple whole blocks by generating & using cipherblocks. */
 static void
 crypto_aesctr_arm_stream_wholeblocks(struct crypto_aesctr * stream,
     const uint8_t ** inbuf, uint8_t ** outbuf, size_t * buflen)
 {
-	uint8x16_t bufarm;
+	uint8x16_t bufarm[8];
 	uint8x16_t inbufarm;
 	uint8x8_t nonce_be;
-	uint8x8_t block_counter_be;
-	uint8_t block_counter_be_arr[8];
 	uint64_t block_counter;
 	size_t num_blocks;
 	size_t i;
+	size_t j;
 
 	/* Load local variables from stream. */
 	nonce_be = vld1_u8(stream->pblk);
@@ -54,38 +64,53 @@ crypto_aesctr_arm_stream_wholeblocks(struct crypto_aesctr * stream,
 	num_blocks = (*buflen) / 16;
 
 	/*
-	 * This is 'for (i = num_blocks; i > 0; i--)', but ensuring that the
-	 * compiler knows that we will execute the loop at least once.
+	 * Process eight blocks at once, so that the AES rounds of independent
+	 * counter blocks can be executed in parallel.
 	 */
-	i = num_blocks;
-	do {
-		/* Prepare counter. */
-		be64enc(block_counter_be_arr, block_counter);
+	for (i = num_blocks; i >= 8; i -= 8) {
+		/* Prepare counters. */
+		for (j = 0; j < 8; j++)
+			bufarm[j] = counter_block(nonce_be, block_counter + j);
 
+		/* Encrypt the cipherblocks. */
+		crypto_aes_encrypt_block_arm_u8_x8(bufarm, stream->key);
+
+		/* Encrypt the bytes. */
+		for (j = 0; j < 8; j++) {
+			inbufarm = vld1q_u8(*inbuf + 16 * j);
+			bufarm[j] = veorq_u8(inbufarm, bufarm[j]);
+			vst1q_u8(*outbuf + 16 * j, bufarm[j]);
+		}
+
+		/* Update the positions. */
+		block_counter += 8;
+		*inbuf += 128;
+		*outbuf += 128;
+	}
+
+	/* Process any remaining blocks one at a time. */
+	for (; i > 0; i--) {
 		/* Encrypt the cipherblock. */
-		block_counter_be = vld1_u8(block_counter_be_arr);
-		bufarm = vcombine_u8(nonce_be, block_counter_be);
-		bufarm = crypto_aes_encrypt_block_arm_u8(bufarm, stream->key);
+		bufarm[0] = counter_block(nonce_be, block_counter);
+		bufarm[0] = crypto_aes_encrypt_block_arm_u8(bufarm[0],
+		    stream->key);
 
 		/* Encrypt the byte(s). */
 		inbufarm = vld1q_u8(*inbuf);
-		bufarm = veorq_u8(inbufarm, bufarm);
-		vst1q_u8(*outbuf, bufarm);
+		bufarm[0] = veorq_u8(inbufarm, bufarm[0]);
+		vst1q_u8(*outbuf, bufarm[0]);
 
 		/* Update the positions. */
 		block_counter++;
 		*inbuf += 16;
 		*outbuf += 16;
-
-		/* Update the counter. */
-		i--;
-	} while (i > 0);
+	}
 
 	/* Update the overall buffer length. */
 	*buflen -= 16 * num_blocks;
 
-	/* Update variables in stream. */
-	memcpy(stream->pblk + 8, block_counter_be_arr, 8);
+	/* Update variables in stream; pblk holds the last counter used. */
+	be64enc(stream->pblk + 8, block_counter - 1);
 	stream->bytectr += 16 * num_blocks;
 }
 
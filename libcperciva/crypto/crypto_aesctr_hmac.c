@@ -0,0 +1,275 @@
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "cpusupport.h"
+#include "crypto_aes.h"
+#include "crypto_aesctr.h"
+#include "crypto_aesctr_hmac_aesni_shani.h"
+#include "crypto_aesctr_hmac_arm.h"
+#include "sha256.h"
+#include "warnp.h"
+
+#include "crypto_aesctr_hmac.h"
+
+/**
+ * The "stitched" implementations below generate AES-CTR keystream and run
+ * the SHA256 compression function in the same loop, so that each block of
+ * ciphertext is hashed while it is still in L1 cache and the AES and SHA256
+ * units of the CPU work in parallel.  They only handle whole SHA256 blocks
+ * and require the inner SHA256 context to be at a block boundary; everything
+ * else goes through the generic crypto_aesctr and HMAC-SHA256 code.
+ */
+
+#if (defined(CPUSUPPORT_X86_AESNI) && defined(CPUSUPPORT_X86_SHANI) &&	\
+    defined(CPUSUPPORT_X86_SSSE3)) ||					\
+    (defined(CPUSUPPORT_ARM_AES) && defined(CPUSUPPORT_ARM_SHA256))
+#define HWACCEL
+
+static enum {
+	HW_SOFTWARE = 0,
+#if defined(CPUSUPPORT_X86_AESNI) && defined(CPUSUPPORT_X86_SHANI) &&	\
+    defined(CPUSUPPORT_X86_SSSE3)
+	HW_X86_AESNI_SHANI,
+#endif
+#if defined(CPUSUPPORT_ARM_AES) && defined(CPUSUPPORT_ARM_SHA256)
+	HW_ARM_AES_SHA256,
+#endif
+	HW_UNSET
+} hwaccel = HW_UNSET;
+
+/* Length of the self-test buffer; not a multiple of either block size. */
+#define TESTLEN 300
+
+/* Length of separate input when testing encryption; ditto. */
+#define TESTINLEN 200
+
+static void crypto_aesctr_hmac(const struct crypto_aes_key *, uint64_t,
+    const uint8_t *, size_t, uint8_t *, size_t, HMAC_SHA256_CTX *, int);
+
+/*
+ * Test whether the two-pass and stitched code produce the same results when
+ * encrypting (with part of the input in a separate buffer) and decrypting.
+ * Must be called with (hwaccel == HW_SOFTWARE); this sets hwaccel to ${hw}
+ * temporarily.
+ */
+static int
+hwtest(int hw)
+{
+	struct crypto_aes_key * key;
+	HMAC_SHA256_CTX ctx_sw, ctx_hw;
+	uint8_t kbuf[32];
+	uint8_t inbuf[TESTINLEN];
+	uint8_t buf_sw[TESTLEN];
+	uint8_t buf_hw[TESTLEN];
+	uint8_t hbuf_sw[32];
+	uint8_t hbuf_hw[32];
+	size_t i;
+	int decr;
+	int rc = 1;
+
+	/* Test case: Key 0x00 0x01 ... 0x1f, data 0xff 0xfe 0xfd .... */
+	for (i = 0; i < 32; i++)
+		kbuf[i] = (uint8_t)i;
+	if ((key = crypto_aes_key_expand(kbuf, 32)) == NULL)
+		goto err0;
+
+	/* Check encryption and then decryption. */
+	for (decr = 0; decr < 2; decr++) {
+		for (i = 0; i < TESTLEN; i++)
+			buf_sw[i] = buf_hw[i] = (uint8_t)(255 - i);
+		for (i = 0; i < TESTINLEN; i++)
+			inbuf[i] = (uint8_t)i;
+		HMAC_SHA256_Init(&ctx_sw, kbuf, 32);
+		HMAC_SHA256_Init(&ctx_hw, kbuf, 32);
+
+		/* Two-pass. */
+		hwaccel = HW_SOFTWARE;
+		if (decr)
+			crypto_aesctr_hmac(key, 0x0123456789abcdef, buf_sw,
+			    TESTLEN, buf_sw, TESTLEN, &ctx_sw, decr);
+		else
+			crypto_aesctr_hmac(key, 0x0123456789abcdef, inbuf,
+			    TESTINLEN, buf_sw, TESTLEN, &ctx_sw, decr);
+		HMAC_SHA256_Final(hbuf_sw, &ctx_sw);
+
+		/* Stitched. */
+		hwaccel = hw;
+		if (decr)
+			crypto_aesctr_hmac(key, 0x0123456789abcdef, buf_hw,
+			    TESTLEN, buf_hw, TESTLEN, &ctx_hw, decr);
+		else
+			crypto_aesctr_hmac(key, 0x0123456789abcdef, inbuf,
+			    TESTINLEN, buf_hw, TESTLEN, &ctx_hw, decr);
+		HMAC_SHA256_Final(hbuf_hw, &ctx_hw);
+		hwaccel = HW_SOFTWARE;
+
+		/* Do the results match? */
+		if (memcmp(buf_sw, buf_hw, TESTLEN) ||
+		    memcmp(hbuf_sw, hbuf_hw, 32))
+			goto err1;
+	}
+
+	/* Success! */
+	rc = 0;
+
+err1:
+	crypto_aes_key_free(key);
+err0:
+	/* Return the result of the test. */
+	return (rc);
+}
+
+/* Which type of hardware acceleration should we use, if any? */
+static void
+hwaccel_init(void)
+{
+
+	/* If we've already set hwaccel, we're finished. */
+	if (hwaccel != HW_UNSET)
+		return;
+
+	/* Default to software. */
+	hwaccel = HW_SOFTWARE;
+
+#if defined(CPUSUPPORT_X86_AESNI) && defined(CPUSUPPORT_X86_SHANI) &&	\
+    defined(CPUSUPPORT_X86_SSSE3)
+	CPUSUPPORT_VALIDATE(hwaccel, HW_X86_AESNI_SHANI,
+	    (crypto_aes_can_use_intrinsics() == 1) &&
+	    cpusupport_x86_shani() && cpusupport_x86_ssse3(),
+	    hwtest(HW_X86_AESNI_SHANI));
+#endif
+#if defined(CPUSUPPORT_ARM_AES) && defined(CPUSUPPORT_ARM_SHA256)
+	CPUSUPPORT_VALIDATE(hwaccel, HW_ARM_AES_SHA256,
+	    (crypto_aes_can_use_intrinsics() == 2) && cpusupport_arm_sha256(),
+	    hwtest(HW_ARM_AES_SHA256));
+#endif
+}
+#endif /* HWACCEL */
+
+/*
+ * Encrypt or decrypt into ${buf}, reading the first ${inlen} bytes of input
+ * from ${inbuf}, and authenticate the ciphertext.  Decryption must be done in
+ * place.
+ */
+static void
+crypto_aesctr_hmac(const struct crypto_aes_key * key, uint64_t nonce,
+    const uint8_t * inbuf, size_t inlen, uint8_t * buf, size_t buflen,
+    HMAC_SHA256_CTX * ctx, int decr)
+{
+#ifdef HWACCEL
+	uint8_t tail[64];
+	size_t hashlen;
+#endif
+
+	/* Sanity-check: We only decrypt in place. */
+	assert((decr == 0) || ((inbuf == buf) && (inlen == buflen)));
+
+#ifdef HWACCEL
+	/* Pick an implementation if we haven't done so already. */
+	hwaccel_init();
+
+	/* Can we use the stitched code? */
+	if ((hwaccel == HW_SOFTWARE) || (((ctx->ictx.count >> 3) & 0x3f) != 0))
+		goto twopass;
+
+	/* The stitched code only hashes whole blocks. */
+	hashlen = buflen - (buflen % 64);
+
+	/* If decrypting, save the (public) ciphertext which will be left over. */
+	if (decr)
+		memcpy(tail, &buf[hashlen], buflen - hashlen);
+
+	/* Encrypt or decrypt and hash whole blocks. */
+	switch (hwaccel) {
+#if defined(CPUSUPPORT_X86_AESNI) && defined(CPUSUPPORT_X86_SHANI) &&	\
+    defined(CPUSUPPORT_X86_SSSE3)
+	case HW_X86_AESNI_SHANI:
+		crypto_aesctr_hmac_aesni_shani(key, nonce, inbuf, inlen,
+		    buf, buflen, ctx->ictx.state, decr);
+		break;
+#endif
+#if defined(CPUSUPPORT_ARM_AES) && defined(CPUSUPPORT_ARM_SHA256)
+	case HW_ARM_AES_SHA256:
+		crypto_aesctr_hmac_arm(key, nonce, inbuf, inlen, buf,
+		    buflen, ctx->ictx.state, decr);
+		break;
+#endif
+	default:
+		warn0("Programmer error: unexpected hwaccel value");
+		break;
+	}
+
+	/* Account for the data which has been hashed. */
+	ctx->ictx.count += (uint64_t)hashlen << 3;
+
+	/* Hash any leftover ciphertext. */
+	HMAC_SHA256_Update(ctx, decr ? tail : &buf[hashlen], buflen - hashlen);
+
+	/* We're done. */
+	return;
+
+twopass:
+#endif /* HWACCEL */
+
+	/* Bring the input together. */
+	if (inbuf != buf)
+		memcpy(buf, inbuf, inlen);
+
+	/* Authenticate the ciphertext before or after decrypting/encrypting. */
+	if (decr)
+		HMAC_SHA256_Update(ctx, buf, buflen);
+	crypto_aesctr_buf(key, nonce, buf, buf, buflen);
+	if (!decr)
+		HMAC_SHA256_Update(ctx, buf, buflen);
+}
+
+/**
+ * crypto_aesctr_hmac_enc(key, nonce, buf, buflen, ctx):
+ * Equivalent to crypto_aesctr_buf(key, nonce, buf, buf, buflen) followed by
+ * HMAC_SHA256_Update(ctx, buf, buflen), but if possible, perform both in a
+ * single pass over the data.
+ */
+void
+crypto_aesctr_hmac_enc(const struct crypto_aes_key * key, uint64_t nonce,
+    uint8_t * buf, size_t buflen, HMAC_SHA256_CTX * ctx)
+{
+
+	/* Encrypt and authenticate. */
+	crypto_aesctr_hmac(key, nonce, buf, buflen, buf, buflen, ctx, 0);
+}
+
+/**
+ * crypto_aesctr_hmac_enc_copy(key, nonce, inbuf, inlen, buf, buflen, ctx):
+ * Behave as crypto_aesctr_hmac_enc(key, nonce, buf, buflen, ctx) after
+ * copying ${inlen} <= ${buflen} bytes from ${inbuf} to the start of ${buf},
+ * but if possible, read that part of the plaintext directly from ${inbuf}
+ * instead of copying it.  The buffers must not overlap.
+ */
+void
+crypto_aesctr_hmac_enc_copy(const struct crypto_aes_key * key, uint64_t nonce,
+    const uint8_t * inbuf, size_t inlen, uint8_t * buf, size_t buflen,
+    HMAC_SHA256_CTX * ctx)
+{
+
+	/* Sanity-check. */
+	assert(inlen <= buflen);
+
+	/* Encrypt and authenticate. */
+	crypto_aesctr_hmac(key, nonce, inbuf, inlen, buf, buflen, ctx, 0);
+}
+
+/**
+ * crypto_aesctr_hmac_dec(key, nonce, buf, buflen, ctx):
+ * Equivalent to HMAC_SHA256_Update(ctx, buf, buflen) followed by
+ * crypto_aesctr_buf(key, nonce, buf, buf, buflen), but if possible, perform
+ * both in a single pass over the data.
+ */
+void
+crypto_aesctr_hmac_dec(const struct crypto_aes_key * key, uint64_t nonce,
+    uint8_t * buf, size_t buflen, HMAC_SHA256_CTX * ctx)
+{
+
+	/* Authenticate and decrypt. */
+	crypto_aesctr_hmac(key, nonce, buf, buflen, buf, buflen, ctx, 1);
+}
@@ -0,0 +1,40 @@
+#ifndef CRYPTO_AESCTR_HMAC_H_
+#define CRYPTO_AESCTR_HMAC_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sha256.h"
+
+/* Opaque type. */
+struct crypto_aes_key;
+
+/**
+ * crypto_aesctr_hmac_enc(key, nonce, buf, buflen, ctx):
+ * Equivalent to crypto_aesctr_buf(key, nonce, buf, buf, buflen) followed by
+ * HMAC_SHA256_Update(ctx, buf, buflen), but if possible, perform both in a
+ * single pass over the data.
+ */
+void crypto_aesctr_hmac_enc(const struct crypto_aes_key *, uint64_t,
+    uint8_t *, size_t, HMAC_SHA256_CTX *);
+
+/**
+ * crypto_aesctr_hmac_enc_copy(key, nonce, inbuf, inlen, buf, buflen, ctx):
+ * Behave as crypto_aesctr_hmac_enc(key, nonce, buf, buflen, ctx) after
+ * copying ${inlen} <= ${buflen} bytes from ${inbuf} to the start of ${buf},
+ * but if possible, read that part of the plaintext directly from ${inbuf}
+ * instead of copying it.  The buffers must not overlap.
+ */
+void crypto_aesctr_hmac_enc_copy(const struct crypto_aes_key *, uint64_t,
+    const uint8_t *, size_t, uint8_t *, size_t, HMAC_SHA256_CTX *);
+
+/**
+ * crypto_aesctr_hmac_dec(key, nonce, buf, buflen, ctx):
+ * Equivalent to HMAC_SHA256_Update(ctx, buf, buflen) followed by
+ * crypto_aesctr_buf(key, nonce, buf, buf, buflen), but if possible, perform
+ * both in a single pass over the data.
+ */
+void crypto_aesctr_hmac_dec(const struct crypto_aes_key *, uint64_t,
+    uint8_t *, size_t, HMAC_SHA256_CTX *);
+
+#endif /* !CRYPTO_AESCTR_HMAC_H_ */
@@ -0,0 +1,184 @@
+#include "cpusupport.h"
+#if defined(CPUSUPPORT_X86_AESNI) && defined(CPUSUPPORT_X86_SHANI) &&	\
+    defined(CPUSUPPORT_X86_SSSE3)
+/**
+ * CPUSUPPORT CFLAGS: X86_AESNI X86_SHANI X86_SSSE3
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include <emmintrin.h>
+
+#include "crypto_aes_aesni_m128i.h"
+#include "insecure_memzero.h"
+#include "sha256_shani.h"
+#include "sysendian.h"
+
+#include "crypto_aesctr_hmac_aesni_shani.h"
+
+/**
+ * AES-CTR and the SHA256 compression function use different execution units,
+ * so we interleave them: the keystream for the next 128 bytes is generated
+ * while the previous 128 bytes of ciphertext are being hashed, and each chunk
+ * of data is hashed while it is still in L1 cache.
+ */
+
+/**
+ * load_si64(mem):
+ * Load an unaligned 64-bit integer from memory into the lowest 64 bits of the
+ * returned value.  The contents of the upper 64 bits is not defined.
+ */
+static inline __m128i
+load_si64(const void * mem)
+{
+
+#ifdef BROKEN_MM_LOADU_SI64
+	return (_mm_castpd_si128(_mm_load_sd(mem)));
+#else
+	return (_mm_loadu_si64(mem));
+#endif
+}
+
+/* Prepare the counter block for ${block_counter} with the nonce ${nonce_be}. */
+static inline __m128i
+counter_block(__m128i nonce_be, uint64_t block_counter)
+{
+	uint8_t block_counter_be_arr[8];
+
+	/* Encode the counter and combine it with the nonce. */
+	be64enc(block_counter_be_arr, block_counter);
+	return (_mm_unpacklo_epi64(nonce_be, load_si64(block_counter_be_arr)));
+}
+
+/* Generate eight blocks of keystream starting at ${block_counter}. */
+static inline void
+keystream_x8(__m128i ks[8], const void * key, __m128i nonce_be,
+    uint64_t block_counter)
+{
+	size_t j;
+
+	/* Prepare counters and encrypt them. */
+	for (j = 0; j < 8; j++)
+		ks[j] = counter_block(nonce_be, block_counter + j);
+	crypto_aes_encrypt_block_aesni_m128i_x8(ks, key);
+}
+
+/* Xor ${nblocks} blocks of keystream from ${ks} with ${in} into ${out}. */
+static inline void
+xor_blocks(const uint8_t * in, uint8_t * out, const __m128i * ks,
+    size_t nblocks)
+{
+	__m128i data;
+	size_t j;
+
+	for (j = 0; j < nblocks; j++) {
+		data = _mm_loadu_si128((const __m128i *)&in[16 * j]);
+		data = _mm_xor_si128(data, ks[j]);
+		_mm_storeu_si128((__m128i *)&out[16 * j], data);
+	}
+}
+
+/**
+ * crypto_aesctr_hmac_aesni_shani(key, nonce, inbuf, inlen, buf, buflen, state,
+ *     decr):
+ * Encrypt or decrypt (if ${decr} is zero or non-zero respectively) ${buflen}
+ * bytes into ${buf} using AES-CTR with the expanded AES key ${key} and
+ * the nonce ${nonce}, starting from the beginning of the stream.  The first
+ * ${inlen} bytes of input are read from ${inbuf} and the rest from ${buf}
+ * itself; ${inbuf} must either be equal to ${buf} or not overlap it.  Run the
+ * SHA256 block compression function on each complete 64-byte block of the
+ * ciphertext, transforming ${state}; the caller is responsible for hashing
+ * any final partial block.  This implementation uses x86 AESNI, SHANI, and
+ * SSSE3 instructions, and should only be used if CPUSUPPORT_X86_AESNI,
+ * _SHANI, and _SSSE3 are defined and cpusupport_x86_aesni(), _shani(), and
+ * _ssse3() return nonzero.
+ */
+void
+crypto_aesctr_hmac_aesni_shani(const void * key, uint64_t nonce,
+    const uint8_t * inbuf, size_t inlen, uint8_t * buf, size_t buflen,
+    uint32_t state[8], int decr)
+{
+	const uint8_t * src = inbuf;
+	__m128i ks[8];
+	__m128i nonce_be;
+	uint8_t nonce_be_arr[8];
+	uint8_t ksbuf[16];
+	uint64_t block_counter = 0;
+	size_t hashblock;
+	size_t i;
+
+	/* Encode the nonce. */
+	be64enc(nonce_be_arr, nonce);
+	nonce_be = load_si64(nonce_be_arr);
+
+	/* Process 128 bytes (eight AES blocks, two SHA256 blocks) at once. */
+	if (buflen >= 128)
+		keystream_x8(ks, key, nonce_be, block_counter);
+	while (buflen >= 128) {
+		/* If the separate input ends in this chunk, move it into place. */
+		if ((src != buf) && (inlen < 128)) {
+			memcpy(buf, src, inlen);
+			src = buf;
+		}
+
+		/* When decrypting, we authenticate the ciphertext. */
+		if (decr) {
+			SHA256_Transform_shani(state, &src[0]);
+			SHA256_Transform_shani(state, &src[64]);
+		}
+
+		/* Encrypt or decrypt the data. */
+		xor_blocks(src, buf, ks, 8);
+		block_counter += 8;
+
+		/* Start on the keystream for the next 128 bytes. */
+		if (buflen >= 256)
+			keystream_x8(ks, key, nonce_be, block_counter);
+
+		/* When encrypting, we authenticate the ciphertext. */
+		if (!decr) {
+			SHA256_Transform_shani(state, &buf[0]);
+			SHA256_Transform_shani(state, &buf[64]);
+		}
+
+		/* Update the position. */
+		if (src != buf)
+			inlen -= 128;
+		src += 128;
+		buf += 128;
+		buflen -= 128;
+	}
+
+	/* Process the rest of the data in place. */
+	if (src != buf)
+		memcpy(buf, src, inlen);
+
+	/* Is there one more complete block to hash? */
+	hashblock = (buflen >= 64);
+	if (decr && hashblock)
+		SHA256_Transform_shani(state, buf);
+
+	/* Process any remaining whole AES blocks one at a time. */
+	for (i = 0; i + 16 <= buflen; i += 16) {
+		ks[0] = counter_block(nonce_be, block_counter++);
+		ks[0] = crypto_aes_encrypt_block_aesni_m128i(ks[0], key);
+		xor_blocks(&buf[i], &buf[i], ks, 1);
+	}
+
+	/* Process any final bytes. */
+	if (i < buflen) {
+		ks[0] = counter_block(nonce_be, block_counter);
+		ks[0] = crypto_aes_encrypt_block_aesni_m128i(ks[0], key);
+		_mm_storeu_si128((__m128i *)ksbuf, ks[0]);
+		for (; i < buflen; i++)
+			buf[i] ^= ksbuf[i % 16];
+		insecure_memzero(ksbuf, 16);
+	}
+
+	/* Hash the final complete block of ciphertext. */
+	if (!decr && hashblock)
+		SHA256_Transform_shani(state, buf);
+}
+
+#endif /* CPUSUPPORT_X86_AESNI && CPUSUPPORT_X86_SHANI && ... */
@@ -0,0 +1,168 @@
+#include "cpusupport.h"
+#if defined(CPUSUPPORT_ARM_AES) && defined(CPUSUPPORT_ARM_SHA256)
+/**
+ * CPUSUPPORT CFLAGS: ARM_AES ARM_SHA256
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __ARM_NEON
+#include <arm_neon.h>
+#endif
+
+#include "crypto_aes_arm_u8.h"
+#include "insecure_memzero.h"
+#include "sha256_arm.h"
+#include "sysendian.h"
+
+#include "crypto_aesctr_hmac_arm.h"
+
+/**
+ * AES-CTR and the SHA256 compression function use different execution units,
+ * so we interleave them: the keystream for the next 128 bytes is generated
+ * while the previous 128 bytes of ciphertext are being hashed, and each chunk
+ * of data is hashed while it is still in L1 cache.
+ */
+
+/* Prepare the counter block for ${block_counter} with the nonce ${nonce_be}. */
+static inline uint8x16_t
+counter_block(uint8x8_t nonce_be, uint64_t block_counter)
+{
+	uint8_t block_counter_be_arr[8];
+
+	/* Encode the counter and combine it with the nonce. */
+	be64enc(block_counter_be_arr, block_counter);
+	return (vcombine_u8(nonce_be, vld1_u8(block_counter_be_arr)));
+}
+
+/* Generate eight blocks of keystream starting at ${block_counter}. */
+static inline void
+keystream_x8(uint8x16_t ks[8], const void * key, uint8x8_t nonce_be,
+    uint64_t block_counter)
+{
+	size_t j;
+
+	/* Prepare counters and encrypt them. */
+	for (j = 0; j < 8; j++)
+		ks[j] = counter_block(nonce_be, block_counter + j);
+	crypto_aes_encrypt_block_arm_u8_x8(ks, key);
+}
+
+/* Xor ${nblocks} blocks of keystream from ${ks} with ${in} into ${out}. */
+static inline void
+xor_blocks(const uint8_t * in, uint8_t * out, const uint8x16_t * ks,
+    size_t nblocks)
+{
+	uint8x16_t data;
+	size_t j;
+
+	for (j = 0; j < nblocks; j++) {
+		data = vld1q_u8(&in[16 * j]);
+		data = veorq_u8(data, ks[j]);
+		vst1q_u8(&out[16 * j], data);
+	}
+}
+
+/**
+ * crypto_aesctr_hmac_arm(key, nonce, inbuf, inlen, buf, buflen, state,
+ *     decr):
+ * Encrypt or decrypt (if ${decr} is zero or non-zero respectively) ${buflen}
+ * bytes into ${buf} using AES-CTR with the expanded AES key ${key} and
+ * the nonce ${nonce}, starting from the beginning of the stream.  The first
+ * ${inlen} bytes of input are read from ${inbuf} and the rest from ${buf}
+ * itself; ${inbuf} must either be equal to ${buf} or not overlap it.  Run the
+ * SHA256 block compression function on each complete 64-byte block of the
+ * ciphertext, transforming ${state}; the caller is responsible for hashing
+ * any final partial block.  This implementation uses ARM AES and SHA256
+ * instructions, and should only be used if CPUSUPPORT_ARM_AES and _SHA256 are
+ * defined and cpusupport_arm_aes() and _sha256() return nonzero.
+ */
+void
+crypto_aesctr_hmac_arm(const void * key, uint64_t nonce,
+    const uint8_t * inbuf, size_t inlen, uint8_t * buf, size_t buflen,
+    uint32_t state[8], int decr)
+{
+	const uint8_t * src = inbuf;
+	uint8x16_t ks[8];
+	uint8x8_t nonce_be;
+	uint8_t nonce_be_arr[8];
+	uint8_t ksbuf[16];
+	uint64_t block_counter = 0;
+	size_t hashblock;
+	size_t i;
+
+	/* Encode the nonce. */
+	be64enc(nonce_be_arr, nonce);
+	nonce_be = vld1_u8(nonce_be_arr);
+
+	/* Process 128 bytes (eight AES blocks, two SHA256 blocks) at once. */
+	if (buflen >= 128)
+		keystream_x8(ks, key, nonce_be, block_counter);
+	while (buflen >= 128) {
+		/* If the separate input ends in this chunk, move it into place. */
+		if ((src != buf) && (inlen < 128)) {
+			memcpy(buf, src, inlen);
+			src = buf;
+		}
+
+		/* When decrypting, we authenticate the ciphertext. */
+		if (decr) {
+			SHA256_Transform_arm(state, &src[0]);
+			SHA256_Transform_arm(state, &src[64]);
+		}
+
+		/* Encrypt or decrypt the data. */
+		xor_blocks(src, buf, ks, 8);
+		block_counter += 8;
+
+		/* Start on the keystream for the next 128 bytes. */
+		if (buflen >= 256)
+			keystream_x8(ks, key, nonce_be, block_counter);
+
+		/* When encrypting, we authenticate the ciphertext. */
+		if (!decr) {
+			SHA256_Transform_arm(state, &buf[0]);
+			SHA256_Transform_arm(state, &buf[64]);
+		}
+
+		/* Update the position. */
+		if (src != buf)
+			inlen -= 128;
+		src += 128;
+		buf += 128;
+		buflen -= 128;
+	}
+
+	/* Process the rest of the data in place. */
+	if (src != buf)
+		memcpy(buf, src, inlen);
+
+	/* Is there one more complete block to hash? */
+	hashblock = (buflen >= 64);
+	if (decr && hashblock)
+		SHA256_Transform_arm(state, buf);
+
+	/* Process any remaining whole AES blocks one at a time. */
+	for (i = 0; i + 16 <= buflen; i += 16) {
+		ks[0] = counter_block(nonce_be, block_counter++);
+		ks[0] = crypto_aes_encrypt_block_arm_u8(ks[0], key);
+		xor_blocks(&buf[i], &buf[i], ks, 1);
+	}
+
+	/* Process any final bytes. */
+	if (i < buflen) {
+		ks[0] = counter_block(nonce_be, block_counter);
+		ks[0] = crypto_aes_encrypt_block_arm_u8(ks[0], key);
+		vst1q_u8(ksbuf, ks[0]);
+		for (; i < buflen; i++)
+			buf[i] ^= ksbuf[i % 16];
+		insecure_memzero(ksbuf, 16);
+	}
+
+	/* Hash the final complete block of ciphertext. */
+	if (!decr && hashblock)
+		SHA256_Transform_arm(state, buf);
+}
+
+#endif /* CPUSUPPORT_ARM_AES && CPUSUPPORT_ARM_SHA256 */
@@ -0,0 +1,24 @@
+#ifndef CRYPTO_AESCTR_HMAC_ARM_H_
+#define CRYPTO_AESCTR_HMAC_ARM_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * crypto_aesctr_hmac_arm(key, nonce, inbuf, inlen, buf, buflen, state,
+ *     decr):
+ * Encrypt or decrypt (if ${decr} is zero or non-zero respectively) ${buflen}
+ * bytes into ${buf} using AES-CTR with the expanded AES key ${key} and
+ * the nonce ${nonce}, starting from the beginning of the stream.  The first
+ * ${inlen} bytes of input are read from ${inbuf} and the rest from ${buf}
+ * itself; ${inbuf} must either be equal to ${buf} or not overlap it.  Run the
+ * SHA256 block compression function on each complete 64-byte block of the
+ * ciphertext, transforming ${state}; the caller is responsible for hashing
+ * any final partial block.  This implementation uses ARM AES and SHA256
+ * instructions, and should only be used if CPUSUPPORT_ARM_AES and _SHA256 are
+ * defined and cpusupport_arm_aes() and _sha256() return nonzero.
+ */
+void crypto_aesctr_hmac_arm(const void *, uint64_t, const uint8_t *,
+    size_t, uint8_t *, size_t, uint32_t[8], int);
+
+#endif /* !CRYPTO_AESCTR_HMAC_ARM_H_ */
@@ -44,3 +44,42 @@ const uint8_t crypto_dh_group14[256] = {
 	0x15, 0x72, 0x8e, 0x5a, 0x8a, 0xac, 0xaa, 0x68,
 	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff
 };
+
+/**
+ * This is the big-endian representation of 2^4096 mod p, which is used to
+ * convert values into the Montgomery representation with R = 2^2048.
+ */
+const uint8_t crypto_dh_group14_r2[256] = {
+	0x0c, 0xd3, 0x7a, 0x33, 0x62, 0x8b, 0x31, 0x97,
+	0x3e, 0xd8, 0x57, 0x03, 0x66, 0x61, 0x30, 0x00,
+	0x8a, 0x3a, 0x68, 0x6c, 0x92, 0x40, 0xc9, 0x74,
+	0x27, 0x23, 0x82, 0x97, 0x0a, 0x16, 0x98, 0xab,
+	0x63, 0xbd, 0xd9, 0x6d, 0x19, 0xea, 0x00, 0xbe,
+	0x2a, 0x49, 0x20, 0x90, 0xfa, 0x11, 0xe1, 0x05,
+	0xeb, 0x5b, 0x27, 0x6f, 0xbe, 0x06, 0xa1, 0xdf,
+	0xd8, 0x5d, 0x6e, 0x7e, 0xed, 0x68, 0x80, 0xdd,
+	0xf8, 0x3c, 0x92, 0xcb, 0x14, 0xe9, 0x92, 0xc5,
+	0x8c, 0x10, 0x6b, 0xbe, 0x38, 0x56, 0x9f, 0x92,
+	0xf2, 0x73, 0xb2, 0x93, 0x7e, 0x30, 0x08, 0x67,
+	0x5d, 0x99, 0x8f, 0xb3, 0x94, 0x91, 0x0c, 0x76,
+	0x94, 0x78, 0x95, 0x1b, 0x70, 0xc4, 0xb2, 0xce,
+	0xdb, 0xd4, 0x42, 0xb3, 0x86, 0x6d, 0x29, 0x86,
+	0xbc, 0x82, 0x1c, 0x9d, 0xe8, 0xd7, 0x2b, 0xd5,
+	0xa2, 0xf8, 0x82, 0x57, 0x32, 0x5b, 0x54, 0xd0,
+	0xac, 0x2b, 0x79, 0x25, 0x73, 0x9c, 0x79, 0x78,
+	0x55, 0x22, 0x72, 0xd2, 0x75, 0xf1, 0x0a, 0x7e,
+	0x5c, 0xa5, 0x2f, 0xf7, 0xd7, 0x45, 0x0b, 0xd9,
+	0x57, 0x0e, 0x43, 0x6f, 0x4e, 0x2e, 0x6f, 0x7f,
+	0xf2, 0x28, 0x10, 0x5f, 0x81, 0xf1, 0xcb, 0x61,
+	0x07, 0x4e, 0xd6, 0xab, 0x78, 0x5a, 0x30, 0x71,
+	0x56, 0x20, 0x82, 0x0e, 0x25, 0x86, 0x33, 0xff,
+	0x4b, 0xc1, 0xb1, 0x87, 0x8a, 0x0e, 0x30, 0xd9,
+	0xf8, 0x11, 0x54, 0x26, 0xed, 0x93, 0x9e, 0xeb,
+	0x27, 0xba, 0x72, 0x5a, 0x6b, 0x02, 0x0c, 0xb1,
+	0x4b, 0xec, 0x06, 0xe1, 0x36, 0xbd, 0x84, 0xe7,
+	0xbb, 0xc7, 0x16, 0x29, 0xfc, 0xb7, 0xf5, 0xf9,
+	0x2a, 0x09, 0x2b, 0x50, 0x87, 0x3f, 0x9b, 0xc6,
+	0x4c, 0x21, 0x53, 0xff, 0x6f, 0xd4, 0x12, 0xc1,
+	0xb0, 0x35, 0x48, 0xfb, 0x9b, 0x38, 0xd3, 0x13,
+	0x47, 0x71, 0x22, 0xce, 0x12, 0x5f, 0xb6, 0x64
+};
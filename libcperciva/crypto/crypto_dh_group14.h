@@ -6,4 +6,7 @@
 /* Diffie-Hellman group #14, from RFC 3526. */
 extern const uint8_t crypto_dh_group14[];
 
+/* 2^4096 mod p, where p is the group #14 modulus. */
+extern const uint8_t crypto_dh_group14_r2[];
+
 #endif /* !CRYPTO_DH_GROUP14_H_ */
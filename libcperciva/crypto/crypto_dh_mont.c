@@ -0,0 +1,411 @@
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "insecure_memzero.h"
+#include "optional_mutex.h"
+#include "warnp.h"
+
+#include "crypto_dh_group14.h"
+
+#include "crypto_dh_mont.h"
+
+/**
+ * This implements modular exponentiation in Diffie-Hellman group #14 using
+ * Montgomery multiplication (with a separate squaring routine) with R = 2^2048
+ * and a fixed 5-bit window.  Every exponentiation performs the same sequence
+ * of multiplications and memory accesses regardless of the base and exponent,
+ * so unlike a generic bignum library we do not need to blind the exponent.
+ *
+ * The group #14 modulus p is equal to -1 mod 2^64, so -1/p is equal to 1 mod
+ * 2^64 (and thus also mod 2^32); this simplifies the Montgomery reduction.
+ *
+ * Since public keys are always computed with the same base, we also keep
+ * tables of the Montgomery representations of 2^(j * 2^(5k)) for each window
+ * k; computing 2^x then takes one multiplication per window and no squarings.
+ */
+
+/*
+ * Use 64-bit limbs if the compiler provides a 128-bit type for holding their
+ * products, and 32-bit limbs otherwise.
+ */
+#ifdef __SIZEOF_INT128__
+typedef uint64_t limb_t;
+__extension__ typedef unsigned __int128 dlimb_t;
+#define LIMB_BITS 64
+#else
+typedef uint32_t limb_t;
+typedef uint64_t dlimb_t;
+#define LIMB_BITS 32
+#endif
+
+/* Number of limbs in a 2048-bit value. */
+#define NLIMBS (2048 / LIMB_BITS)
+
+/* Exponents are less than 2^260; we process them in 52 windows of 5 bits. */
+#define WBITS 5
+#define NWIN 52
+
+/* Fixed-base tables: gtab[k][j] = 2^(j * 2^(WBITS * k)) * 2^2048 mod p. */
+static limb_t gtab[NWIN][1 << WBITS][NLIMBS];
+
+/* Set to non-zero once gtab has been filled in. */
+static int gtab_done = 0;
+
+/* Protects the tables above if the program is multi-threaded. */
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* Convert the big-endian value ${buf} into little-endian limbs ${x}. */
+static void
+load(limb_t x[NLIMBS], const uint8_t buf[256])
+{
+	size_t i, j;
+
+	for (i = 0; i < NLIMBS; i++) {
+		x[i] = 0;
+		for (j = 0; j < LIMB_BITS / 8; j++)
+			x[i] |= (limb_t)buf[255 - i * (LIMB_BITS / 8) - j] <<
+			    (8 * j);
+	}
+}
+
+/* Convert the little-endian limbs ${x} into the big-endian value ${buf}. */
+static void
+store(uint8_t buf[256], const limb_t x[NLIMBS])
+{
+	size_t i, j;
+
+	for (i = 0; i < NLIMBS; i++) {
+		for (j = 0; j < LIMB_BITS / 8; j++)
+			buf[255 - i * (LIMB_BITS / 8) - j] =
+			    (uint8_t)(x[i] >> (8 * j));
+	}
+}
+
+/*
+ * Set ${r} to ${hi} * 2^2048 + ${t} - ${p} if that is non-negative, or to
+ * ${hi} * 2^2048 + ${t} otherwise, where ${hi} is 0 or 1.
+ */
+static void
+csub(limb_t r[NLIMBS], const limb_t t[NLIMBS], limb_t hi,
+    const limb_t p[NLIMBS])
+{
+	limb_t s[NLIMBS];
+	limb_t borrow = 0;
+	limb_t mask;
+	dlimb_t d;
+	size_t i;
+
+	/* Compute s = t - p, keeping track of the borrow. */
+	for (i = 0; i < NLIMBS; i++) {
+		d = (dlimb_t)t[i] - p[i] - borrow;
+		s[i] = (limb_t)d;
+		borrow = (limb_t)(d >> LIMB_BITS) & 1;
+	}
+
+	/* Use s unless the subtraction went negative. */
+	mask = (limb_t)0 - (hi | (borrow ^ 1));
+	for (i = 0; i < NLIMBS; i++)
+		r[i] = (s[i] & mask) | (t[i] & ~mask);
+}
+
+/* (c, t[k]) = t[k] + x * y + c. */
+#define MULADD(t, k, x, y, c) do {					\
+	(c) += (dlimb_t)(x) * (y) + (t)[k];				\
+	(t)[k] = (limb_t)(c);						\
+	(c) >>= LIMB_BITS;						\
+} while (0)
+
+/* (c, t[k + j]) = t[k + j] + x * y[j] + c, for j = 0 ... 3. */
+#define MULADD4(t, k, x, y, c) do {					\
+	MULADD(t, (k), x, (y)[0], c);					\
+	MULADD(t, (k) + 1, x, (y)[1], c);				\
+	MULADD(t, (k) + 2, x, (y)[2], c);				\
+	MULADD(t, (k) + 3, x, (y)[3], c);				\
+} while (0)
+
+/*
+ * Montgomery-reduce the 4096-bit value ${t}, setting ${r} to ${t} / 2^2048
+ * mod ${p}, where ${t} is less than 2^2048 * ${p}.
+ */
+static void
+montred(limb_t r[NLIMBS], limb_t t[2 * NLIMBS], const limb_t p[NLIMBS])
+{
+	limb_t m, hc = 0;
+	dlimb_t c;
+	size_t i, j;
+
+	for (i = 0; i < NLIMBS; i++) {
+		/* Add m * p to make t[i] zero; m = t[i] * (-1/p) = t[i]. */
+		m = t[i];
+		c = 0;
+		for (j = 0; j < NLIMBS; j += 4)
+			MULADD4(t, i + j, m, &p[j], c);
+
+		/* Add the carry into the next limb. */
+		c += (dlimb_t)t[i + NLIMBS] + hc;
+		t[i + NLIMBS] = (limb_t)c;
+		hc = (limb_t)(c >> LIMB_BITS);
+	}
+
+	/* We now have t / 2^2048 < 2p; subtract p if necessary. */
+	csub(r, &t[NLIMBS], hc, p);
+}
+
+/*
+ * Set ${r} to ${a} * ${b} / 2^2048 mod ${p}, where ${a} and ${b} are less
+ * than ${p}.  The output may overlap with the inputs.
+ */
+static void
+montmul(limb_t r[NLIMBS], const limb_t a[NLIMBS], const limb_t b[NLIMBS],
+    const limb_t p[NLIMBS])
+{
+	limb_t t[2 * NLIMBS];
+	dlimb_t c;
+	size_t i, j;
+
+	/* Compute t = a * b. */
+	memset(t, 0, NLIMBS * sizeof(limb_t));
+	for (i = 0; i < NLIMBS; i++) {
+		c = 0;
+		for (j = 0; j < NLIMBS; j += 4)
+			MULADD4(t, i + j, b[i], &a[j], c);
+		t[i + NLIMBS] = (limb_t)c;
+	}
+
+	/* Reduce. */
+	montred(r, t, p);
+}
+
+/*
+ * Set ${r} to ${a}^2 / 2^2048 mod ${p}, where ${a} is less than ${p}.  The
+ * output may overlap with the input.
+ */
+static void
+montsqr(limb_t r[NLIMBS], const limb_t a[NLIMBS], const limb_t p[NLIMBS])
+{
+	limb_t t[2 * NLIMBS];
+	limb_t hi;
+	dlimb_t c;
+	size_t i, j;
+
+	/* Compute the products a[i] * a[j] with i < j. */
+	memset(t, 0, sizeof(t));
+	for (i = 0; i < NLIMBS - 1; i++) {
+		c = 0;
+		for (j = i + 1; j % 4 != 0; j++)
+			MULADD(t, i + j, a[i], a[j], c);
+		for (; j < NLIMBS; j += 4)
+			MULADD4(t, i + j, a[i], &a[j], c);
+		t[i + NLIMBS] = (limb_t)c;
+	}
+
+	/* Double them and add the products a[i] * a[i]. */
+	hi = 0;
+	c = 0;
+	for (i = 0; i < NLIMBS; i++) {
+		c += (dlimb_t)a[i] * a[i];
+		c += (dlimb_t)((t[2 * i] << 1) | hi);
+		hi = t[2 * i] >> (LIMB_BITS - 1);
+		t[2 * i] = (limb_t)c;
+		c >>= LIMB_BITS;
+		c += (dlimb_t)((t[2 * i + 1] << 1) | hi);
+		hi = t[2 * i + 1] >> (LIMB_BITS - 1);
+		t[2 * i + 1] = (limb_t)c;
+		c >>= LIMB_BITS;
+	}
+
+	/* Reduce. */
+	montred(r, t, p);
+}
+
+/* Return bit ${i} of the exponent 2^258 + ${priv}. */
+static unsigned int
+expbit(const uint8_t priv[CRYPTO_DH_PRIVLEN], size_t i)
+{
+
+	if (i < 8 * CRYPTO_DH_PRIVLEN)
+		return ((priv[CRYPTO_DH_PRIVLEN - 1 - i / 8] >> (i % 8)) & 1);
+	return (i == 258);
+}
+
+/* Return window ${k} of the exponent 2^258 + ${priv}. */
+static unsigned int
+expwin(const uint8_t priv[CRYPTO_DH_PRIVLEN], size_t k)
+{
+	unsigned int w = 0;
+	size_t j;
+
+	for (j = 0; j < WBITS; j++)
+		w |= expbit(priv, k * WBITS + j) << j;
+	return (w);
+}
+
+/* Set ${r} to ${tab}[${w}], reading every entry of ${tab}. */
+static void
+tabselect(limb_t r[NLIMBS], limb_t tab[1 << WBITS][NLIMBS], unsigned int w)
+{
+	limb_t mask;
+	unsigned int k;
+	size_t i;
+
+	memset(r, 0, NLIMBS * sizeof(limb_t));
+	for (k = 0; k < (1 << WBITS); k++) {
+		/* All ones if k == w, all zeroes otherwise. */
+		mask = (limb_t)0 - (limb_t)(((uint32_t)(k ^ w) - 1) >> 31);
+		for (i = 0; i < NLIMBS; i++)
+			r[i] |= tab[k][i] & mask;
+	}
+}
+
+/**
+ * crypto_dh_mont_exp(r, a, priv):
+ * Compute ${r} = ${a}^(2^258 + ${priv}) mod p, where p is the Diffie-Hellman
+ * group #14 modulus and all values are big-endian integers.  The time taken
+ * does not depend on the values of ${a} or ${priv}.
+ */
+void
+crypto_dh_mont_exp(uint8_t r[CRYPTO_DH_PUBLEN],
+    const uint8_t a[CRYPTO_DH_PUBLEN], const uint8_t priv[CRYPTO_DH_PRIVLEN])
+{
+	limb_t p[NLIMBS];
+	limb_t r2[NLIMBS];
+	limb_t one[NLIMBS];
+	limb_t x[NLIMBS];
+	limb_t y[NLIMBS];
+	limb_t tab[1 << WBITS][NLIMBS];
+	size_t k, i;
+
+	/* Load the modulus and the Montgomery conversion constant. */
+	load(p, crypto_dh_group14);
+	load(r2, crypto_dh_group14_r2);
+	memset(one, 0, sizeof(one));
+	one[0] = 1;
+
+	/* Load the base and reduce it mod p (it is less than 2p). */
+	load(x, a);
+	csub(x, x, 0, p);
+
+	/* Compute tab[k] = a^k * R mod p. */
+	montmul(tab[0], one, r2, p);
+	montmul(tab[1], x, r2, p);
+	for (k = 2; k < (1 << WBITS); k++)
+		montmul(tab[k], tab[k - 1], tab[1], p);
+
+	/* Start with the top window of the exponent. */
+	tabselect(x, tab, expwin(priv, NWIN - 1));
+
+	/* Square WBITS times and multiply in each following window. */
+	for (k = NWIN - 1; k-- > 0; ) {
+		for (i = 0; i < WBITS; i++)
+			montsqr(x, x, p);
+		tabselect(y, tab, expwin(priv, k));
+		montmul(x, x, y, p);
+	}
+
+	/* Convert out of Montgomery representation. */
+	montmul(x, x, one, p);
+	store(r, x);
+
+	/* Clean up. */
+	insecure_memzero(x, sizeof(x));
+	insecure_memzero(y, sizeof(y));
+	insecure_memzero(tab, sizeof(tab));
+}
+
+/* Fill in the fixed-base tables gtab. */
+static void
+gtab_init(void)
+{
+	limb_t p[NLIMBS];
+	limb_t r2[NLIMBS];
+	limb_t one[NLIMBS];
+	limb_t two[NLIMBS];
+	size_t k, j;
+
+	/* Load the modulus and the Montgomery conversion constant. */
+	load(p, crypto_dh_group14);
+	load(r2, crypto_dh_group14_r2);
+	memset(one, 0, sizeof(one));
+	one[0] = 1;
+	memset(two, 0, sizeof(two));
+	two[0] = 2;
+
+	/* The first table holds powers of 2. */
+	montmul(gtab[0][0], one, r2, p);
+	montmul(gtab[0][1], two, r2, p);
+
+	for (k = 0; k < NWIN; k++) {
+		/* gtab[k][1] = gtab[k - 1][1]^(2^WBITS). */
+		if (k > 0) {
+			memcpy(gtab[k][0], gtab[0][0], sizeof(gtab[k][0]));
+			montmul(gtab[k][1], gtab[k - 1][(1 << WBITS) - 1],
+			    gtab[k - 1][1], p);
+		}
+
+		/* gtab[k][j] = gtab[k][1]^j. */
+		for (j = 2; j < (1 << WBITS); j++)
+			montmul(gtab[k][j], gtab[k][j - 1], gtab[k][1], p);
+	}
+}
+
+/**
+ * crypto_dh_mont_exp2(r, priv):
+ * Compute ${r} = 2^(2^258 + ${priv}) mod p, where p is the Diffie-Hellman
+ * group #14 modulus and all values are big-endian integers.  The time taken
+ * does not depend on the value of ${priv}.  Return 0 on success or -1 on
+ * error; the first call takes longer as it computes tables of powers of 2.
+ */
+int
+crypto_dh_mont_exp2(uint8_t r[CRYPTO_DH_PUBLEN],
+    const uint8_t priv[CRYPTO_DH_PRIVLEN])
+{
+	limb_t p[NLIMBS];
+	limb_t one[NLIMBS];
+	limb_t x[NLIMBS];
+	limb_t y[NLIMBS];
+	size_t k;
+	int rc;
+
+	/* Compute the tables if we haven't already done so. */
+	if ((rc = optional_mutex_lock(&mutex)) != 0) {
+		warn0("optional_mutex_lock: %s", strerror(rc));
+		goto err0;
+	}
+	if (gtab_done == 0) {
+		gtab_init();
+		gtab_done = 1;
+	}
+	if ((rc = optional_mutex_unlock(&mutex)) != 0) {
+		warn0("optional_mutex_unlock: %s", strerror(rc));
+		goto err0;
+	}
+
+	/* Load the modulus. */
+	load(p, crypto_dh_group14);
+	memset(one, 0, sizeof(one));
+	one[0] = 1;
+
+	/* Multiply together the table entries for each exponent window. */
+	tabselect(x, gtab[0], expwin(priv, 0));
+	for (k = 1; k < NWIN; k++) {
+		tabselect(y, gtab[k], expwin(priv, k));
+		montmul(x, x, y, p);
+	}
+
+	/* Convert out of Montgomery representation. */
+	montmul(x, x, one, p);
+	store(r, x);
+
+	/* Clean up. */
+	insecure_memzero(x, sizeof(x));
+	insecure_memzero(y, sizeof(y));
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
@@ -0,0 +1,27 @@
+#ifndef CRYPTO_DH_MONT_H_
+#define CRYPTO_DH_MONT_H_
+
+#include <stdint.h>
+
+#include "crypto_dh.h"
+
+/**
+ * crypto_dh_mont_exp(r, a, priv):
+ * Compute ${r} = ${a}^(2^258 + ${priv}) mod p, where p is the Diffie-Hellman
+ * group #14 modulus and all values are big-endian integers.  The time taken
+ * does not depend on the values of ${a} or ${priv}.
+ */
+void crypto_dh_mont_exp(uint8_t[CRYPTO_DH_PUBLEN],
+    const uint8_t[CRYPTO_DH_PUBLEN], const uint8_t[CRYPTO_DH_PRIVLEN]);
+
+/**
+ * crypto_dh_mont_exp2(r, priv):
+ * Compute ${r} = 2^(2^258 + ${priv}) mod p, where p is the Diffie-Hellman
+ * group #14 modulus and all values are big-endian integers.  The time taken
+ * does not depend on the value of ${priv}.  Return 0 on success or -1 on
+ * error; the first call takes longer as it computes tables of powers of 2.
+ */
+int crypto_dh_mont_exp2(uint8_t[CRYPTO_DH_PUBLEN],
+    const uint8_t[CRYPTO_DH_PRIVLEN]);
+
+#endif /* !CRYPTO_DH_MONT_H_ */
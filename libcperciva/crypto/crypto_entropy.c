@@ -1,4 +1,5 @@
 #include <assert.h>
+#include <pthread.h>
 #include <stdint.h>
 #include <string.h>
 
@@ -6,6 +7,8 @@
 #include "crypto_entropy_rdrand.h"
 #include "entropy.h"
 #include "insecure_memzero.h"
+#include "optional_mutex.h"
+#include "warnp.h"
 
 #include "sha256.h"
 
@@ -28,6 +31,9 @@ static struct {
 /* Set to non-zero once the PRNG has been instantiated. */
 static int instantiated = 0;
 
+/* Protects the state above if the program is multi-threaded. */
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+
 /* Could be as high as 2^48 if we wanted... */
 #define RESEED_INTERVAL	256
 
@@ -207,12 +213,19 @@ int
 crypto_entropy_read(uint8_t * buf, size_t buflen)
 {
 	size_t bytes_to_provide;
+	int rc;
+
+	/* Lock the DRBG state. */
+	if ((rc = optional_mutex_lock(&mutex)) != 0) {
+		warn0("optional_mutex_lock: %s", strerror(rc));
+		goto err0;
+	}
 
 	/* Instantiate if needed. */
 	if (instantiated == 0) {
 		/* Try to instantiate the PRNG. */
 		if (instantiate())
-			return (-1);
+			goto err1;
 
 		/* We have instantiated the PRNG. */
 		instantiated = 1;
@@ -223,7 +236,7 @@ crypto_entropy_read(uint8_t * buf, size_t buflen)
 		/* Do we need to reseed? */
 		if (drbg.reseed_counter > RESEED_INTERVAL) {
 			if (reseed())
-				return (-1);
+				goto err1;
 		}
 
 		/* How much data are we generating in this step? */
@@ -240,6 +253,19 @@ crypto_entropy_read(uint8_t * buf, size_t buflen)
 		buflen -= bytes_to_provide;
 	}
 
+	/* Unlock the DRBG state. */
+	if ((rc = optional_mutex_unlock(&mutex)) != 0) {
+		warn0("optional_mutex_unlock: %s", strerror(rc));
+		goto err0;
+	}
+
 	/* Success! */
 	return (0);
+
+err1:
+	if ((rc = optional_mutex_unlock(&mutex)) != 0)
+		warn0("optional_mutex_unlock: %s", strerror(rc));
+err0:
+	/* Failure! */
+	return (-1);
 }
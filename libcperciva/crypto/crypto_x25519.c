@@ -0,0 +1,465 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "crypto_entropy.h"
+#include "insecure_memzero.h"
+
+#include "crypto_x25519.h"
+
+/**
+ * This implements the X25519 function from RFC 7748 using the Montgomery
+ * ladder, with field elements modulo p = 2^255 - 19 held in unsigned limbs of
+ * LIMB_BITS bits each.  Products wrap around using 2^255 = 19 mod p, and
+ * subtraction adds 2p to keep every limb non-negative.  Every operation is
+ * performed the same way regardless of the values involved.
+ */
+
+/*
+ * Use five 51-bit limbs if the compiler provides a 128-bit type for holding
+ * their products, and fifteen 17-bit limbs otherwise.
+ */
+#ifdef __SIZEOF_INT128__
+typedef uint64_t limb_t;
+__extension__ typedef unsigned __int128 dlimb_t;
+#define LIMB_BITS 51
+#else
+typedef uint32_t limb_t;
+typedef uint64_t dlimb_t;
+#define LIMB_BITS 17
+#endif
+
+/* Number of limbs in a field element, and the mask for one limb. */
+#define NLIMBS (255 / LIMB_BITS)
+#define LIMB_MASK (((limb_t)1 << LIMB_BITS) - 1)
+
+/* A field element. */
+typedef limb_t fe[NLIMBS];
+
+/* Base point u = 9. */
+static const uint8_t basepoint[CRYPTO_X25519_PUBLEN] = {9};
+
+/* Convert the little-endian value ${s}, ignoring the top bit, into ${h}. */
+static void
+fe_frombytes(fe h, const uint8_t s[32])
+{
+	uint64_t acc = 0;
+	size_t nbits = 0;
+	size_t i, j;
+
+	for (i = j = 0; j < NLIMBS; i++) {
+		acc |= (uint64_t)s[i] << nbits;
+		nbits += 8;
+		if (nbits >= LIMB_BITS) {
+			h[j++] = (limb_t)(acc & LIMB_MASK);
+			acc >>= LIMB_BITS;
+			nbits -= LIMB_BITS;
+		}
+	}
+}
+
+/* Convert the fully reduced field element ${h} into little-endian ${s}. */
+static void
+fe_tobytes(uint8_t s[32], const fe h)
+{
+	uint64_t acc = 0;
+	size_t nbits = 0;
+	size_t i, j;
+
+	for (i = j = 0; i < NLIMBS; i++) {
+		acc |= (uint64_t)h[i] << nbits;
+		nbits += LIMB_BITS;
+		while (nbits >= 8) {
+			s[j++] = (uint8_t)acc;
+			acc >>= 8;
+			nbits -= 8;
+		}
+	}
+	s[j] = (uint8_t)acc;
+}
+
+/* Set ${h} to the fully reduced value of ${f} mod p. */
+static void
+fe_reduce(fe h, const fe f)
+{
+	limb_t c;
+	size_t i, k;
+
+	/* Carry twice; the result is less than 2^255. */
+	memcpy(h, f, sizeof(fe));
+	for (k = 0; k < 2; k++) {
+		for (i = 0, c = 0; i < NLIMBS; i++) {
+			h[i] += c;
+			c = h[i] >> LIMB_BITS;
+			h[i] &= LIMB_MASK;
+		}
+		h[0] += 19 * c;
+	}
+
+	/* Compute c = 1 if h >= p, or 0 otherwise. */
+	for (i = 0, c = 19; i < NLIMBS; i++)
+		c = (h[i] + c) >> LIMB_BITS;
+
+	/* Subtract c * p by adding 19c and dropping bit 255. */
+	h[0] += 19 * c;
+	for (i = 0, c = 0; i < NLIMBS; i++) {
+		h[i] += c;
+		c = h[i] >> LIMB_BITS;
+		h[i] &= LIMB_MASK;
+	}
+}
+
+/* Set ${h} to ${f} + ${g}, without carrying. */
+static void
+fe_add(fe h, const fe f, const fe g)
+{
+	size_t i;
+
+	for (i = 0; i < NLIMBS; i++)
+		h[i] = f[i] + g[i];
+}
+
+/* Set ${h} to ${f} + 2p - ${g}, without carrying; ${g} must be carried. */
+static void
+fe_sub(fe h, const fe f, const fe g)
+{
+	size_t i;
+
+	h[0] = f[0] + 2 * (LIMB_MASK - 18) - g[0];
+	for (i = 1; i < NLIMBS; i++)
+		h[i] = f[i] + 2 * LIMB_MASK - g[i];
+}
+
+#ifdef __SIZEOF_INT128__
+/*
+ * Carry the wide limbs ${t} into ${h}, such that every limb of ${h} except
+ * the second is less than 2^LIMB_BITS and the second is only slightly larger.
+ */
+static void
+fe_carry(fe h, dlimb_t t[NLIMBS])
+{
+
+	t[1] += t[0] >> LIMB_BITS;
+	h[0] = (limb_t)t[0] & LIMB_MASK;
+	t[2] += t[1] >> LIMB_BITS;
+	h[1] = (limb_t)t[1] & LIMB_MASK;
+	t[3] += t[2] >> LIMB_BITS;
+	h[2] = (limb_t)t[2] & LIMB_MASK;
+	t[4] += t[3] >> LIMB_BITS;
+	h[3] = (limb_t)t[3] & LIMB_MASK;
+	h[4] = (limb_t)t[4] & LIMB_MASK;
+
+	/* Wrap the top carry around, using 2^255 = 19. */
+	t[0] = (t[4] >> LIMB_BITS) * 19 + h[0];
+	h[0] = (limb_t)t[0] & LIMB_MASK;
+	h[1] += (limb_t)(t[0] >> LIMB_BITS);
+}
+
+/* Product of two limbs. */
+#define M(x, y) ((dlimb_t)(x) * (y))
+
+/* Set ${h} to ${f} * ${g}. */
+static void
+fe_mul(fe h, const fe f, const fe g)
+{
+	dlimb_t t[NLIMBS];
+	limb_t g1_19 = 19 * g[1], g2_19 = 19 * g[2];
+	limb_t g3_19 = 19 * g[3], g4_19 = 19 * g[4];
+
+	/* Limbs which wrap around past 2^255 are multiplied by 19. */
+	t[0] = M(f[0], g[0]) + M(f[1], g4_19) + M(f[2], g3_19) +
+	    M(f[3], g2_19) + M(f[4], g1_19);
+	t[1] = M(f[0], g[1]) + M(f[1], g[0]) + M(f[2], g4_19) +
+	    M(f[3], g3_19) + M(f[4], g2_19);
+	t[2] = M(f[0], g[2]) + M(f[1], g[1]) + M(f[2], g[0]) +
+	    M(f[3], g4_19) + M(f[4], g3_19);
+	t[3] = M(f[0], g[3]) + M(f[1], g[2]) + M(f[2], g[1]) +
+	    M(f[3], g[0]) + M(f[4], g4_19);
+	t[4] = M(f[0], g[4]) + M(f[1], g[3]) + M(f[2], g[2]) +
+	    M(f[3], g[1]) + M(f[4], g[0]);
+
+	fe_carry(h, t);
+}
+
+/* Set ${h} to ${f}^2. */
+static void
+fe_sqr(fe h, const fe f)
+{
+	dlimb_t t[NLIMBS];
+	limb_t f1_2 = 2 * f[1], f2_2 = 2 * f[2];
+	limb_t f3_2 = 2 * f[3], f4_2 = 2 * f[4];
+	limb_t f3_19 = 19 * f[3], f4_19 = 19 * f[4];
+	limb_t f3_38 = 38 * f[3], f4_38 = 38 * f[4];
+
+	/* Cross products appear twice; those which wrap around, 19 times. */
+	t[0] = M(f[0], f[0]) + M(f[1], f4_38) + M(f[2], f3_38);
+	t[1] = M(f[0], f1_2) + M(f[2], f4_38) + M(f[3], f3_19);
+	t[2] = M(f[0], f2_2) + M(f[1], f[1]) + M(f[3], f4_38);
+	t[3] = M(f[0], f3_2) + M(f[1], f2_2) + M(f[4], f4_19);
+	t[4] = M(f[0], f4_2) + M(f[1], f3_2) + M(f[2], f[2]);
+
+	fe_carry(h, t);
+}
+#else
+/*
+ * Carry the wide limbs ${t} into ${h}, such that every limb of ${h} except
+ * the second is less than 2^LIMB_BITS and the second is only slightly larger.
+ */
+static void
+fe_carry(fe h, dlimb_t t[NLIMBS])
+{
+	dlimb_t c = 0;
+	size_t i;
+
+	for (i = 0; i < NLIMBS; i++) {
+		t[i] += c;
+		h[i] = (limb_t)t[i] & LIMB_MASK;
+		c = t[i] >> LIMB_BITS;
+	}
+
+	/* Wrap the top carry around, using 2^255 = 19. */
+	c = c * 19 + h[0];
+	h[0] = (limb_t)c & LIMB_MASK;
+	h[1] += (limb_t)(c >> LIMB_BITS);
+}
+
+/* Set ${h} to ${f} * ${g}. */
+static void
+fe_mul(fe h, const fe f, const fe g)
+{
+	dlimb_t t[NLIMBS];
+	limb_t g19[NLIMBS];
+	size_t i, j;
+
+	/* Limbs which wrap around past 2^255 are multiplied by 19. */
+	for (j = 0; j < NLIMBS; j++)
+		g19[j] = 19 * g[j];
+
+	memset(t, 0, sizeof(t));
+	for (i = 0; i < NLIMBS; i++) {
+		for (j = 0; j < NLIMBS - i; j++)
+			t[i + j] += (dlimb_t)f[i] * g[j];
+		for (; j < NLIMBS; j++)
+			t[i + j - NLIMBS] += (dlimb_t)f[i] * g19[j];
+	}
+
+	fe_carry(h, t);
+}
+
+/* Set ${h} to ${f}^2. */
+static void
+fe_sqr(fe h, const fe f)
+{
+	dlimb_t t[NLIMBS];
+	limb_t f2[NLIMBS];
+	limb_t f38[NLIMBS];
+	size_t i, j;
+
+	/* Cross products appear twice; those which wrap around, 19 times. */
+	for (j = 0; j < NLIMBS; j++) {
+		f2[j] = 2 * f[j];
+		f38[j] = 38 * f[j];
+	}
+
+	memset(t, 0, sizeof(t));
+	for (i = 0; i < NLIMBS; i++) {
+		if (2 * i < NLIMBS)
+			t[2 * i] += (dlimb_t)f[i] * f[i];
+		else
+			t[2 * i - NLIMBS] += (dlimb_t)f[i] * (19 * f[i]);
+		for (j = i + 1; j < NLIMBS; j++) {
+			if (i + j < NLIMBS)
+				t[i + j] += (dlimb_t)f[i] * f2[j];
+			else
+				t[i + j - NLIMBS] += (dlimb_t)f[i] * f38[j];
+		}
+	}
+
+	fe_carry(h, t);
+}
+#endif
+
+/* Set ${h} to ${f}^(2^${n}), for n > 0. */
+static void
+fe_sqrn(fe h, const fe f, size_t n)
+{
+
+	fe_sqr(h, f);
+	while (--n > 0)
+		fe_sqr(h, h);
+}
+
+/* Set ${h} to 121665 * ${f}. */
+static void
+fe_mul121665(fe h, const fe f)
+{
+	dlimb_t t[NLIMBS];
+	size_t i;
+
+	for (i = 0; i < NLIMBS; i++)
+		t[i] = (dlimb_t)f[i] * 121665;
+
+	fe_carry(h, t);
+}
+
+/* Set ${h} to 1 / ${z} = ${z}^(p - 2), with p - 2 = 2^255 - 21. */
+static void
+fe_invert(fe h, const fe z)
+{
+	fe z2, z11, z2_5_0, z2_10_0, z2_20_0, z2_50_0, z2_100_0, t;
+
+	fe_sqr(z2, z);				/* 2 */
+	fe_sqrn(t, z2, 2);			/* 8 */
+	fe_mul(t, t, z);			/* 9 */
+	fe_mul(z11, t, z2);			/* 11 */
+	fe_sqr(z2_5_0, z11);			/* 22 */
+	fe_mul(z2_5_0, z2_5_0, t);		/* 2^5 - 1 */
+	fe_sqrn(t, z2_5_0, 5);
+	fe_mul(z2_10_0, t, z2_5_0);		/* 2^10 - 1 */
+	fe_sqrn(t, z2_10_0, 10);
+	fe_mul(z2_20_0, t, z2_10_0);		/* 2^20 - 1 */
+	fe_sqrn(t, z2_20_0, 20);
+	fe_mul(t, t, z2_20_0);			/* 2^40 - 1 */
+	fe_sqrn(t, t, 10);
+	fe_mul(z2_50_0, t, z2_10_0);		/* 2^50 - 1 */
+	fe_sqrn(t, z2_50_0, 50);
+	fe_mul(z2_100_0, t, z2_50_0);		/* 2^100 - 1 */
+	fe_sqrn(t, z2_100_0, 100);
+	fe_mul(t, t, z2_100_0);			/* 2^200 - 1 */
+	fe_sqrn(t, t, 50);
+	fe_mul(t, t, z2_50_0);			/* 2^250 - 1 */
+	fe_sqrn(t, t, 5);			/* 2^255 - 32 */
+	fe_mul(h, t, z11);			/* 2^255 - 21 */
+}
+
+/* Swap ${f} and ${g} if ${b} is 1; do nothing if ${b} is 0. */
+static void
+fe_cswap(fe f, fe g, limb_t b)
+{
+	limb_t mask = (limb_t)0 - b;
+	limb_t x;
+	size_t i;
+
+	for (i = 0; i < NLIMBS; i++) {
+		x = mask & (f[i] ^ g[i]);
+		f[i] ^= x;
+		g[i] ^= x;
+	}
+}
+
+/* Compute the X25519 function of the scalar ${k} and the u-coordinate ${u}. */
+static void
+x25519(uint8_t out[CRYPTO_X25519_KEYLEN],
+    const uint8_t k[CRYPTO_X25519_PRIVLEN],
+    const uint8_t u[CRYPTO_X25519_PUBLEN])
+{
+	uint8_t e[CRYPTO_X25519_PRIVLEN];
+	fe x1, x2, z2, x3, z3;
+	fe a, aa, b, bb, c, d, da, cb, ee;
+	limb_t swap = 0;
+	limb_t bit;
+	size_t t;
+
+	/* Clamp the scalar. */
+	memcpy(e, k, CRYPTO_X25519_PRIVLEN);
+	e[0] &= 248;
+	e[31] &= 127;
+	e[31] |= 64;
+
+	/* Initialize the ladder with (x2 : z2) = 1 and (x3 : z3) = u. */
+	fe_frombytes(x1, u);
+	memset(x2, 0, sizeof(fe));
+	x2[0] = 1;
+	memset(z2, 0, sizeof(fe));
+	memcpy(x3, x1, sizeof(fe));
+	memset(z3, 0, sizeof(fe));
+	z3[0] = 1;
+
+	/* Walk down the scalar from bit 254. */
+	for (t = 255; t-- > 0; ) {
+		bit = (e[t / 8] >> (t % 8)) & 1;
+		swap ^= bit;
+		fe_cswap(x2, x3, swap);
+		fe_cswap(z2, z3, swap);
+		swap = bit;
+
+		fe_add(a, x2, z2);
+		fe_sqr(aa, a);
+		fe_sub(b, x2, z2);
+		fe_sqr(bb, b);
+		fe_sub(ee, aa, bb);
+		fe_add(c, x3, z3);
+		fe_sub(d, x3, z3);
+		fe_mul(da, d, a);
+		fe_mul(cb, c, b);
+		fe_add(x3, da, cb);
+		fe_sqr(x3, x3);
+		fe_sub(z3, da, cb);
+		fe_sqr(z3, z3);
+		fe_mul(z3, z3, x1);
+		fe_mul(x2, aa, bb);
+		fe_mul121665(z2, ee);
+		fe_add(z2, z2, aa);
+		fe_mul(z2, z2, ee);
+	}
+	fe_cswap(x2, x3, swap);
+	fe_cswap(z2, z3, swap);
+
+	/* Compute x2 / z2 and export it. */
+	fe_invert(z2, z2);
+	fe_mul(x2, x2, z2);
+	fe_reduce(x2, x2);
+	fe_tobytes(out, x2);
+
+	/* Clean up. */
+	insecure_memzero(e, sizeof(e));
+	insecure_memzero(x2, sizeof(fe));
+	insecure_memzero(z2, sizeof(fe));
+	insecure_memzero(x3, sizeof(fe));
+	insecure_memzero(z3, sizeof(fe));
+	insecure_memzero(a, sizeof(fe));
+	insecure_memzero(b, sizeof(fe));
+	insecure_memzero(aa, sizeof(fe));
+	insecure_memzero(bb, sizeof(fe));
+}
+
+/**
+ * crypto_x25519_generate(pub, priv):
+ * Generate a random X25519 private key ${priv}, and compute the corresponding
+ * public key ${pub}.
+ */
+int
+crypto_x25519_generate(uint8_t pub[CRYPTO_X25519_PUBLEN],
+    uint8_t priv[CRYPTO_X25519_PRIVLEN])
+{
+
+	/* Generate a random private key. */
+	if (crypto_entropy_read(priv, CRYPTO_X25519_PRIVLEN))
+		goto err0;
+
+	/* Compute the public key. */
+	x25519(pub, priv, basepoint);
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/**
+ * crypto_x25519_compute(pub, priv, key):
+ * Compute the X25519 function of the private key ${priv} and the public key
+ * ${pub} produced by the *other* participant in the key exchange, and write
+ * the result into ${key}.  All values are little-endian, as specified in RFC
+ * 7748.  The time taken does not depend on the values of ${pub} or ${priv}.
+ */
+void
+crypto_x25519_compute(const uint8_t pub[CRYPTO_X25519_PUBLEN],
+    const uint8_t priv[CRYPTO_X25519_PRIVLEN],
+    uint8_t key[CRYPTO_X25519_KEYLEN])
+{
+
+	x25519(key, priv, pub);
+}
@@ -0,0 +1,29 @@
+#ifndef CRYPTO_X25519_H_
+#define CRYPTO_X25519_H_
+
+#include <stdint.h>
+
+/* Sizes of X25519 private keys, public keys, and shared secrets. */
+#define CRYPTO_X25519_PRIVLEN 32
+#define CRYPTO_X25519_PUBLEN 32
+#define CRYPTO_X25519_KEYLEN 32
+
+/**
+ * crypto_x25519_generate(pub, priv):
+ * Generate a random X25519 private key ${priv}, and compute the corresponding
+ * public key ${pub}.
+ */
+int crypto_x25519_generate(uint8_t[CRYPTO_X25519_PUBLEN],
+    uint8_t[CRYPTO_X25519_PRIVLEN]);
+
+/**
+ * crypto_x25519_compute(pub, priv, key):
+ * Compute the X25519 function of the private key ${priv} and the public key
+ * ${pub} produced by the *other* participant in the key exchange, and write
+ * the result into ${key}.  All values are little-endian, as specified in RFC
+ * 7748.  The time taken does not depend on the values of ${pub} or ${priv}.
+ */
+void crypto_x25519_compute(const uint8_t[CRYPTO_X25519_PUBLEN],
+    const uint8_t[CRYPTO_X25519_PRIVLEN], uint8_t[CRYPTO_X25519_KEYLEN]);
+
+#endif /* !CRYPTO_X25519_H_ */
@@ -0,0 +1,568 @@
+#include <sys/time.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ptrheap.h"
+
+#include "timerwheel.h"
+
+/*
+ * Timers are sorted into ticks of 1/256 s.  The wheel has WHEEL_LEVELS
+ * levels of WHEEL_SIZE slots; a slot at level k spans WHEEL_SIZE^k ticks, so
+ * with the values below the wheel covers 2^24 ticks (about 18 hours) and any
+ * timers further out are kept on an overflow list.
+ */
+#define TICKS_PER_SEC	256
+#define WHEEL_BITS	6
+#define WHEEL_SIZE	(1 << WHEEL_BITS)
+#define WHEEL_MASK	(WHEEL_SIZE - 1)
+#define WHEEL_LEVELS	4
+
+/* Index of the slot at level ${k} which holds tick ${t}. */
+#define SLOT(t, k)	((int)(((t) >> (WHEEL_BITS * (k))) & WHEEL_MASK))
+
+struct timerrec {
+	struct timeval tv;
+	uint64_t tick;
+	void * ptr;
+	struct timerrec * next;
+	struct timerrec ** prev;
+	size_t rc;
+	int inheap;
+};
+
+/*
+ * Every timer is either in the heap, with a tick less than ${cur}; or in the
+ * wheel (or its overflow list), with a tick greater than or equal to ${cur}.
+ * A timer is in level k of the wheel if its tick agrees with ${cur} in all of
+ * the bits above those used by level k, and it is in slot SLOT(tick, k) of
+ * that level; the slots at or after SLOT(cur, k) are thus in time order.
+ */
+struct timerwheel {
+	struct ptrheap * H;
+	struct timerrec * slots[WHEEL_LEVELS][WHEEL_SIZE];
+	uint64_t map[WHEEL_LEVELS];
+	struct timerrec * overflow;
+	uint64_t ovfmin;
+	uint64_t cur;
+	size_t n;
+};
+
+/* Compare two timevals. */
+static int
+tvcmp(const struct timeval * x, const struct timeval * y)
+{
+
+	/* Does one have more seconds? */
+	if (x->tv_sec > y->tv_sec)
+		return (1);
+	if (x->tv_sec < y->tv_sec)
+		return (-1);
+
+	/* Does one have more microseconds? */
+	if (x->tv_usec > y->tv_usec)
+		return (1);
+	if (x->tv_usec < y->tv_usec)
+		return (-1);
+
+	/* They must be equal. */
+	return (0);
+}
+
+/* Record-comparison callback from ptrheap. */
+static int
+compar(void * cookie, const void * x, const void * y)
+{
+	const struct timerrec * _x = x;
+	const struct timerrec * _y = y;
+
+	(void)cookie; /* UNUSED */
+
+	/* Compare the times. */
+	return (tvcmp(&_x->tv, &_y->tv));
+}
+
+/* Cookie-recording callback from ptrheap. */
+static void
+setreccookie(void * cookie, void * ptr, size_t rc)
+{
+	struct timerrec * rec = ptr;
+
+	(void)cookie; /* UNUSED */
+
+	rec->rc = rc;
+}
+
+/* Return the tick in which the time ${tv} falls. */
+static uint64_t
+gettick(const struct timeval * tv)
+{
+
+	return ((uint64_t)tv->tv_sec * TICKS_PER_SEC +
+	    (uint64_t)tv->tv_usec * TICKS_PER_SEC / 1000000);
+}
+
+/* Set ${tv} to the start of the tick ${tick}. */
+static void
+ticktv(uint64_t tick, struct timeval * tv)
+{
+
+	tv->tv_sec = (time_t)(tick / TICKS_PER_SEC);
+	tv->tv_usec =
+	    (suseconds_t)((tick % TICKS_PER_SEC) * 1000000 / TICKS_PER_SEC);
+}
+
+/* Return the first non-empty slot at or after ${i} in ${map}, or -1. */
+static int
+firstslot(uint64_t map, int i)
+{
+
+	/* Are there any non-empty slots left? */
+	if ((i >= WHEEL_SIZE) || ((map >>= i) == 0))
+		return (-1);
+
+	/* Find the first one. */
+	while ((map & 1) == 0) {
+		map >>= 1;
+		i++;
+	}
+
+	/* Return its index. */
+	return (i);
+}
+
+/* Add the record ${r} to the list ${head}. */
+static void
+list_insert(struct timerrec ** head, struct timerrec * r)
+{
+
+	if ((r->next = *head) != NULL)
+		r->next->prev = &r->next;
+	r->prev = head;
+	*head = r;
+}
+
+/* Remove the record ${r} from the list it is on. */
+static void
+list_remove(struct timerrec * r)
+{
+
+	if (r->next != NULL)
+		r->next->prev = r->prev;
+	*r->prev = r->next;
+}
+
+/* Add the record ${r}, which must not be earlier than ${W->cur}, to ${W}. */
+static void
+wheel_insert(struct timerwheel * W, struct timerrec * r)
+{
+	uint64_t d;
+	int k, s;
+
+	/* If the wheel is empty, we can start it at this timer. */
+	if (W->n == 0)
+		W->cur = r->tick;
+
+	/* Find the lowest level on which this timer can go. */
+	d = r->tick ^ W->cur;
+	for (k = 0; k < WHEEL_LEVELS; k++) {
+		if ((d >> (WHEEL_BITS * (k + 1))) == 0)
+			break;
+	}
+
+	/* Add it to the appropriate slot, or to the overflow list. */
+	if (k < WHEEL_LEVELS) {
+		s = SLOT(r->tick, k);
+		list_insert(&W->slots[k][s], r);
+		W->map[k] |= (uint64_t)1 << s;
+	} else {
+		list_insert(&W->overflow, r);
+		if (r->tick < W->ovfmin)
+			W->ovfmin = r->tick;
+	}
+	r->inheap = 0;
+	W->n++;
+}
+
+/* Remove the record ${r} from the wheel ${W}. */
+static void
+wheel_remove(struct timerwheel * W, struct timerrec * r)
+{
+	int k, s;
+
+	/* Remove it from its list. */
+	list_remove(r);
+	W->n--;
+
+	/* If that slot is now empty, record that. */
+	for (k = 0; k < WHEEL_LEVELS; k++) {
+		s = SLOT(r->tick, k);
+		if (r->prev == &W->slots[k][s]) {
+			if (W->slots[k][s] == NULL)
+				W->map[k] &= ~((uint64_t)1 << s);
+			break;
+		}
+	}
+}
+
+/* Move all of the records on the list ${head} back into the wheel ${W}. */
+static void
+cascade(struct timerwheel * W, struct timerrec ** head)
+{
+	struct timerrec * r, * next;
+
+	/* Detach the list, since some records may go back onto it. */
+	r = *head;
+	*head = NULL;
+
+	/* Re-insert the records one by one. */
+	for (; r != NULL; r = next) {
+		next = r->next;
+		W->n--;
+		wheel_insert(W, r);
+	}
+}
+
+/*
+ * Find the first non-empty slot in the wheel ${W}, moving timers down from
+ * higher levels as necessary so that it is in level 0, and return its index
+ * via ${s}; or return -1 via ${s} if the wheel is empty.
+ */
+static void
+findslot(struct timerwheel * W, int * s)
+{
+	uint64_t hi;
+	int k, i;
+
+	do {
+		/* If the wheel is empty, there is nothing to find. */
+		if (W->n == 0) {
+			*s = -1;
+			return;
+		}
+
+		/* Move down any overflow timers which now fit in the wheel. */
+		hi = W->cur >> (WHEEL_BITS * WHEEL_LEVELS);
+		if ((W->overflow != NULL) &&
+		    ((W->ovfmin >> (WHEEL_BITS * WHEEL_LEVELS)) <= hi)) {
+			W->ovfmin = UINT64_MAX;
+			cascade(W, &W->overflow);
+		}
+
+		/* Move down timers in the slots which ${cur} has reached. */
+		for (k = WHEEL_LEVELS - 1; k > 0; k--) {
+			i = SLOT(W->cur, k);
+			if (W->slots[k][i] != NULL) {
+				W->map[k] &= ~((uint64_t)1 << i);
+				cascade(W, &W->slots[k][i]);
+			}
+		}
+
+		/* Look for a non-empty slot at level 0. */
+		if ((*s = firstslot(W->map[0], SLOT(W->cur, 0))) != -1)
+			return;
+
+		/* Advance to the first non-empty slot at a higher level. */
+		for (k = 1; k < WHEEL_LEVELS; k++) {
+			i = firstslot(W->map[k], SLOT(W->cur, k) + 1);
+			if (i == -1)
+				continue;
+			hi = W->cur >> (WHEEL_BITS * (k + 1));
+			W->cur = (hi << (WHEEL_BITS * (k + 1))) |
+			    ((uint64_t)i << (WHEEL_BITS * k));
+			break;
+		}
+
+		/* If only the overflow list is left, advance to it. */
+		if ((k == WHEEL_LEVELS) && (W->ovfmin > W->cur))
+			W->cur = W->ovfmin;
+	} while (1);
+}
+
+/*
+ * Move timers from the wheel ${W} into the heap until the heap contains the
+ * earliest timer (if any).
+ */
+static int
+settle(struct timerwheel * W)
+{
+	struct timerrec * r;
+	struct timeval tv;
+	uint64_t tick;
+	int s;
+
+	do {
+		/* Find the first non-empty slot. */
+		findslot(W, &s);
+		if (s == -1)
+			break;
+
+		/* Is the earliest timer in the heap earlier than this slot? */
+		tick = (W->cur & ~(uint64_t)WHEEL_MASK) | (uint64_t)s;
+		ticktv(tick, &tv);
+		if (((r = ptrheap_getmin(W->H)) != NULL) &&
+		    (tvcmp(&r->tv, &tv) <= 0))
+			break;
+
+		/* Move the timers in this slot into the heap. */
+		while ((r = W->slots[0][s]) != NULL) {
+			if (ptrheap_add(W->H, r))
+				goto err0;
+			wheel_remove(W, r);
+			r->inheap = 1;
+		}
+
+		/* Everything left in the wheel is later than this slot. */
+		W->cur = tick + 1;
+	} while (1);
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/**
+ * timerwheel_init(void):
+ * Create and return an empty timer wheel.
+ */
+struct timerwheel *
+timerwheel_init(void)
+{
+	struct timerwheel * W;
+	int k, s;
+
+	/* Allocate structure. */
+	if ((W = malloc(sizeof(struct timerwheel))) == NULL)
+		goto err0;
+
+	/* Allocate heap. */
+	if ((W->H = ptrheap_init(compar, setreccookie, W)) == NULL)
+		goto err1;
+
+	/* The wheel starts out empty. */
+	for (k = 0; k < WHEEL_LEVELS; k++) {
+		for (s = 0; s < WHEEL_SIZE; s++)
+			W->slots[k][s] = NULL;
+		W->map[k] = 0;
+	}
+	W->overflow = NULL;
+	W->ovfmin = UINT64_MAX;
+	W->cur = 0;
+	W->n = 0;
+
+	/* Success! */
+	return (W);
+
+err1:
+	free(W);
+err0:
+	/* Failure! */
+	return (NULL);
+}
+
+/**
+ * timerwheel_add(W, tv, ptr):
+ * Add the pair (${tv}, ${ptr}) to the timer wheel ${W}.  Return a cookie
+ * which can be passed to timerwheel_delete() or timerwheel_increase().
+ */
+void *
+timerwheel_add(struct timerwheel * W, const struct timeval * tv, void * ptr)
+{
+	struct timerrec * r;
+
+	/* Allocate (timeval, ptr) pair record. */
+	if ((r = malloc(sizeof(struct timerrec))) == NULL)
+		goto err0;
+
+	/* Fill in values. */
+	memcpy(&r->tv, tv, sizeof(struct timeval));
+	r->tick = gettick(tv);
+	r->ptr = ptr;
+
+	/*
+	 * Timers which are due before the wheel's current position go into
+	 * the heap; anything else goes into the wheel.
+	 */
+	if (r->tick < W->cur) {
+		if (ptrheap_add(W->H, r))
+			goto err1;
+		r->inheap = 1;
+	} else {
+		wheel_insert(W, r);
+	}
+
+	/* Success! */
+	return (r);
+
+err1:
+	free(r);
+err0:
+	/* Failure! */
+	return (NULL);
+}
+
+/**
+ * timerwheel_delete(W, cookie):
+ * Delete the (timeval, ptr) pair associated with the cookie ${cookie} from
+ * the timer wheel ${W}.
+ */
+void
+timerwheel_delete(struct timerwheel * W, void * cookie)
+{
+	struct timerrec * r = cookie;
+
+	/* Remove the record from the heap or the wheel. */
+	if (r->inheap)
+		ptrheap_delete(W->H, r->rc);
+	else
+		wheel_remove(W, r);
+
+	/* Free the record. */
+	free(r);
+}
+
+/**
+ * timerwheel_increase(W, cookie, tv):
+ * Increase the timer associated with the cookie ${cookie} in the timer wheel
+ * ${W} to ${tv}.
+ */
+void
+timerwheel_increase(struct timerwheel * W, void * cookie,
+    const struct timeval * tv)
+{
+	struct timerrec * r = cookie;
+
+	/* If the timer can stay in the heap, adjust it and inform the heap. */
+	if (r->inheap && (gettick(tv) < W->cur)) {
+		memcpy(&r->tv, tv, sizeof(struct timeval));
+		r->tick = gettick(tv);
+		ptrheap_increase(W->H, r->rc);
+		return;
+	}
+
+	/* Otherwise, take it out of the heap or the wheel... */
+	if (r->inheap)
+		ptrheap_delete(W->H, r->rc);
+	else
+		wheel_remove(W, r);
+
+	/* ... adjust the timer value, and put it back into the wheel. */
+	memcpy(&r->tv, tv, sizeof(struct timeval));
+	r->tick = gettick(tv);
+	wheel_insert(W, r);
+}
+
+/**
+ * timerwheel_getmin(W, tv):
+ * Return via ${tv} a pointer to the least timeval in ${W}, or NULL if the
+ * timer wheel is empty.  The pointer will remain valid until the next call to
+ * a timerwheel_* function.
+ */
+int
+timerwheel_getmin(struct timerwheel * W, const struct timeval ** tv)
+{
+	struct timerrec * r;
+
+	/* Make sure the earliest timer is in the heap. */
+	if (settle(W))
+		goto err0;
+
+	/* If we have an element, return its timeval; otherwise, NULL. */
+	if ((r = ptrheap_getmin(W->H)) != NULL)
+		*tv = &r->tv;
+	else
+		*tv = NULL;
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/**
+ * timerwheel_getptr(W, tv, ptr):
+ * If the least timeval in ${W} is less than or equal to ${tv}, return via
+ * ${ptr} the associated pointer and remove the pair from the timer wheel.  If
+ * not, return NULL via ${ptr}.
+ */
+int
+timerwheel_getptr(struct timerwheel * W, const struct timeval * tv,
+    void ** ptr)
+{
+	struct timerrec * r;
+
+	/* Make sure the earliest timer is in the heap. */
+	if (settle(W))
+		goto err0;
+
+	/* If there is no timer or it is later than ${tv}, return NULL. */
+	if (((r = ptrheap_getmin(W->H)) == NULL) || (tvcmp(&r->tv, tv) > 0)) {
+		*ptr = NULL;
+		goto done;
+	}
+
+	/* Remove this record from the heap. */
+	ptrheap_deletemin(W->H);
+
+	/* Extract its pointer. */
+	*ptr = r->ptr;
+
+	/* Free the record. */
+	free(r);
+
+done:
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/**
+ * timerwheel_free(W):
+ * Free the timer wheel ${W}.
+ */
+void
+timerwheel_free(struct timerwheel * W)
+{
+	struct timerrec * r;
+	int k, s;
+
+	/* Behave consistently with free(NULL). */
+	if (W == NULL)
+		return;
+
+	/* Free the records in the wheel. */
+	for (k = 0; k < WHEEL_LEVELS; k++) {
+		for (s = 0; s < WHEEL_SIZE; s++) {
+			while ((r = W->slots[k][s]) != NULL) {
+				list_remove(r);
+				free(r);
+			}
+		}
+	}
+	while ((r = W->overflow) != NULL) {
+		list_remove(r);
+		free(r);
+	}
+
+	/* Extract elements from the heap and free them one by one. */
+	while ((r = ptrheap_getmin(W->H)) != NULL) {
+		free(r);
+		ptrheap_deletemin(W->H);
+	}
+
+	/* Free the heap. */
+	ptrheap_free(W->H);
+
+	/* Free the timer wheel structure. */
+	free(W);
+}
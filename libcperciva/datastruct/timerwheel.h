@@ -0,0 +1,67 @@
+#ifndef TIMERWHEEL_H_
+#define TIMERWHEEL_H_
+
+#include <sys/time.h>
+
+/**
+ * Timer wheel.  Contains (timeval, ptr) pairs, like a timerqueue, but timers
+ * which are not about to expire are kept in a hierarchical timing wheel so
+ * that adding and deleting them takes constant time; only timers which are
+ * due before anything else in the wheel are moved into a priority queue.
+ * Functions return NULL or (int)(-1) on error and set errno; other return
+ * types indicate that failure is not possible.
+ */
+
+/* Opaque timer wheel type. */
+struct timerwheel;
+
+/**
+ * timerwheel_init(void):
+ * Create and return an empty timer wheel.
+ */
+struct timerwheel * timerwheel_init(void);
+
+/**
+ * timerwheel_add(W, tv, ptr):
+ * Add the pair (${tv}, ${ptr}) to the timer wheel ${W}.  Return a cookie
+ * which can be passed to timerwheel_delete() or timerwheel_increase().
+ */
+void * timerwheel_add(struct timerwheel *, const struct timeval *, void *);
+
+/**
+ * timerwheel_delete(W, cookie):
+ * Delete the (timeval, ptr) pair associated with the cookie ${cookie} from
+ * the timer wheel ${W}.
+ */
+void timerwheel_delete(struct timerwheel *, void *);
+
+/**
+ * timerwheel_increase(W, cookie, tv):
+ * Increase the timer associated with the cookie ${cookie} in the timer wheel
+ * ${W} to ${tv}.
+ */
+void timerwheel_increase(struct timerwheel *, void *, const struct timeval *);
+
+/**
+ * timerwheel_getmin(W, tv):
+ * Return via ${tv} a pointer to the least timeval in ${W}, or NULL if the
+ * timer wheel is empty.  The pointer will remain valid until the next call to
+ * a timerwheel_* function.
+ */
+int timerwheel_getmin(struct timerwheel *, const struct timeval **);
+
+/**
+ * timerwheel_getptr(W, tv, ptr):
+ * If the least timeval in ${W} is less than or equal to ${tv}, return via
+ * ${ptr} the associated pointer and remove the pair from the timer wheel.  If
+ * not, return NULL via ${ptr}.
+ */
+int timerwheel_getptr(struct timerwheel *, const struct timeval *, void **);
+
+/**
+ * timerwheel_free(W):
+ * Free the timer wheel ${W}.
+ */
+void timerwheel_free(struct timerwheel *);
+
+#endif /* !TIMERWHEEL_H_ */
@@ -5,6 +5,15 @@
 
 #include <signal.h>
 
+/*
+ * On Linux, use epoll(7) rather than poll(2) to wait for network events, so
+ * that the cost of waiting does not grow with the number of registered
+ * sockets.  Define EVENTS_NETWORK_POLL to use poll(2) anyway.
+ */
+#if defined(__linux__) && !defined(EVENTS_NETWORK_POLL)
+#define EVENTS_NETWORK_EPOLL
+#endif
+
 /* Opaque event structure. */
 struct eventrec;
 
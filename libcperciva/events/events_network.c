@@ -16,6 +16,8 @@
 #include "events.h"
 #include "events_internal.h"
 
+#ifndef EVENTS_NETWORK_EPOLL
+
 /*
  * Sanity checks on the nfds_t type: POSIX simply says "an unsigned integer
  * type used for the number of file descriptors", but it doesn't make sense
@@ -495,3 +497,5 @@ events_network_shutdown(void)
 	socketlist_free(S);
 	S = NULL;
 }
+
+#endif /* !EVENTS_NETWORK_EPOLL */
@@ -0,0 +1,681 @@
+#if defined(__linux__)
+#include <sys/epoll.h>
+#endif
+
+#include <assert.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "elasticarray.h"
+#include "warnp.h"
+
+#include "events.h"
+#include "events_internal.h"
+
+#ifdef EVENTS_NETWORK_EPOLL
+
+/*
+ * This is an implementation of the events_network_* functions using the
+ * Linux epoll(7) interface.  Unlike poll(2), the cost of waiting for events
+ * does not depend on the number of registered sockets; the cost is instead
+ * one epoll_ctl(2) call when a socket's set of registered events changes.
+ *
+ * Descriptors are registered with EPOLLONESHOT, so a descriptor is disarmed
+ * in the kernel as soon as it is returned by epoll_wait(2).  Rather than
+ * re-arming descriptors immediately, we keep a list of descriptors which may
+ * need their kernel registration updated, and process that list just before
+ * calling epoll_wait(2).  A callback which re-registers the event which has
+ * just fired (the usual pattern) thus costs a single epoll_ctl(2) call.
+ *
+ * If the last event for a descriptor is cancelled, we remove the descriptor
+ * from the epoll set immediately: the caller may close the descriptor as soon
+ * as events_network_cancel() returns, and we cannot remove a registration
+ * once the descriptor has been closed.
+ */
+
+/* Structure for holding readability and writability events for a socket. */
+struct socketrec {
+	struct eventrec * reader;
+	struct eventrec * writer;
+	uint32_t revents;	/* Ready events not yet returned. */
+	uint32_t armed;		/* Events armed in the kernel. */
+	int inset;		/* Descriptor is in the epoll set. */
+	int dirty;		/* Descriptor is in the list of changes. */
+};
+
+/* List of sockets. */
+ELASTICARRAY_DECL(SOCKETLIST, socketlist, struct socketrec);
+static SOCKETLIST S = NULL;
+
+/* List of descriptors whose kernel registration may need updating. */
+ELASTICARRAY_DECL(CHANGELIST, changelist, int);
+static CHANGELIST C;
+
+/* The epoll descriptor. */
+static int epfd;
+
+/* Buffer for events returned by epoll_wait. */
+static struct epoll_event * evs;
+
+/* Number of epoll_event structures allocated in the buffer. */
+static size_t evs_alloc;
+
+/* Number of epoll_event structures returned by epoll_wait. */
+static size_t nevs;
+
+/* Position to which events_network_get has scanned in *evs. */
+static size_t evscanpos;
+
+/* Number of descriptors with events registered. */
+static size_t nfds;
+
+/**
+ * Invariants:
+ * 1. The events we want are the events which have eventrecs:
+ *     wanted(i) = (S[i].reader != NULL ? EPOLLIN : 0) |
+ *         (S[i].writer != NULL ? EPOLLOUT : 0)
+ * 2. Descriptors which might need re-arming are in the list of changes:
+ *     S[i].armed != wanted(i) ==> S[i].dirty
+ *     S[i].dirty <==> i appears exactly once in C
+ * 3. Descriptors without events registered aren't armed in the kernel:
+ *     wanted(i) == 0 ==> S[i].armed == 0
+ *     S[i].armed != 0 ==> S[i].inset
+ * 4. We don't have events ready which we don't want:
+ *     (S[i].revents & ~wanted(i)) == 0
+ * 5. nfds is the number of descriptors with wanted(i) != 0.
+ */
+
+static void events_network_shutdown(void);
+
+/* Initialize data structures if we haven't already done so. */
+static int
+init(void)
+{
+
+	/* If we're already initialized, do nothing. */
+	if (S != NULL)
+		goto done;
+
+	/* Create an epoll descriptor. */
+	if ((epfd = epoll_create1(EPOLL_CLOEXEC)) == -1) {
+		warnp("epoll_create1");
+		goto err0;
+	}
+
+	/* Allocate a buffer for returned events. */
+	evs_alloc = 16;
+	if ((evs = malloc(evs_alloc * sizeof(struct epoll_event))) == NULL)
+		goto err1;
+	nevs = evscanpos = 0;
+
+	/* Initialize the list of changes. */
+	if ((C = changelist_init(0)) == NULL)
+		goto err2;
+
+	/* Initialize the socket list. */
+	if ((S = socketlist_init(0)) == NULL)
+		goto err3;
+
+	/* No descriptors have events registered. */
+	nfds = 0;
+
+	/* Clean up the socket list at exit. */
+	if (atexit(events_network_shutdown))
+		goto err4;
+
+done:
+	/* Success! */
+	return (0);
+
+err4:
+	socketlist_free(S);
+	S = NULL;
+err3:
+	changelist_free(C);
+err2:
+	free(evs);
+err1:
+	if (close(epfd))
+		warnp("close");
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* Grow the socket list and initialize new records. */
+static int
+growsocketlist(size_t nrec)
+{
+	struct socketrec * sr;
+	size_t i;
+
+	/* Get the old size. */
+	i = socketlist_getsize(S);
+
+	/* Grow the list. */
+	if (socketlist_resize(S, nrec))
+		goto err0;
+
+	/* Initialize new members. */
+	for (; i < nrec; i++) {
+		sr = socketlist_get(S, i);
+		sr->reader = NULL;
+		sr->writer = NULL;
+		sr->revents = 0;
+		sr->armed = 0;
+		sr->inset = 0;
+		sr->dirty = 0;
+	}
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* Return the set of events which we want for the socket record ${sr}. */
+static uint32_t
+wanted(const struct socketrec * sr)
+{
+
+	return ((sr->reader != NULL ? (uint32_t)EPOLLIN : 0) |
+	    (sr->writer != NULL ? (uint32_t)EPOLLOUT : 0));
+}
+
+/* Add the descriptor ${fd} to the list of changes if it isn't there. */
+static int
+markdirty(int fd)
+{
+	struct socketrec * sr = socketlist_get(S, (size_t)fd);
+
+	/* Nothing to do if it's already listed. */
+	if (sr->dirty)
+		return (0);
+
+	/* Add it to the list. */
+	if (changelist_append(C, &fd, 1))
+		return (-1);
+	sr->dirty = 1;
+
+	/* Success! */
+	return (0);
+}
+
+/* Remove the descriptor ${fd} from the epoll set. */
+static int
+delfd(int fd)
+{
+	struct socketrec * sr = socketlist_get(S, (size_t)fd);
+
+	/* Remove the descriptor. */
+	if (epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL)) {
+		/*
+		 * If the descriptor was closed after its last event fired
+		 * (and was disarmed), the kernel has already forgotten about
+		 * it, or cannot be told about it any more; either is fine.
+		 */
+		if ((errno != EBADF) && (errno != ENOENT)) {
+			warnp("epoll_ctl(EPOLL_CTL_DEL)");
+			goto err0;
+		}
+	}
+
+	/* The descriptor is no longer in the set. */
+	sr->inset = 0;
+	sr->armed = 0;
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* Arm the descriptor ${fd} for the events ${events}. */
+static int
+armfd(int fd, uint32_t events)
+{
+	struct socketrec * sr = socketlist_get(S, (size_t)fd);
+	struct epoll_event ev;
+
+	/* Describe what we want. */
+	ev.events = events | (uint32_t)EPOLLONESHOT;
+	ev.data.fd = fd;
+
+	/*
+	 * Modify the existing registration, or add a new one.  If the
+	 * descriptor was closed and its number re-used since we registered
+	 * it, the kernel has forgotten about it (or, if other references to
+	 * the old socket remain, knows it under a different key) so
+	 * EPOLL_CTL_MOD will fail with ENOENT and we need to add it.
+	 */
+	if (sr->inset) {
+		if (epoll_ctl(epfd, EPOLL_CTL_MOD, fd, &ev) == 0)
+			goto done;
+		if (errno != ENOENT) {
+			warnp("epoll_ctl(EPOLL_CTL_MOD)");
+			goto err0;
+		}
+	}
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev)) {
+		warnp("epoll_ctl(EPOLL_CTL_ADD)");
+		goto err0;
+	}
+
+done:
+	/* Record the kernel state. */
+	sr->inset = 1;
+	sr->armed = events;
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* Bring the kernel's view of each changed descriptor up to date. */
+static int
+applychanges(void)
+{
+	struct socketrec * sr;
+	size_t i;
+	int fd;
+
+	/* Process each changed descriptor. */
+	for (i = 0; i < changelist_getsize(C); i++) {
+		fd = *changelist_get(C, i);
+		sr = socketlist_get(S, (size_t)fd);
+
+		/* This descriptor is no longer dirty. */
+		sr->dirty = 0;
+
+		/* Nothing to do if the right events are already armed. */
+		if (sr->armed == wanted(sr))
+			continue;
+
+		/* Arm the descriptor, or remove it from the set. */
+		if (wanted(sr) != 0) {
+			if (armfd(fd, wanted(sr)))
+				goto err0;
+		} else if (sr->inset) {
+			if (delfd(fd))
+				goto err0;
+		}
+	}
+
+	/* The list of changes is now empty. */
+	if (changelist_resize(C, 0))
+		goto err0;
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Everything is still in the list; we'll try again next time. */
+	for (i = 0; i < changelist_getsize(C); i++)
+		socketlist_get(S, (size_t)*changelist_get(C, i))->dirty = 1;
+
+	/* Failure! */
+	return (-1);
+}
+
+/**
+ * events_network_register(func, cookie, s, op):
+ * Register ${func}(${cookie}) to be run when socket ${s} is ready for
+ * reading or writing depending on whether ${op} is EVENTS_NETWORK_OP_READ or
+ * EVENTS_NETWORK_OP_WRITE.  If there is already an event registration for
+ * this ${s}/${op} pair, errno will be set to EEXIST and the function will
+ * fail.
+ */
+int
+events_network_register(int (* func)(void *), void * cookie, int s, int op)
+{
+	struct socketrec * sr;
+	struct eventrec ** r;
+	int hadevents;
+
+	/* Initialize if necessary. */
+	if (init())
+		goto err0;
+
+	/* Sanity-check socket number. */
+	if (s < 0) {
+		warn0("Invalid file descriptor for network event: %d", s);
+		goto err0;
+	}
+
+	/* Sanity-check operation. */
+	if ((op != EVENTS_NETWORK_OP_READ) &&
+	    (op != EVENTS_NETWORK_OP_WRITE)) {
+		warn0("Invalid operation for network event: %d", op);
+		goto err0;
+	}
+
+	/* Grow the array if necessary. */
+	if (((size_t)(s) >= socketlist_getsize(S)) &&
+	    (growsocketlist((size_t)s + 1) != 0))
+		goto err0;
+
+	/* Look up the relevant event pointer. */
+	sr = socketlist_get(S, (size_t)s);
+	if (op == EVENTS_NETWORK_OP_READ)
+		r = &sr->reader;
+	else
+		r = &sr->writer;
+
+	/* Error out if we already have an event registered. */
+	if (*r != NULL) {
+		errno = EEXIST;
+		goto err0;
+	}
+
+	/* Make sure the kernel will hear about this. */
+	if (markdirty(s))
+		goto err0;
+
+	/* Register the new event. */
+	hadevents = (wanted(sr) != 0);
+	if ((*r = events_mkrec(func, cookie)) == NULL)
+		goto err0;
+
+	/* If we had no events registered, start a clock. */
+	if (nfds == 0)
+		events_network_selectstats_startclock();
+
+	/* We may have one more descriptor with events registered. */
+	if (!hadevents)
+		nfds++;
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/**
+ * events_network_cancel(s, op):
+ * Cancel the event registered for the socket/operation pair ${s}/${op}.  If
+ * there is no such registration, errno will be set to ENOENT and the
+ * function will fail.
+ */
+int
+events_network_cancel(int s, int op)
+{
+	struct socketrec * sr;
+	struct eventrec ** r;
+
+	/* Initialize if necessary. */
+	if (init())
+		goto err0;
+
+	/* Sanity-check socket number. */
+	if (s < 0) {
+		warn0("Invalid file descriptor for network event: %d", s);
+		goto err0;
+	}
+
+	/* Sanity-check operation. */
+	if ((op != EVENTS_NETWORK_OP_READ) &&
+	    (op != EVENTS_NETWORK_OP_WRITE)) {
+		warn0("Invalid operation for network event: %d", op);
+		goto err0;
+	}
+
+	/* We have no events registered beyond the end of the array. */
+	if ((size_t)(s) >= socketlist_getsize(S)) {
+		errno = ENOENT;
+		goto err0;
+	}
+
+	/* Look up the relevant event pointer. */
+	sr = socketlist_get(S, (size_t)s);
+	if (op == EVENTS_NETWORK_OP_READ)
+		r = &sr->reader;
+	else
+		r = &sr->writer;
+
+	/* Check if we have an event. */
+	if (*r == NULL) {
+		errno = ENOENT;
+		goto err0;
+	}
+
+	/* Free the event. */
+	events_freerec(*r);
+	*r = NULL;
+
+	/* We no longer want this type of event. */
+	sr->revents &= wanted(sr);
+
+	/*
+	 * If that was the last event for this descriptor, remove it from the
+	 * epoll set now, since the caller may be about to close it; otherwise
+	 * update the kernel's view before we next wait for events.
+	 */
+	if (wanted(sr) == 0) {
+		nfds--;
+		if (sr->inset && delfd(s))
+			goto err0;
+	} else {
+		if (markdirty(s))
+			goto err0;
+	}
+
+	/* If that was the last remaining event, stop the clock. */
+	if (nfds == 0)
+		events_network_selectstats_stopclock();
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/**
+ * events_network_select(tv, interrupt_requested):
+ * Check for socket readiness events, waiting up to ${tv} time if there are
+ * no sockets immediately ready, or indefinitely if ${tv} is NULL.  The value
+ * stored in ${tv} may be modified.  If ${*interrupt_requested} is non-zero
+ * and a signal is received, exit.
+ */
+int
+events_network_select(const struct timeval * tv,
+    const volatile sig_atomic_t * interrupt_requested)
+{
+	struct epoll_event * new_evs;
+	struct socketrec * sr;
+	uint32_t revents;
+	size_t new_evs_alloc;
+	size_t i;
+	int timeout;
+	int n;
+
+	/* Initialize if necessary. */
+	if (init())
+		goto err0;
+
+	/* Tell the kernel about any changes to registered events. */
+	if (applychanges())
+		goto err0;
+
+	/* Make sure we have room for an event for every descriptor. */
+	if ((evs_alloc < nfds) && (nfds <= INT_MAX)) {
+		new_evs_alloc = evs_alloc;
+		while (new_evs_alloc < nfds)
+			new_evs_alloc *= 2;
+		if (new_evs_alloc > INT_MAX)
+			new_evs_alloc = INT_MAX;
+
+		/* If this fails, we'll just get events over several calls. */
+		if ((new_evs_alloc <= SIZE_MAX / sizeof(struct epoll_event)) &&
+		    ((new_evs = realloc(evs, new_evs_alloc *
+		    sizeof(struct epoll_event))) != NULL)) {
+			evs = new_evs;
+			evs_alloc = new_evs_alloc;
+		}
+	}
+
+	/*
+	 * Convert timeout to an integer number of ms.  We round up in order
+	 * to avoid creating busy loops when 0 < ${tv} < 1 ms.
+	 */
+	if (tv == NULL)
+		timeout = -1;
+	else if (tv->tv_sec >= INT_MAX / 1000)
+		timeout = INT_MAX;
+	else
+		timeout = (int)(tv->tv_sec * 1000 + (tv->tv_usec + 999) / 1000);
+
+	/* We're about to call epoll_wait! */
+	events_network_selectstats_select();
+
+	/* Wait for events. */
+	while ((n = epoll_wait(epfd, evs, (int)evs_alloc, timeout)) == -1) {
+		/* EINTR is harmless, unless we've requested an interrupt. */
+		if (errno == EINTR) {
+			if (*interrupt_requested) {
+				n = 0;
+				break;
+			}
+			continue;
+		}
+
+		/* Anything else is an error. */
+		warnp("epoll_wait");
+		goto err0;
+	}
+
+	/* If we have any events registered, start the clock again. */
+	if (nfds > 0)
+		events_network_selectstats_startclock();
+
+	/* Record which events are ready. */
+	for (i = 0; i < (size_t)n; i++) {
+		sr = socketlist_get(S, (size_t)evs[i].data.fd);
+
+		/* The kernel has disarmed this descriptor. */
+		sr->armed = 0;
+		if (markdirty(evs[i].data.fd))
+			goto err0;
+
+		/*
+		 * If either EPOLLERR or EPOLLHUP is set, then we should
+		 * invoke whatever callbacks we have available.
+		 */
+		revents = evs[i].events;
+		if (revents & (uint32_t)(EPOLLERR | EPOLLHUP))
+			revents |= (uint32_t)(EPOLLIN | EPOLLOUT);
+
+		/* We only want the events we asked for. */
+		sr->revents |= revents & wanted(sr);
+	}
+	nevs = (size_t)n;
+
+	/* Start scanning at the last returned descriptor and work down. */
+	evscanpos = nevs - 1;
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/**
+ * events_network_get(void):
+ * Find a socket readiness event which was identified by a previous call to
+ * events_network_select, and return it as an eventrec structure; or return
+ * NULL if there are no such events available.  The caller is responsible for
+ * freeing the returned memory.
+ */
+struct eventrec *
+events_network_get(void)
+{
+	struct socketrec * sr;
+	struct eventrec * r;
+
+	/* We haven't found any events yet. */
+	r = NULL;
+
+	/* Scan through the returned events looking for ready descriptors. */
+	for (; evscanpos < nevs; evscanpos--) {
+		sr = socketlist_get(S, (size_t)evs[evscanpos].data.fd);
+
+		/* Are we ready for reading? */
+		if (sr->revents & EPOLLIN) {
+			r = sr->reader;
+			sr->reader = NULL;
+			sr->revents &= ~(uint32_t)EPOLLIN;
+		} else if (sr->revents & EPOLLOUT) {
+			r = sr->writer;
+			sr->writer = NULL;
+			sr->revents &= ~(uint32_t)EPOLLOUT;
+		} else {
+			continue;
+		}
+
+		/* Sanity-check. */
+		assert(r != NULL);
+
+		/* Did this descriptor run out of events? */
+		if (wanted(sr) == 0)
+			nfds--;
+		break;
+	}
+
+	/* If we're returning the last registered event, stop the clock. */
+	if ((r != NULL) && (nfds == 0))
+		events_network_selectstats_stopclock();
+
+	/* Return the event we found, or NULL if we didn't find any. */
+	return (r);
+}
+
+/**
+ * events_network_shutdown(void):
+ * Clean up and free memory.  This should run automatically via atexit.
+ */
+static void
+events_network_shutdown(void)
+{
+
+	/* If we're not initialized, do nothing. */
+	if (S == NULL)
+		return;
+
+	/* If we have any registered events, do nothing. */
+	if (nfds > 0)
+		return;
+
+	/* Close the epoll descriptor. */
+	if (close(epfd))
+		warnp("close");
+
+	/* Free the event buffer. */
+	free(evs);
+	evs = NULL;
+	evs_alloc = 0;
+
+	/* Free the list of changes. */
+	changelist_free(C);
+
+	/* Free the socket list. */
+	socketlist_free(S);
+	S = NULL;
+}
+
+#endif /* EVENTS_NETWORK_EPOLL */
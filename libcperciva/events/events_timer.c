@@ -4,7 +4,7 @@
 #include <string.h>
 
 #include "monoclock.h"
-#include "timerqueue.h"
+#include "timerwheel.h"
 
 #include "events.h"
 #include "events_internal.h"
@@ -16,7 +16,7 @@ struct timerrec {
 };
 
 /* This also tracks whether we've initialized the atexit function. */
-static struct timerqueue * Q = NULL;
+static struct timerwheel * Q = NULL;
 
 static void events_timer_shutdown(void);
 
@@ -54,12 +54,12 @@ events_timer_register(int (* func)(void *), void * cookie,
 	struct timerrec * t;
 	struct timeval tv;
 
-	/* Create the timer queue if it doesn't exist yet. */
+	/* Create the timer wheel if it doesn't exist yet. */
 	if (Q == NULL) {
-		if ((Q = timerqueue_init()) == NULL)
+		if ((Q = timerwheel_init()) == NULL)
 			goto err0;
 
-		/* Clean up the timer queue at exit. */
+		/* Clean up the timer wheel at exit. */
 		if (atexit(events_timer_shutdown))
 			goto err0;
 	}
@@ -78,8 +78,8 @@ events_timer_register(int (* func)(void *), void * cookie,
 	if (gettimeout(&tv, &t->tv_orig))
 		goto err2;
 
-	/* Add this to the timer queue. */
-	if ((t->cookie = timerqueue_add(Q, &tv, t)) == NULL)
+	/* Add this to the timer wheel. */
+	if ((t->cookie = timerwheel_add(Q, &tv, t)) == NULL)
 		goto err2;
 
 	/* Success! */
@@ -123,8 +123,8 @@ events_timer_cancel(void * cookie)
 {
 	struct timerrec * t = cookie;
 
-	/* Remove from the timer queue. */
-	timerqueue_delete(Q, t->cookie);
+	/* Remove from the timer wheel. */
+	timerwheel_delete(Q, t->cookie);
 
 	/* Free the eventrec and timer records. */
 	events_freerec(t->r);
@@ -147,7 +147,7 @@ events_timer_reset(void * cookie)
 		goto err0;
 
 	/* Adjust the timer. */
-	timerqueue_increase(Q, t->cookie, &tv);
+	timerwheel_increase(Q, t->cookie, &tv);
 
 	/* Success! */
 	return (0);
@@ -169,14 +169,15 @@ events_timer_min(struct timeval ** timeo)
 	struct timeval tnow;
 	const struct timeval * tv;
 
-	/* If we have no queue, we have no timers; return NULL. */
+	/* If we have no wheel, we have no timers; return NULL. */
 	if (Q == NULL) {
 		*timeo = NULL;
 		goto done;
 	}
 
-	/* Get the minimum timer from the queue. */
-	tv = timerqueue_getmin(Q);
+	/* Get the minimum timer from the wheel. */
+	if (timerwheel_getmin(Q, &tv))
+		goto err0;
 
 	/* If there are no timers, return NULL. */
 	if (tv == NULL) {
@@ -230,8 +231,9 @@ events_timer_get(struct eventrec ** r)
 {
 	struct timeval tnow;
 	struct timerrec * t;
+	void * ptr;
 
-	/* If we have no queue, we have no timers; return NULL. */
+	/* If we have no wheel, we have no timers; return NULL. */
 	if (Q == NULL) {
 		*r = NULL;
 		goto done;
@@ -242,7 +244,9 @@ events_timer_get(struct eventrec ** r)
 		goto err0;
 
 	/* Get an expired timer, if there is one. */
-	t = timerqueue_getptr(Q, &tnow);
+	if (timerwheel_getptr(Q, &tnow, &ptr))
+		goto err0;
+	t = ptr;
 
 	/* If there is an expired timer... */
 	if (t != NULL) {
@@ -270,10 +274,11 @@ err0:
 static void
 events_timer_shutdown(void)
 {
+	const struct timeval * tv;
 
-	/* If we have a queue and it is empty, free it. */
-	if ((Q != NULL) && (timerqueue_getmin(Q) == NULL)) {
-		timerqueue_free(Q);
+	/* If we have a wheel and it is empty, free it. */
+	if ((Q != NULL) && (timerwheel_getmin(Q, &tv) == 0) && (tv == NULL)) {
+		timerwheel_free(Q);
 		Q = NULL;
 	}
 }
@@ -24,6 +24,13 @@ struct netbuf_read * netbuf_read_init(int);
  */
 void netbuf_read_peek(struct netbuf_read *, uint8_t **, size_t *);
 
+/**
+ * netbuf_read_reserve(R, len):
+ * Make sure that ${R} has room to buffer at least ${len} bytes, so that a
+ * single read may return up to that much data.
+ */
+int netbuf_read_reserve(struct netbuf_read *, size_t);
+
 /**
  * netbuf_read_wait(R, len, callback, cookie):
  * Wait until ${R} has ${len} or more bytes of data buffered or an error
@@ -138,6 +138,30 @@ err0:
 	return (-1);
 }
 
+/**
+ * netbuf_read_reserve(R, len):
+ * Make sure that ${R} has room to buffer at least ${len} bytes, so that a
+ * single read may return up to that much data.
+ */
+int
+netbuf_read_reserve(struct netbuf_read * R, size_t len)
+{
+
+	/* Sanity-check: We shouldn't be reading already. */
+	assert(R->read_cookie == NULL);
+
+	/* Resize the buffer if needed. */
+	if ((R->buflen < len) && netbuf_read_resize_buffer(R, len))
+		goto err0;
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
 /**
  * netbuf_read_wait(R, len, callback, cookie):
  * Wait until ${R} has ${len} or more bytes of data buffered or an error
@@ -10,6 +10,9 @@
 /* Opaque address structure. */
 struct sock_addr;
 
+/* Defined in <sys/uio.h>. */
+struct iovec;
+
 /**
  * network_accept(fd, callback, cookie):
  * Asynchronously accept a connection on the socket ${fd}, which must be
@@ -52,6 +55,35 @@ void * network_connect(struct sock_addr * const *,
 void * network_connect_bind(struct sock_addr * const *,
     const struct sock_addr *, int (*)(void *, int), void *);
 
+/**
+ * network_connect_bind_race(sas, sa_b, stagger, callback, cookie):
+ * Behave as network_connect_bind(), but if an attempt to connect to an
+ * address has neither succeeded nor failed after ${stagger}, start attempting
+ * the next address while continuing to wait for the earlier ones, and use
+ * whichever connects first; and attempt the addresses in an order which
+ * alternates between address families, starting with the family of the first
+ * address.  This is the "Happy Eyeballs" algorithm of RFC 8305.
+ */
+void * network_connect_bind_race(struct sock_addr * const *,
+    const struct sock_addr *, const struct timeval *, int (*)(void *, int),
+    void *);
+
+/**
+ * network_connect_bind_report(sas, sa_b, stagger, callback_report,
+ *     callback, cookie):
+ * Behave as network_connect_bind_race() if ${stagger} is not NULL, or as
+ * network_connect_bind() otherwise; but before invoking ${callback}, invoke
+ * ${callback_report}(${cookie}, sa, connected) for each address sa which was
+ * attempted, with connected non-zero for the address which connected and zero
+ * for each address which failed.  An attempt which is still in progress when
+ * a later attempt connects is reported as having failed; attempts which
+ * started after the one which connected are not reported.
+ */
+void * network_connect_bind_report(struct sock_addr * const *,
+    const struct sock_addr *, const struct timeval *,
+    int (*)(void *, const struct sock_addr *, int), int (*)(void *, int),
+    void *);
+
 /**
  * network_connect_timeo(sas, timeo, callback, cookie):
  * Behave as network_connect(), but wait a duration of at most ${timeo} for
@@ -67,6 +99,15 @@ void * network_connect_timeo(struct sock_addr * const *, const struct timeval *,
  */
 void network_connect_cancel(void *);
 
+/**
+ * network_connect_giveup(cookie):
+ * Report each address which the connection attempt ${cookie}, which was
+ * returned by network_connect_bind_report(), is still waiting for as having
+ * failed, and then cancel the connection attempt as network_connect_cancel()
+ * does.  Return -1 if the report callback failed, and 0 otherwise.
+ */
+int network_connect_giveup(void *);
+
 /**
  * network_read(fd, buf, buflen, minread, callback, cookie):
  * Asynchronously read up to ${buflen} bytes of data from ${fd} into ${buf}.
@@ -98,10 +139,23 @@ void network_read_cancel(void *);
 void * network_write(int, const uint8_t *, size_t, size_t,
     int (*)(void *, ssize_t), void *);
 
+/**
+ * network_writev(fd, iov, iovcnt, minwrite, callback, cookie):
+ * Asynchronously write the data described by the ${iovcnt} elements of
+ * ${iov} to ${fd}, gathering it into as few system calls as possible.  The
+ * array ${iov} must remain valid until the callback is invoked or the write
+ * is cancelled.  Otherwise, behave as network_write() with ${buflen} equal
+ * to the total length of the elements of ${iov}; the returned cookie can be
+ * passed to network_write_cancel().
+ */
+void * network_writev(int, const struct iovec *, int, size_t,
+    int (*)(void *, ssize_t), void *);
+
 /**
  * network_write_cancel(cookie):
  * Cancel the buffer write for which the cookie ${cookie} was returned by
- * network_write().  Do not invoke the callback associated with the write.
+ * network_write() or network_writev().  Do not invoke the callback associated
+ * with the write.
  */
 void network_write_cancel(void *);
 
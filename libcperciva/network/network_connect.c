@@ -8,24 +8,109 @@
 
 #include "events.h"
 #include "sock.h"
+#include "sock_util.h"
 #include "warnp.h"
 
 #include "network.h"
 
+/* A single in-progress connection attempt. */
+struct connect_attempt {
+	struct connect_cookie * C;
+	const struct sock_addr * sa;
+	size_t seq;
+	int s;
+	void * cookie_timeo;
+};
+
 struct connect_cookie {
+	int (* callback_report)(void *, const struct sock_addr *, int);
 	int (* callback)(void *, int);
 	void * cookie;
 	struct sock_addr * const * sas;
+	struct sock_addr ** sas_order;
 	const struct sock_addr * sa_b;
 	struct timeval timeo;
+	int timeo_enabled;
+	struct timeval stagger;
+	int stagger_enabled;
+	void * cookie_stagger;
 	void * cookie_immediate;
 	int s;
-	int timeo_enabled;
-	void * cookie_timeo;
+	struct connect_attempt * attempts;
+	size_t nattempts;
+	size_t ninflight;
+	size_t nstarted;
 };
 
 static int tryconnect(struct connect_cookie *);
 
+/* Close the socket of a connection attempt which is no longer waiting. */
+static void
+attempt_close(struct connect_attempt * A)
+{
+
+	/* Cancel any timer. */
+	if (A->cookie_timeo != NULL) {
+		events_timer_cancel(A->cookie_timeo);
+		A->cookie_timeo = NULL;
+	}
+
+	/* Close the socket. */
+	if (close(A->s))
+		warnp("close");
+
+	/* This slot is free again. */
+	A->s = -1;
+	A->C->ninflight -= 1;
+}
+
+/* Stop an in-progress connection attempt and close its socket. */
+static void
+attempt_cancel(struct connect_attempt * A)
+{
+
+	/* Stop listening for this socket. */
+	events_network_cancel(A->s, EVENTS_NETWORK_OP_WRITE);
+
+	/* Close it. */
+	attempt_close(A);
+}
+
+/* Cancel everything in progress and free the cookie. */
+static void
+cleanup(struct connect_cookie * C)
+{
+	size_t i;
+
+	/* Cancel any connection attempts. */
+	for (i = 0; i < C->nattempts; i++) {
+		if (C->attempts[i].s != -1)
+			attempt_cancel(&C->attempts[i]);
+	}
+
+	/* Cancel any timer for starting the next attempt. */
+	if (C->cookie_stagger != NULL)
+		events_timer_cancel(C->cookie_stagger);
+
+	/* Free the cookie. */
+	free(C->attempts);
+	free(C->sas_order);
+	free(C);
+}
+
+/* Tell the upstream code whether we could connect to ${sa}. */
+static int
+report(struct connect_cookie * C, const struct sock_addr * sa, int connected)
+{
+
+	/* Nothing to do if nobody is listening. */
+	if (C->callback_report == NULL)
+		return (0);
+
+	/* Invoke the upstream callback. */
+	return ((C->callback_report)(C->cookie, sa, connected));
+}
+
 /* Invoke the upstream callback and clean up. */
 static int
 docallback(void * cookie)
@@ -37,7 +122,7 @@ docallback(void * cookie)
 	rc = (C->callback)(C->cookie, C->s);
 
 	/* Free the cookie. */
-	free(C);
+	cleanup(C);
 
 	/* Return status from upstream callback. */
 	return (rc);
@@ -45,42 +130,67 @@ docallback(void * cookie)
 
 /* An address failed to connect. */
 static int
-dofailed(struct connect_cookie * C)
+dofailed(struct connect_attempt * A)
 {
 
-	/* Close the socket which failed to connect. */
-	if (close(C->s))
-		warnp("close");
+	struct connect_cookie * C = A->C;
 
-	/* We don't have an open socket any more. */
-	C->s = -1;
+	/* Close the socket which failed to connect. */
+	attempt_close(A);
 
-	/* This address didn't work. */
-	C->sas++;
+	/* Report the failure. */
+	if (report(C, A->sa, 0))
+		goto err0;
 
 	/* Try other addresses until we run out of options. */
 	return (tryconnect(C));
+
+err0:
+	cleanup(C);
+
+	/* Fatal error! */
+	return (-1);
 }
 
 /* Callback when connect(2) succeeds or fails. */
 static int
 callback_connect(void * cookie)
 {
-	struct connect_cookie * C = cookie;
+	struct connect_attempt * A = cookie;
+	struct connect_cookie * C = A->C;
 	int sockerr;
 	socklen_t sockerrlen = sizeof(int);
+	size_t i;
 
 	/* Stop waiting for the timer callback. */
-	if (C->cookie_timeo != NULL) {
-		events_timer_cancel(C->cookie_timeo);
-		C->cookie_timeo = NULL;
+	if (A->cookie_timeo != NULL) {
+		events_timer_cancel(A->cookie_timeo);
+		A->cookie_timeo = NULL;
 	}
 
 	/* Did we succeed? */
-	if (getsockopt(C->s, SOL_SOCKET, SO_ERROR, &sockerr, &sockerrlen))
+	if (getsockopt(A->s, SOL_SOCKET, SO_ERROR, &sockerr, &sockerrlen))
 		goto err1;
 	if (sockerr != 0)
-		return (dofailed(C));
+		return (dofailed(A));
+
+	/* Take this socket; cleanup() will cancel any other attempts. */
+	C->s = A->s;
+	A->s = -1;
+	C->ninflight -= 1;
+
+	/*
+	 * Attempts which started before this one and are still waiting have
+	 * lost the race; report them as having failed, and report this one as
+	 * having connected.
+	 */
+	for (i = 0; i < C->nattempts; i++) {
+		if ((C->attempts[i].s != -1) && (C->attempts[i].seq < A->seq) &&
+		    report(C, C->attempts[i].sa, 0))
+			goto err2;
+	}
+	if (report(C, A->sa, 1))
+		goto err2;
 
 	/*
 	 * Perform the callback (this can be done here rather than being
@@ -89,10 +199,17 @@ callback_connect(void * cookie)
 	 */
 	return (docallback(C));
 
-err1:
+err2:
 	if (close(C->s))
 		warnp("close");
-	free(C);
+	cleanup(C);
+
+	/* Fatal error! */
+	return (-1);
+
+err1:
+	attempt_close(A);
+	cleanup(C);
 
 	/* Fatal error! */
 	return (-1);
@@ -102,78 +219,173 @@ err1:
 static int
 callback_timeo(void * cookie)
 {
-	struct connect_cookie * C = cookie;
+	struct connect_attempt * A = cookie;
 
 	/* We're not waiting for a timer callback any more. */
-	C->cookie_timeo = NULL;
+	A->cookie_timeo = NULL;
 
 	/* Stop listening for this socket. */
-	events_network_cancel(C->s, EVENTS_NETWORK_OP_WRITE);
+	events_network_cancel(A->s, EVENTS_NETWORK_OP_WRITE);
 
 	/* This connect attempt failed. */
-	return (dofailed(C));
+	return (dofailed(A));
+}
+
+/* Callback when it is time to start racing the next address. */
+static int
+callback_stagger(void * cookie)
+{
+	struct connect_cookie * C = cookie;
+
+	/* We're not waiting for a timer callback any more. */
+	C->cookie_stagger = NULL;
+
+	/* Start connecting to the next address. */
+	return (tryconnect(C));
 }
 
-/* Try to launch a connection.  Free the cookie on fatal errors. */
+/*
+ * Try to launch a connection, or schedule the failure callback if there are
+ * no addresses left and no attempts in progress.  Free the cookie on fatal
+ * errors.
+ */
 static int
 tryconnect(struct connect_cookie * C)
 {
+	struct connect_attempt * A;
+	size_t i;
+
+	/* Don't start another attempt early; we'll start one now. */
+	if (C->cookie_stagger != NULL) {
+		events_timer_cancel(C->cookie_stagger);
+		C->cookie_stagger = NULL;
+	}
+
+	/* Find a free slot; there is one for every attempt we might make. */
+	for (i = 0; i < C->nattempts; i++) {
+		if (C->attempts[i].s == -1)
+			break;
+	}
+	assert(i < C->nattempts);
+	A = &C->attempts[i];
 
 	/* Try addresses until we find one which doesn't fail immediately. */
 	for (; C->sas[0] != NULL; C->sas++) {
 		/* Can we try to connect to this address? */
-		if ((C->s = sock_connect_bind_nb(C->sas[0], C->sa_b)) != -1)
+		if ((A->s = sock_connect_bind_nb(C->sas[0], C->sa_b)) != -1)
 			break;
+
+		/* Report the failure. */
+		if (report(C, C->sas[0], 0))
+			goto err0;
 	}
 
 	/* Did we run out of addresses to try? */
-	if (C->sas[0] == NULL)
+	if (C->sas[0] == NULL) {
+		/* Wait for the attempts which are still in progress. */
+		if (C->ninflight > 0)
+			return (0);
 		goto failed;
+	}
+	A->sa = C->sas[0];
+	A->seq = C->nstarted++;
+	C->sas++;
+	C->ninflight += 1;
 
 	/* If we've been asked to have a timeout, set one. */
 	if (C->timeo_enabled) {
-		if ((C->cookie_timeo = events_timer_register(callback_timeo,
-		    C, &C->timeo)) == NULL)
+		if ((A->cookie_timeo = events_timer_register(callback_timeo,
+		    A, &C->timeo)) == NULL)
 			goto err1;
-	} else {
-		C->cookie_timeo = NULL;
 	}
 
 	/* Wait until this socket connects or fails to do so. */
-	if (events_network_register(callback_connect, C, C->s,
+	if (events_network_register(callback_connect, A, A->s,
 	    EVENTS_NETWORK_OP_WRITE))
-		goto err2;
+		goto err1;
+
+	/* If we're racing, start the next address if this one is slow. */
+	if (C->stagger_enabled && (C->sas[0] != NULL)) {
+		if ((C->cookie_stagger = events_timer_register(
+		    callback_stagger, C, &C->stagger)) == NULL)
+			goto err2;
+	}
 
 	/* Success! */
 	return (0);
 
 failed:
 	/* Schedule a callback. */
+	C->s = -1;
 	if ((C->cookie_immediate =
 	    events_immediate_register(docallback, C, 0)) == NULL)
-		goto err1;
+		goto err0;
 
 	/* Failure successfully handled. */
 	return (0);
 
 err2:
-	if (C->cookie_timeo != NULL)
-		events_timer_cancel(C->cookie_timeo);
+	events_network_cancel(A->s, EVENTS_NETWORK_OP_WRITE);
 err1:
-	if ((C->s != -1) && close(C->s))
-		warnp("close");
-	free(C);
+	attempt_close(A);
+err0:
+	cleanup(C);
 
 	/* Fatal error. */
 	return (-1);
 }
 
+/*
+ * Order the addresses ${sas} so that address families alternate, starting
+ * with the family of the first address, as recommended by RFC 8305.
+ */
+static struct sock_addr **
+interleave(struct sock_addr * const * sas, size_t n)
+{
+	struct sock_addr ** order;
+	size_t i, j, k;
+	int family;
+
+	/* Allocate a NULL-terminated list. */
+	if ((order = malloc((n + 1) * sizeof(struct sock_addr *))) == NULL)
+		goto err0;
+
+	/*
+	 * Walk through the addresses of the first family (i) and of other
+	 * families (j) in their original order, taking one of each in turn.
+	 */
+	family = (n > 0) ? sock_addr_family(sas[0]) : 0;
+	for (i = j = k = 0; k < n; k++) {
+		while ((i < n) && (sock_addr_family(sas[i]) != family))
+			i++;
+		while ((j < n) && (sock_addr_family(sas[j]) == family))
+			j++;
+		if ((i < n) && ((j == n) || (k % 2 == 0)))
+			order[k] = sas[i++];
+		else
+			order[k] = sas[j++];
+	}
+	order[n] = NULL;
+
+	/* Success! */
+	return (order);
+
+err0:
+	/* Failure! */
+	return (NULL);
+}
+
 /**
- * network_connect_internal(sas, sa_b, timeo, callback, cookie):
+ * network_connect_internal(sas, sa_b, timeo, stagger, callback_report,
+ *     callback, cookie):
  * Iterate through the addresses in ${sas}, attempting to create and connect
  * a non-blocking socket.  If ${timeo} is not NULL, wait a duration of at
- * most ${timeo} for each address which is being attempted.  If ${sa_b} is
- * not NULL, then bind the socket to ${sa_b}.
+ * most ${timeo} for each address which is being attempted.  If ${stagger} is
+ * not NULL, start attempting the next address after ${stagger} even if the
+ * previous attempts are still in progress, and interleave address families.
+ * If ${sa_b} is not NULL, then bind the socket to ${sa_b}.  If
+ * ${callback_report} is not NULL, report the outcome of each attempt as
+ * network_connect_bind_report() does.
  *
  * Once connected, invoke ${callback}(${cookie}, s) where s is the connected
  * socket; upon fatal error or if there are no addresses remaining to
@@ -184,20 +396,28 @@ err1:
 static void *
 network_connect_internal(struct sock_addr * const * sas,
     const struct sock_addr * sa_b, const struct timeval * timeo,
+    const struct timeval * stagger,
+    int (* callback_report)(void *, const struct sock_addr *, int),
     int (* callback)(void *, int), void * cookie)
 {
 	struct connect_cookie * C;
+	size_t n;
+	size_t i;
 
 	/* Bake a cookie. */
 	if ((C = malloc(sizeof(struct connect_cookie))) == NULL)
 		goto err0;
+	C->callback_report = callback_report;
 	C->callback = callback;
 	C->cookie = cookie;
 	C->sas = sas;
+	C->sas_order = NULL;
 	C->sa_b = sa_b;
+	C->cookie_stagger = NULL;
 	C->cookie_immediate = NULL;
-	C->cookie_timeo = NULL;
 	C->s = -1;
+	C->ninflight = 0;
+	C->nstarted = 0;
 
 	/* Do we have a timeout? */
 	if (timeo != NULL) {
@@ -207,6 +427,35 @@ network_connect_internal(struct sock_addr * const * sas,
 		C->timeo_enabled = 0;
 	}
 
+	/* Are we racing addresses? */
+	if (stagger != NULL) {
+		memcpy(&C->stagger, stagger, sizeof(struct timeval));
+		C->stagger_enabled = 1;
+
+		/* Alternate between address families. */
+		for (n = 0; sas[n] != NULL; n++)
+			continue;
+		if ((C->sas_order = interleave(sas, n)) == NULL)
+			goto err1;
+		C->sas = C->sas_order;
+	} else {
+		C->stagger_enabled = 0;
+		n = 1;
+	}
+
+	/* We might have an attempt in progress for every address. */
+	C->nattempts = (n > 0) ? n : 1;
+	if ((C->attempts =
+	    malloc(C->nattempts * sizeof(struct connect_attempt))) == NULL)
+		goto err2;
+	for (i = 0; i < C->nattempts; i++) {
+		C->attempts[i].C = C;
+		C->attempts[i].sa = NULL;
+		C->attempts[i].seq = 0;
+		C->attempts[i].s = -1;
+		C->attempts[i].cookie_timeo = NULL;
+	}
+
 	/* Try to connect to the first address. */
 	if (tryconnect(C))
 		goto err0;
@@ -214,6 +463,10 @@ network_connect_internal(struct sock_addr * const * sas,
 	/* Success! */
 	return (C);
 
+err2:
+	free(C->sas_order);
+err1:
+	free(C);
 err0:
 	/* Failure! */
 	return (NULL);
@@ -234,7 +487,8 @@ network_connect(struct sock_addr * const * sas,
 {
 
 	/* Let network_connect_internal handle this. */
-	return (network_connect_internal(sas, NULL, NULL, callback, cookie));
+	return (network_connect_internal(sas, NULL, NULL, NULL, NULL,
+	    callback, cookie));
 }
 
 /**
@@ -254,7 +508,51 @@ network_connect_bind(struct sock_addr * const * sas,
 {
 
 	/* Let network_connect_internal handle this. */
-	return (network_connect_internal(sas, sa_b, NULL, callback, cookie));
+	return (network_connect_internal(sas, sa_b, NULL, NULL, NULL,
+	    callback, cookie));
+}
+
+/**
+ * network_connect_bind_race(sas, sa_b, stagger, callback, cookie):
+ * Behave as network_connect_bind(), but if an attempt to connect to an
+ * address has neither succeeded nor failed after ${stagger}, start attempting
+ * the next address while continuing to wait for the earlier ones, and use
+ * whichever connects first; and attempt the addresses in an order which
+ * alternates between address families, starting with the family of the first
+ * address.  This is the "Happy Eyeballs" algorithm of RFC 8305.
+ */
+void *
+network_connect_bind_race(struct sock_addr * const * sas,
+    const struct sock_addr * sa_b, const struct timeval * stagger,
+    int (* callback)(void *, int), void * cookie)
+{
+
+	/* Let network_connect_internal handle this. */
+	return (network_connect_internal(sas, sa_b, NULL, stagger, NULL,
+	    callback, cookie));
+}
+
+/**
+ * network_connect_bind_report(sas, sa_b, stagger, callback_report,
+ *     callback, cookie):
+ * Behave as network_connect_bind_race() if ${stagger} is not NULL, or as
+ * network_connect_bind() otherwise; but before invoking ${callback}, invoke
+ * ${callback_report}(${cookie}, sa, connected) for each address sa which was
+ * attempted, with connected non-zero for the address which connected and zero
+ * for each address which failed.  An attempt which is still in progress when
+ * a later attempt connects is reported as having failed; attempts which
+ * started after the one which connected are not reported.
+ */
+void *
+network_connect_bind_report(struct sock_addr * const * sas,
+    const struct sock_addr * sa_b, const struct timeval * stagger,
+    int (* callback_report)(void *, const struct sock_addr *, int),
+    int (* callback)(void *, int), void * cookie)
+{
+
+	/* Let network_connect_internal handle this. */
+	return (network_connect_internal(sas, sa_b, NULL, stagger,
+	    callback_report, callback, cookie));
 }
 
 /**
@@ -269,7 +567,8 @@ network_connect_timeo(struct sock_addr * const * sas,
 {
 
 	/* Let network_connect_internal handle this. */
-	return (network_connect_internal(sas, NULL, timeo, callback, cookie));
+	return (network_connect_internal(sas, NULL, timeo, NULL, NULL,
+	    callback, cookie));
 }
 
 /**
@@ -283,24 +582,41 @@ network_connect_cancel(void * cookie)
 	struct connect_cookie * C = cookie;
 
 	/* We should have either an immediate callback or a socket. */
-	assert((C->cookie_immediate != NULL) || (C->s != -1));
-	assert((C->cookie_immediate == NULL) || (C->s == -1));
-
-	/* Cancel any timer. */
-	if (C->cookie_timeo != NULL)
-		events_timer_cancel(C->cookie_timeo);
+	assert((C->cookie_immediate != NULL) || (C->ninflight > 0));
+	assert((C->cookie_immediate == NULL) || (C->ninflight == 0));
 
 	/* Cancel any immediate callback. */
 	if (C->cookie_immediate != NULL)
 		events_immediate_cancel(C->cookie_immediate);
 
-	/* Close any socket. */
-	if (C->s != -1) {
-		events_network_cancel(C->s, EVENTS_NETWORK_OP_WRITE);
-		if (close(C->s))
-			warnp("close");
+	/* Cancel any attempts and timers, and free the cookie. */
+	cleanup(C);
+}
+
+/**
+ * network_connect_giveup(cookie):
+ * Report each address which the connection attempt ${cookie}, which was
+ * returned by network_connect_bind_report(), is still waiting for as having
+ * failed, and then cancel the connection attempt as network_connect_cancel()
+ * does.  Return -1 if the report callback failed, and 0 otherwise.
+ */
+int
+network_connect_giveup(void * cookie)
+{
+	struct connect_cookie * C = cookie;
+	size_t i;
+	int rc = 0;
+
+	/* Report the addresses we're still waiting for. */
+	for (i = 0; i < C->nattempts; i++) {
+		if ((C->attempts[i].s != -1) &&
+		    report(C, C->attempts[i].sa, 0))
+			rc = -1;
 	}
 
-	/* Free the cookie. */
-	free(C);
+	/* Cancel the connection attempt. */
+	network_connect_cancel(C);
+
+	/* Return status from the report callback. */
+	return (rc);
 }
@@ -10,6 +10,7 @@
 #include "mpool.h"
 
 #include "network.h"
+#include "network_uring.h"
 
 struct network_read_cookie {
 	int (* callback)(void *, ssize_t);
@@ -114,6 +115,11 @@ network_read(int fd, uint8_t * buf, size_t buflen, size_t minread,
 {
 	struct network_read_cookie * C;
 
+	/* Use the io_uring engine if it has been enabled. */
+	if (network_uring_enabled())
+		return (network_uring_read(fd, buf, buflen, minread, callback,
+		    cookie));
+
 	/* Make sure buflen is non-zero. */
 	assert(buflen != 0);
 
@@ -156,6 +162,12 @@ network_read_cancel(void * cookie)
 {
 	struct network_read_cookie * C = cookie;
 
+	/* Operations started via the io_uring engine are cancelled there. */
+	if (network_uring_enabled()) {
+		network_uring_cancel(cookie);
+		return;
+	}
+
 	/* Kill the network event. */
 	events_network_cancel(C->fd, EVENTS_NETWORK_OP_READ);
 
@@ -0,0 +1,963 @@
+/*
+ * io_uring is accessed via raw system calls, which are not exposed in strict
+ * POSIX mode; and we need MSG_NOSIGNAL for send(2).  This must happen before
+ * the regular includes.
+ */
+#if defined(__linux__)
+#define _BSD_SOURCE 1
+#define _DEFAULT_SOURCE 1
+#endif
+
+/* Only use io_uring if we have the kernel header which defines it. */
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define NETWORK_URING
+#endif
+#endif
+
+#ifdef NETWORK_URING
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+
+#include <linux/io_uring.h>
+#endif
+
+#include <assert.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "events.h"
+#include "mpool.h"
+#include "queue.h"
+#include "warnp.h"
+
+#include "network_uring.h"
+
+#ifdef NETWORK_URING
+
+/*
+ * Rather than waiting for each socket to become readable or writable and
+ * then calling recv(2) or send(2), we queue RECV and SEND operations for the
+ * kernel.  Operations started while events are being run are collected in a
+ * list and written to the submission queue by a single low-priority immediate
+ * event, which submits all of them with one io_uring_enter(2) call.  Socket
+ * operations which cannot complete immediately are parked inside the kernel
+ * (IORING_FEAT_FAST_POLL) rather than being retried by us; completions are
+ * read directly from the shared completion queue, and we wait for the io_uring
+ * descriptor itself to become readable when we need more of them.
+ *
+ * Cancelling an operation which the kernel owns is synchronous: we submit an
+ * IORING_OP_ASYNC_CANCEL and reap completions until the cancelled operation's
+ * completion arrives, since the caller may free the buffer or close the
+ * descriptor as soon as network_uring_cancel() returns.  Other completions
+ * reaped while doing this are queued and dispatched later.
+ */
+
+/* Number of submission queue entries to request. */
+#define SQ_ENTRIES 256
+
+/* Number of completion queue entries to request. */
+#define CQ_ENTRIES 4096
+
+/* Operation types. */
+#define OP_READ		0
+#define OP_WRITE	1
+#define OP_WRITEV	2
+
+/* Some platforms don't define IOV_MAX; POSIX requires it to be at least 16. */
+#ifndef IOV_MAX
+#define IOV_MAX 16
+#endif
+
+/* Operation states. */
+#define STATE_QUEUED	0	/* In the pending list. */
+#define STATE_INFLIGHT	1	/* Owned by the kernel. */
+#define STATE_DONE	2	/* In the completed list. */
+
+struct network_uring_op {
+	int (* callback)(void *, ssize_t);
+	void * cookie;
+	int fd;
+	int op;
+	uint8_t * buf;
+	size_t buflen;
+	size_t minlen;
+	size_t bufpos;
+	const struct iovec * iov;	/* OP_WRITEV only. */
+	int iovcnt;
+	int iovpos;
+	size_t iovoff;
+	struct msghdr msg;
+	int state;
+	int res;
+	TAILQ_ENTRY(network_uring_op) entries;
+};
+
+MPOOL(network_uring_op, struct network_uring_op, 16);
+
+TAILQ_HEAD(oplist, network_uring_op);
+
+/* The io_uring instance. */
+static struct ring {
+	int fd;
+	void * sq_ring;
+	size_t sq_ring_len;
+	void * sqes_map;
+	size_t sqes_len;
+
+	/* Submission queue. */
+	unsigned * sq_head;
+	unsigned * sq_tail;
+	unsigned * sq_mask;
+	unsigned * sq_flags;
+	struct io_uring_sqe * sqes;
+
+	/* Completion queue. */
+	unsigned * cq_head;
+	unsigned * cq_tail;
+	unsigned * cq_mask;
+	struct io_uring_cqe * cqes;
+} R;
+
+/* Is the engine active? */
+static int enabled = 0;
+
+/* Operations waiting to be submitted, and completed but not dispatched. */
+static struct oplist pending = TAILQ_HEAD_INITIALIZER(pending);
+static struct oplist completed = TAILQ_HEAD_INITIALIZER(completed);
+
+/* Number of operations owned by the kernel. */
+static size_t ninflight = 0;
+
+/* Cookie from events_immediate_register, if a flush is scheduled. */
+static void * flush_cookie = NULL;
+
+/* Are we waiting for the io_uring descriptor to become readable? */
+static int ring_registered = 0;
+
+static int callback_flush(void *);
+static int callback_ring(void *);
+
+/* Wrapper for io_uring_setup(2). */
+static int
+sys_io_uring_setup(unsigned entries, struct io_uring_params * p)
+{
+
+	return ((int)syscall(__NR_io_uring_setup, entries, p));
+}
+
+/* Wrapper for io_uring_enter(2). */
+static int
+sys_io_uring_enter(unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+
+	return ((int)syscall(__NR_io_uring_enter, R.fd, to_submit,
+	    min_complete, flags, NULL, 0));
+}
+
+/* Call io_uring_enter(2), retrying if interrupted by a signal. */
+static int
+ring_enter(unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+
+	while (sys_io_uring_enter(to_submit, min_complete, flags) == -1) {
+		if (errno == EINTR)
+			continue;
+		warnp("io_uring_enter");
+		goto err0;
+	}
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* Return a free submission queue entry, or NULL if the queue is full. */
+static struct io_uring_sqe *
+sqe_get(void)
+{
+	unsigned head = __atomic_load_n(R.sq_head, __ATOMIC_ACQUIRE);
+	unsigned tail = *R.sq_tail;
+	struct io_uring_sqe * sqe;
+
+	/* Is the queue full? */
+	if (tail - head > *R.sq_mask)
+		return (NULL);
+
+	/* Clear the entry. */
+	sqe = &R.sqes[tail & *R.sq_mask];
+	memset(sqe, 0, sizeof(struct io_uring_sqe));
+
+	/* The caller fills in the entry and then calls sqe_push(). */
+	return (sqe);
+}
+
+/* Publish the most recent entry returned by sqe_get(). */
+static void
+sqe_push(void)
+{
+
+	__atomic_store_n(R.sq_tail, *R.sq_tail + 1, __ATOMIC_RELEASE);
+}
+
+/* Return the number of published entries not yet consumed by the kernel. */
+static unsigned
+sq_unsubmitted(void)
+{
+
+	return (*R.sq_tail - __atomic_load_n(R.sq_head, __ATOMIC_ACQUIRE));
+}
+
+/* Move completed operations from the completion queue to the list. */
+static int
+reap(void)
+{
+	struct network_uring_op * O;
+	struct io_uring_cqe * cqe;
+	unsigned head, tail;
+
+	do {
+		/* Process all available completions. */
+		head = *R.cq_head;
+		tail = __atomic_load_n(R.cq_tail, __ATOMIC_ACQUIRE);
+		for (; head != tail; head++) {
+			cqe = &R.cqes[head & *R.cq_mask];
+
+			/* Ignore the completions of cancellation requests. */
+			if (cqe->user_data == 0)
+				continue;
+
+			/* Record the result. */
+			O = (struct network_uring_op *)(uintptr_t)cqe->user_data;
+			assert(O->state == STATE_INFLIGHT);
+			O->res = cqe->res;
+			O->state = STATE_DONE;
+			TAILQ_INSERT_TAIL(&completed, O, entries);
+			ninflight--;
+		}
+		__atomic_store_n(R.cq_head, head, __ATOMIC_RELEASE);
+
+		/* If the kernel kept completions for us, ask for them. */
+		if (!(__atomic_load_n(R.sq_flags, __ATOMIC_ACQUIRE) &
+		    IORING_SQ_CQ_OVERFLOW))
+			break;
+		if (ring_enter(0, 0, IORING_ENTER_GETEVENTS))
+			goto err0;
+	} while (1);
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* Fill in ${sqe} to send data from the iovec array of ${O}. */
+static void
+prep_writev(struct network_uring_op * O, struct io_uring_sqe * sqe)
+{
+	const struct iovec * iov = &O->iov[O->iovpos];
+
+	/* If we're part-way through an element, finish it first. */
+	if (O->iovoff > 0) {
+		sqe->opcode = IORING_OP_SEND;
+		sqe->addr = (uint64_t)(uintptr_t)iov->iov_base + O->iovoff;
+		sqe->len = (iov->iov_len - O->iovoff > UINT32_MAX) ?
+		    UINT32_MAX : (uint32_t)(iov->iov_len - O->iovoff);
+		return;
+	}
+
+	/* Otherwise, gather as many elements as we can. */
+	memset(&O->msg, 0, sizeof(struct msghdr));
+	O->msg.msg_iov = (struct iovec *)(uintptr_t)iov;
+	O->msg.msg_iovlen = (O->iovcnt - O->iovpos > IOV_MAX) ?
+	    IOV_MAX : (size_t)(O->iovcnt - O->iovpos);
+	sqe->opcode = IORING_OP_SENDMSG;
+	sqe->addr = (uint64_t)(uintptr_t)&O->msg;
+	sqe->len = 1;
+}
+
+/* Advance the position within the iovec array of ${O} by ${len} bytes. */
+static void
+iov_advance(struct network_uring_op * O, size_t len)
+{
+
+	while ((O->iovpos < O->iovcnt) &&
+	    (len >= O->iov[O->iovpos].iov_len - O->iovoff)) {
+		len -= O->iov[O->iovpos].iov_len - O->iovoff;
+		O->iovpos++;
+		O->iovoff = 0;
+	}
+	O->iovoff += len;
+}
+
+/* Write pending operations into the submission queue and submit them. */
+static int
+submit(void)
+{
+	struct network_uring_op * O;
+	struct io_uring_sqe * sqe;
+
+	do {
+		/* Fill as many submission queue entries as we can. */
+		while ((O = TAILQ_FIRST(&pending)) != NULL) {
+			if ((sqe = sqe_get()) == NULL)
+				break;
+			if (O->op == OP_WRITEV) {
+				prep_writev(O, sqe);
+			} else {
+				sqe->opcode = (O->op == OP_READ) ?
+				    IORING_OP_RECV : IORING_OP_SEND;
+				sqe->addr = (uint64_t)(uintptr_t)&O->buf[O->bufpos];
+				sqe->len = (O->buflen - O->bufpos > UINT32_MAX) ?
+				    UINT32_MAX : (uint32_t)(O->buflen - O->bufpos);
+			}
+			if (O->op != OP_READ)
+				sqe->msg_flags = MSG_NOSIGNAL;
+			sqe->fd = O->fd;
+			sqe->user_data = (uint64_t)(uintptr_t)O;
+			sqe_push();
+
+			/* The kernel owns this operation now. */
+			TAILQ_REMOVE(&pending, O, entries);
+			O->state = STATE_INFLIGHT;
+			ninflight++;
+		}
+
+		/* Nothing to do? */
+		if (sq_unsubmitted() == 0)
+			break;
+
+		/* Submit the entries. */
+		if (sys_io_uring_enter(sq_unsubmitted(), 0, 0) == -1) {
+			switch (errno) {
+			case EINTR:
+				break;
+			case EAGAIN:
+			case EBUSY:
+				/* Make room by collecting completions. */
+				if (reap())
+					goto err0;
+				break;
+			default:
+				warnp("io_uring_enter");
+				goto err0;
+			}
+		}
+	} while (1);
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* Make sure that queued work will be picked up by the event loop. */
+static int
+schedule(void)
+{
+
+	/* Flush pending operations and dispatch completions soon. */
+	if ((flush_cookie == NULL) &&
+	    (!TAILQ_EMPTY(&pending) || !TAILQ_EMPTY(&completed))) {
+		/* Run after other immediate events, so that we batch more. */
+		if ((flush_cookie =
+		    events_immediate_register(callback_flush, NULL, 31)) == NULL)
+			goto err0;
+	}
+
+	/* Wait for completions of operations owned by the kernel. */
+	if ((ring_registered == 0) && (ninflight > 0)) {
+		if (events_network_register(callback_ring, NULL, R.fd,
+		    EVENTS_NETWORK_OP_READ))
+			goto err0;
+		ring_registered = 1;
+	}
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* Invoke the callback for ${O}, clean up, and return the callback's status. */
+static int
+docallback(struct network_uring_op * O, ssize_t nbytes)
+{
+	int rc;
+
+	/* Invoke the callback. */
+	rc = (O->callback)(O->cookie, nbytes);
+
+	/* Clean up. */
+	mpool_network_uring_op_free(O);
+
+	/* Return the callback's status. */
+	return (rc);
+}
+
+/* Process a completed operation. */
+static int
+complete(struct network_uring_op * O)
+{
+
+	/* Failure? */
+	if (O->res < 0) {
+		/* Was it really an error, or just a try-again? */
+		if ((O->res == -EAGAIN) ||
+#if EAGAIN != EWOULDBLOCK
+		    (O->res == -EWOULDBLOCK) ||
+#endif
+		    (O->res == -EINTR))
+			goto tryagain;
+
+		/* Something went wrong. */
+		errno = -O->res;
+		goto failed;
+	} else if (O->res == 0) {
+		/* The socket was shut down by the remote host. */
+		if (O->op == OP_READ)
+			goto eof;
+
+		/* We should never see a send length of zero. */
+		goto failed;
+	}
+
+	/* We processed some data. */
+	O->bufpos += (size_t)O->res;
+	if (O->op == OP_WRITEV)
+		iov_advance(O, (size_t)O->res);
+
+	/* Do we need to keep going? */
+	if (O->bufpos < O->minlen)
+		goto tryagain;
+
+	/* Sanity-check: buffer position must fit into a ssize_t. */
+	assert(O->bufpos <= SSIZE_MAX);
+
+	/* Invoke the callback and return. */
+	return (docallback(O, (ssize_t)O->bufpos));
+
+tryagain:
+	/* Queue the operation again. */
+	O->state = STATE_QUEUED;
+	TAILQ_INSERT_TAIL(&pending, O, entries);
+
+	/* Success! */
+	return (0);
+
+eof:
+	/* Invoke the callback with an EOF status and return. */
+	return (docallback(O, 0));
+
+failed:
+	/* Invoke the callback with a failure status and return. */
+	return (docallback(O, -1));
+}
+
+/* Submit pending operations, collect completions, and dispatch them. */
+static int
+run(void)
+{
+	struct network_uring_op * O;
+	int rc = 0;
+
+	/* Submit everything which has been queued. */
+	if (submit())
+		goto err0;
+
+	/* Collect anything which completed inside io_uring_enter. */
+	if (reap())
+		goto err0;
+
+	/* Dispatch completions until a callback asks us to stop. */
+	while ((rc == 0) && ((O = TAILQ_FIRST(&completed)) != NULL)) {
+		TAILQ_REMOVE(&completed, O, entries);
+		rc = complete(O);
+	}
+
+	/* Make sure any remaining work gets done. */
+	if (schedule())
+		goto err0;
+
+	/* Return the status of the last callback. */
+	return (rc);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* Submit queued operations. */
+static int
+callback_flush(void * cookie)
+{
+
+	(void)cookie; /* UNUSED */
+
+	/* This callback is no longer pending. */
+	flush_cookie = NULL;
+
+	/* Do the work. */
+	return (run());
+}
+
+/* The completion queue is not empty. */
+static int
+callback_ring(void * cookie)
+{
+
+	(void)cookie; /* UNUSED */
+
+	/* This callback is no longer pending. */
+	ring_registered = 0;
+
+	/* Do the work. */
+	return (run());
+}
+
+/* Create an operation and queue it for submission. */
+static void *
+queue_op(int op, int fd, uint8_t * buf, const struct iovec * iov, int iovcnt,
+    size_t buflen, size_t minlen, int (* callback)(void *, ssize_t),
+    void * cookie)
+{
+	struct network_uring_op * O;
+
+	/* Make sure buflen is non-zero. */
+	assert(buflen != 0);
+
+	/* Sanity-check: # bytes must fit into a ssize_t. */
+	assert(buflen <= SSIZE_MAX);
+
+	/* Bake a cookie. */
+	if ((O = mpool_network_uring_op_malloc()) == NULL)
+		goto err0;
+	O->callback = callback;
+	O->cookie = cookie;
+	O->fd = fd;
+	O->op = op;
+	O->buf = buf;
+	O->buflen = buflen;
+	O->minlen = minlen;
+	O->bufpos = 0;
+	O->iov = iov;
+	O->iovcnt = iovcnt;
+	O->iovpos = 0;
+	O->iovoff = 0;
+
+	/* Queue the operation. */
+	O->state = STATE_QUEUED;
+	TAILQ_INSERT_TAIL(&pending, O, entries);
+
+	/* Make sure it gets submitted. */
+	if (schedule())
+		goto err1;
+
+	/* Success! */
+	return (O);
+
+err1:
+	TAILQ_REMOVE(&pending, O, entries);
+	mpool_network_uring_op_free(O);
+err0:
+	/* Failure! */
+	return (NULL);
+}
+
+/**
+ * network_uring_init(void):
+ * Attempt to create an io_uring instance and route subsequent network_read()
+ * and network_write() operations through it, so that the reads and writes
+ * started while running events are submitted to the kernel in a single
+ * system call and their completions are collected in a single pass.  If
+ * io_uring is not supported by the platform or the running kernel, return -1
+ * and leave the poll-based code paths in use.  This must not be called while
+ * any network_read() or network_write() operations are in progress.
+ */
+int
+network_uring_init(void)
+{
+	struct io_uring_params p;
+	unsigned * sq_array;
+	unsigned i;
+
+	/* Sanity-check: We shouldn't be running already. */
+	assert(enabled == 0);
+
+	/* Create the io_uring instance. */
+	memset(&p, 0, sizeof(struct io_uring_params));
+	p.flags = IORING_SETUP_CQSIZE;
+	p.cq_entries = CQ_ENTRIES;
+	if ((R.fd = sys_io_uring_setup(SQ_ENTRIES, &p)) == -1)
+		goto err0;
+
+	/*
+	 * We need completions to never be dropped, a single mapping for both
+	 * rings, and (most importantly) socket operations which wait in the
+	 * kernel for readiness rather than in a worker thread.
+	 */
+	if (!(p.features & IORING_FEAT_NODROP) ||
+	    !(p.features & IORING_FEAT_SINGLE_MMAP) ||
+	    !(p.features & IORING_FEAT_FAST_POLL)) {
+		errno = ENOTSUP;
+		goto err1;
+	}
+
+	/* Map the submission and completion rings. */
+	R.sq_ring_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	if (R.sq_ring_len < p.cq_off.cqes +
+	    p.cq_entries * sizeof(struct io_uring_cqe))
+		R.sq_ring_len = p.cq_off.cqes +
+		    p.cq_entries * sizeof(struct io_uring_cqe);
+	if ((R.sq_ring = mmap(NULL, R.sq_ring_len, PROT_READ | PROT_WRITE,
+	    MAP_SHARED | MAP_POPULATE, R.fd, IORING_OFF_SQ_RING)) ==
+	    MAP_FAILED)
+		goto err1;
+
+	/* Map the submission queue entries. */
+	R.sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+	if ((R.sqes_map = mmap(NULL, R.sqes_len, PROT_READ | PROT_WRITE,
+	    MAP_SHARED | MAP_POPULATE, R.fd, IORING_OFF_SQES)) == MAP_FAILED)
+		goto err2;
+
+	/* Find the pieces of the rings. */
+	R.sq_head = (unsigned *)((uint8_t *)R.sq_ring + p.sq_off.head);
+	R.sq_tail = (unsigned *)((uint8_t *)R.sq_ring + p.sq_off.tail);
+	R.sq_mask = (unsigned *)((uint8_t *)R.sq_ring + p.sq_off.ring_mask);
+	R.sq_flags = (unsigned *)((uint8_t *)R.sq_ring + p.sq_off.flags);
+	sq_array = (unsigned *)((uint8_t *)R.sq_ring + p.sq_off.array);
+	R.sqes = R.sqes_map;
+	R.cq_head = (unsigned *)((uint8_t *)R.sq_ring + p.cq_off.head);
+	R.cq_tail = (unsigned *)((uint8_t *)R.sq_ring + p.cq_off.tail);
+	R.cq_mask = (unsigned *)((uint8_t *)R.sq_ring + p.cq_off.ring_mask);
+	R.cqes = (struct io_uring_cqe *)((uint8_t *)R.sq_ring +
+	    p.cq_off.cqes);
+
+	/* Submission queue slot i always holds entry i. */
+	for (i = 0; i < p.sq_entries; i++)
+		sq_array[i] = i;
+
+	/* We're ready to go. */
+	enabled = 1;
+
+	/* Success! */
+	return (0);
+
+err2:
+	munmap(R.sq_ring, R.sq_ring_len);
+err1:
+	close(R.fd);
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/**
+ * network_uring_enabled(void):
+ * Return non-zero if network_uring_init() has succeeded and
+ * network_uring_shutdown() has not been called since.
+ */
+int
+network_uring_enabled(void)
+{
+
+	return (enabled);
+}
+
+/**
+ * network_uring_read(fd, buf, buflen, minread, callback, cookie):
+ * Behave as network_read(), using the io_uring instance.
+ */
+void *
+network_uring_read(int fd, uint8_t * buf, size_t buflen, size_t minread,
+    int (* callback)(void *, ssize_t), void * cookie)
+{
+
+	/* Queue a read. */
+	return (queue_op(OP_READ, fd, buf, NULL, 0, buflen, minread, callback,
+	    cookie));
+}
+
+/**
+ * network_uring_write(fd, buf, buflen, minwrite, callback, cookie):
+ * Behave as network_write(), using the io_uring instance.
+ */
+void *
+network_uring_write(int fd, const uint8_t * buf, size_t buflen,
+    size_t minwrite, int (* callback)(void *, ssize_t), void * cookie)
+{
+
+	/* Queue a write; the kernel will not modify the buffer. */
+	return (queue_op(OP_WRITE, fd, (uint8_t *)(uintptr_t)buf, NULL, 0,
+	    buflen, minwrite, callback, cookie));
+}
+
+/**
+ * network_uring_writev(fd, iov, iovcnt, minwrite, callback, cookie):
+ * Behave as network_writev(), using the io_uring instance.
+ */
+void *
+network_uring_writev(int fd, const struct iovec * iov, int iovcnt,
+    size_t minwrite, int (* callback)(void *, ssize_t), void * cookie)
+{
+	size_t buflen = 0;
+	int i;
+
+	/* Add up the total length. */
+	for (i = 0; i < iovcnt; i++)
+		buflen += iov[i].iov_len;
+
+	/* Queue a gathering write. */
+	return (queue_op(OP_WRITEV, fd, NULL, iov, iovcnt, buflen, minwrite,
+	    callback, cookie));
+}
+
+/**
+ * network_uring_cancel(cookie):
+ * Cancel the operation for which the cookie ${cookie} was returned by
+ * network_uring_read(), network_uring_write(), or network_uring_writev().  Do
+ * not invoke the callback associated with the operation.  Once this returns,
+ * the kernel will no longer access the operation's buffer or descriptor.
+ */
+void
+network_uring_cancel(void * cookie)
+{
+	struct network_uring_op * O = cookie;
+	struct io_uring_sqe * sqe;
+
+	/* If the kernel owns the operation, take it back. */
+	if (O->state == STATE_INFLIGHT) {
+		/* Submit anything pending to make room for our request. */
+		if (submit())
+			goto fatal;
+
+		/* Ask the kernel to cancel the operation. */
+		if ((sqe = sqe_get()) == NULL) {
+			warn0("io_uring submission queue is full");
+			goto fatal;
+		}
+		sqe->opcode = IORING_OP_ASYNC_CANCEL;
+		sqe->fd = -1;
+		sqe->addr = (uint64_t)(uintptr_t)O;
+		sqe->user_data = 0;
+		sqe_push();
+		if (ring_enter(sq_unsubmitted(), 0, 0))
+			goto fatal;
+
+		/* Wait until the operation completes, one way or another. */
+		do {
+			if (reap())
+				goto fatal;
+			if (O->state == STATE_DONE)
+				break;
+			if (ring_enter(0, 1, IORING_ENTER_GETEVENTS))
+				goto fatal;
+		} while (1);
+
+		/* Other completions may now need to be dispatched. */
+		if (schedule())
+			goto fatal;
+	}
+
+	/* Remove the operation from whichever list it is in. */
+	if (O->state == STATE_QUEUED)
+		TAILQ_REMOVE(&pending, O, entries);
+	else
+		TAILQ_REMOVE(&completed, O, entries);
+
+	/* Free the cookie. */
+	mpool_network_uring_op_free(O);
+
+	/* Done. */
+	return;
+
+fatal:
+	/*
+	 * We cannot return while the kernel might still write into a buffer
+	 * which the caller is about to free.
+	 */
+	warn0("Failed to cancel io_uring operation");
+	abort();
+}
+
+/**
+ * network_uring_shutdown(void):
+ * Destroy the io_uring instance created by network_uring_init(), and revert
+ * to using the poll-based code paths.  This must not be called while any
+ * network_read() or network_write() operations are in progress.
+ */
+void
+network_uring_shutdown(void)
+{
+
+	/* Behave consistently with free(NULL). */
+	if (enabled == 0)
+		return;
+
+	/* Sanity-check: No operations may be in progress. */
+	assert(TAILQ_EMPTY(&pending));
+	assert(TAILQ_EMPTY(&completed));
+	assert(ninflight == 0);
+
+	/* Cancel any outstanding events. */
+	if (flush_cookie != NULL) {
+		events_immediate_cancel(flush_cookie);
+		flush_cookie = NULL;
+	}
+	if (ring_registered) {
+		events_network_cancel(R.fd, EVENTS_NETWORK_OP_READ);
+		ring_registered = 0;
+	}
+
+	/* Tear down the io_uring instance. */
+	munmap(R.sqes_map, R.sqes_len);
+	munmap(R.sq_ring, R.sq_ring_len);
+	close(R.fd);
+
+	/* We're no longer running. */
+	enabled = 0;
+}
+
+#else /* !NETWORK_URING */
+
+/**
+ * network_uring_init(void):
+ * Attempt to create an io_uring instance and route subsequent network_read()
+ * and network_write() operations through it, so that the reads and writes
+ * started while running events are submitted to the kernel in a single
+ * system call and their completions are collected in a single pass.  If
+ * io_uring is not supported by the platform or the running kernel, return -1
+ * and leave the poll-based code paths in use.  This must not be called while
+ * any network_read() or network_write() operations are in progress.
+ */
+int
+network_uring_init(void)
+{
+
+	/* Not supported on this platform. */
+	errno = ENOTSUP;
+	return (-1);
+}
+
+/**
+ * network_uring_enabled(void):
+ * Return non-zero if network_uring_init() has succeeded and
+ * network_uring_shutdown() has not been called since.
+ */
+int
+network_uring_enabled(void)
+{
+
+	/* We never succeed in starting. */
+	return (0);
+}
+
+/**
+ * network_uring_read(fd, buf, buflen, minread, callback, cookie):
+ * Behave as network_read(), using the io_uring instance.
+ */
+void *
+network_uring_read(int fd, uint8_t * buf, size_t buflen, size_t minread,
+    int (* callback)(void *, ssize_t), void * cookie)
+{
+
+	(void)fd; /* UNUSED */
+	(void)buf; /* UNUSED */
+	(void)buflen; /* UNUSED */
+	(void)minread; /* UNUSED */
+	(void)callback; /* UNUSED */
+	(void)cookie; /* UNUSED */
+
+	/* This should never be called. */
+	assert(0);
+	return (NULL);
+}
+
+/**
+ * network_uring_write(fd, buf, buflen, minwrite, callback, cookie):
+ * Behave as network_write(), using the io_uring instance.
+ */
+void *
+network_uring_write(int fd, const uint8_t * buf, size_t buflen,
+    size_t minwrite, int (* callback)(void *, ssize_t), void * cookie)
+{
+
+	(void)fd; /* UNUSED */
+	(void)buf; /* UNUSED */
+	(void)buflen; /* UNUSED */
+	(void)minwrite; /* UNUSED */
+	(void)callback; /* UNUSED */
+	(void)cookie; /* UNUSED */
+
+	/* This should never be called. */
+	assert(0);
+	return (NULL);
+}
+
+/**
+ * network_uring_writev(fd, iov, iovcnt, minwrite, callback, cookie):
+ * Behave as network_writev(), using the io_uring instance.
+ */
+void *
+network_uring_writev(int fd, const struct iovec * iov, int iovcnt,
+    size_t minwrite, int (* callback)(void *, ssize_t), void * cookie)
+{
+
+	(void)fd; /* UNUSED */
+	(void)iov; /* UNUSED */
+	(void)iovcnt; /* UNUSED */
+	(void)minwrite; /* UNUSED */
+	(void)callback; /* UNUSED */
+	(void)cookie; /* UNUSED */
+
+	/* This should never be called. */
+	assert(0);
+	return (NULL);
+}
+
+/**
+ * network_uring_cancel(cookie):
+ * Cancel the operation for which the cookie ${cookie} was returned by
+ * network_uring_read(), network_uring_write(), or network_uring_writev().  Do
+ * not invoke the callback associated with the operation.  Once this returns,
+ * the kernel will no longer access the operation's buffer or descriptor.
+ */
+void
+network_uring_cancel(void * cookie)
+{
+
+	(void)cookie; /* UNUSED */
+
+	/* This should never be called. */
+	assert(0);
+}
+
+/**
+ * network_uring_shutdown(void):
+ * Destroy the io_uring instance created by network_uring_init(), and revert
+ * to using the poll-based code paths.  This must not be called while any
+ * network_read() or network_write() operations are in progress.
+ */
+void
+network_uring_shutdown(void)
+{
+
+	/* Nothing to do. */
+}
+
+#endif /* !NETWORK_URING */
@@ -0,0 +1,68 @@
+#ifndef NETWORK_URING_H_
+#define NETWORK_URING_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <unistd.h>
+
+/* Defined in <sys/uio.h>. */
+struct iovec;
+
+/**
+ * network_uring_init(void):
+ * Attempt to create an io_uring instance and route subsequent network_read()
+ * and network_write() operations through it, so that the reads and writes
+ * started while running events are submitted to the kernel in a single
+ * system call and their completions are collected in a single pass.  If
+ * io_uring is not supported by the platform or the running kernel, return -1
+ * and leave the poll-based code paths in use.  This must not be called while
+ * any network_read() or network_write() operations are in progress.
+ */
+int network_uring_init(void);
+
+/**
+ * network_uring_enabled(void):
+ * Return non-zero if network_uring_init() has succeeded and
+ * network_uring_shutdown() has not been called since.
+ */
+int network_uring_enabled(void);
+
+/**
+ * network_uring_read(fd, buf, buflen, minread, callback, cookie):
+ * Behave as network_read(), using the io_uring instance.
+ */
+void * network_uring_read(int, uint8_t *, size_t, size_t,
+    int (*)(void *, ssize_t), void *);
+
+/**
+ * network_uring_write(fd, buf, buflen, minwrite, callback, cookie):
+ * Behave as network_write(), using the io_uring instance.
+ */
+void * network_uring_write(int, const uint8_t *, size_t, size_t,
+    int (*)(void *, ssize_t), void *);
+
+/**
+ * network_uring_writev(fd, iov, iovcnt, minwrite, callback, cookie):
+ * Behave as network_writev(), using the io_uring instance.
+ */
+void * network_uring_writev(int, const struct iovec *, int, size_t,
+    int (*)(void *, ssize_t), void *);
+
+/**
+ * network_uring_cancel(cookie):
+ * Cancel the operation for which the cookie ${cookie} was returned by
+ * network_uring_read(), network_uring_write(), or network_uring_writev().  Do
+ * not invoke the callback associated with the operation.  Once this returns,
+ * the kernel will no longer access the operation's buffer or descriptor.
+ */
+void network_uring_cancel(void *);
+
+/**
+ * network_uring_shutdown(void):
+ * Destroy the io_uring instance created by network_uring_init(), and revert
+ * to using the poll-based code paths.  This must not be called while any
+ * network_read() or network_write() operations are in progress.
+ */
+void network_uring_shutdown(void);
+
+#endif /* !NETWORK_URING_H_ */
@@ -1,4 +1,5 @@
 #include <sys/socket.h>
+#include <sys/uio.h>
 
 #include <assert.h>
 #include <errno.h>
@@ -6,12 +7,14 @@
 #include <signal.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "events.h"
 #include "mpool.h"
 #include "warnp.h"
 
 #include "network.h"
+#include "network_uring.h"
 
 /**
  * POSIX.1-2008 requires that MSG_NOSIGNAL be defined as a flag for send(2)
@@ -30,6 +33,11 @@
 #endif
 #endif
 
+/* Some platforms don't define IOV_MAX; POSIX requires it to be at least 16. */
+#ifndef IOV_MAX
+#define IOV_MAX 16
+#endif
+
 struct network_write_cookie {
 	int (* callback)(void *, ssize_t);
 	void * cookie;
@@ -38,6 +46,10 @@ struct network_write_cookie {
 	size_t buflen;
 	size_t minlen;
 	size_t bufpos;
+	const struct iovec * iov;	/* NULL unless gathering. */
+	int iovcnt;
+	int iovpos;
+	size_t iovoff;
 };
 
 MPOOL(network_write_cookie, struct network_write_cookie, 16);
@@ -58,6 +70,40 @@ docallback(struct network_write_cookie * C, ssize_t nbytes)
 	return (rc);
 }
 
+/* Advance the position within the iovec array by ${len} bytes. */
+static void
+iov_advance(struct network_write_cookie * C, size_t len)
+{
+
+	while ((C->iovpos < C->iovcnt) &&
+	    (len >= C->iov[C->iovpos].iov_len - C->iovoff)) {
+		len -= C->iov[C->iovpos].iov_len - C->iovoff;
+		C->iovpos++;
+		C->iovoff = 0;
+	}
+	C->iovoff += len;
+}
+
+/* Send data from the iovec array, starting at the current position. */
+static ssize_t
+sendiov(struct network_write_cookie * C)
+{
+	const struct iovec * iov = &C->iov[C->iovpos];
+	struct msghdr msg;
+
+	/* If we're part-way through an element, finish it first. */
+	if (C->iovoff > 0)
+		return (send(C->fd, (const uint8_t *)iov->iov_base + C->iovoff,
+		    iov->iov_len - C->iovoff, MSG_NOSIGNAL));
+
+	/* Otherwise, gather as many elements as we can. */
+	memset(&msg, 0, sizeof(struct msghdr));
+	msg.msg_iov = (struct iovec *)(uintptr_t)iov;
+	msg.msg_iovlen = (C->iovcnt - C->iovpos > IOV_MAX) ?
+	    IOV_MAX : C->iovcnt - C->iovpos;
+	return (sendmsg(C->fd, &msg, MSG_NOSIGNAL));
+}
+
 /* The socket is ready for reading/writing. */
 static int
 callback_buf(void * cookie)
@@ -79,8 +125,12 @@ callback_buf(void * cookie)
 #endif
 
 	/* Attempt to read/write data to/from the buffer. */
-	oplen = C->buflen - C->bufpos;
-	len = send(C->fd, C->buf + C->bufpos, oplen, MSG_NOSIGNAL);
+	if (C->iov != NULL) {
+		len = sendiov(C);
+	} else {
+		oplen = C->buflen - C->bufpos;
+		len = send(C->fd, C->buf + C->bufpos, oplen, MSG_NOSIGNAL);
+	}
 
 	/* We should never see a send length of zero. */
 	assert(len != 0);
@@ -115,6 +165,8 @@ callback_buf(void * cookie)
 
 	/* We processed some data. */
 	C->bufpos += (size_t)len;
+	if (C->iov != NULL)
+		iov_advance(C, (size_t)len);
 
 	/* Do we need to keep going? */
 	if (C->bufpos < C->minlen)
@@ -155,6 +207,11 @@ network_write(int fd, const uint8_t * buf, size_t buflen, size_t minwrite,
 {
 	struct network_write_cookie * C;
 
+	/* Use the io_uring engine if it has been enabled. */
+	if (network_uring_enabled())
+		return (network_uring_write(fd, buf, buflen, minwrite, callback,
+		    cookie));
+
 	/* Make sure buflen is non-zero. */
 	assert(buflen != 0);
 
@@ -171,6 +228,69 @@ network_write(int fd, const uint8_t * buf, size_t buflen, size_t minwrite,
 	C->buflen = buflen;
 	C->minlen = minwrite;
 	C->bufpos = 0;
+	C->iov = NULL;
+
+	/* Register a callback for network readiness. */
+	if (events_network_register(callback_buf, C, C->fd,
+	    EVENTS_NETWORK_OP_WRITE))
+		goto err1;
+
+	/* Success! */
+	return (C);
+
+err1:
+	mpool_network_write_cookie_free(C);
+err0:
+	/* Failure! */
+	return (NULL);
+}
+
+/**
+ * network_writev(fd, iov, iovcnt, minwrite, callback, cookie):
+ * Asynchronously write the data described by the ${iovcnt} elements of
+ * ${iov} to ${fd}, gathering it into as few system calls as possible.  The
+ * array ${iov} must remain valid until the callback is invoked or the write
+ * is cancelled.  Otherwise, behave as network_write() with ${buflen} equal
+ * to the total length of the elements of ${iov}; the returned cookie can be
+ * passed to network_write_cancel().
+ */
+void *
+network_writev(int fd, const struct iovec * iov, int iovcnt, size_t minwrite,
+    int (* callback)(void *, ssize_t), void * cookie)
+{
+	struct network_write_cookie * C;
+	size_t buflen = 0;
+	int i;
+
+	/* Use the io_uring engine if it has been enabled. */
+	if (network_uring_enabled())
+		return (network_uring_writev(fd, iov, iovcnt, minwrite,
+		    callback, cookie));
+
+	/* Add up the total length. */
+	for (i = 0; i < iovcnt; i++)
+		buflen += iov[i].iov_len;
+
+	/* Make sure buflen is non-zero. */
+	assert(buflen != 0);
+
+	/* Sanity-check: # bytes must fit into a ssize_t. */
+	assert(buflen <= SSIZE_MAX);
+
+	/* Bake a cookie. */
+	if ((C = mpool_network_write_cookie_malloc()) == NULL)
+		goto err0;
+	C->callback = callback;
+	C->cookie = cookie;
+	C->fd = fd;
+	C->buf = NULL;
+	C->buflen = buflen;
+	C->minlen = minwrite;
+	C->bufpos = 0;
+	C->iov = iov;
+	C->iovcnt = iovcnt;
+	C->iovpos = 0;
+	C->iovoff = 0;
 
 	/* Register a callback for network readiness. */
 	if (events_network_register(callback_buf, C, C->fd,
@@ -190,13 +310,20 @@ err0:
 /**
  * network_write_cancel(cookie):
  * Cancel the buffer write for which the cookie ${cookie} was returned by
- * network_write().  Do not invoke the callback associated with the write.
+ * network_write() or network_writev().  Do not invoke the callback associated
+ * with the write.
  */
 void
 network_write_cancel(void * cookie)
 {
 	struct network_write_cookie * C = cookie;
 
+	/* Operations started via the io_uring engine are cancelled there. */
+	if (network_uring_enabled()) {
+		network_uring_cancel(cookie);
+		return;
+	}
+
 	/* Kill the network event. */
 	events_network_cancel(C->fd, EVENTS_NETWORK_OP_WRITE);
 
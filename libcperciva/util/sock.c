@@ -20,6 +20,7 @@
 
 #include "sock.h"
 #include "sock_internal.h"
+#include "sock_reuseport.h"
 #include "sock_util.h"
 
 /* Convert a path into a socket address. */
@@ -305,6 +306,47 @@ err0:
 	return (NULL);
 }
 
+/**
+ * sock_addr_pickone(addr, sas):
+ * Return the first of the addresses ${sas}, which were resolved from ${addr},
+ * and free the others and the list.  Warn if there is more than one address.
+ * If there are no addresses, warn, free the list, and return NULL.
+ */
+struct sock_addr *
+sock_addr_pickone(const char * addr, struct sock_addr ** sas)
+{
+	struct sock_addr * sa;
+	struct sock_addr ** sa_tmp;
+
+	/* Check that the array is not empty. */
+	if (sas[0] == NULL) {
+		warn0("No addresses found for %s", addr);
+		goto err0;
+	}
+
+	/* If there's more than one address, give a warning. */
+	if (sas[1] != NULL)
+		warn0("Using the first of multiple addresses found for %s",
+		    addr);
+
+	/* Keep the address we want. */
+	sa = sas[0];
+
+	/* Free the other addresses and list. */
+	for (sa_tmp = &sas[1]; *sa_tmp != NULL; sa_tmp++)
+		sock_addr_free(*sa_tmp);
+	free(sas);
+
+	/* Success! */
+	return (sa);
+
+err0:
+	sock_addr_freelist(sas);
+
+	/* Failure! */
+	return (NULL);
+}
+
 /**
  * sock_resolve_one(addr, addport):
  * Return a single sock_addr structure, or NULL if there are no addresses.
@@ -317,7 +359,6 @@ sock_resolve_one(const char * addr, int addport)
 {
 	struct sock_addr ** sas;
 	struct sock_addr * sa;
-	struct sock_addr ** sa_tmp;
 	char * addr_alloc = NULL;
 
 	/* Prepare the address to resolve. */
@@ -333,24 +374,9 @@ sock_resolve_one(const char * addr, int addport)
 		goto err1;
 	}
 
-	/* Check that the array is not empty. */
-	if (sas[0] == NULL) {
-		warn0("No addresses found for %s", addr);
-		goto err2;
-	}
-
-	/* If there's more than one address, give a warning. */
-	if (sas[1] != NULL)
-		warn0("Using the first of multiple addresses found for %s",
-		    addr);
-
-	/* Keep the address we want. */
-	sa = sas[0];
-
-	/* Free the other addresses and list. */
-	for (sa_tmp = &sas[1]; *sa_tmp != NULL; sa_tmp++)
-		sock_addr_free(*sa_tmp);
-	free(sas);
+	/* Keep the first address. */
+	if ((sa = sock_addr_pickone(addr, sas)) == NULL)
+		goto err1;
 
 	/* Clean up. */
 	free(addr_alloc);
@@ -358,8 +384,6 @@ sock_resolve_one(const char * addr, int addport)
 	/* Success! */
 	return (sa);
 
-err2:
-	sock_addr_freelist(sas);
 err1:
 	free(addr_alloc);
 err0:
@@ -367,13 +391,9 @@ err0:
 	return (NULL);
 }
 
-/**
- * sock_listener(sa):
- * Create a socket, attempt to set SO_REUSEADDR, bind it to the socket address
- * ${sa}, mark it for listening, and mark it as non-blocking.
- */
-int
-sock_listener(const struct sock_addr * sa)
+/* Create a listening socket, optionally with SO_REUSEPORT set. */
+static int
+sock_listener_internal(const struct sock_addr * sa, int reuseport)
 {
 	int s;
 	int val = 1;
@@ -393,6 +413,12 @@ sock_listener(const struct sock_addr * sa)
 		}
 	}
 
+	/* Set SO_REUSEPORT, if requested. */
+	if (reuseport && sock_reuseport(s)) {
+		warnp("setsockopt(SO_REUSEPORT)");
+		goto err1;
+	}
+
 	/* Bind the socket. */
 	if (bind(s, sa->name, sa->namelen)) {
 		warnp("Error binding socket");
@@ -422,6 +448,33 @@ err0:
 	return (-1);
 }
 
+/**
+ * sock_listener(sa):
+ * Create a socket, attempt to set SO_REUSEADDR, bind it to the socket address
+ * ${sa}, mark it for listening, and mark it as non-blocking.
+ */
+int
+sock_listener(const struct sock_addr * sa)
+{
+
+	/* Create a listener without SO_REUSEPORT. */
+	return (sock_listener_internal(sa, 0));
+}
+
+/**
+ * sock_listener_reuseport(sa):
+ * Behave as sock_listener(), but also set SO_REUSEPORT so that several
+ * sockets may be bound to the same address ${sa}; the kernel then distributes
+ * incoming connections between them.  Fail if SO_REUSEPORT is not supported.
+ */
+int
+sock_listener_reuseport(const struct sock_addr * sa)
+{
+
+	/* Create a listener with SO_REUSEPORT. */
+	return (sock_listener_internal(sa, 1));
+}
+
 /**
  * sock_connect(sas):
  * Iterate through the addresses in ${sas}, attempting to create a socket and
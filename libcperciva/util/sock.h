@@ -18,6 +18,14 @@ struct sock_addr;
  */
 struct sock_addr ** sock_resolve(const char *);
 
+/**
+ * sock_addr_pickone(addr, sas):
+ * Return the first of the addresses ${sas}, which were resolved from ${addr},
+ * and free the others and the list.  Warn if there is more than one address.
+ * If there are no addresses, warn, free the list, and return NULL.
+ */
+struct sock_addr * sock_addr_pickone(const char *, struct sock_addr **);
+
 /**
  * sock_resolve_one(addr, addport):
  * Return a single sock_addr structure, or NULL if there are no addresses.
@@ -34,6 +42,14 @@ struct sock_addr * sock_resolve_one(const char *, int);
  */
 int sock_listener(const struct sock_addr *);
 
+/**
+ * sock_listener_reuseport(sa):
+ * Behave as sock_listener(), but also set SO_REUSEPORT so that several
+ * sockets may be bound to the same address ${sa}; the kernel then distributes
+ * incoming connections between them.  Fail if SO_REUSEPORT is not supported.
+ */
+int sock_listener_reuseport(const struct sock_addr *);
+
 /**
  * sock_connect(sas):
  * Iterate through the addresses in ${sas}, attempting to create a socket and
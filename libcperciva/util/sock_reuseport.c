@@ -0,0 +1,44 @@
+/*
+ * There is no SO_REUSEPORT in the POSIX standard, so we need to expose it
+ * with platform-specific symbols.  This must happen before the regular
+ * includes.
+ */
+#if defined(__linux__)
+/* SO_REUSEPORT is a non-POSIX extension on Linux. */
+#define _BSD_SOURCE 1
+#define _DEFAULT_SOURCE 1
+#elif defined(__FreeBSD__) || defined(__NetBSD__) || defined(__OpenBSD__) || \
+    defined(__APPLE__)
+/* SO_REUSEPORT is hidden in strict POSIX mode on BSD-derived platforms. */
+#undef _POSIX_C_SOURCE
+#undef _XOPEN_SOURCE
+#endif
+
+#include <sys/socket.h>
+
+#include <errno.h>
+
+#include "sock_reuseport.h"
+
+/**
+ * sock_reuseport(s):
+ * Attempt to set the SO_REUSEPORT socket option on the socket ${s}.  If we do
+ * not know how to do this on the platform, return -1 with errno set to
+ * ENOPROTOOPT.
+ */
+int
+sock_reuseport(int s)
+{
+#ifdef SO_REUSEPORT
+	int val = 1;
+
+	/* Attempt to set the socket option. */
+	return (setsockopt(s, SOL_SOCKET, SO_REUSEPORT, &val, sizeof(val)));
+#else
+	(void)s; /* UNUSED */
+
+	/* Not supported. */
+	errno = ENOPROTOOPT;
+	return (-1);
+#endif
+}
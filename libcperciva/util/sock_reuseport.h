@@ -0,0 +1,12 @@
+#ifndef SOCK_REUSEPORT_H_
+#define SOCK_REUSEPORT_H_
+
+/**
+ * sock_reuseport(s):
+ * Attempt to set the SO_REUSEPORT socket option on the socket ${s}.  If we do
+ * not know how to do this on the platform, return -1 with errno set to
+ * ENOPROTOOPT.
+ */
+int sock_reuseport(int);
+
+#endif /* !SOCK_REUSEPORT_H_ */
@@ -45,6 +45,17 @@ sock_addr_cmp(const struct sock_addr * sa1, const struct sock_addr * sa2)
 	return (0);
 }
 
+/**
+ * sock_addr_family(sa):
+ * Return the address family of the socket address ${sa}.
+ */
+int
+sock_addr_family(const struct sock_addr * sa)
+{
+
+	return (sa->ai_family);
+}
+
 /**
  * sock_addr_dup(sa):
  * Duplicate the provided socket address.
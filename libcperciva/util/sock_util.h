@@ -13,6 +13,12 @@ struct sock_addr;
  */
 int sock_addr_cmp(const struct sock_addr *, const struct sock_addr *);
 
+/**
+ * sock_addr_family(sa):
+ * Return the address family of the socket address ${sa}.
+ */
+int sock_addr_family(const struct sock_addr *);
+
 /**
  * sock_addr_dup(sa):
  * Duplicate the provided socket address.
@@ -44,6 +44,11 @@ print_hardware(const char * str)
 	if (cpusupport_x86_aesni())
 		printf(" and hardware AESNI.\n");
 	else
+#endif
+#if defined(CPUSUPPORT_ARM_AES)
+	if (cpusupport_arm_aes())
+		printf(" and hardware ARM AES.\n");
+	else
 #endif
 		printf(" and software AES.\n");
 #else
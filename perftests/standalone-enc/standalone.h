@@ -23,7 +23,8 @@ int standalone_aesctr_hmac(const size_t *, size_t, size_t, size_t);
 
 /**
  * standalone_pce(perfsizes, num_perf, nbytes_perftest, nbytes_warmup):
- * Performance test for proto_crypt_enc().
+ * Performance test for proto_crypt_enc(), one packet at a time and then in
+ * batches using proto_crypt_enc_batch().
  */
 int standalone_pce(const size_t *, size_t, size_t, size_t);
 
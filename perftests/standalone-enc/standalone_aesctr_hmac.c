@@ -4,6 +4,7 @@
 
 #include "crypto_aes.h"
 #include "crypto_aesctr.h"
+#include "crypto_aesctr_hmac.h"
 #include "perftest.h"
 #include "sha256.h"
 #include "sysendian.h"
@@ -40,6 +41,7 @@ static int
 aesctr_hmac_func(void * cookie, uint8_t * buf, size_t buflen, size_t nreps)
 {
 	struct aesctr_hmac_cookie * ahc = cookie;
+	HMAC_SHA256_CTX ctx;
 	uint8_t hbuf[32];
 	uint8_t pnum_exp[8];
 	size_t i;
@@ -50,14 +52,39 @@ aesctr_hmac_func(void * cookie, uint8_t * buf, size_t buflen, size_t nreps)
 		 * In proto_crypt_enc(), we would append the length to buf,
 		 * then encrypt the buffer + 4 bytes of length.  After that,
 		 * we'd hash the resulting (larger) buffer.  For simplicity,
-		 * this test does not imitate those details.
+		 * this test does not imitate those details; but as in
+		 * proto_crypt_enc(), each buffer gets its own HMAC.
 		 */
+		memcpy(&ctx, ahc->ctx, sizeof(HMAC_SHA256_CTX));
 		crypto_aesctr_buf(ahc->k_aes, i, buf, buf, buflen);
-		HMAC_SHA256_Update(ahc->ctx, buf, buflen);
+		HMAC_SHA256_Update(&ctx, buf, buflen);
+		be64enc(pnum_exp, i);
+		HMAC_SHA256_Update(&ctx, pnum_exp, 8);
+		HMAC_SHA256_Final(hbuf, &ctx);
+	}
+
+	/* Success! */
+	return (0);
+}
+
+static int
+aesctr_hmac_stitched_func(void * cookie, uint8_t * buf, size_t buflen,
+    size_t nreps)
+{
+	struct aesctr_hmac_cookie * ahc = cookie;
+	HMAC_SHA256_CTX ctx;
+	uint8_t hbuf[32];
+	uint8_t pnum_exp[8];
+	size_t i;
+
+	/* Do the hashing, using a single pass over each buffer. */
+	for (i = 0; i < nreps; i++) {
+		memcpy(&ctx, ahc->ctx, sizeof(HMAC_SHA256_CTX));
+		crypto_aesctr_hmac_enc(ahc->k_aes, i, buf, buflen, &ctx);
 		be64enc(pnum_exp, i);
-		HMAC_SHA256_Update(ahc->ctx, pnum_exp, 8);
+		HMAC_SHA256_Update(&ctx, pnum_exp, 8);
+		HMAC_SHA256_Final(hbuf, &ctx);
 	}
-	HMAC_SHA256_Final(hbuf, ahc->ctx);
 
 	/* Success! */
 	return (0);
@@ -65,7 +92,8 @@ aesctr_hmac_func(void * cookie, uint8_t * buf, size_t buflen, size_t nreps)
 
 /**
  * standalone_aesctr_hmac(perfsizes, num_perf, nbytes_perftest, nbytes_warmup):
- * Performance test for AES-CTR followed by HMAC-SHA256.
+ * Performance test for AES-CTR followed by HMAC-SHA256, first as two passes
+ * over the data and then using the single-pass "stitched" code.
  */
 int
 standalone_aesctr_hmac(const size_t * perfsizes, size_t num_perf,
@@ -76,20 +104,27 @@ standalone_aesctr_hmac(const size_t * perfsizes, size_t num_perf,
 	HMAC_SHA256_CTX ctx;
 	uint8_t kbuf[32];
 
-	/* Report what we're doing. */
-	printf("Testing HMAC_SHA256 with AES-CTR\n");
-
 	/* Initialize. */
 	ahc->ctx = &ctx;
 	memset(kbuf, 0, 32);
 	if ((ahc->k_aes = crypto_aes_key_expand(kbuf, 32)) == NULL)
 		goto err0;
 
-	/* Time the function. */
+	/* Time the two-pass function. */
+	printf("Testing HMAC_SHA256 with AES-CTR (two-pass)\n");
 	if (perftest_buffers(nbytes_perftest, perfsizes, num_perf,
 	    nbytes_warmup, 0, aesctr_hmac_init, aesctr_hmac_func, NULL, ahc)) {
 		warn0("perftest_buffers");
-		goto err0;
+		goto err1;
+	}
+
+	/* Time the stitched function. */
+	printf("Testing HMAC_SHA256 with AES-CTR (stitched)\n");
+	if (perftest_buffers(nbytes_perftest, perfsizes, num_perf,
+	    nbytes_warmup, 0, aesctr_hmac_init, aesctr_hmac_stitched_func,
+	    NULL, ahc)) {
+		warn0("perftest_buffers");
+		goto err1;
 	}
 
 	/* Clean up. */
@@ -98,6 +133,8 @@ standalone_aesctr_hmac(const size_t * perfsizes, size_t num_perf,
 	/* Success! */
 	return (0);
 
+err1:
+	crypto_aes_key_free(ahc->k_aes);
 err0:
 	/* Failure! */
 	return (1);
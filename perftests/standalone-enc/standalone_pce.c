@@ -1,3 +1,5 @@
+#include <sys/uio.h>
+
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
@@ -8,6 +10,9 @@
 
 #include "standalone.h"
 
+/* Number of packets per proto_crypt_enc_batch() call. */
+#define PCE_BATCH 8
+
 /* Cookie for proto_crypt_enc(). */
 struct pce {
 	struct proto_keys * k;
@@ -52,6 +57,30 @@ pce_func(void * cookie, uint8_t * buf, size_t buflen, size_t nreps)
 	return (0);
 }
 
+static int
+pce_batch_func(void * cookie, uint8_t * buf, size_t buflen, size_t nreps)
+{
+	struct pce * pce = cookie;
+	struct iovec iov[PCE_BATCH];
+	uint8_t encbuf[PCE_BATCH * PCRYPT_ESZ];
+	size_t i, n;
+
+	/* Every packet in a batch uses the same input. */
+	for (i = 0; i < PCE_BATCH; i++) {
+		iov[i].iov_base = buf;
+		iov[i].iov_len = buflen;
+	}
+
+	/* Encrypt a bunch of times, PCE_BATCH packets at once. */
+	for (i = 0; i < nreps; i += n) {
+		n = (nreps - i > PCE_BATCH) ? PCE_BATCH : nreps - i;
+		proto_crypt_enc_batch(iov, n, encbuf, pce->k);
+	}
+
+	/* Success! */
+	return (0);
+}
+
 static int
 pce_cleanup(void * cookie)
 {
@@ -66,7 +95,8 @@ pce_cleanup(void * cookie)
 
 /**
  * standalone_pce(perfsizes, num_perf, nbytes_perftest, nbytes_warmup):
- * Performance test for proto_crypt_enc().
+ * Performance test for proto_crypt_enc(), one packet at a time and then in
+ * batches using proto_crypt_enc_batch().
  */
 int
 standalone_pce(const size_t * perfsizes, size_t num_perf,
@@ -85,6 +115,16 @@ standalone_pce(const size_t * perfsizes, size_t num_perf,
 		goto err0;
 	}
 
+	/* Report what we're doing. */
+	printf("Testing proto_crypt_enc_batch()\n");
+
+	/* Time the batched function. */
+	if (perftest_buffers(nbytes_perftest, perfsizes, num_perf,
+	    nbytes_warmup, 0, pce_init, pce_batch_func, pce_cleanup, pce)) {
+		warn0("perftest_buffers");
+		goto err0;
+	}
+
 	/* Success! */
 	return (0);
 
@@ -58,8 +58,8 @@ pipe_enc(void * cookie)
 
 	/* Create the pipe. */
 	if ((cancel_cookie = proto_pipe(pipeinfo->in[R], pipeinfo->out[W], 0,
-	    pipeinfo->k, &pipeinfo->status, pipe_callback_status, pipeinfo))
-	    == NULL) {
+	    pipeinfo->k, 0.0, &pipeinfo->status, pipe_callback_status,
+	    pipeinfo)) == NULL) {
 		warn0("proto_pipe");
 		goto err0;
 	}
@@ -116,7 +116,7 @@ usage(void)
 	fprintf(stderr,
 	    "usage: spipe -t <target socket> -k <key file>"
 	    " [-b <bind address>] [-f | -g]\n"
-	    "    [-j] [-o <connection timeout>]\n"
+	    "    [-j] [--jumbo] [-o <connection timeout>] [--x25519]\n"
 	    "       spipe -v\n");
 	exit(1);
 }
@@ -135,16 +135,19 @@ main(int argc, char * argv[])
 	int opt_f = 0;
 	int opt_g = 0;
 	int opt_j = 0;
+	int opt_jumbo = 0;
 	const char * opt_k = NULL;
 	int opt_o_set = 0;
 	double opt_o = 0.0;
 	const char * opt_t = NULL;
+	int opt_x25519 = 0;
 
 	/* Working variables. */
 	struct events_threads ET;
 	struct sock_addr * sa_b = NULL;
 	struct sock_addr ** sas_t;
 	struct proto_secret * K;
+	struct proto_conn_opts opts;
 	const char * ch;
 	int s[2];
 	void * conn_cookie;
@@ -175,6 +178,11 @@ main(int argc, char * argv[])
 				usage();
 			opt_j = 1;
 			break;
+		GETOPT_OPT("--jumbo"):
+			if (opt_jumbo)
+				usage();
+			opt_jumbo = 1;
+			break;
 		GETOPT_OPTARG("-k"):
 			if (opt_k)
 				usage();
@@ -195,6 +203,11 @@ main(int argc, char * argv[])
 		GETOPT_OPT("-v"):
 			fprintf(stderr, "spipe @VERSION@\n");
 			exit(0);
+		GETOPT_OPT("--x25519"):
+			if (opt_x25519)
+				usage();
+			opt_x25519 = 1;
+			break;
 		GETOPT_MISSING_ARG:
 			warn0("Missing argument to %s", ch);
 			usage();
@@ -268,8 +281,19 @@ main(int argc, char * argv[])
 	}
 
 	/* Set up a connection. */
-	if ((conn_cookie = proto_conn_create(s[1], sas_t, sa_b, 0, opt_f,
-	    opt_g, opt_j, K, opt_o, callback_conndied, &ET)) == NULL) {
+	opts.decr = 0;
+	opts.nopfs = opt_f;
+	opts.requirepfs = opt_g;
+	opts.jumbo = opt_jumbo;
+	opts.x25519 = opt_x25519;
+	opts.early = 0;
+	opts.nokeepalive = opt_j;
+	opts.K = K;
+	opts.timeo = opt_o;
+	opts.race = 0.0;
+	opts.coalesce = 0.0;
+	if ((conn_cookie = proto_conn_create(s[1], sas_t, sa_b, &opts, NULL,
+	    NULL, callback_conndied, &ET)) == NULL) {
 		warnp("Could not set up connection");
 		goto err4;
 	}
@@ -1,9 +1,13 @@
+#include <sys/time.h>
+
 #include <assert.h>
 #include <stdlib.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "dnsthread.h"
 #include "events.h"
+#include "monoclock.h"
 #include "network.h"
 #include "queue.h"
 #include "sock.h"
@@ -11,6 +15,7 @@
 #include "warnp.h"
 
 #include "proto_conn.h"
+#include "proto_mux.h"
 
 #include "dispatch.h"
 
@@ -20,32 +25,433 @@ struct accept_state {
 	struct sock_addr ** sas;
 	const struct sock_addr * sa_b;
 	double rtime;
-	int decr;
-	int nopfs;
-	int requirepfs;
-	int nokeepalive;
+	struct proto_conn_opts opts;
 	int * conndone;
 	int shutdown_requested;
-	const struct proto_secret * K;
 	size_t nconn;
 	size_t nconn_max;
-	double timeo;
+	size_t npool;
+	size_t npool_max;
+	int mux;
+	struct mux_list_node * mux_cur;
+	int balance;
+	struct target * targets;
+	size_t ntargets;
+	size_t rr;
+	double health;
 	void * accept_cookie;
 	void * dnstimer_cookie;
+	void * pooltimer_cookie;
+	void * healthtimer_cookie;
 	LIST_HEAD(conn_head, conn_list_node) conn_cookies;
+	TAILQ_HEAD(pool_head, pool_node) pool;
+	LIST_HEAD(mux_head, mux_list_node) mux_cookies;
+	LIST_HEAD(probe_head, probe) probes;
 	DNSTHREAD T;
 };
 
+/*
+ * A target address, the number of connections we've sent to it, and whether
+ * we've been able to connect to it recently.
+ */
+struct target {
+	struct sock_addr * sa;
+	size_t nconn;
+	unsigned int nfail;	/* Consecutive failures to connect. */
+	struct timeval until;	/* Quarantined until this time. */
+	double rtt;		/* Smoothed time for probes to connect. */
+	int skip;		/* Used by targets_pick(). */
+};
+
+/* An attempt to connect to a target address, to check that it's reachable. */
+struct probe {
+	struct accept_state * A;
+	struct sock_addr * sas[2];
+	struct timeval start;
+	void * connect_cookie;
+	void * timeout_cookie;
+	LIST_ENTRY(probe) entries;
+};
+
 /* Doubly linked list. */
 struct conn_list_node {
 	void * conn_cookie;
 	LIST_ENTRY(conn_list_node) entries;
 	struct accept_state * A;
+	struct sock_addr * target;
 };
 
+/* Queue of pre-established connections, oldest first. */
+struct pool_node {
+	void * conn_cookie;
+	TAILQ_ENTRY(pool_node) entries;
+	struct accept_state * A;
+	struct sock_addr * target;
+};
+
+/* Multiplexed connections to the target, when encrypting. */
+struct mux_list_node {
+	void * mux_cookie;
+	LIST_ENTRY(mux_list_node) entries;
+	struct accept_state * A;
+};
+
+/*
+ * After failing to connect to a target address, don't use it for between
+ * HEALTH_BACKOFF_MIN and HEALTH_BACKOFF_MAX seconds, doubling the time for
+ * each consecutive failure.
+ */
+#define HEALTH_BACKOFF_MIN 1
+#define HEALTH_BACKOFF_MAX 64
+
+static int callback_conndied(void *, int);
 static int callback_gotconn(void *, int);
+static int callback_healthcheck(void *);
+static int callback_muxdied(void *, int);
+static int callback_pooldied(void *, int);
+static int callback_poolretry(void *);
+static int callback_probe_done(void *, int);
+static int callback_probe_timeout(void *);
 static int callback_resolveagain(void *);
 
+/*
+ * Rebuild the list of target addresses for the addresses ${sas}, keeping the
+ * connection counts and health of addresses which were in the old list.
+ */
+static int
+targets_update(struct accept_state * A, struct sock_addr ** sas)
+{
+	struct target * targets;
+	size_t ntargets;
+	size_t i, j;
+
+	/* Streams over multiplexed connections use the addresses directly. */
+	if (A->mux)
+		return (0);
+
+	/* Allocate a new list. */
+	for (ntargets = 0; sas[ntargets] != NULL; ntargets++)
+		continue;
+	if ((targets = malloc((ntargets + 1) * sizeof(struct target))) == NULL)
+		goto err0;
+
+	/* Carry over the connection counts and health. */
+	for (i = 0; i < ntargets; i++) {
+		targets[i].sa = sas[i];
+		targets[i].nconn = 0;
+		targets[i].nfail = 0;
+		targets[i].until.tv_sec = 0;
+		targets[i].until.tv_usec = 0;
+		targets[i].rtt = 0.0;
+		for (j = 0; j < A->ntargets; j++) {
+			if (sock_addr_cmp(sas[i], A->targets[j].sa) == 0) {
+				targets[i] = A->targets[j];
+				targets[i].sa = sas[i];
+				break;
+			}
+		}
+	}
+
+	/* Replace the old list. */
+	free(A->targets);
+	A->targets = targets;
+	A->ntargets = ntargets;
+	if (A->rr >= ntargets)
+		A->rr = 0;
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* Return the target for the address ${sa}, or NULL if there is none. */
+static struct target *
+targets_find(struct accept_state * A, const struct sock_addr * sa)
+{
+	size_t i;
+
+	/* Look for the address. */
+	for (i = 0; i < A->ntargets; i++) {
+		if (sock_addr_cmp(sa, A->targets[i].sa) == 0)
+			return (&A->targets[i]);
+	}
+
+	/* It's not in the list (any more). */
+	return (NULL);
+}
+
+/* Is the target ${T} quarantined at time ${now}? */
+static int
+targets_down(struct accept_state * A, const struct target * T,
+    const struct timeval * now)
+{
+
+	/* Addresses which we've connected to are fine. */
+	if (T->nfail == 0)
+		return (0);
+
+	/* If we're probing addresses, wait until a probe succeeds. */
+	if (A->health > 0.0)
+		return (1);
+
+	/* Otherwise, try the address again once it has served its time. */
+	return (timeval_diff(*now, T->until) > 0.0);
+}
+
+/* Return the index of the ${m}th target which isn't being skipped. */
+static size_t
+targets_nth(const struct target * T, size_t m)
+{
+	size_t i;
+
+	/* Count through the targets which aren't being skipped. */
+	for (i = 0; T[i].skip || (m-- > 0); i++)
+		continue;
+
+	return (i);
+}
+
+/*
+ * Pick a target address according to the balancing policy, skipping any
+ * which are quarantined, and return a list of the target addresses to try
+ * connecting to, starting with the one we picked.  Set ${sa} to a copy of
+ * that address (or NULL if we have no list of target addresses), which should
+ * be passed to targets_release() once the connection closes.
+ */
+static struct sock_addr **
+targets_pick(struct accept_state * A, struct sock_addr ** sa)
+{
+	struct target * T = A->targets;
+	size_t n = A->ntargets;
+	struct timeval now;
+	struct sock_addr ** rot;
+	struct sock_addr ** sas;
+	size_t nlive;
+	size_t i, j, k;
+
+	/* If we have no list, use the order in which they resolved. */
+	*sa = NULL;
+	if (n == 0)
+		return (sock_addr_duplist(A->sas));
+
+	/* Skip quarantined addresses, unless they're all quarantined. */
+	if (monoclock_get(&now))
+		goto err0;
+	for (nlive = k = 0; k < n; k++) {
+		if ((T[k].skip = targets_down(A, &T[k], &now)) == 0)
+			nlive++;
+	}
+	if (nlive == 0) {
+		for (k = 0; k < n; k++)
+			T[k].skip = 0;
+		nlive = n;
+	}
+
+	/* Pick an address. */
+	switch (A->balance) {
+	case DISPATCH_BALANCE_FIRST:
+		i = targets_nth(T, 0);
+		break;
+	case DISPATCH_BALANCE_RR:
+		for (i = A->rr; T[i].skip; i = (i + 1) % n)
+			continue;
+		A->rr = (i + 1) % n;
+		break;
+	case DISPATCH_BALANCE_LEAST:
+		/* Break ties in round-robin order. */
+		for (i = A->rr; T[i].skip; i = (i + 1) % n)
+			continue;
+		for (k = 1; k < n; k++) {
+			j = (A->rr + k) % n;
+			if (!T[j].skip && (T[j].nconn < T[i].nconn))
+				i = j;
+		}
+		A->rr = (A->rr + 1) % n;
+		break;
+	default:
+		/*
+		 * Pick the less loaded of two random addresses, or the one
+		 * which probes connect to faster if they're equally loaded.
+		 */
+		i = targets_nth(T, (size_t)random() % nlive);
+		j = targets_nth(T, (size_t)random() % nlive);
+		if ((T[j].nconn < T[i].nconn) || ((T[j].nconn == T[i].nconn) &&
+		    (T[j].rtt > 0.0) && (T[j].rtt < T[i].rtt)))
+			i = j;
+		break;
+	}
+
+	/* Try that address first, and then the ones after it. */
+	if ((rot = malloc((nlive + 1) * sizeof(struct sock_addr *))) == NULL)
+		goto err0;
+	for (j = k = 0; k < n; k++) {
+		if (!T[(i + k) % n].skip)
+			rot[j++] = T[(i + k) % n].sa;
+	}
+	rot[j] = NULL;
+	sas = sock_addr_duplist(rot);
+	free(rot);
+	if (sas == NULL)
+		goto err0;
+
+	/* Remember which address we picked. */
+	if ((*sa = sock_addr_dup(T[i].sa)) == NULL)
+		goto err1;
+	T[i].nconn += 1;
+
+	/* Success! */
+	return (sas);
+
+err1:
+	sock_addr_freelist(sas);
+err0:
+	/* Failure! */
+	return (NULL);
+}
+
+/* Print a warning about the target address ${sa}. */
+static void
+targets_warn(const struct sock_addr * sa, const char * msg)
+{
+	char * addr;
+
+	/* Say which address it is, if we can. */
+	if ((addr = sock_addr_prettyprint(sa)) == NULL) {
+		warn0("Target address %s", msg);
+		return;
+	}
+	warn0("Target address %s %s", addr, msg);
+	free(addr);
+}
+
+/*
+ * None of the target addresses are working; the target may have moved, so
+ * resolve it again now instead of waiting for the timer.
+ */
+static int
+targets_reresolve(struct accept_state * A)
+{
+
+	/* Nothing to do if we don't re-resolve, or are doing so already. */
+	if (A->dnstimer_cookie == NULL)
+		return (0);
+
+	/* Resolve the target now. */
+	events_timer_cancel(A->dnstimer_cookie);
+	return (callback_resolveagain(A));
+}
+
+/* We failed to connect to the target address ${sa}; quarantine it. */
+static int
+targets_failed(struct accept_state * A, const struct sock_addr * sa)
+{
+	struct target * T;
+	unsigned int backoff;
+	unsigned int i;
+	size_t j;
+	int wasok;
+
+	/* Nothing to do if it is no longer a target address. */
+	if ((T = targets_find(A, sa)) == NULL)
+		return (0);
+
+	/* Warn if it was working until now. */
+	if ((wasok = (T->nfail == 0)) != 0)
+		targets_warn(sa, "is not responding");
+
+	/* Back off exponentially. */
+	for (backoff = HEALTH_BACKOFF_MIN, i = 0; i < T->nfail; i++)
+		backoff *= 2;
+	if (monoclock_get(&T->until))
+		goto err0;
+	T->until.tv_sec += backoff;
+	if (backoff < HEALTH_BACKOFF_MAX)
+		T->nfail += 1;
+
+	/* If that was the last working address, look the target up again. */
+	if (wasok) {
+		for (j = 0; j < A->ntargets; j++) {
+			if (A->targets[j].nfail == 0)
+				break;
+		}
+		if ((j == A->ntargets) && targets_reresolve(A))
+			goto err0;
+	}
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/*
+ * We connected to the target address ${sa}, taking ${rtt} seconds if ${rtt}
+ * is positive; it is no longer quarantined.
+ */
+static void
+targets_ok(struct accept_state * A, const struct sock_addr * sa, double rtt)
+{
+	struct target * T;
+
+	/* Nothing to do if it is no longer a target address. */
+	if ((T = targets_find(A, sa)) == NULL)
+		return;
+
+	/* It's working again. */
+	if (T->nfail > 0)
+		targets_warn(sa, "is responding again");
+	T->nfail = 0;
+
+	/* Keep a moving average of how long it takes to connect. */
+	if (rtt > 0.0) {
+		if (T->rtt > 0.0)
+			T->rtt += (rtt - T->rtt) / 8;
+		else
+			T->rtt = rtt;
+	}
+}
+
+/*
+ * A connection tried to connect to the target address ${sa}, and did so if
+ * ${connected} is non-zero; keep track of whether we could connect.
+ */
+static int
+callback_targets_report(void * cookie, const struct sock_addr * sa,
+    int connected)
+{
+	struct accept_state * A = cookie;
+
+	/* Credit or quarantine this address. */
+	if (connected) {
+		targets_ok(A, sa, 0.0);
+		return (0);
+	}
+	return (targets_failed(A, sa));
+}
+
+/* A connection to the target address ${sa} has closed. */
+static void
+targets_release(struct accept_state * A, struct sock_addr * sa)
+{
+	struct target * T;
+
+	/* Nothing to do if we don't know where it started. */
+	if (sa == NULL)
+		return;
+
+	/* It has one fewer connection, if it is still in the list. */
+	if (((T = targets_find(A, sa)) != NULL) && (T->nconn > 0))
+		T->nconn -= 1;
+
+	/* Free the address. */
+	sock_addr_free(sa);
+}
+
 /* Callback from address resolution. */
 static int
 callback_resolve(void * cookie, struct sock_addr ** sas)
@@ -54,6 +460,12 @@ callback_resolve(void * cookie, struct sock_addr ** sas)
 
 	/* If the address resolution succeeded... */
 	if (sas != NULL) {
+		/* Update the list of target addresses. */
+		if (targets_update(A, sas)) {
+			sock_addr_freelist(sas);
+			goto err0;
+		}
+
 		/* Free the old addresses. */
 		sock_addr_freelist(A->sas);
 
@@ -87,6 +499,176 @@ callback_resolveagain(void * cookie)
 	return (dnsthread_resolveone(A->T, A->tgt, callback_resolve, A));
 }
 
+/* Stop and free the probe ${P}. */
+static void
+probe_free(struct probe * P)
+{
+
+	/* Cancel whatever is still pending. */
+	if (P->connect_cookie != NULL)
+		network_connect_cancel(P->connect_cookie);
+	if (P->timeout_cookie != NULL)
+		events_timer_cancel(P->timeout_cookie);
+
+	/* Remove it from the list of probes. */
+	LIST_REMOVE(P, entries);
+
+	/* Free the probe. */
+	sock_addr_free(P->sas[0]);
+	free(P);
+}
+
+/* Start probing the target address ${sa}. */
+static int
+probe_start(struct accept_state * A, const struct sock_addr * sa)
+{
+	struct probe * P;
+
+	/* Bake a cookie. */
+	if ((P = malloc(sizeof(struct probe))) == NULL)
+		goto err0;
+	P->A = A;
+	P->sas[1] = NULL;
+	P->connect_cookie = NULL;
+	P->timeout_cookie = NULL;
+	LIST_INSERT_HEAD(&A->probes, P, entries);
+	if ((P->sas[0] = sock_addr_dup(sa)) == NULL)
+		goto err1;
+
+	/* Time how long it takes to connect, up to the connection timeout. */
+	if (monoclock_get(&P->start))
+		goto err1;
+	if ((P->timeout_cookie = events_timer_register_double(
+	    callback_probe_timeout, P, A->opts.timeo)) == NULL)
+		goto err1;
+
+	/* Connect to the address. */
+	if ((P->connect_cookie = network_connect_bind(P->sas, A->sa_b,
+	    callback_probe_done, P)) == NULL)
+		goto err1;
+
+	/* Success! */
+	return (0);
+
+err1:
+	probe_free(P);
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* A probe has connected to its target address, or failed to. */
+static int
+callback_probe_done(void * cookie, int s)
+{
+	struct probe * P = cookie;
+	struct accept_state * A = P->A;
+	struct timeval now;
+	int rc = 0;
+
+	/* This connection attempt is no longer pending. */
+	P->connect_cookie = NULL;
+
+	/* Record whether we connected, and how long it took. */
+	if (s == -1) {
+		rc = targets_failed(A, P->sas[0]);
+	} else {
+		if (close(s))
+			warnp("close");
+		if (monoclock_get(&now))
+			rc = -1;
+		else
+			targets_ok(A, P->sas[0], timeval_diff(P->start, now));
+	}
+
+	/* We're done with this probe. */
+	probe_free(P);
+
+	/* Return success/fail status. */
+	return (rc);
+}
+
+/* A probe took too long to connect to its target address. */
+static int
+callback_probe_timeout(void * cookie)
+{
+	struct probe * P = cookie;
+	struct accept_state * A = P->A;
+	int rc;
+
+	/* This timeout is no longer pending. */
+	P->timeout_cookie = NULL;
+
+	/* The address isn't reachable. */
+	rc = targets_failed(A, P->sas[0]);
+
+	/* We're done with this probe. */
+	probe_free(P);
+
+	/* Return success/fail status. */
+	return (rc);
+}
+
+/* Stop probing the target addresses. */
+static void
+healthdrain(struct accept_state * A)
+{
+	struct probe * P;
+
+	/* We don't want any more probes. */
+	if (A->healthtimer_cookie != NULL) {
+		events_timer_cancel(A->healthtimer_cookie);
+		A->healthtimer_cookie = NULL;
+	}
+
+	/* Cancel the probes in progress. */
+	while ((P = LIST_FIRST(&A->probes)) != NULL)
+		probe_free(P);
+}
+
+/* Timer callback to probe the target addresses. */
+static int
+callback_healthcheck(void * cookie)
+{
+	struct accept_state * A = cookie;
+	struct target * T;
+	struct probe * P;
+	struct timeval now;
+	size_t i;
+
+	/* This timer is expired. */
+	A->healthtimer_cookie = NULL;
+
+	/* Probe each address which isn't backing off or being probed. */
+	if (monoclock_get(&now))
+		goto err0;
+	for (i = 0; i < A->ntargets; i++) {
+		T = &A->targets[i];
+		if ((T->nfail > 0) && (timeval_diff(now, T->until) > 0.0))
+			continue;
+		LIST_FOREACH(P, &A->probes, entries) {
+			if (sock_addr_cmp(P->sas[0], T->sa) == 0)
+				break;
+		}
+		if (P != NULL)
+			continue;
+		if (probe_start(A, T->sa))
+			goto err0;
+	}
+
+	/* Probe them again after a while. */
+	if ((A->healthtimer_cookie = events_timer_register_double(
+	    callback_healthcheck, A, A->health)) == NULL)
+		goto err0;
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
 /* Non-blocking accept, if we can have more connections. */
 static int
 doaccept(struct accept_state * A)
@@ -111,6 +693,318 @@ doaccept(struct accept_state * A)
 	return (rc);
 }
 
+/* Create connections to the target until the pool is full. */
+static int
+poolfill(struct accept_state * A)
+{
+	struct sock_addr ** sas;
+	struct pool_node * P;
+
+	/* Don't refill the pool if we're waiting before retrying. */
+	if (A->pooltimer_cookie != NULL)
+		goto done;
+
+	/* Create connections until we have enough. */
+	while (A->npool < A->npool_max) {
+		/* Create new pool_node. */
+		if ((P = malloc(sizeof(struct pool_node))) == NULL)
+			goto err0;
+		P->A = A;
+
+		/* Pick the target addresses. */
+		if ((sas = targets_pick(A, &P->target)) == NULL)
+			goto err1;
+
+		/* Create a new connection, without a source socket. */
+		if ((P->conn_cookie = proto_conn_create(-1, sas, A->sa_b,
+		    &A->opts, callback_targets_report, A, callback_pooldied,
+		    P)) == NULL) {
+			warnp("Failure setting up new connection");
+			goto err2;
+		}
+
+		/* Add it to the end of the pool. */
+		TAILQ_INSERT_TAIL(&A->pool, P, entries);
+		A->npool += 1;
+	}
+
+done:
+	/* Success! */
+	return (0);
+
+err2:
+	sock_addr_freelist(sas);
+	targets_release(A, P->target);
+err1:
+	free(P);
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* Drop all the connections in the pool, and don't refill it. */
+static void
+pooldrain(struct accept_state * A)
+{
+	struct pool_node * P;
+
+	/* We don't want any more pooled connections. */
+	A->npool_max = 0;
+	if (A->pooltimer_cookie != NULL) {
+		events_timer_cancel(A->pooltimer_cookie);
+		A->pooltimer_cookie = NULL;
+	}
+
+	/*
+	 * Drop the pooled connections.  proto_conn_drop() will call
+	 * callback_pooldied(), which removes the relevant pool_node from the
+	 * pool.
+	 */
+	while ((P = TAILQ_FIRST(&A->pool)) != NULL) {
+		proto_conn_drop(P->conn_cookie, PROTO_CONN_CANCELLED);
+
+		/*
+		 * Convince static analyzers that P->conn_cookie is no longer
+		 * in the pool.
+		 */
+		assert(P != TAILQ_FIRST(&A->pool));
+	}
+}
+
+/* A pooled connection has closed before being used. */
+static int
+callback_pooldied(void * cookie, int reason)
+{
+	struct pool_node * P = cookie;
+	struct accept_state * A = P->A;
+
+	(void)reason; /* UNUSED */
+
+	/* Remove the closed connection from the pool. */
+	TAILQ_REMOVE(&A->pool, P, entries);
+	A->npool -= 1;
+
+	/* Clean up the now-unused node. */
+	targets_release(A, P->target);
+	free(P);
+
+	/*
+	 * Wait a second before replacing it, so that we don't spin if the
+	 * target is refusing connections.
+	 */
+	if ((A->npool < A->npool_max) && (A->pooltimer_cookie == NULL)) {
+		if ((A->pooltimer_cookie = events_timer_register_double(
+		    callback_poolretry, A, 1.0)) == NULL)
+			goto err0;
+	}
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* Timer callback to refill the pool after a connection died. */
+static int
+callback_poolretry(void * cookie)
+{
+	struct accept_state * A = cookie;
+
+	/* This timer is expired. */
+	A->pooltimer_cookie = NULL;
+
+	/* Refill the pool. */
+	return (poolfill(A));
+}
+
+/* Hand the oldest pooled connection to the incoming connection ${s}. */
+static int
+usepool(struct accept_state * A, int s)
+{
+	struct pool_node * P = TAILQ_FIRST(&A->pool);
+	struct conn_list_node * node_new;
+
+	/* Create new conn_list_node. */
+	if ((node_new = malloc(sizeof(struct conn_list_node))) == NULL)
+		goto err0;
+	node_new->A = A;
+
+	/* Take the connection out of the pool. */
+	TAILQ_REMOVE(&A->pool, P, entries);
+	A->npool -= 1;
+	node_new->conn_cookie = P->conn_cookie;
+	node_new->target = P->target;
+	free(P);
+
+	/* Insert node_new to the beginning of the conn_cookies list. */
+	LIST_INSERT_HEAD(&A->conn_cookies, node_new, entries);
+
+	/*
+	 * Give the connection its source socket.  If this fails, the
+	 * connection is dropped and callback_conndied() cleans up.
+	 */
+	if (proto_conn_attach(node_new->conn_cookie, s, callback_conndied,
+	    node_new)) {
+		warnp("Failure setting up new connection");
+		goto err1;
+	}
+
+	/* Replace the connection we took from the pool. */
+	if (poolfill(A))
+		goto err1;
+
+	/* Accept another connection if we can. */
+	if (doaccept(A))
+		goto err1;
+
+	/* Success! */
+	return (0);
+
+err0:
+	A->nconn -= 1;
+	if (close(s))
+		warnp("close");
+err1:
+	/* Failure! */
+	return (-1);
+}
+
+/* Create a new multiplexed connection to the target. */
+static int
+muxnew(struct accept_state * A)
+{
+	struct mux_list_node * M;
+
+	/* Create new mux_list_node. */
+	if ((M = malloc(sizeof(struct mux_list_node))) == NULL)
+		goto err0;
+	M->A = A;
+
+	/* Create a new multiplexed connection. */
+	if ((M->mux_cookie = proto_mux_create(-1, &A->sas, A->sa_b, &A->opts,
+	    A->nconn_max, callback_muxdied, M)) == NULL)
+		goto err1;
+
+	/* Open new streams over this connection. */
+	LIST_INSERT_HEAD(&A->mux_cookies, M, entries);
+	A->mux_cur = M;
+
+	/* Success! */
+	return (0);
+
+err1:
+	free(M);
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* Drop all the multiplexed connections to the target. */
+static void
+muxdrain(struct accept_state * A)
+{
+	struct mux_list_node * M;
+
+	/*
+	 * Drop the multiplexed connections.  proto_mux_drop() will call
+	 * callback_muxdied(), which removes the relevant mux_list_node from
+	 * the list of mux_cookies.
+	 */
+	while ((M = LIST_FIRST(&A->mux_cookies)) != NULL) {
+		proto_mux_drop(M->mux_cookie, PROTO_CONN_CANCELLED);
+
+		/*
+		 * Convince static analyzers that M->mux_cookie is no longer
+		 * in the list.
+		 */
+		assert(M != LIST_FIRST(&A->mux_cookies));
+	}
+}
+
+/* A multiplexed connection to the target has closed. */
+static int
+callback_muxdied(void * cookie, int reason)
+{
+	struct mux_list_node * M = cookie;
+	struct accept_state * A = M->A;
+
+	(void)reason; /* UNUSED */
+
+	/* Open new streams over a new connection. */
+	if (A->mux_cur == M)
+		A->mux_cur = NULL;
+
+	/* Remove the closed connection from the list of mux_cookies. */
+	LIST_REMOVE(M, entries);
+
+	/* Clean up the now-unused node. */
+	free(M);
+
+	/* Success! */
+	return (0);
+}
+
+/* Carry the incoming connection ${s} over a multiplexed connection. */
+static int
+muxopen(struct accept_state * A, int s)
+{
+	struct conn_list_node * node_new;
+	int rc;
+
+	/* Create new conn_list_node; streams don't have their own cookies. */
+	if ((node_new = malloc(sizeof(struct conn_list_node))) == NULL)
+		goto err0;
+	node_new->A = A;
+	node_new->conn_cookie = NULL;
+	node_new->target = NULL;
+
+	/* Make sure we have a multiplexed connection. */
+	if ((A->mux_cur == NULL) && muxnew(A))
+		goto err2;
+
+	/* Open a stream over it. */
+	if ((rc = proto_mux_open(A->mux_cur->mux_cookie, s, callback_conndied,
+	    node_new)) == 1) {
+		/* Retire this connection once its streams close. */
+		if (proto_mux_shutdown(A->mux_cur->mux_cookie))
+			goto err1;
+		A->mux_cur = NULL;
+
+		/* Try again with a new connection. */
+		if (muxnew(A))
+			goto err2;
+		rc = proto_mux_open(A->mux_cur->mux_cookie, s,
+		    callback_conndied, node_new);
+	}
+	if (rc) {
+		warnp("Failure setting up new connection");
+		goto err1;
+	}
+
+	/* Insert node_new to the beginning of the conn_cookies list. */
+	LIST_INSERT_HEAD(&A->conn_cookies, node_new, entries);
+
+	/* Accept another connection if we can. */
+	if (doaccept(A))
+		goto err0;
+
+	/* Success! */
+	return (0);
+
+err2:
+	warnp("Failure setting up new connection");
+err1:
+	free(node_new);
+	A->nconn -= 1;
+	if (close(s))
+		warnp("close");
+err0:
+	/* Failure! */
+	return (-1);
+}
+
 /* A connection has closed.  Accept more if necessary. */
 static int
 callback_conndied(void * cookie, int reason)
@@ -130,6 +1024,7 @@ callback_conndied(void * cookie, int reason)
 	LIST_REMOVE(node_ptr, entries);
 
 	/* Clean up the now-unused node. */
+	targets_release(A, node_ptr->target);
 	free(node_ptr);
 
 	/* If requested to do so, indicate that all connections are closed. */
@@ -160,19 +1055,38 @@ callback_gotconn(void * cookie, int s)
 	/* We have gained a connection. */
 	A->nconn += 1;
 
-	/* Duplicate the target address list. */
-	if ((sas = sock_addr_duplist(A->sas)) == NULL)
-		goto err1;
+	/* If we have a pre-established connection, use it. */
+	if (!TAILQ_EMPTY(&A->pool))
+		return (usepool(A, s));
+
+	/* If we're multiplexing outgoing connections, open a stream. */
+	if (A->mux && !A->opts.decr)
+		return (muxopen(A, s));
 
 	/* Create new conn_list_node. */
 	if ((node_new = malloc(sizeof(struct conn_list_node))) == NULL)
-		goto err2;
+		goto err1;
 	node_new->A = A;
+	node_new->target = NULL;
+
+	/*
+	 * Pick the target addresses, unless we're carrying streams which each
+	 * connect to the current target addresses.
+	 */
+	sas = NULL;
+	if (!A->mux && ((sas = targets_pick(A, &node_new->target)) == NULL))
+		goto err2;
 
 	/* Create a new connection. */
-	if ((node_new->conn_cookie = proto_conn_create(s, sas, A->sa_b,
-	    A->decr, A->nopfs, A->requirepfs, A->nokeepalive, A->K,
-	    A->timeo, callback_conndied, node_new)) == NULL) {
+	if (A->mux) {
+		node_new->conn_cookie = proto_mux_create(s, &A->sas, A->sa_b,
+		    &A->opts, A->nconn_max, callback_conndied, node_new);
+	} else {
+		node_new->conn_cookie = proto_conn_create(s, sas, A->sa_b,
+		    &A->opts, callback_targets_report, A, callback_conndied,
+		    node_new);
+	}
+	if (node_new->conn_cookie == NULL) {
 		warnp("Failure setting up new connection");
 		goto err3;
 	}
@@ -188,9 +1102,10 @@ callback_gotconn(void * cookie, int s)
 	return (0);
 
 err3:
-	free(node_new);
-err2:
 	sock_addr_freelist(sas);
+	targets_release(A, node_new->target);
+err2:
+	free(node_new);
 err1:
 	A->nconn -= 1;
 	if (close(s))
@@ -201,28 +1116,39 @@ err0:
 }
 
 /**
- * dispatch_accept(s, tgt, rtime, sas, sa_b, decr, nopfs, requirepfs,
- *     nokeepalive, K, nconn_max, timeo, conndone):
+ * dispatch_accept(s, tgt, rtime, sas, sa_b, opts, nconn_max, dopts,
+ *     conndone):
  * Start accepting connections on the socket ${s}.  Bind outgoing address to
- * ${sa_b} if it is not NULL.  Connect to the target ${tgt}, re-resolving
- * it every ${rtime} seconds if ${rtime} > 0; on address resolution
- * failure use the most recent successfully obtained addresses, or the
- * addresses ${sas}.  If ${decr} is 0, encrypt the outgoing connections; if
- * ${decr} is non-zero, decrypt the incoming connections.  Don't accept more
- * than ${nconn_max} connections.  If ${nopfs} is non-zero, don't use perfect
- * forward secrecy.  If ${requirepfs} is non-zero, require that both ends use
- * perfect forward secrecy.  Enable transport layer keep-alives (if applicable)
- * if and only if ${nokeepalive} is zero.  Drop connections if the handshake or
- * connecting to the target takes more than ${timeo} seconds.  If
- * dispatch_request_shutdown() is called then ${conndone} is set to a non-zero
- * value as soon as there are no active connections.  Return a cookie which can
- * be passed to dispatch_shutdown() and dispatch_request_shutdown().
+ * ${sa_b} if it is not NULL.  Connect to the target ${tgt}, re-resolving it
+ * every ${rtime} seconds if ${rtime} > 0; on address resolution failure use the
+ * most recent successfully obtained addresses, or the addresses ${sas}.  Make
+ * each connection with the options ${opts}, as for proto_conn_create(); if
+ * ${opts}->decr is 0 the outgoing connections are encrypted, and if it is
+ * non-zero the incoming connections are decrypted.  Don't accept more than
+ * ${nconn_max} connections.  If ${dopts}->npool is non-zero (which is only
+ * permitted if ${opts}->decr is 0), keep up to ${dopts}->npool connections to
+ * the target connected and handshaken in advance, in addition to the
+ * ${nconn_max} incoming connections, and use them for incoming connections.  If
+ * ${dopts}->mux is non-zero, carry all of the incoming connections over a
+ * single encrypted connection when encrypting, or carry streams over each
+ * incoming connection when decrypting, connecting up to ${nconn_max} of each
+ * connection's streams to the target at once; in that case ${opts}->coalesce
+ * is ignored and ${dopts}->npool must be zero.  Pick which target address to
+ * connect to first according to the policy ${dopts}->balance, skipping
+ * addresses which we have recently failed to connect to.  If ${dopts}->health
+ * is positive, also try to connect to each target address every
+ * ${dopts}->health seconds, and skip addresses until such a probe succeeds.  If
+ * ${dopts}->mux is non-zero, ${dopts}->balance must be DISPATCH_BALANCE_FIRST
+ * and ${dopts}->health must be zero.  The options ${opts} and ${dopts} are
+ * copied, but ${opts}->K must remain valid until dispatch_shutdown() is called.
+ * If dispatch_request_shutdown() is called then ${conndone} is set to a
+ * non-zero value as soon as there are no active connections.  Return a cookie
+ * which can be passed to dispatch_shutdown() and dispatch_request_shutdown().
  */
 void *
 dispatch_accept(int s, const char * tgt, double rtime, struct sock_addr ** sas,
-    const struct sock_addr * sa_b, int decr, int nopfs, int requirepfs,
-    int nokeepalive, const struct proto_secret * K, size_t nconn_max,
-    double timeo, int * conndone)
+    const struct sock_addr * sa_b, const struct proto_conn_opts * opts,
+    size_t nconn_max, const struct dispatch_opts * dopts, int * conndone)
 {
 	struct accept_state * A;
 
@@ -234,20 +1160,37 @@ dispatch_accept(int s, const char * tgt, double rtime, struct sock_addr ** sas,
 	A->sas = sas;
 	A->sa_b = sa_b;
 	A->rtime = rtime;
-	A->decr = decr;
-	A->nopfs = nopfs;
-	A->requirepfs = requirepfs;
-	A->nokeepalive = nokeepalive;
+	A->opts = *opts;
 	A->conndone = conndone;
 	A->shutdown_requested = 0;
-	A->K = K;
 	A->nconn = 0;
 	A->nconn_max = nconn_max;
-	A->timeo = timeo;
+	A->npool = 0;
+	A->npool_max = dopts->npool;
+	A->mux = dopts->mux;
+	A->mux_cur = NULL;
+	A->balance = dopts->balance;
+	A->targets = NULL;
+	A->ntargets = 0;
+	A->rr = 0;
+	A->health = dopts->health;
 	A->T = NULL;
 	A->accept_cookie = NULL;
 	A->dnstimer_cookie = NULL;
+	A->pooltimer_cookie = NULL;
+	A->healthtimer_cookie = NULL;
 	LIST_INIT(&A->conn_cookies);
+	TAILQ_INIT(&A->pool);
+	LIST_INIT(&A->mux_cookies);
+	LIST_INIT(&A->probes);
+
+	/* Keep track of the load on and health of the target addresses. */
+	if (targets_update(A, A->sas))
+		goto err1;
+
+	/* Each worker process should make different random choices. */
+	if (A->balance == DISPATCH_BALANCE_P2C)
+		srandom((unsigned int)time(NULL) ^ (unsigned int)getpid());
 
 	/* If address re-resolution is enabled... */
 	if (rtime > 0.0) {
@@ -261,6 +1204,16 @@ dispatch_accept(int s, const char * tgt, double rtime, struct sock_addr ** sas,
 			goto err2;
 	}
 
+	/* Probe the target addresses after a while. */
+	if ((A->health > 0.0) && ((A->healthtimer_cookie =
+	    events_timer_register_double(callback_healthcheck, A,
+	    A->health)) == NULL))
+		goto err3;
+
+	/* Establish connections for the pool. */
+	if (poolfill(A))
+		goto err3;
+
 	/* Accept a connection. */
 	if (doaccept(A))
 		goto err3;
@@ -269,12 +1222,15 @@ dispatch_accept(int s, const char * tgt, double rtime, struct sock_addr ** sas,
 	return (A);
 
 err3:
+	pooldrain(A);
+	healthdrain(A);
 	if (A->dnstimer_cookie != NULL)
 		events_timer_cancel(A->dnstimer_cookie);
 err2:
 	if (A->T != NULL)
 		dnsthread_kill(A->T);
 err1:
+	free(A->targets);
 	free(A);
 err0:
 	/* Failure! */
@@ -291,13 +1247,25 @@ dispatch_shutdown(void * dispatch_cookie)
 	struct accept_state * A = dispatch_cookie;
 	struct conn_list_node * C;
 
+	/* Drop any pooled connections. */
+	pooldrain(A);
+
+	/* Drop any multiplexed connections, and the streams they carry. */
+	muxdrain(A);
+
+	/* Stop probing the target addresses. */
+	healthdrain(A);
+
 	/*
-	 * Shutdown any open connections.  proto_conn_drop() will call
-	 * callback_conndied(), which removes the relevant conn_list_node from
-	 * the list of conn_cookies.
+	 * Shutdown any open connections.  proto_conn_drop() and
+	 * proto_mux_drop() will call callback_conndied(), which removes the
+	 * relevant conn_list_node from the list of conn_cookies.
 	 */
 	while ((C = LIST_FIRST(&A->conn_cookies)) != NULL) {
-		proto_conn_drop(C->conn_cookie, PROTO_CONN_CANCELLED);
+		if (A->mux)
+			proto_mux_drop(C->conn_cookie, PROTO_CONN_CANCELLED);
+		else
+			proto_conn_drop(C->conn_cookie, PROTO_CONN_CANCELLED);
 
 		/*
 		 * Convince static analyzers that C->conn_cookie is no longer
@@ -312,6 +1280,7 @@ dispatch_shutdown(void * dispatch_cookie)
 		events_timer_cancel(A->dnstimer_cookie);
 	if (A->T != NULL)
 		dnsthread_kill(A->T);
+	free(A->targets);
 	sock_addr_freelist(A->sas);
 	if (close(A->s))
 		warnp("close");
@@ -327,9 +1296,28 @@ void
 dispatch_request_shutdown(void * dispatch_cookie)
 {
 	struct accept_state * A = dispatch_cookie;
+	struct conn_list_node * C;
+	struct mux_list_node * M;
 
 	A->shutdown_requested = 1;
 
+	/* We won't need any pooled connections, or to probe the target. */
+	pooldrain(A);
+	healthdrain(A);
+
+	/* Close multiplexed connections once their streams have closed. */
+	if (A->mux && A->opts.decr) {
+		LIST_FOREACH(C, &A->conn_cookies, entries) {
+			if (proto_mux_shutdown(C->conn_cookie))
+				warnp("Failure shutting down connection");
+		}
+	}
+	LIST_FOREACH(M, &A->mux_cookies, entries) {
+		if (proto_mux_shutdown(M->mux_cookie))
+			warnp("Failure shutting down connection");
+	}
+	A->mux_cur = NULL;
+
 	/* Cancel any further accepts. */
 	if (A->accept_cookie != NULL) {
 		network_accept_cancel(A->accept_cookie);
@@ -4,30 +4,58 @@
 #include <stddef.h>
 
 /* Opaque structures. */
-struct proto_secret;
+struct proto_conn_opts;
 struct sock_addr;
 
+/* Policies for picking which target address to connect to first. */
+enum {
+	DISPATCH_BALANCE_FIRST = 0,	/* In the order they were resolved */
+	DISPATCH_BALANCE_RR,		/* Round-robin */
+	DISPATCH_BALANCE_LEAST,		/* Fewest active connections */
+	DISPATCH_BALANCE_P2C,		/* Less loaded of two random choices */
+};
+
+/* How to share out incoming connections between the target addresses. */
+struct dispatch_opts {
+	size_t npool;		/* Connections to make in advance, or 0. */
+	int mux;		/* Multiplex connections? */
+	int balance;		/* DISPATCH_BALANCE_* policy. */
+	double health;		/* Seconds between health checks, or 0. */
+};
+
 /**
- * dispatch_accept(s, tgt, rtime, sas, sa_b, decr, nopfs, requirepfs,
- *     nokeepalive, K, nconn_max, timeo, conndone):
+ * dispatch_accept(s, tgt, rtime, sas, sa_b, opts, nconn_max, dopts,
+ *     conndone):
  * Start accepting connections on the socket ${s}.  Bind outgoing address to
- * ${sa_b} if it is not NULL.  Connect to the target ${tgt}, re-resolving
- * it every ${rtime} seconds if ${rtime} > 0; on address resolution
- * failure use the most recent successfully obtained addresses, or the
- * addresses ${sas}.  If ${decr} is 0, encrypt the outgoing connections; if
- * ${decr} is non-zero, decrypt the incoming connections.  Don't accept more
- * than ${nconn_max} connections.  If ${nopfs} is non-zero, don't use perfect
- * forward secrecy.  If ${requirepfs} is non-zero, require that both ends use
- * perfect forward secrecy.  Enable transport layer keep-alives (if applicable)
- * if and only if ${nokeepalive} is zero.  Drop connections if the handshake or
- * connecting to the target takes more than ${timeo} seconds.  If
- * dispatch_request_shutdown() is called then ${conndone} is set to a non-zero
- * value as soon as there are no active connections.  Return a cookie which can
- * be passed to dispatch_shutdown() and dispatch_request_shutdown().
+ * ${sa_b} if it is not NULL.  Connect to the target ${tgt}, re-resolving it
+ * every ${rtime} seconds if ${rtime} > 0; on address resolution failure use the
+ * most recent successfully obtained addresses, or the addresses ${sas}.  Make
+ * each connection with the options ${opts}, as for proto_conn_create(); if
+ * ${opts}->decr is 0 the outgoing connections are encrypted, and if it is
+ * non-zero the incoming connections are decrypted.  Don't accept more than
+ * ${nconn_max} connections.  If ${dopts}->npool is non-zero (which is only
+ * permitted if ${opts}->decr is 0), keep up to ${dopts}->npool connections to
+ * the target connected and handshaken in advance, in addition to the
+ * ${nconn_max} incoming connections, and use them for incoming connections.  If
+ * ${dopts}->mux is non-zero, carry all of the incoming connections over a
+ * single encrypted connection when encrypting, or carry streams over each
+ * incoming connection when decrypting, connecting up to ${nconn_max} of each
+ * connection's streams to the target at once; in that case ${opts}->coalesce
+ * is ignored and ${dopts}->npool must be zero.  Pick which target address to
+ * connect to first according to the policy ${dopts}->balance, skipping
+ * addresses which we have recently failed to connect to.  If ${dopts}->health
+ * is positive, also try to connect to each target address every
+ * ${dopts}->health seconds, and skip addresses until such a probe succeeds.  If
+ * ${dopts}->mux is non-zero, ${dopts}->balance must be DISPATCH_BALANCE_FIRST
+ * and ${dopts}->health must be zero.  The options ${opts} and ${dopts} are
+ * copied, but ${opts}->K must remain valid until dispatch_shutdown() is called.
+ * If dispatch_request_shutdown() is called then ${conndone} is set to a
+ * non-zero value as soon as there are no active connections.  Return a cookie
+ * which can be passed to dispatch_shutdown() and dispatch_request_shutdown().
  */
 void * dispatch_accept(int, const char *, double, struct sock_addr **,
-    const struct sock_addr *, int, int, int, int,
-    const struct proto_secret *, size_t, double, int *);
+    const struct sock_addr *, const struct proto_conn_opts *, size_t,
+    const struct dispatch_opts *, int *);
 
 /**
  * dispatch_shutdown(dispatch_cookie):
@@ -1,15 +1,21 @@
+#include <errno.h>
 #include <math.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
 #include "asprintf.h"
 #include "daemonize.h"
+#include "dhpool.h"
+#include "dhthread.h"
 #include "events.h"
 #include "getopt.h"
 #include "graceful_shutdown.h"
+#include "network_uring.h"
 #include "parsenum.h"
 #include "setuidgid.h"
 #include "sock.h"
@@ -17,7 +23,36 @@
 #include "warnp.h"
 
 #include "dispatch.h"
+#include "proto_conn.h"
 #include "proto_crypt.h"
+#include "workers.h"
+
+/* Parameters for running a connection dispatcher. */
+struct dispatch_params {
+	int * socks;		/* Listening socket(s); -1 once closed. */
+	size_t nsocks;		/* 1, or one per worker with --reuseport. */
+	const char * tgt;
+	double rtime;
+	struct sock_addr ** sas_t;
+	const struct sock_addr * sa_b;
+	struct proto_conn_opts opts;
+	size_t nconn_max;
+	struct dispatch_opts dopts;
+	size_t dhpool_depth;
+	double dhpool_rate;
+	size_t dhthreads;
+	int io_uring;
+};
+
+/* An address given on the command line, being resolved at startup. */
+struct startup_addr {
+	const char * addr;		/* Address to resolve. */
+	int warn;			/* Warn about each failed attempt? */
+	struct sock_addr ** sas;	/* Resolved addresses, or NULL. */
+	int res_errno;			/* Why resolution failed (or 0). */
+	pthread_t thr;			/* Thread resolving the address. */
+	int running;			/* Is that thread running? */
+};
 
 static void
 usage(void)
@@ -29,7 +64,14 @@ usage(void)
 	    "    [-b <bind address> [-DFj] [-f | -g] "
 	    "[-n <max # connections>]\n"
 	    "    [-o <connection timeout>] [-p <pidfile>] [-r <rtime> | -R] "
-	    "[--syslog]\n"
+	    "[-T <# workers>]\n"
+	    "    [--balance <policy>] [--coalesce <usec>] "
+	    "[--conn-pool <# connections>]\n"
+	    "    [--dh-pool <depth>] [--dh-pool-rate <keypairs/s>] "
+	    "[--dh-threads <# threads>]\n"
+	    "    [--fast-handshake] [--health-check <seconds>] [--io-uring] "
+	    "[--jumbo] [--mux]\n"
+	    "    [--race <seconds>] [--reuseport] [--syslog] [--x25519]\n"
 	    "    [-u {<username> | <:groupname> | <username:groupname>}]\n"
 	    "       spiped -v\n");
 	exit(1);
@@ -45,6 +87,211 @@ callback_graceful_shutdown(void * dispatch_cookie)
 	return (0);
 }
 
+/* Close the listening sockets in ${P}, except for number ${keep}. */
+static void
+listeners_close(struct dispatch_params * P, size_t keep)
+{
+	size_t i;
+
+	for (i = 0; i < P->nsocks; i++) {
+		if ((i == keep) || (P->socks[i] == -1))
+			continue;
+		if (close(P->socks[i]))
+			warnp("close");
+		P->socks[i] = -1;
+	}
+}
+
+/* Callback from workers_run(): the workers own the listening sockets now. */
+static void
+callback_workers_started(void * cookie)
+{
+	struct dispatch_params * P = cookie;
+
+	/* Close all of our listening sockets. */
+	listeners_close(P, SIZE_MAX);
+}
+
+/*
+ * Start accepting connections with the parameters ${cookie}, and run the event
+ * loop until an error occurs or a graceful shutdown completes.  Worker number
+ * ${worker} uses the listening socket of the same number if there is one per
+ * worker, or the sole listening socket otherwise; ownership of that socket
+ * and of the target addresses passes to the dispatcher.
+ */
+static int
+run_dispatch(void * cookie, size_t worker)
+{
+	struct dispatch_params * P = cookie;
+	void * dispatch_cookie;
+	size_t sockno = worker % P->nsocks;
+	int s = P->socks[sockno];
+	int conndone = 0;
+
+	/* Close listening sockets which belong to other workers. */
+	listeners_close(P, sockno);
+
+	/* Perform connection I/O via io_uring if requested and available. */
+	if (P->io_uring && network_uring_init() && (worker == 0))
+		warnp("io_uring is not available; using poll-based I/O");
+
+	/* Pre-generate diffie-hellman keypairs if requested. */
+	if ((P->dhpool_depth > 0) && !P->opts.nopfs &&
+	    dhpool_init(P->dhpool_depth, P->dhpool_rate)) {
+		warnp("Failed to start diffie-hellman keypair pool");
+		goto err0;
+	}
+
+	/* Perform diffie-hellman computations off the event loop if asked. */
+	if ((P->dhthreads > 0) && !P->opts.nopfs &&
+	    dhthread_init(P->dhthreads)) {
+		warnp("Failed to start diffie-hellman computation threads");
+		goto err0;
+	}
+
+	/* Start accepting connections. */
+	if ((dispatch_cookie = dispatch_accept(s, P->tgt, P->rtime,
+	    P->sas_t, P->sa_b, &P->opts, P->nconn_max, &P->dopts,
+	    &conndone)) == NULL) {
+		warnp("Failed to initialize connection acceptor");
+		goto err0;
+	}
+
+	/* dispatch is now maintaining sas_t and s. */
+	P->sas_t = NULL;
+	P->socks[sockno] = -1;
+
+	/* Register a handler for SIGTERM. */
+	if (graceful_shutdown_initialize(&callback_graceful_shutdown,
+	    dispatch_cookie)) {
+		warn0("Failed to start graceful_shutdown timer");
+		goto err1;
+	}
+
+	/*
+	 * Loop until an error occurs, or a connection closes if the
+	 * command-line argument -1 was given.
+	 */
+	if (events_spin(&conndone)) {
+		warnp("Error running event loop");
+		goto err1;
+	}
+
+	/* Stop accepting connections and shut down the dispatcher. */
+	dispatch_shutdown(dispatch_cookie);
+
+	/* All connection I/O has been cancelled. */
+	network_uring_shutdown();
+
+	/* Stop pre-generating keypairs and performing computations. */
+	dhpool_shutdown();
+	dhthread_shutdown();
+
+	/* Success! */
+	return (0);
+
+err1:
+	dispatch_shutdown(dispatch_cookie);
+err0:
+	network_uring_shutdown();
+	dhpool_shutdown();
+	dhthread_shutdown();
+
+	/* Failure! */
+	return (-1);
+}
+
+/* Thread which resolves an address at startup. */
+static void *
+startup_resolve(void * cookie)
+{
+	struct startup_addr * R = cookie;
+
+	/* Resolve the address. */
+	if ((R->sas = sock_resolve(R->addr)) == NULL) {
+		R->res_errno = errno;
+	} else if (R->sas[0] == NULL) {
+		/* Finding no addresses is as bad as failing to look them up. */
+		sock_addr_freelist(R->sas);
+		R->sas = NULL;
+		R->res_errno = 0;
+	}
+
+	/* We're done. */
+	return (NULL);
+}
+
+/*
+ * Resolve the ${n} addresses ${R} in parallel.  If ${retry} is non-zero and
+ * some of them can't be resolved, try those again every second until they
+ * are, warning about each failed attempt for the addresses which ask for
+ * that; otherwise, warn about them and fail.
+ */
+static int
+resolve_startup(struct startup_addr * R, size_t n, int retry)
+{
+	int failed;
+	size_t i;
+	int rc;
+
+	do {
+		/*
+		 * Start resolving each address we don't have yet in a thread
+		 * of its own, or in this thread if we can't create one.
+		 */
+		for (i = 0; i < n; i++) {
+			R[i].running = 0;
+			if (R[i].sas != NULL)
+				continue;
+			if (pthread_create(&R[i].thr, NULL, startup_resolve,
+			    &R[i]) == 0)
+				R[i].running = 1;
+			else
+				startup_resolve(&R[i]);
+		}
+
+		/* Wait for them. */
+		for (i = 0; i < n; i++) {
+			if (!R[i].running)
+				continue;
+			if ((rc = pthread_join(R[i].thr, NULL)) != 0) {
+				warn0("pthread_join: %s", strerror(rc));
+				goto err0;
+			}
+		}
+
+		/* Did any of them fail? */
+		for (failed = 0, i = 0; i < n; i++) {
+			if (R[i].sas != NULL)
+				continue;
+			if (!retry || R[i].warn) {
+				if (R[i].res_errno == 0) {
+					warn0("No addresses found for %s",
+					    R[i].addr);
+				} else {
+					errno = R[i].res_errno;
+					warnp("Error resolving socket address:"
+					    " %s", R[i].addr);
+				}
+			}
+			if (!retry)
+				goto err0;
+			failed = 1;
+		}
+
+		/* Wait a second before trying again. */
+		if (failed)
+			sleep(1);
+	} while (failed);
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
 /*
  * Signal handler for SIGINT to perform a hard shutdown.
  */
@@ -67,37 +314,61 @@ main(int argc, char * argv[])
 {
 	/* Command-line parameters. */
 	const char * opt_b = NULL;
+	int opt_balance_set = 0;
+	int opt_balance = DISPATCH_BALANCE_FIRST;
+	int opt_coalesce_set = 0;
+	double opt_coalesce = 0.0;
+	int opt_conn_pool_set = 0;
+	size_t opt_conn_pool = 0;
 	int opt_d = 0;
 	int opt_D = 0;
+	int opt_dh_pool_set = 0;
+	size_t opt_dh_pool = 0;
+	int opt_dh_pool_rate_set = 0;
+	double opt_dh_pool_rate = 0.0;
+	size_t opt_dh_threads = 0;
 	int opt_e = 0;
 	int opt_f = 0;
+	int opt_fast_handshake = 0;
 	int opt_g = 0;
+	int opt_health_check_set = 0;
+	double opt_health_check = 0.0;
+	int opt_io_uring = 0;
 	int opt_F = 0;
 	int opt_j = 0;
+	int opt_jumbo = 0;
 	const char * opt_k = NULL;
+	int opt_mux = 0;
 	int opt_n_set = 0;
 	size_t opt_n = 0;
 	int opt_o_set = 0;
 	double opt_o = 0.0;
 	const char * opt_p = NULL;
+	int opt_race_set = 0;
+	double opt_race = 0.0;
+	int opt_reuseport = 0;
 	int opt_r_set = 0;
 	double opt_r = 0.0;
 	int opt_R = 0;
 	int opt_syslog = 0;
 	const char * opt_s = NULL;
 	const char * opt_t = NULL;
+	size_t opt_T = 0;
 	const char * opt_u = NULL;
+	int opt_x25519 = 0;
 
 	/* Working variables. */
-	struct sock_addr * sa_s;
+	struct sock_addr * sa_s = NULL;
 	struct sock_addr * sa_b = NULL;
-	struct sock_addr ** sas_t;
+	struct sock_addr ** sas_t = NULL;
+	struct startup_addr R[3];
+	size_t nresolve;
+	char * addr_b = NULL;
 	struct proto_secret * K;
 	const char * ch;
 	char * pidfilename = NULL;
-	int s;
-	void * dispatch_cookie = NULL;
-	int conndone = 0;
+	struct dispatch_params P;
+	size_t i;
 
 	WARNP_INIT;
 
@@ -109,6 +380,35 @@ main(int argc, char * argv[])
 				usage();
 			opt_b = optarg;
 			break;
+		GETOPT_OPTARG("--balance"):
+			if (opt_balance_set)
+				usage();
+			opt_balance_set = 1;
+			if (strcmp(optarg, "first") == 0)
+				opt_balance = DISPATCH_BALANCE_FIRST;
+			else if (strcmp(optarg, "round-robin") == 0)
+				opt_balance = DISPATCH_BALANCE_RR;
+			else if (strcmp(optarg, "least-conn") == 0)
+				opt_balance = DISPATCH_BALANCE_LEAST;
+			else if (strcmp(optarg, "two-choice") == 0)
+				opt_balance = DISPATCH_BALANCE_P2C;
+			else
+				usage();
+			break;
+		GETOPT_OPTARG("--coalesce"):
+			if (opt_coalesce_set)
+				usage();
+			opt_coalesce_set = 1;
+			if (PARSENUM(&opt_coalesce, optarg, 0, 1000000))
+				OPT_EPARSE(ch, optarg);
+			break;
+		GETOPT_OPTARG("--conn-pool"):
+			if (opt_conn_pool_set)
+				usage();
+			opt_conn_pool_set = 1;
+			if (PARSENUM(&opt_conn_pool, optarg, 1, 1000))
+				OPT_EPARSE(ch, optarg);
+			break;
 		GETOPT_OPT("-d"):
 			if (opt_d || opt_e)
 				usage();
@@ -119,6 +419,26 @@ main(int argc, char * argv[])
 				usage();
 			opt_D = 1;
 			break;
+		GETOPT_OPTARG("--dh-pool"):
+			if (opt_dh_pool_set)
+				usage();
+			opt_dh_pool_set = 1;
+			if (PARSENUM(&opt_dh_pool, optarg, 1, 65536))
+				OPT_EPARSE(ch, optarg);
+			break;
+		GETOPT_OPTARG("--dh-pool-rate"):
+			if (opt_dh_pool_rate_set)
+				usage();
+			opt_dh_pool_rate_set = 1;
+			if (PARSENUM(&opt_dh_pool_rate, optarg, 0, INFINITY))
+				OPT_EPARSE(ch, optarg);
+			break;
+		GETOPT_OPTARG("--dh-threads"):
+			if (opt_dh_threads != 0)
+				usage();
+			if (PARSENUM(&opt_dh_threads, optarg, 1, 1024))
+				OPT_EPARSE(ch, optarg);
+			break;
 		GETOPT_OPT("-e"):
 			if (opt_d || opt_e)
 				usage();
@@ -134,21 +454,48 @@ main(int argc, char * argv[])
 				usage();
 			opt_F = 1;
 			break;
+		GETOPT_OPT("--fast-handshake"):
+			if (opt_fast_handshake)
+				usage();
+			opt_fast_handshake = 1;
+			break;
 		GETOPT_OPT("-g"):
 			if (opt_g)
 				usage();
 			opt_g = 1;
 			break;
+		GETOPT_OPTARG("--health-check"):
+			if (opt_health_check_set)
+				usage();
+			opt_health_check_set = 1;
+			if (PARSENUM(&opt_health_check, optarg, 0, INFINITY))
+				OPT_EPARSE(ch, optarg);
+			break;
+		GETOPT_OPT("--io-uring"):
+			if (opt_io_uring)
+				usage();
+			opt_io_uring = 1;
+			break;
 		GETOPT_OPT("-j"):
 			if (opt_j)
 				usage();
 			opt_j = 1;
 			break;
+		GETOPT_OPT("--jumbo"):
+			if (opt_jumbo)
+				usage();
+			opt_jumbo = 1;
+			break;
 		GETOPT_OPTARG("-k"):
 			if (opt_k)
 				usage();
 			opt_k = optarg;
 			break;
+		GETOPT_OPT("--mux"):
+			if (opt_mux)
+				usage();
+			opt_mux = 1;
+			break;
 		GETOPT_OPTARG("-n"):
 			if (opt_n_set)
 				usage();
@@ -170,6 +517,13 @@ main(int argc, char * argv[])
 				usage();
 			opt_p = optarg;
 			break;
+		GETOPT_OPTARG("--race"):
+			if (opt_race_set)
+				usage();
+			opt_race_set = 1;
+			if (PARSENUM(&opt_race, optarg, 0, INFINITY))
+				OPT_EPARSE(ch, optarg);
+			break;
 		GETOPT_OPTARG("-r"):
 			if (opt_r_set)
 				usage();
@@ -182,6 +536,11 @@ main(int argc, char * argv[])
 				usage();
 			opt_R = 1;
 			break;
+		GETOPT_OPT("--reuseport"):
+			if (opt_reuseport)
+				usage();
+			opt_reuseport = 1;
+			break;
 		GETOPT_OPTARG("-s"):
 			if (opt_s)
 				usage();
@@ -197,6 +556,12 @@ main(int argc, char * argv[])
 				usage();
 			opt_t = optarg;
 			break;
+		GETOPT_OPTARG("-T"):
+			if (opt_T != 0)
+				usage();
+			if (PARSENUM(&opt_T, optarg, 1, 1024))
+				OPT_EPARSE(ch, optarg);
+			break;
 		GETOPT_OPTARG("-u"):
 			if (opt_u != NULL)
 				usage();
@@ -205,6 +570,11 @@ main(int argc, char * argv[])
 		GETOPT_OPT("-v"):
 			fprintf(stderr, "spiped @VERSION@\n");
 			exit(0);
+		GETOPT_OPT("--x25519"):
+			if (opt_x25519)
+				usage();
+			opt_x25519 = 1;
+			break;
 		GETOPT_MISSING_ARG:
 			warn0("Missing argument to %s", ch);
 			usage();
@@ -228,6 +598,8 @@ main(int argc, char * argv[])
 		opt_o = 5.0;
 	if (opt_r == 0.0)
 		opt_r = 60.0;
+	if (opt_T == 0)
+		opt_T = 1;
 
 	/* Sanity-check options. */
 	if (!opt_d && !opt_e)
@@ -240,6 +612,20 @@ main(int argc, char * argv[])
 		usage();
 	if ((opt_r != 60.0) && opt_R)
 		usage();
+	if (opt_dh_pool_rate_set && !opt_dh_pool_set)
+		usage();
+	if (opt_conn_pool_set && !opt_e)
+		usage();
+	if (opt_fast_handshake && !opt_d)
+		usage();
+	if (opt_mux && (opt_coalesce_set || opt_conn_pool_set))
+		usage();
+	if (opt_mux && (opt_balance_set || opt_health_check_set))
+		usage();
+	if (opt_health_check_set && !(opt_health_check > 0.0))
+		usage();
+	if (opt_race_set && !(opt_race > 0.0))
+		usage();
 	if ((opt_s == NULL) || sock_addr_validate(opt_s))
 		usage();
 	if ((opt_t == NULL) || sock_addr_validate(opt_t))
@@ -285,38 +671,42 @@ main(int argc, char * argv[])
 			warnp_syslog(1);
 	}
 
-	/* Resolve source address. */
-	while ((sa_s = sock_resolve_one(opt_s, 0)) == NULL) {
-		if (!opt_D) {
-			warnp("Error resolving socket address: %s", opt_s);
+	/*
+	 * Resolve the source, target, and bind addresses in parallel, since
+	 * each may require a slow DNS lookup.
+	 */
+	for (i = 0; i < 3; i++)
+		R[i].sas = NULL;
+	R[0].addr = opt_s;
+	R[0].warn = 1;
+	R[1].addr = opt_t;
+	R[1].warn = 0;
+	nresolve = 2;
+	if (opt_b) {
+		if ((addr_b = sock_addr_ensure_port(opt_b)) == NULL) {
+			warnp("sock_addr_ensure_port");
 			goto err1;
 		}
-		sleep(1);
-	}
-
-	/* Resolve target address. */
-	while ((sas_t = sock_resolve(opt_t)) == NULL) {
-		if (!opt_D) {
-			warnp("Error resolving socket address: %s", opt_t);
-			goto err2;
-		}
-		sleep(1);
-	}
-	if (sas_t[0] == NULL) {
-		warn0("No addresses found for %s", opt_t);
-		goto err3;
+		R[nresolve].addr = addr_b;
+		R[nresolve++].warn = 1;
 	}
-
-	/* Resolve bind address (if applicable). */
+	if (resolve_startup(R, nresolve, opt_D))
+		goto err2;
+
+	/* We want a single source address, and all the target addresses. */
+	sa_s = sock_addr_pickone(opt_s, R[0].sas);
+	R[0].sas = NULL;
+	if (sa_s == NULL)
+		goto err2;
+	sas_t = R[1].sas;
+	R[1].sas = NULL;
+
+	/* We want a single bind address (if applicable). */
 	if (opt_b) {
-		while ((sa_b = sock_resolve_one(opt_b, 1)) == NULL) {
-			if (!opt_D) {
-				warnp("Error resolving socket address: %s",
-				    opt_b);
-				goto err3;
-			}
-			sleep(1);
-		}
+		sa_b = sock_addr_pickone(addr_b, R[2].sas);
+		R[2].sas = NULL;
+		if (sa_b == NULL)
+			goto err3;
 	}
 
 	/* Load the keying data. */
@@ -325,9 +715,22 @@ main(int argc, char * argv[])
 		goto err4;
 	}
 
-	/* Create and bind a socket, and mark it as listening. */
-	if ((s = sock_listener(sa_s)) == -1)
+	/*
+	 * Create and bind a socket, and mark it as listening.  With
+	 * --reuseport, create one such socket for each worker.
+	 */
+	P.nsocks = opt_reuseport ? opt_T : 1;
+	if ((P.socks = malloc(P.nsocks * sizeof(int))) == NULL) {
+		warnp("malloc");
 		goto err5;
+	}
+	for (i = 0; i < P.nsocks; i++)
+		P.socks[i] = -1;
+	for (i = 0; i < P.nsocks; i++) {
+		if ((P.socks[i] = opt_reuseport ?
+		    sock_listener_reuseport(sa_s) : sock_listener(sa_s)) == -1)
+			goto err6;
+	}
 
 	/* Daemonize and write pid. */
 	if (!opt_D && !opt_F) {
@@ -346,36 +749,53 @@ main(int argc, char * argv[])
 		goto err6;
 	}
 
-	/* Start accepting connections. */
-	if ((dispatch_cookie = dispatch_accept(s, opt_t, opt_R ? 0.0 : opt_r,
-	    sas_t, sa_b, opt_d, opt_f, opt_g, opt_j, K, opt_n, opt_o,
-	    &conndone)) == NULL) {
-		warnp("Failed to initialize connection acceptor");
-		goto err6;
-	}
-
-	/* dispatch is now maintaining sas_t and s. */
-	sas_t = NULL;
-	s = -1;
-
-	/* Register a handler for SIGTERM. */
-	if (graceful_shutdown_initialize(&callback_graceful_shutdown,
-	    dispatch_cookie)) {
-		warn0("Failed to start graceful_shutdown timer");
-		goto err7;
-	}
+	/* Parameters for the connection dispatcher(s). */
+	P.tgt = opt_t;
+	P.rtime = opt_R ? 0.0 : opt_r;
+	P.sas_t = sas_t;
+	P.sa_b = sa_b;
+	P.opts.decr = opt_d;
+	P.opts.nopfs = opt_f;
+	P.opts.requirepfs = opt_g;
+	P.opts.jumbo = opt_jumbo;
+	P.opts.x25519 = opt_x25519;
+	P.opts.early = opt_fast_handshake;
+	P.opts.nokeepalive = opt_j;
+	P.opts.K = K;
+	P.opts.timeo = opt_o;
+	P.opts.race = opt_race;
+	P.opts.coalesce = opt_coalesce / 1000000.0;
+	P.nconn_max = opt_n;
+	P.dopts.npool = opt_conn_pool;
+	P.dopts.mux = opt_mux;
+	P.dopts.balance = opt_balance;
+	P.dopts.health = opt_health_check;
+	P.dhpool_depth = opt_dh_pool;
+	P.dhpool_rate = opt_dh_pool_rate;
+	P.dhthreads = opt_dh_threads;
+	P.io_uring = opt_io_uring;
 
 	/*
-	 * Loop until an error occurs, or a connection closes if the
-	 * command-line argument -1 was given.
+	 * Handle connections in this process, or in ${opt_T} worker processes
+	 * which share the listening socket (or have one each).
 	 */
-	if (events_spin(&conndone)) {
-		warnp("Error running event loop");
-		goto err7;
+	if (opt_T > 1) {
+		if (workers_run(opt_T, run_dispatch,
+		    callback_workers_started, &P)) {
+			warn0("Worker process(es) failed");
+			goto err6;
+		}
+	} else {
+		if (run_dispatch(&P, 0))
+			goto err7;
 	}
 
-	/* Stop accepting connections and shut down the dispatcher. */
-	dispatch_shutdown(dispatch_cookie);
+	/* Close the listening socket(s) (if we still own any). */
+	listeners_close(&P, SIZE_MAX);
+	free(P.socks);
+
+	/* Free the target addresses (if we still own them). */
+	sock_addr_freelist(P.sas_t);
 
 	/* Free the protocol secret structure. */
 	proto_crypt_secret_free(K);
@@ -383,6 +803,7 @@ main(int argc, char * argv[])
 	/* Free arrays of resolved addresses. */
 	sock_addr_free(sa_s);
 	sock_addr_free(sa_b);
+	free(addr_b);
 
 	/* Free pid filename. */
 	free(pidfilename);
@@ -391,10 +812,11 @@ main(int argc, char * argv[])
 	exit(0);
 
 err7:
-	dispatch_shutdown(dispatch_cookie);
+	/* The dispatcher may have taken ownership of sas_t. */
+	sas_t = P.sas_t;
 err6:
-	if ((s != -1) && close(s))
-		warnp("close");
+	listeners_close(&P, SIZE_MAX);
+	free(P.socks);
 err5:
 	proto_crypt_secret_free(K);
 err4:
@@ -403,7 +825,10 @@ err3:
 	sock_addr_freelist(sas_t);
 err2:
 	sock_addr_free(sa_s);
+	for (i = 0; i < 3; i++)
+		sock_addr_freelist(R[i].sas);
 err1:
+	free(addr_b);
 	free(pidfilename);
 err0:
 	/* Failure! */
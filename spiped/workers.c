@@ -0,0 +1,183 @@
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "warnp.h"
+
+#include "workers.h"
+
+/* Worker processes, for forwarding SIGTERM. */
+static pid_t * worker_pids;
+static volatile size_t nworker_pids = 0;
+
+/* Signal handler for SIGTERM in the parent process. */
+static void
+workers_sigterm(int signo)
+{
+	size_t i;
+
+	(void)signo; /* UNUSED */
+
+	/* Ask each worker to perform a graceful shutdown. */
+	for (i = 0; i < nworker_pids; i++)
+		kill(worker_pids[i], SIGTERM);
+}
+
+/* Wait for the worker ${pid} to exit; return 0 if it exited with status 0. */
+static int
+workers_wait(pid_t pid)
+{
+	int status;
+
+	/* Wait for the process to finish. */
+	while (waitpid(pid, &status, 0) == -1) {
+		if (errno == EINTR)
+			continue;
+		warnp("waitpid");
+		goto err0;
+	}
+
+	/* Did it succeed? */
+	if (WIFEXITED(status)) {
+		if (WEXITSTATUS(status) != 0)
+			goto err0;
+	} else {
+		if (WIFSIGNALED(status))
+			warn0("worker %jd: terminated with signal %d",
+			    (intmax_t)pid, WTERMSIG(status));
+		else
+			warn0("worker %jd: exited for an unknown reason",
+			    (intmax_t)pid);
+		goto err0;
+	}
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/**
+ * workers_run(nworkers, func, started, cookie):
+ * Fork ${nworkers} worker processes; worker number i (0 <= i < ${nworkers})
+ * runs ${func}(${cookie}, i) and exits with status 0 if that returns 0, or 1
+ * otherwise.  Once all of the workers have been launched, call
+ * ${started}(${cookie}) in this process if ${started} is not NULL.  While the
+ * workers are running, forward SIGTERM to each of them.  Wait for all of the
+ * workers to exit, and return 0 if they all exited with status 0, or -1
+ * otherwise.
+ */
+int
+workers_run(size_t nworkers, int (* func)(void *, size_t),
+    void (* started)(void *), void * cookie)
+{
+	struct sigaction sa;
+	struct sigaction sa_orig;
+	sigset_t set;
+	sigset_t set_orig;
+	pid_t pid;
+	size_t i;
+	int rc = 0;
+
+	/* Allocate space for the worker process IDs. */
+	if ((worker_pids = calloc(nworkers, sizeof(pid_t))) == NULL) {
+		warnp("calloc");
+		goto err0;
+	}
+
+	/* Hold SIGTERM until the workers exist and our handler is in place. */
+	if (sigemptyset(&set) || sigaddset(&set, SIGTERM)) {
+		warnp("sigaddset");
+		goto err1;
+	}
+	if (sigprocmask(SIG_BLOCK, &set, &set_orig)) {
+		warnp("sigprocmask");
+		goto err1;
+	}
+
+	/* Launch the workers. */
+	for (i = 0; i < nworkers; i++) {
+		switch (pid = fork()) {
+		case -1:
+			warnp("fork");
+			goto err2;
+		case 0:
+			/* In the worker: receive SIGTERM normally. */
+			if ((signal(SIGTERM, SIG_DFL) == SIG_ERR) ||
+			    sigprocmask(SIG_SETMASK, &set_orig, NULL)) {
+				warnp("Failed to reset SIGTERM handling");
+				exit(1);
+			}
+
+			/* Do the work. */
+			exit(func(cookie, i) ? 1 : 0);
+		default:
+			/* In the parent: record the new worker. */
+			worker_pids[i] = pid;
+			nworker_pids = i + 1;
+			break;
+		}
+	}
+
+	/* Let the caller know that the workers have been launched. */
+	if (started != NULL)
+		started(cookie);
+
+	/* Forward SIGTERM to the workers. */
+	memset(&sa, 0, sizeof(struct sigaction));
+	sa.sa_handler = workers_sigterm;
+	sa.sa_flags = SA_RESTART;
+	if (sigemptyset(&sa.sa_mask)) {
+		warnp("sigemptyset");
+		goto err2;
+	}
+	if (sigaction(SIGTERM, &sa, &sa_orig)) {
+		warnp("sigaction");
+		goto err2;
+	}
+	if (sigprocmask(SIG_SETMASK, &set_orig, NULL)) {
+		warnp("sigprocmask");
+		goto err3;
+	}
+
+	/* Wait for all of the workers to finish. */
+	for (i = 0; i < nworkers; i++) {
+		if (workers_wait(worker_pids[i]))
+			rc = -1;
+	}
+
+	/* Restore the original SIGTERM handler. */
+	nworker_pids = 0;
+	if (sigaction(SIGTERM, &sa_orig, NULL))
+		warnp("sigaction");
+
+	/* Clean up. */
+	free(worker_pids);
+
+	/* Return status of the workers. */
+	return (rc);
+
+err3:
+	sigaction(SIGTERM, &sa_orig, NULL);
+err2:
+	/* Shut down any workers which we managed to launch. */
+	for (i = 0; i < nworker_pids; i++) {
+		kill(worker_pids[i], SIGTERM);
+		workers_wait(worker_pids[i]);
+	}
+	nworker_pids = 0;
+	sigprocmask(SIG_SETMASK, &set_orig, NULL);
+err1:
+	free(worker_pids);
+err0:
+	/* Failure! */
+	return (-1);
+}
@@ -0,0 +1,18 @@
+#ifndef WORKERS_H_
+#define WORKERS_H_
+
+#include <stddef.h>
+
+/**
+ * workers_run(nworkers, func, started, cookie):
+ * Fork ${nworkers} worker processes; worker number i (0 <= i < ${nworkers})
+ * runs ${func}(${cookie}, i) and exits with status 0 if that returns 0, or 1
+ * otherwise.  Once all of the workers have been launched, call
+ * ${started}(${cookie}) in this process if ${started} is not NULL.  While the
+ * workers are running, forward SIGTERM to each of them.  Wait for all of the
+ * workers to exit, and return 0 if they all exited with status 0, or -1
+ * otherwise.
+ */
+int workers_run(size_t, int (*)(void *, size_t), void (*)(void *), void *);
+
+#endif /* !WORKERS_H_ */
@@ -0,0 +1,33 @@
+#!/bin/sh
+
+# Goal of this test:
+# - create a pair of spiped servers (encryption, decryption), each of which
+#   handles connections in several worker processes
+# - each server should have started the requested number of workers
+# - establish a connection to the encryption spiped server
+# - open one connection, send a file, close the connection
+# - the received file should match the original one
+
+### Constants
+c_valgrind_min=1
+ncat_output="${s_basename}-ncat-output.txt"
+sendfile=${scriptdir}/shared_test_functions.sh
+
+### Actual command
+scenario_cmd() {
+	# Set up infrastructure.
+	setup_spiped_decryption_server "${ncat_output}" 0 1 0 "-T 3"
+	setup_spiped_encryption_server "-T 2"
+
+	# Check that the servers started their workers.
+	setup_check "spiped workers"
+	if wait_children "${s_basename}-spiped-d.pid" 3 &&		\
+	    wait_children "${s_basename}-spiped-e.pid" 2; then
+		echo 0
+	else
+		echo 1
+	fi > "${c_exitfile}"
+
+	# Send a file and check that it arrived intact.
+	send_file_check "${sendfile}" "${ncat_output}"
+}
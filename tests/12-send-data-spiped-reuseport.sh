@@ -0,0 +1,40 @@
+#!/bin/sh
+
+# Goal of this test:
+# - create a pair of spiped servers (encryption, decryption), each of which
+#   handles connections in several worker processes with one SO_REUSEPORT
+#   listening socket per worker
+# - each worker should have its own listening socket
+# - establish a connection to the encryption spiped server
+# - open one connection, send a file, close the connection
+# - the received file should match the original one
+
+### Constants
+c_valgrind_min=1
+ncat_output="${s_basename}-ncat-output.txt"
+sendfile=${scriptdir}/shared_test_functions.sh
+
+### Actual command
+scenario_cmd() {
+	# Set up infrastructure.
+	setup_spiped_decryption_server "${ncat_output}" 0 1 0 "-T 3 --reuseport"
+	setup_spiped_encryption_server "-T 2 --reuseport"
+
+	# Check that each worker is listening on its own socket.
+	setup_check "spiped reuseport listeners"
+	if [ -z "$(count_listeners "${mid_sock}")" ]; then
+		printf "/proc/net/tcp is not available... " 1>&2
+		echo "-1"
+	elif ! wait_while 5000 has_fewer_listeners "${mid_sock}" 3 ||	\
+	    ! wait_while 5000 has_fewer_listeners "${src_sock}" 2; then
+		echo "1"
+	elif [ "$(count_listeners "${mid_sock}")" -ne 3 ] ||		\
+	    [ "$(count_listeners "${src_sock}")" -ne 2 ]; then
+		echo "1"
+	else
+		echo "0"
+	fi > "${c_exitfile}"
+
+	# Send a file and check that it arrived intact.
+	send_file_check "${sendfile}" "${ncat_output}"
+}
@@ -0,0 +1,36 @@
+#!/bin/sh
+
+# Goal of this test:
+# - create a pair of spiped servers (encryption, decryption), each of which
+#   performs connection I/O via io_uring
+# - establish a connection to the encryption spiped server
+# - open one connection, send a file, close the connection
+# - the received file should match the original one
+# - neither server should have fallen back to poll-based I/O; if io_uring is
+#   not available, skip that check
+
+### Constants
+c_valgrind_min=1
+ncat_output="${s_basename}-ncat-output.txt"
+spiped_stderr="${s_basename}-spiped-stderr.txt"
+sendfile=${scriptdir}/shared_test_functions.sh
+
+### Actual command
+scenario_cmd() {
+	# Set up infrastructure, keeping any warnings from spiped.
+	setup_spiped_decryption_server "${ncat_output}" 0 1 0		\
+		"--io-uring" 2> "${spiped_stderr}"
+	setup_spiped_encryption_server "--io-uring" 2>> "${spiped_stderr}"
+
+	# Send a file and check that it arrived intact.
+	send_file_check "${sendfile}" "${ncat_output}"
+
+	# Check that the servers really used io_uring.
+	setup_check "spiped io_uring"
+	if grep -q "io_uring is not available" "${spiped_stderr}"; then
+		printf "io_uring is not available... " 1>&2
+		echo "-1"
+	else
+		echo "0"
+	fi > "${c_exitfile}"
+}
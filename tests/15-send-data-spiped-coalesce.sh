@@ -0,0 +1,97 @@
+#!/bin/sh
+
+# Goal of this test:
+# - create a pair of spiped servers (encryption, decryption), where the
+#   encryption server holds back data which does not fill a packet, with a
+#   proxy between them which counts the encrypted bytes
+# - open one connection, send many short lines spaced well within the
+#   coalescing deadline, wait for the deadline to pass, close the connection
+# - far fewer packets than lines should have been sent
+# - everything should have been sent before the connection was closed
+# - open one connection, send one short line, close the connection at once
+# - each received file should match the original one
+
+### Constants
+c_valgrind_min=1
+prx_sock="[127.0.0.1]:8004"
+ncat_output="${s_basename}-ncat-output.txt"
+ncat_output2="${s_basename}-ncat-output2.txt"
+count_output="${s_basename}-count.txt"
+count_snapshot="${s_basename}-count-snapshot.txt"
+sendfile="${s_basename}-sendfile.txt"
+sendfile2="${s_basename}-sendfile2.txt"
+
+# Number of short lines to send, and the size of an encrypted packet.
+nlines=40
+packetsize=1060
+
+### Actual command
+scenario_cmd() {
+	# Create the files to send.
+	i=0
+	while [ "${i}" -lt "${nlines}" ]; do
+		echo "coalesced line ${i}"
+		i=$((i + 1))
+	done > "${sendfile}"
+	echo "single line" > "${sendfile2}"
+
+	# Set up infrastructure, passing the encrypted connections through a
+	# proxy.
+	setup_spiped_decryption_server "${ncat_output}"
+	${nc_proxy_binary} "${prx_sock}" "${mid_sock}" "${count_output}" 2 &
+	wait_while 5000 has_fewer_listeners "${prx_sock}" 1
+	setup_spiped_encryption_server "--coalesce 500000" "${prx_sock}"
+
+	# Send the lines one at a time, and record how much has gone over
+	# the wire once the deadline has passed.
+	setup_check "spiped coalesce send lines"
+	(
+		while read -r line; do
+			echo "${line}"
+			"${msleep}" 20
+		done < "${sendfile}"
+		"${msleep}" 1500
+		cp "${count_output}-0" "${count_snapshot}"
+	) | ${nc_client_binary} "${src_sock}"
+	echo $? > "${c_exitfile}"
+
+	# Start a new nc-server once the first one has quit.
+	wait_while 0 has_pid "${nc_server_binary} ${dst_sock}"
+	${nc_server_binary} "${dst_sock}" "${ncat_output2}" &
+	wait_while 5000 has_fewer_listeners "${dst_sock}" 1
+
+	# Send one line and close the connection immediately.
+	setup_check "spiped coalesce send line"
+	${nc_client_binary} "${src_sock}" < "${sendfile2}"
+	echo $? > "${c_exitfile}"
+
+	# Wait for server(s) and the proxy to quit.
+	servers_stop
+	wait_while 0 has_pid "${nc_proxy_binary} ${prx_sock}"
+
+	# Far fewer packets than lines should have been sent.
+	setup_check "spiped coalesce packets"
+	if [ "$(cat "${count_output}-0")" -le			\
+	    $((nlines * packetsize / 4)) ]; then
+		echo 0
+	else
+		echo 1
+	fi > "${c_exitfile}"
+
+	# Nothing should have been held back until the connection closed.
+	setup_check "spiped coalesce flush at deadline"
+	if cmp -s "${count_snapshot}" "${count_output}-0"; then
+		echo 0
+	else
+		echo 1
+	fi > "${c_exitfile}"
+
+	# Each file should have arrived intact.
+	setup_check "spiped coalesce output"
+	if cmp -s "${ncat_output}" "${sendfile}" &&			\
+	    cmp -s "${ncat_output2}" "${sendfile2}"; then
+		echo 0
+	else
+		echo 1
+	fi > "${c_exitfile}"
+}
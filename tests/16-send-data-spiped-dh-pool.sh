@@ -0,0 +1,45 @@
+#!/bin/sh
+
+# Goal of this test:
+# - create a pair of spiped servers (encryption, decryption), each of which
+#   takes diffie-hellman keypairs from a pre-generated pool
+# - establish a connection to the encryption spiped server
+# - open one connection, send a file, close the connection
+# - the decryption server's pool thread should wake up to replace the
+#   keypair used by the connection
+# - the received file should match the original one
+
+### Constants
+c_valgrind_min=1
+ncat_output="${s_basename}-ncat-output.txt"
+sendfile=${scriptdir}/shared_test_functions.sh
+
+### Actual command
+scenario_cmd() {
+	# Set up infrastructure.
+	setup_spiped_decryption_server "${ncat_output}" 0 1 0 "--dh-pool 4"
+	setup_spiped_encryption_server "--dh-pool 4 --dh-pool-rate 100"
+
+	# Wait for the pools to fill, and record the pool thread's wakeups.
+	wait_while 5000 threads_busy "${s_basename}-spiped-d.pid"
+	wakeups=$(thread_wakeups "${s_basename}-spiped-d.pid")
+
+	# Send a file.
+	send_file "${sendfile}"
+
+	# Check that the pool thread woke up to replace a keypair.
+	setup_check "spiped dh pool"
+	wait_while 5000 threads_busy "${s_basename}-spiped-d.pid"
+	if [ -z "${wakeups}" ]; then
+		printf "/proc is not available... " 1>&2
+		echo "-1"
+	elif [ "$(thread_wakeups "${s_basename}-spiped-d.pid")"	\
+	    -gt "${wakeups}" ]; then
+		echo "0"
+	else
+		echo "1"
+	fi > "${c_exitfile}"
+
+	# Check that the file arrived intact.
+	check_received "${sendfile}" "${ncat_output}"
+}
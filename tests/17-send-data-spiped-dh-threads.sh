@@ -0,0 +1,45 @@
+#!/bin/sh
+
+# Goal of this test:
+# - create a pair of spiped servers (encryption, decryption), each of which
+#   performs diffie-hellman computations in background threads
+# - establish a connection to the encryption spiped server
+# - open one connection, send a file, close the connection
+# - the decryption server's diffie-hellman thread should wake up to handle
+#   the connection's handshake
+# - the received file should match the original one
+
+### Constants
+c_valgrind_min=1
+ncat_output="${s_basename}-ncat-output.txt"
+sendfile=${scriptdir}/shared_test_functions.sh
+
+### Actual command
+scenario_cmd() {
+	# Set up infrastructure.
+	setup_spiped_decryption_server "${ncat_output}" 0 1 0 "--dh-threads 1"
+	setup_spiped_encryption_server "--dh-threads 2 --dh-pool 4"
+
+	# Record the diffie-hellman thread's wakeups.
+	wait_while 5000 threads_busy "${s_basename}-spiped-d.pid"
+	wakeups=$(thread_wakeups "${s_basename}-spiped-d.pid")
+
+	# Send a file.
+	send_file "${sendfile}"
+
+	# Check that the diffie-hellman thread woke up for the handshake.
+	setup_check "spiped dh threads"
+	wait_while 5000 threads_busy "${s_basename}-spiped-d.pid"
+	if [ -z "${wakeups}" ]; then
+		printf "/proc is not available... " 1>&2
+		echo "-1"
+	elif [ "$(thread_wakeups "${s_basename}-spiped-d.pid")"	\
+	    -gt "${wakeups}" ]; then
+		echo "0"
+	else
+		echo "1"
+	fi > "${c_exitfile}"
+
+	# Check that the file arrived intact.
+	check_received "${sendfile}" "${ncat_output}"
+}
@@ -0,0 +1,38 @@
+#!/bin/sh
+
+# Goal of this test:
+# - create a pair of spiped servers (encryption, decryption) where the
+#   decryption server sends its diffie-hellman parameter early
+# - connect directly to the decryption server and send only a nonce; the
+#   server's diffie-hellman parameter should arrive with its nonce
+# - establish a connection to the encryption spiped server
+# - open one connection, send a file large enough to need several
+#   packets, close the connection
+# - the received file should match the original one
+
+### Constants
+c_valgrind_min=1
+ncat_output="${s_basename}-ncat-output.txt"
+sendfile="${s_basename}-sendfile.txt"
+
+### Actual command
+scenario_cmd() {
+	# Create a file of around 100 kB to send.
+	make_sendfile "${sendfile}"
+
+	# Set up infrastructure, writing each connection to its own file.
+	setup_spiped_decryption_server /dev/null 0 0 0 "--fast-handshake"
+	${nc_server_binary} "${dst_sock}" "${ncat_output}" 0 2 &
+	setup_spiped_encryption_server
+
+	# Send a nonce; we should get back a nonce and a public value.
+	setup_check "spiped fast handshake"
+	if [ "$(${nc_probe_binary} "${mid_sock}" 32 320)" = "320" ]; then
+		echo 0
+	else
+		echo 1
+	fi > "${c_exitfile}"
+
+	# Send a file and check that it arrived intact.
+	send_file_check "${sendfile}" "${ncat_output}-0"
+}
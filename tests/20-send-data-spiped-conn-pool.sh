@@ -0,0 +1,27 @@
+#!/bin/sh
+
+# Goal of this test:
+# - create a pair of spiped servers (encryption, decryption) where the
+#   encryption server keeps a pool of pre-established connections
+# - establish a connection to the encryption spiped server
+# - open one connection, send a file large enough to need several
+#   packets, close the connection
+# - the received file should match the original one
+
+### Constants
+c_valgrind_min=1
+ncat_output="${s_basename}-ncat-output.txt"
+sendfile="${s_basename}-sendfile.txt"
+
+### Actual command
+scenario_cmd() {
+	# Create a file of around 100 kB to send.
+	make_sendfile "${sendfile}"
+
+	# Set up infrastructure.
+	setup_spiped_decryption_server "${ncat_output}"
+	setup_spiped_encryption_server "--conn-pool 2"
+
+	# Send a file and check that it arrived intact.
+	send_file_check "${sendfile}" "${ncat_output}"
+}
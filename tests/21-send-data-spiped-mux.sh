@@ -0,0 +1,56 @@
+#!/bin/sh
+
+# Goal of this test:
+# - create a pair of spiped servers (encryption, decryption) which carry
+#   connections over a single multiplexed connection
+# - establish two connections to the encryption spiped server at once
+# - over each connection, send a different file of more than twice the
+#   size of a stream's flow control window, and close the connection
+# - the data received over each connection to the target should match one
+#   of the original files, and both files should arrive
+
+### Constants
+c_valgrind_min=1
+ncat_output="${s_basename}-ncat-output.txt"
+sendfile="${s_basename}-sendfile.txt"
+sendfile2="${s_basename}-sendfile2.txt"
+
+### Actual command
+scenario_cmd() {
+	# Create two different files of around 300 kB to send.
+	make_sendfile "${sendfile}" 27
+	sed 's/^/2 /' "${sendfile}" > "${sendfile2}"
+
+	# Set up infrastructure, writing each connection to its own file.
+	setup_spiped_decryption_server /dev/null 0 0 0 "--mux"
+	${nc_server_binary} "${dst_sock}" "${ncat_output}" 0 2 &
+	setup_spiped_encryption_server "--mux"
+
+	# Send both files at once over the multiplexed connection.
+	setup_check "spiped mux send two files"
+	(
+		${nc_client_binary} "${src_sock}" < "${sendfile}" &
+		pid=$!
+		${nc_client_binary} "${src_sock}" < "${sendfile2}"
+		rc=$?
+		if wait "${pid}" && [ "${rc}" -eq 0 ]; then
+			echo 0
+		else
+			echo 1
+		fi > "${c_exitfile}"
+	)
+
+	# Wait for server(s) to quit.
+	servers_stop
+
+	# Each file should have arrived intact over its own connection.
+	setup_check "spiped mux send two files output"
+	if { cmp -s "${ncat_output}-0" "${sendfile}" &&			\
+	    cmp -s "${ncat_output}-1" "${sendfile2}"; } ||		\
+	    { cmp -s "${ncat_output}-0" "${sendfile2}" &&		\
+	    cmp -s "${ncat_output}-1" "${sendfile}"; }; then
+		echo 0
+	else
+		echo 1
+	fi > "${c_exitfile}"
+}
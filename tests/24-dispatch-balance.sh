@@ -0,0 +1,22 @@
+#!/bin/sh
+
+# Goal of this test:
+# - run the spiped connection dispatcher with a target which has three
+#   addresses, using each of the balancing policies
+# - open several connections through the dispatcher, one at a time
+# - the connections should be spread across the target addresses as the
+#   policy says they should be
+
+### Constants
+c_valgrind_min=1
+tgt_socks="[127.0.0.1]:8004 [127.0.0.1]:8005 [127.0.0.1]:8006"
+
+### Actual command
+scenario_cmd() {
+	for policy in first round-robin least-conn two-choice; do
+		setup_check "test_dispatch balance ${policy}"
+		${c_valgrind_cmd} "${scriptdir}/dispatch/test_dispatch"	\
+			balance "${policy}" "${src_sock}" ${tgt_socks}
+		echo $? > "${c_exitfile}"
+	done
+}
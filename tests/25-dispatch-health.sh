@@ -0,0 +1,22 @@
+#!/bin/sh
+
+# Goal of this test:
+# - run the spiped connection dispatcher with a target which has a dead
+#   address (to which connections hang) and a live address
+# - open a connection through the dispatcher; it should try the dead address
+#   and give up
+# - open several more connections, one at a time; they should skip the dead
+#   address and go straight to the live one
+
+### Constants
+c_valgrind_min=1
+dead_sock="[127.0.0.1]:8004"
+live_sock="[127.0.0.1]:8005"
+
+### Actual command
+scenario_cmd() {
+	setup_check "test_dispatch health"
+	${c_valgrind_cmd} "${scriptdir}/dispatch/test_dispatch"		\
+		health "${src_sock}" "${dead_sock}" "${live_sock}"
+	echo $? > "${c_exitfile}"
+}
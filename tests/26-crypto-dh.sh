@@ -0,0 +1,16 @@
+#!/bin/sh
+
+# Goal of this test:
+# - check the group #14 Diffie-Hellman computations against known answers,
+#   both with the fixed-base tables for 2^x and with a general base,
+#   including public values which are not less than the modulus
+
+### Constants
+c_valgrind_min=1
+
+### Actual command
+scenario_cmd() {
+	setup_check "test_crypto_dh"
+	${c_valgrind_cmd} "${scriptdir}/crypto_dh/test_crypto_dh"
+	echo $? > "${c_exitfile}"
+}
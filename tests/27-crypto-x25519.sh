@@ -0,0 +1,15 @@
+#!/bin/sh
+
+# Goal of this test:
+# - check the X25519 computations against the RFC 7748 test vectors,
+#   including 1000 iterations of the iterated test
+
+### Constants
+c_valgrind_min=1
+
+### Actual command
+scenario_cmd() {
+	setup_check "test_crypto_x25519"
+	${c_valgrind_cmd} "${scriptdir}/crypto_x25519/test_crypto_x25519"
+	echo $? > "${c_exitfile}"
+}
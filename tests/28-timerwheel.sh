@@ -0,0 +1,19 @@
+#!/bin/sh
+
+# Goal of this test:
+# - perform random operations on a timer wheel, with timers due in the next
+#   few ticks, throughout the wheel, and beyond its end
+# - the timer wheel should agree with a brute-force model of its contents
+
+### Constants
+c_valgrind_min=1
+
+### Actual command
+scenario_cmd() {
+	for seed in 0 1 2; do
+		setup_check "test_timerwheel ${seed}"
+		${c_valgrind_cmd} "${scriptdir}/timerwheel/test_timerwheel"	\
+			"${seed}"
+		echo $? > "${c_exitfile}"
+	done
+}
@@ -0,0 +1,18 @@
+#!/bin/sh
+
+# Goal of this test:
+# - check AES-CTR against known answers, using whichever AES implementation
+#   (software, AESNI, or ARM AES) this CPU supports
+# - check that encrypting in pieces gives the same result as in one go
+# - check that the single-pass AES-CTR + HMAC-SHA256 code agrees with the
+#   two-pass code
+
+### Constants
+c_valgrind_min=1
+
+### Actual command
+scenario_cmd() {
+	setup_check "test_crypto_aesctr"
+	${c_valgrind_cmd} "${scriptdir}/crypto_aesctr/test_crypto_aesctr"
+	echo $? > "${c_exitfile}"
+}
@@ -0,0 +1,21 @@
+#!/bin/sh
+
+# Goal of this test:
+# - run a pair of spiped connection dispatchers (encryption, decryption),
+#   where the encrypting one keeps a pool of connections and the target sends
+#   a banner and hangs up as soon as a connection arrives
+# - the pooled connections should be dropped when the banner arrives, and
+#   replaced
+# - open a connection through the dispatchers; it should receive the banner
+
+### Constants
+c_valgrind_min=1
+tgt_sock="[127.0.0.1]:8004"
+
+### Actual command
+scenario_cmd() {
+	setup_check "test_dispatch pool"
+	${c_valgrind_cmd} "${scriptdir}/dispatch/test_dispatch"		\
+		pool "${src_sock}" "${mid_sock}" "${tgt_sock}"
+	echo $? > "${c_exitfile}"
+}
@@ -0,0 +1,408 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "crypto_aes.h"
+#include "crypto_aesctr.h"
+#include "crypto_aesctr_hmac.h"
+#include "sha256.h"
+#include "warnp.h"
+
+/* The nonce used in all of the tests. */
+#define NONCE 0x0123456789abcdef
+
+/* Longest message which we test. */
+#define MAXLEN 4099
+
+/*
+ * Known-answer test: encrypting the bytes 0x00 0x01 ... with the key 0x00
+ * 0x01 ... 0x1f gives this ciphertext.
+ */
+static const char * kat_short =
+    "237b4780075ff9902ce0e6367ca406fe4e9143083608119e6025f2686c525b57"
+    "f2f2c337fdb9e9fa";
+
+/*
+ * Known-answer tests for longer messages, which exercise both the loop which
+ * encrypts eight blocks at once and the code which handles what is left:
+ * (key length, message length, SHA256 of the ciphertext), with the key and
+ * message as above.
+ */
+static const struct aesctr_kat {
+	size_t keylen;
+	size_t len;
+	const char * sha256;
+} aesctr_kats[] = {
+	{
+	    16, 15,
+	    "030033fde96b1482eeed7aa68c0e698e619a4ff9577614e56c49d4d2cce0c7d2"
+	},
+	{
+	    16, 128,
+	    "0db6828e56a9b4449722d43298aa7d580be11500e54e785f7d628b9d59633ac0"
+	},
+	{
+	    16, 129,
+	    "d25ca7c3cef82990472b26aebcba624eb829d25a0d67284111a8408f1b1a1d4b"
+	},
+	{
+	    16, 1041,
+	    "2f4fc0f9ea59d69c44381db4d4cc238d1fcd18d0f8f9b51b9888476cbe100716"
+	},
+	{
+	    16, 4099,
+	    "1de06057ee1502a2441601e85e2d2b670d9c2e2f4dbccd075551a13ff5028996"
+	},
+	{
+	    32, 15,
+	    "8d175f63df23c2f1311ce0e31664111f4fc43e74b3e6514dde1c11a68de47144"
+	},
+	{
+	    32, 128,
+	    "b49c3f3efdfce5484464f9c6fde1d353cf5f51f47675e673d2149e0b2b63248b"
+	},
+	{
+	    32, 129,
+	    "8ed0fcffdbad29f27c07563bf8cd218a8123533d331843a1769954d745aa83bf"
+	},
+	{
+	    32, 1041,
+	    "bfc5ea0dfe546abac2887546526818b84b7964c8cac006fa87348e4fa8814e20"
+	},
+	{
+	    32, 4099,
+	    "b709b3b38ae7b579b5077bf872a61c3894aab4031a23296723d7026ccf1d0beb"
+	}
+};
+
+/*
+ * Amounts of data to hash before the stitched code runs: at and away from a
+ * SHA256 block boundary.
+ */
+static const size_t hmac_prefixes[] = {0, 1, 63, 64, 100, 128};
+
+/* Sizes of the pieces in which we feed data to crypto_aesctr_stream. */
+static const size_t stream_splits[] = {1, 3, 16, 17, 100, 128, 129, 1000};
+
+/* Convert the hex string ${s} into ${len} bytes in ${buf}. */
+static int
+unhexify(const char * s, uint8_t * buf, size_t len)
+{
+	unsigned int x;
+	size_t i;
+
+	/* The string must be exactly the right length. */
+	if (strlen(s) != len * 2)
+		goto err0;
+
+	/* Parse each pair of hex digits. */
+	for (i = 0; i < len; i++) {
+		if (sscanf(&s[i * 2], "%2x", &x) != 1)
+			goto err0;
+		buf[i] = (uint8_t)x;
+	}
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* Expand the key 0x00 0x01 ... of length ${keylen}. */
+static struct crypto_aes_key *
+test_key(size_t keylen)
+{
+	struct crypto_aes_key * key;
+	uint8_t kbuf[32];
+	size_t i;
+
+	for (i = 0; i < keylen; i++)
+		kbuf[i] = (uint8_t)i;
+	if ((key = crypto_aes_key_expand(kbuf, keylen)) == NULL)
+		warnp("crypto_aes_key_expand");
+	return (key);
+}
+
+/* Check crypto_aesctr_buf against the short known answer. */
+static int
+test_short(void)
+{
+	struct crypto_aes_key * key;
+	uint8_t ptext[40];
+	uint8_t ctext[40];
+	uint8_t out[40];
+	size_t i;
+
+	/* Parse the expected ciphertext. */
+	if (unhexify(kat_short, ctext, sizeof(ctext))) {
+		warn0("Invalid test vector");
+		goto err0;
+	}
+
+	/* Encrypt. */
+	for (i = 0; i < sizeof(ptext); i++)
+		ptext[i] = (uint8_t)i;
+	if ((key = test_key(32)) == NULL)
+		goto err0;
+	crypto_aesctr_buf(key, NONCE, ptext, out, sizeof(out));
+	crypto_aes_key_free(key);
+
+	/* Check the result. */
+	if (memcmp(out, ctext, sizeof(ctext))) {
+		warn0("crypto_aesctr_buf: wrong answer for short vector");
+		goto err0;
+	}
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/*
+ * Check crypto_aesctr_buf against the longer known answers, and check that
+ * crypto_aesctr_stream gives the same answer when fed data in pieces.
+ */
+static int
+test_long(void)
+{
+	const struct aesctr_kat * kat;
+	struct crypto_aes_key * key;
+	struct crypto_aesctr * stream;
+	uint8_t * ptext;
+	uint8_t * out;
+	uint8_t * out_stream;
+	uint8_t hbuf[32];
+	uint8_t hbuf_expected[32];
+	size_t i, j, pos, piece;
+
+	/* Allocate buffers. */
+	if ((ptext = malloc(MAXLEN)) == NULL)
+		goto err0;
+	if ((out = malloc(MAXLEN)) == NULL)
+		goto err1;
+	if ((out_stream = malloc(MAXLEN)) == NULL)
+		goto err2;
+	for (i = 0; i < MAXLEN; i++)
+		ptext[i] = (uint8_t)i;
+
+	for (i = 0; i < sizeof(aesctr_kats) / sizeof(aesctr_kats[0]); i++) {
+		kat = &aesctr_kats[i];
+
+		/* Parse the test vector. */
+		if (unhexify(kat->sha256, hbuf_expected, 32)) {
+			warn0("Invalid test vector %zu", i);
+			goto err3;
+		}
+
+		/* Encrypt in one go, and check the result. */
+		if ((key = test_key(kat->keylen)) == NULL)
+			goto err3;
+		crypto_aesctr_buf(key, NONCE, ptext, out, kat->len);
+		SHA256_Buf(out, kat->len, hbuf);
+		if (memcmp(hbuf, hbuf_expected, 32)) {
+			warn0("crypto_aesctr_buf: wrong answer for vector %zu",
+			    i);
+			goto err4;
+		}
+
+		/* Encrypt in pieces of each size; we should get the same. */
+		for (j = 0; j < sizeof(stream_splits) / sizeof(size_t); j++) {
+			if ((stream = crypto_aesctr_init(key, NONCE)) == NULL) {
+				warnp("crypto_aesctr_init");
+				goto err4;
+			}
+			for (pos = 0; pos < kat->len; pos += piece) {
+				piece = stream_splits[j];
+				if (piece > kat->len - pos)
+					piece = kat->len - pos;
+				crypto_aesctr_stream(stream, &ptext[pos],
+				    &out_stream[pos], piece);
+			}
+			crypto_aesctr_free(stream);
+			if (memcmp(out_stream, out, kat->len)) {
+				warn0("crypto_aesctr_stream: wrong answer for"
+				    " vector %zu in pieces of %zu bytes", i,
+				    stream_splits[j]);
+				goto err4;
+			}
+		}
+		crypto_aes_key_free(key);
+	}
+
+	/* Clean up. */
+	free(out_stream);
+	free(out);
+	free(ptext);
+
+	/* Success! */
+	return (0);
+
+err4:
+	crypto_aes_key_free(key);
+err3:
+	free(out_stream);
+err2:
+	free(out);
+err1:
+	free(ptext);
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/*
+ * Compute ${buf} and ${hbuf} by encrypting or decrypting (if ${decr} is
+ * zero or non-zero respectively) the ${len} bytes ${in} and authenticating
+ * the ciphertext in two passes, after hashing the ${prefix} bytes ${pbuf}.
+ */
+static void
+twopass(const struct crypto_aes_key * key, const uint8_t * in, size_t len,
+    const uint8_t * pbuf, size_t prefix, uint8_t * buf, uint8_t hbuf[32],
+    int decr)
+{
+	HMAC_SHA256_CTX ctx;
+
+	HMAC_SHA256_Init(&ctx, pbuf, 32);
+	HMAC_SHA256_Update(&ctx, pbuf, prefix);
+	if (decr)
+		HMAC_SHA256_Update(&ctx, in, len);
+	crypto_aesctr_buf(key, NONCE, in, buf, len);
+	if (!decr)
+		HMAC_SHA256_Update(&ctx, buf, len);
+	HMAC_SHA256_Final(hbuf, &ctx);
+}
+
+/*
+ * Check that crypto_aesctr_hmac_enc, _enc_copy, and _dec agree with the
+ * two-pass code for a range of lengths, with the HMAC context at and away
+ * from a block boundary, and with separate input of various lengths.
+ */
+static int
+test_hmac(void)
+{
+	struct crypto_aes_key * key;
+	HMAC_SHA256_CTX ctx;
+	uint8_t * ptext;
+	uint8_t * buf;
+	uint8_t * buf_2p;
+	uint8_t hbuf[32];
+	uint8_t hbuf_2p[32];
+	size_t i, len, prefix, inlen;
+
+	/* Allocate buffers. */
+	if ((ptext = malloc(MAXLEN)) == NULL)
+		goto err0;
+	if ((buf = malloc(MAXLEN)) == NULL)
+		goto err1;
+	if ((buf_2p = malloc(MAXLEN)) == NULL)
+		goto err2;
+	for (i = 0; i < MAXLEN; i++)
+		ptext[i] = (uint8_t)i;
+	if ((key = test_key(32)) == NULL)
+		goto err3;
+
+	for (len = 0; len < 1100; len += 13) {
+		for (i = 0; i < sizeof(hmac_prefixes) / sizeof(size_t); i++) {
+			prefix = hmac_prefixes[i];
+
+			/* Encrypt in place. */
+			twopass(key, ptext, len, &ptext[2048], prefix, buf_2p,
+			    hbuf_2p, 0);
+			memcpy(buf, ptext, len);
+			HMAC_SHA256_Init(&ctx, &ptext[2048], 32);
+			HMAC_SHA256_Update(&ctx, &ptext[2048], prefix);
+			crypto_aesctr_hmac_enc(key, NONCE, buf, len, &ctx);
+			HMAC_SHA256_Final(hbuf, &ctx);
+			if (memcmp(buf, buf_2p, len) ||
+			    memcmp(hbuf, hbuf_2p, 32)) {
+				warn0("crypto_aesctr_hmac_enc: wrong answer"
+				    " for length %zu, prefix %zu", len, prefix);
+				goto err4;
+			}
+
+			/* Encrypt, reading some of the input separately. */
+			for (inlen = 0; inlen <= len; inlen += 29) {
+				memset(buf, 0, inlen);
+				memcpy(&buf[inlen], &ptext[inlen], len - inlen);
+				HMAC_SHA256_Init(&ctx, &ptext[2048], 32);
+				HMAC_SHA256_Update(&ctx, &ptext[2048], prefix);
+				crypto_aesctr_hmac_enc_copy(key, NONCE, ptext,
+				    inlen, buf, len, &ctx);
+				HMAC_SHA256_Final(hbuf, &ctx);
+				if (memcmp(buf, buf_2p, len) ||
+				    memcmp(hbuf, hbuf_2p, 32)) {
+					warn0("crypto_aesctr_hmac_enc_copy:"
+					    " wrong answer for length %zu,"
+					    " prefix %zu, input %zu", len,
+					    prefix, inlen);
+					goto err4;
+				}
+			}
+
+			/* Decrypt in place. */
+			twopass(key, ptext, len, &ptext[2048], prefix, buf_2p,
+			    hbuf_2p, 1);
+			memcpy(buf, ptext, len);
+			HMAC_SHA256_Init(&ctx, &ptext[2048], 32);
+			HMAC_SHA256_Update(&ctx, &ptext[2048], prefix);
+			crypto_aesctr_hmac_dec(key, NONCE, buf, len, &ctx);
+			HMAC_SHA256_Final(hbuf, &ctx);
+			if (memcmp(buf, buf_2p, len) ||
+			    memcmp(hbuf, hbuf_2p, 32)) {
+				warn0("crypto_aesctr_hmac_dec: wrong answer"
+				    " for length %zu, prefix %zu", len, prefix);
+				goto err4;
+			}
+		}
+	}
+
+	/* Clean up. */
+	crypto_aes_key_free(key);
+	free(buf_2p);
+	free(buf);
+	free(ptext);
+
+	/* Success! */
+	return (0);
+
+err4:
+	crypto_aes_key_free(key);
+err3:
+	free(buf_2p);
+err2:
+	free(buf);
+err1:
+	free(ptext);
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+int
+main(int argc, char ** argv)
+{
+
+	WARNP_INIT;
+	(void)argc; /* UNUSED */
+
+	/* Run the tests. */
+	if (test_short())
+		goto err0;
+	if (test_long())
+		goto err0;
+	if (test_hmac())
+		goto err0;
+
+	/* Success! */
+	exit(0);
+
+err0:
+	/* Failure! */
+	exit(1);
+}
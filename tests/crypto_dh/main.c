@@ -0,0 +1,394 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "crypto_dh.h"
+#include "warnp.h"
+
+/*
+ * Known-answer tests for crypto_dh_compute: (pub, priv, key), where key is
+ * pub^(2^258 + priv) mod p.  The values of pub which are not less than p
+ * would be rejected by crypto_dh_sanitycheck, but crypto_dh_compute must
+ * still reduce them correctly.
+ */
+static const struct compute_kat {
+	const char * pub;
+	const char * priv;
+	const char * key;
+} compute_kats[] = {
+	/* pub = 2 */
+	{
+	    "0000000000000000000000000000000000000000000000000000000000000000"
+	    "0000000000000000000000000000000000000000000000000000000000000000"
+	    "0000000000000000000000000000000000000000000000000000000000000000"
+	    "0000000000000000000000000000000000000000000000000000000000000000"
+	    "0000000000000000000000000000000000000000000000000000000000000000"
+	    "0000000000000000000000000000000000000000000000000000000000000000"
+	    "0000000000000000000000000000000000000000000000000000000000000000"
+	    "0000000000000000000000000000000000000000000000000000000000000002",
+	    "0000000000000000000000000000000000000000000000000000000000000000",
+	    "759606e0090721c22c74923bef3f83a342461fca618e9c5a7f68c296f94a852d"
+	    "757887e1617c7e873f8eb8ee7cead40f964105f3b0260a7050f1deed6f91e5d2"
+	    "e7586e87962aa14c70caa63a013d90414cacf419e2f711f7c6a27dbad914c5d3"
+	    "d0192362142d042cd46a0d4b34198f06952576c5704252c96e7b4e755270ad2c"
+	    "f4fb6c3276bd7391cf1c93ca9b4d298726b07a4275f34d68cc1577c4e57cc0fa"
+	    "5a1df3b768fff33fffed6b94e9f6910321844a0d99d7e2cf71c443c408e59b12"
+	    "97472d579efa4679d5602aaf2e83ac7b48e246afadf6c70ccb598fc74462074f"
+	    "13ce3ac43659e9aee16000be91f2112a203b2c3525a5609be9248557602203d5"
+	},
+	/* pub = random */
+	{
+	    "e57b37e7704b3d09ef2eab42fd8cfe3395522f9a67574c0261c2df96fa5e2d63"
+	    "daa4ed3c3454fae446287225154d1eb0071d14815649f8e998466a921f7ea79c"
+	    "11e760a5a6d5b30a02b7075d2a3a0c78467c0714a9fbd797aa59c1698d242349"
+	    "293a9acc2652f8ff842a2f9da1b4ba07a1fa7d4acde560db5c54e05b42a9ba21"
+	    "cecf4f4e5ba8078050cef798e6c648e7deeda8b23927f7d64375d0341e4f6f2a"
+	    "e8af30f7c70b53bf64d0b50f658c6762df7142dcaf29e6f877744cca4d909eb2"
+	    "732242fda8902e3212979bfcbbeb508f4a800646417a8105bc3199944567ceb1"
+	    "3f372617f0baef3a86f0ce2ea6ec39c1c15521b1b3dca50a9daa37e51b591d77",
+	    "942af46d1c8d5358e2db0c01afd798c2a40f9ca3df62692c182a3add9b872a76",
+	    "2aa09ce67e80ef095ef957f80ce8f86f965ec72018eecfb6419db22edc728dad"
+	    "306e716dde0f0cdb176fa5bb50f5249e63fcd66923e08f4550d355adacf5dfb0"
+	    "49d927a40eba8f383a25c5ce9507e372a179247be7237ae4da1e52878a095e55"
+	    "e03902588de89f4954bcf300cd85d6d05d2850583dfae544a751de48162a9660"
+	    "d278cb8e99dff5f0c865852a142908b0d3507223485a536de6cf8bcf878e1791"
+	    "c8d8694e20dd76385fc2a6b8982e5de33ed2ba0ad235c38fd26dc37e337d7b0e"
+	    "0b1bb0937099a6e26492d1a9f5083ecad491d748451381b4d8d0f3574867f302"
+	    "7310f42d2d477d4da3c74de8f7735db1ea44ab6d363c8c4c091ea991b8af7a91"
+	},
+	/* pub = random */
+	{
+	    "7d32da7cf063a1049d88ae97dd8e5608730115443c7bc0fc64e24875797a05ab"
+	    "41a204e918485df7d3a1c30b986f30426aedf88b6fe205d475b728bf7c208071"
+	    "4f3d01447485d16562fe005b88ebf5e62b1a7ae1af748c55f9493d417afdf260"
+	    "6cd92a4017cdc79a960066c386988190afaaa7131d26e31369703feebd8700eb"
+	    "29663157072ad68b1e47921f47d9e8754754665a16ebc80fffcd88b9d170d65a"
+	    "1f05f4d11a38b927412ecd08801f772d4804ef24cc5994d07c17d84637db2982"
+	    "9fc6245573dda73245552a83319f69e3ac18900483872e757c93a36cdff27e9f"
+	    "bf3ba33a183c74e2dd66a3582e62fe865d3ffd11a23c1698a32dc48296ce385b",
+	    "ffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffff",
+	    "cb96a7fafc4bdf0114ae42141a8517093fb267f288bced35af9c6c82dc786b08"
+	    "bc27f8dc1c267d7f38d4d890c183ece4b7f7b93a39318b9f8bea9d2e3eb4a5c7"
+	    "35f3280e9eebefba8ad4fd9acfcfda49eb37b281a03b50959762ddb22d9e09d2"
+	    "93c1a1aadf1d1651cfde008973ce2c3d8da7794f9404c4af6f531067df58d51e"
+	    "079ebbe9b531753a29dc194083c6445e147ba8877ba19a1c78763f909cd13042"
+	    "df75bbea55deb51c438adbf8c84dc059d23c5797bdea2110f6e40a3ac004d52a"
+	    "25d0c3c2dda171a83336c3a73b2601538907c168efb5d8987e816a45831330e0"
+	    "aa2034d21fd6b316e083bd65ad65ea9c1379012496628cbdcd7cf5c082548266"
+	},
+	/* pub = p - 1 */
+	{
+	    "ffffffffffffffffc90fdaa22168c234c4c6628b80dc1cd129024e088a67cc74"
+	    "020bbea63b139b22514a08798e3404ddef9519b3cd3a431b302b0a6df25f1437"
+	    "4fe1356d6d51c245e485b576625e7ec6f44c42e9a637ed6b0bff5cb6f406b7ed"
+	    "ee386bfb5a899fa5ae9f24117c4b1fe649286651ece45b3dc2007cb8a163bf05"
+	    "98da48361c55d39a69163fa8fd24cf5f83655d23dca3ad961c62f356208552bb"
+	    "9ed529077096966d670c354e4abc9804f1746c08ca18217c32905e462e36ce3b"
+	    "e39e772c180e86039b2783a2ec07a28fb5c55df06f4c52c9de2bcbf695581718"
+	    "3995497cea956ae515d2261898fa051015728e5a8aacaa68fffffffffffffffe",
+	    "70ffec24924a5cd7444c044fb416aad97d32a82f24af1bee91b002ee1102c9f5",
+	    "ffffffffffffffffc90fdaa22168c234c4c6628b80dc1cd129024e088a67cc74"
+	    "020bbea63b139b22514a08798e3404ddef9519b3cd3a431b302b0a6df25f1437"
+	    "4fe1356d6d51c245e485b576625e7ec6f44c42e9a637ed6b0bff5cb6f406b7ed"
+	    "ee386bfb5a899fa5ae9f24117c4b1fe649286651ece45b3dc2007cb8a163bf05"
+	    "98da48361c55d39a69163fa8fd24cf5f83655d23dca3ad961c62f356208552bb"
+	    "9ed529077096966d670c354e4abc9804f1746c08ca18217c32905e462e36ce3b"
+	    "e39e772c180e86039b2783a2ec07a28fb5c55df06f4c52c9de2bcbf695581718"
+	    "3995497cea956ae515d2261898fa051015728e5a8aacaa68fffffffffffffffe"
+	},
+	/* pub = p */
+	{
+	    "ffffffffffffffffc90fdaa22168c234c4c6628b80dc1cd129024e088a67cc74"
+	    "020bbea63b139b22514a08798e3404ddef9519b3cd3a431b302b0a6df25f1437"
+	    "4fe1356d6d51c245e485b576625e7ec6f44c42e9a637ed6b0bff5cb6f406b7ed"
+	    "ee386bfb5a899fa5ae9f24117c4b1fe649286651ece45b3dc2007cb8a163bf05"
+	    "98da48361c55d39a69163fa8fd24cf5f83655d23dca3ad961c62f356208552bb"
+	    "9ed529077096966d670c354e4abc9804f1746c08ca18217c32905e462e36ce3b"
+	    "e39e772c180e86039b2783a2ec07a28fb5c55df06f4c52c9de2bcbf695581718"
+	    "3995497cea956ae515d2261898fa051015728e5a8aacaa68ffffffffffffffff",
+	    "0552d4c06c50f5ccfcbbd0fff1a58c2e67db15cab473e920d34a2c3c04e4217b",
+	    "0000000000000000000000000000000000000000000000000000000000000000"
+	    "0000000000000000000000000000000000000000000000000000000000000000"
+	    "0000000000000000000000000000000000000000000000000000000000000000"
+	    "0000000000000000000000000000000000000000000000000000000000000000"
+	    "0000000000000000000000000000000000000000000000000000000000000000"
+	    "0000000000000000000000000000000000000000000000000000000000000000"
+	    "0000000000000000000000000000000000000000000000000000000000000000"
+	    "0000000000000000000000000000000000000000000000000000000000000000"
+	},
+	/* pub = p + 1 */
+	{
+	    "ffffffffffffffffc90fdaa22168c234c4c6628b80dc1cd129024e088a67cc74"
+	    "020bbea63b139b22514a08798e3404ddef9519b3cd3a431b302b0a6df25f1437"
+	    "4fe1356d6d51c245e485b576625e7ec6f44c42e9a637ed6b0bff5cb6f406b7ed"
+	    "ee386bfb5a899fa5ae9f24117c4b1fe649286651ece45b3dc2007cb8a163bf05"
+	    "98da48361c55d39a69163fa8fd24cf5f83655d23dca3ad961c62f356208552bb"
+	    "9ed529077096966d670c354e4abc9804f1746c08ca18217c32905e462e36ce3b"
+	    "e39e772c180e86039b2783a2ec07a28fb5c55df06f4c52c9de2bcbf695581718"
+	    "3995497cea956ae515d2261898fa051015728e5a8aacaa690000000000000000",
+	    "5b08b56f437743f778965416f06b36b15e32102d91c44cbdb5b07e1458f52363",
+	    "0000000000000000000000000000000000000000000000000000000000000000"
+	    "0000000000000000000000000000000000000000000000000000000000000000"
+	    "0000000000000000000000000000000000000000000000000000000000000000"
+	    "0000000000000000000000000000000000000000000000000000000000000000"
+	    "0000000000000000000000000000000000000000000000000000000000000000"
+	    "0000000000000000000000000000000000000000000000000000000000000000"
+	    "0000000000000000000000000000000000000000000000000000000000000000"
+	    "0000000000000000000000000000000000000000000000000000000000000001"
+	},
+	/* pub = p + random */
+	{
+	    "fffffffffffffffff250bc7fa37eef33ed492b7942b7cbc5f28421a67ba31cf4"
+	    "bfcf0135d39c73323d3a6cc01dd92534f7a771852b9fbc42156dbda6b55684e6"
+	    "088fd103b7e94cb639852e4f4d281e15a268ec2340d2dacd413527b433ab0256"
+	    "1cea4c479e42ef992ecadbb25bc6ce08893b1ae327c7f385c2753c5bd457f8ed"
+	    "5f3d8a9141c3438e5defe8460623ba27a087297a1d08416d19c61f8f7c3d480e"
+	    "6cd05cb4603ccf5eec91fba39314039273296ab5601f195432a8409d29d684d4"
+	    "ea10f975680b2c06cc68004cf4eee651ced0c685d2995fa2f695509ad6e6221c"
+	    "05cbcb6b62b6aea7a526a17b39d9fde3206733febafc00b287b31dc04d628fee",
+	    "63571e05f5c0fc1f3eafcf2162550ba77d8078455dd0f9013284254fd765cec7",
+	    "5bf159425c849a224131f692507ec211af5cfc236f7a3ac7ef14b857f0725838"
+	    "1342ebbcc183cb782c22a4462f1f0a33e3ef3aea9c1f050992b50551986180c1"
+	    "bf208e5321e6152cea3559aec1446f78af48bf2591cbb3d5db6617d6e18c692a"
+	    "230f7edef7129ae1ef2606a1cbe2d62a59639550527ec48021431dcc0ceb7f05"
+	    "9ddf4995e888004cf8f36d99cabf36e6235cb2f3aca211e0ca31476b37b82ba7"
+	    "77eeed94da47f45cb44625d437ee43dafc4cb460f6b4bf3d451f2843339c925d"
+	    "53066e7409037f433f98bc40216eb2164021ec26ad2e25297fdd451c8349915a"
+	    "93baefcff4aa40239932df06a173dbaaf40e4b66371bd01eda7d4c9de48946dd"
+	},
+	/* pub = 2^2048 - 1 */
+	{
+	    "ffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffff"
+	    "ffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffff"
+	    "ffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffff"
+	    "ffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffff"
+	    "ffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffff"
+	    "ffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffff"
+	    "ffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffff"
+	    "ffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffff",
+	    "f3cd0645ea5080977ceb1b7b507fb32be8eeaf9cc600339d8dbbbca18bc2db0e",
+	    "3c65bf8195ae14c847cdca5e95e333ccbacd2912a129a104b083fbe19478d8bc"
+	    "90db2ac65f5cec5bd1e6d8fa3340587112bcd7aa0bde777529b05c25eb55bde4"
+	    "24e9f926962cc4d5976daeeb17ee6e22d3f61549d0c5e40a5f7e1d37ecf9cc41"
+	    "10fd7642f1ef668761713cf18bc40df7ef47fe39627a2a8384db92bad85045a7"
+	    "131faf8c68014b3e74d3b0e217a72ee516ff413410f7d44930e699e6d38470f9"
+	    "a2902526dfe80b515dda81f852f91a5fd0a62d530d30a1eceae9a66277669f4b"
+	    "6ba121f70a9a3d57669bc61e6df82c823a7e0acc8d494135686cb8168784e015"
+	    "ca6c4cc62738156b2ed31b7173553c8cbbca32a59e69aa3a84931fc8bb071ca0"
+	},
+};
+
+/*
+ * Known-answer tests for crypto_dh_generate_pub: (priv, pub), where pub is
+ * 2^(2^258 + priv) mod p.
+ */
+static const struct generate_kat {
+	const char * priv;
+	const char * pub;
+} generate_kats[] = {
+	{
+	    "0000000000000000000000000000000000000000000000000000000000000000",
+	    "759606e0090721c22c74923bef3f83a342461fca618e9c5a7f68c296f94a852d"
+	    "757887e1617c7e873f8eb8ee7cead40f964105f3b0260a7050f1deed6f91e5d2"
+	    "e7586e87962aa14c70caa63a013d90414cacf419e2f711f7c6a27dbad914c5d3"
+	    "d0192362142d042cd46a0d4b34198f06952576c5704252c96e7b4e755270ad2c"
+	    "f4fb6c3276bd7391cf1c93ca9b4d298726b07a4275f34d68cc1577c4e57cc0fa"
+	    "5a1df3b768fff33fffed6b94e9f6910321844a0d99d7e2cf71c443c408e59b12"
+	    "97472d579efa4679d5602aaf2e83ac7b48e246afadf6c70ccb598fc74462074f"
+	    "13ce3ac43659e9aee16000be91f2112a203b2c3525a5609be9248557602203d5"
+	},
+	{
+	    "0000000000000000000000000000000000000000000000000000000000000001",
+	    "eb2c0dc0120e438458e92477de7f0746848c3f94c31d38b4fed1852df2950a5a"
+	    "eaf10fc2c2f8fd0e7f1d71dcf9d5a81f2c820be7604c14e0a1e3bddadf23cba5"
+	    "ceb0dd0f2c554298e1954c74027b20829959e833c5ee23ef8d44fb75b2298ba7"
+	    "a03246c4285a0859a8d41a9668331e0d2a4aed8ae084a592dcf69ceaa4e15a59"
+	    "e9f6d864ed7ae7239e392795369a530e4d60f484ebe69ad1982aef89caf981f4"
+	    "b43be76ed1ffe67fffdad729d3ed22064308941b33afc59ee388878811cb3625"
+	    "2e8e5aaf3df48cf3aac0555e5d0758f691c48d5f5bed8e1996b31f8e88c40e9e"
+	    "279c75886cb3d35dc2c0017d23e422544076586a4b4ac137d2490aaec04407aa"
+	},
+	{
+	    "017f9ee6725ed09d3a0562d56abd685a48f165d57b00c7f4781ef86f5c8cc1ab",
+	    "3d8d34481cb3eb85900f50811853c4d7564b39718fb6320b8f1862b9d20fc1e0"
+	    "5a94e765b578091fbfffcf951c87ab9481dd90b642ddcc1ee4daa6f0a6739692"
+	    "95955354c53e52cc7bb739daf37505256223465173b3bd8326e2f2ba28bbe848"
+	    "cab68ba6ad286345120ebe58fe183d3fc1d71426e1de311719647ef6fce849e1"
+	    "9a72bf2168ab704c0360d75b5352551733bccc4cb79be7a2a86ddd8652721253"
+	    "2369043d5e252a9fdd591b6c0187d8877fd6c9e0413dcff91154c99e8d35ac18"
+	    "761c64d585271d10147f9b13ba12a20bea815c95e0c2bc6679d407fdbb38ff0a"
+	    "3adf33fa54dfe02e67e441c2c89161d469f52270f6ea3a4d6b43876a897b2e5a"
+	},
+	{
+	    "38f12d92a28f17d83ce44e27424458b6b6043106a85f68b6daa8b2a668d605d4",
+	    "c8c88ddc996595f7b7f62cc991ccef154c3ee6478e55bdd29abd638c833b6dcc"
+	    "f1c1189ae4b91f277945c551bee185c25c3809b1ba055a4e1b4a15d3cacfa215"
+	    "54c974a2f985d213887d7a05c9f000a372c51b59e01eb838d30ba6efab9f2fac"
+	    "59f0e5ab2e61ed75d54d6f060d1201f55387e71e13f50b162ff083bab69e6b9f"
+	    "67d27f03076a5f5cd9abec74e8d0bb2f9c6923f797a0049df236f7931f122433"
+	    "37c456bde49e426bf8c8ab1bb5bbd751ef64239ff06bcd9454f5ad07a0a685ff"
+	    "c10a85f7bc8a0be071c8b5b4bdb5a3370ebef6f45bb71a663807cbca8fb5b204"
+	    "a31b1754fee65ca3af49b187c8e633eba676eaa2960e4acb83cdc218b5ffc6b8"
+	},
+	{
+	    "ffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffff",
+	    "9577156346cb3ceffd59962df741b97670f124b2fb181a8ea99336273efc87b7"
+	    "db1e2b0b8971c20a5fb72d67a854cf6522c3be899cb42dc0a80ac76aebc724cd"
+	    "d5bd7af0bf74239c2ef53a5184c1f5c997af78278dfabb5354a6c2044f5f73a2"
+	    "714f812da874d36a0ae7627038686f0739b4068468e5634e8b4519156fea3c31"
+	    "3acc17d43fc30ea1a96746c64b38eb6ad3000e5a4a2797c45d7a72496c8a9687"
+	    "b57c42b958deb6c7fa43ad8904d04b772b59caeb0b6b4fa47fcd173eafa58bb5"
+	    "451e0561a05b2cd9b73cceca62fbea1b3819353a6e056beb44bb13bf12dec446"
+	    "8eef98a7efd7e63776134d326a42472d84a7d1d6b9d2cca1bc7cc22bab0883dd"
+	},
+};
+
+/* Convert the hex string ${s} into ${len} bytes in ${buf}. */
+static int
+unhexify(const char * s, uint8_t * buf, size_t len)
+{
+	unsigned int x;
+	size_t i;
+
+	/* The string must be exactly the right length. */
+	if (strlen(s) != len * 2)
+		goto err0;
+
+	/* Parse each pair of hex digits. */
+	for (i = 0; i < len; i++) {
+		if (sscanf(&s[i * 2], "%2x", &x) != 1)
+			goto err0;
+		buf[i] = (uint8_t)x;
+	}
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* Check crypto_dh_compute against the known answers. */
+static int
+test_compute(void)
+{
+	const struct compute_kat * kat;
+	uint8_t pub[CRYPTO_DH_PUBLEN];
+	uint8_t priv[CRYPTO_DH_PRIVLEN];
+	uint8_t key[CRYPTO_DH_KEYLEN];
+	uint8_t key_out[CRYPTO_DH_KEYLEN];
+	size_t i;
+
+	for (i = 0; i < sizeof(compute_kats) / sizeof(compute_kats[0]); i++) {
+		kat = &compute_kats[i];
+
+		/* Parse the test vector. */
+		if (unhexify(kat->pub, pub, sizeof(pub)) ||
+		    unhexify(kat->priv, priv, sizeof(priv)) ||
+		    unhexify(kat->key, key, sizeof(key))) {
+			warn0("Invalid test vector %zu", i);
+			goto err0;
+		}
+
+		/* Compute the key and check it. */
+		if (crypto_dh_compute(pub, priv, key_out)) {
+			warnp("crypto_dh_compute");
+			goto err0;
+		}
+		if (memcmp(key_out, key, sizeof(key))) {
+			warn0("crypto_dh_compute: wrong answer for vector %zu",
+			    i);
+			goto err0;
+		}
+	}
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/*
+ * Check crypto_dh_generate_pub against the known answers, and against
+ * crypto_dh_compute with a base of 2.
+ */
+static int
+test_generate(void)
+{
+	const struct generate_kat * kat;
+	uint8_t two[CRYPTO_DH_PUBLEN];
+	uint8_t priv[CRYPTO_DH_PRIVLEN];
+	uint8_t pub[CRYPTO_DH_PUBLEN];
+	uint8_t pub_out[CRYPTO_DH_PUBLEN];
+	uint8_t key_out[CRYPTO_DH_KEYLEN];
+	size_t i;
+
+	/* The generator, as a public value. */
+	memset(two, 0, sizeof(two));
+	two[CRYPTO_DH_PUBLEN - 1] = 2;
+
+	for (i = 0; i < sizeof(generate_kats) / sizeof(generate_kats[0]); i++) {
+		kat = &generate_kats[i];
+
+		/* Parse the test vector. */
+		if (unhexify(kat->priv, priv, sizeof(priv)) ||
+		    unhexify(kat->pub, pub, sizeof(pub))) {
+			warn0("Invalid test vector %zu", i);
+			goto err0;
+		}
+
+		/* Compute the public value using the tables and check it. */
+		if (crypto_dh_generate_pub(pub_out, priv)) {
+			warnp("crypto_dh_generate_pub");
+			goto err0;
+		}
+		if (memcmp(pub_out, pub, sizeof(pub))) {
+			warn0("crypto_dh_generate_pub: wrong answer for"
+			    " vector %zu", i);
+			goto err0;
+		}
+
+		/* The general exponentiation should agree. */
+		if (crypto_dh_compute(two, priv, key_out)) {
+			warnp("crypto_dh_compute");
+			goto err0;
+		}
+		if (memcmp(key_out, pub, sizeof(pub))) {
+			warn0("crypto_dh_compute: wrong answer for 2^x,"
+			    " vector %zu", i);
+			goto err0;
+		}
+	}
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+int
+main(int argc, char ** argv)
+{
+
+	WARNP_INIT;
+	(void)argc; /* UNUSED */
+
+	/* Run the tests. */
+	if (test_compute())
+		goto err0;
+	if (test_generate())
+		goto err0;
+
+	/* Success! */
+	exit(0);
+
+err0:
+	/* Failure! */
+	exit(1);
+}
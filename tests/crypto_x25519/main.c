@@ -0,0 +1,234 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "crypto_x25519.h"
+#include "warnp.h"
+
+/* Test vectors from RFC 7748 section 5.2: (scalar, u, X25519(scalar, u)). */
+static const struct x25519_kat {
+	const char * priv;
+	const char * pub;
+	const char * key;
+} x25519_kats[] = {
+	{
+	    "a546e36bf0527c9d3b16154b82465edd62144c0ac1fc5a18506a2244ba449ac4",
+	    "e6db6867583030db3594c1a424b15f7c726624ec26b3353b10a903a6d0ab1c4c",
+	    "c3da55379de9c6908e94ea4df28d084f32eccf03491c71f754b4075577a28552"
+	},
+	/* The most significant bit of u is set, and must be ignored. */
+	{
+	    "4b66e9d4d1b4673c5ad22691957d6af5c11b6421e0ea01d42ca4169e7918ba0d",
+	    "e5210f12786811d3f4b7959d0538ae2c31dbe7106fc03c3efc4cd549c715a493",
+	    "95cbde9476e8907d7aade45cb4b873f88b595a68799fa152e6f8f7647aac7957"
+	}
+};
+
+/*
+ * Iterated test from RFC 7748 section 5.2: starting with k = u = 9, set
+ * (k, u) = (X25519(k, u), k); these are the values of k after 1 and 1000
+ * iterations.  (The value after 1000000 iterations takes too long to check.)
+ */
+static const char * iter_1 =
+    "422c8e7a6227d7bca1350b3e2bb7279f7897b87bb6854b783c60e80311ae3079";
+static const char * iter_1000 =
+    "684cf59ba83309552800ef566f2f4d3c1c3887c49360e3875f2eb94d99532c51";
+
+/* Diffie-Hellman test from RFC 7748 section 6.1. */
+static const char * dh_alice_priv =
+    "77076d0a7318a57d3c16c17251b26645df4c2f87ebc0992ab177fba51db92c2a";
+static const char * dh_alice_pub =
+    "8520f0098930a754748b7ddcb43ef75a0dbf3a0d26381af4eba4a98eaa9b4e6a";
+static const char * dh_bob_priv =
+    "5dab087e624a8a4b79e17f8b83800ee66f3bb1292618b6fd1c2f8b27ff88e0eb";
+static const char * dh_bob_pub =
+    "de9edb7d7b7dc1b4d35b61c2ece435373f8343c85b78674dadfc7e146f882b4f";
+static const char * dh_key =
+    "4a5d9d5ba4ce2de1728e3bf480350f25e07e21c947d19e3376f09b3c1e161742";
+
+/* Convert the hex string ${s} into ${len} bytes in ${buf}. */
+static int
+unhexify(const char * s, uint8_t * buf, size_t len)
+{
+	unsigned int x;
+	size_t i;
+
+	/* The string must be exactly the right length. */
+	if (strlen(s) != len * 2)
+		goto err0;
+
+	/* Parse each pair of hex digits. */
+	for (i = 0; i < len; i++) {
+		if (sscanf(&s[i * 2], "%2x", &x) != 1)
+			goto err0;
+		buf[i] = (uint8_t)x;
+	}
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* Check that ${buf} is equal to the value encoded by the hex string ${s}. */
+static int
+check(const uint8_t buf[CRYPTO_X25519_KEYLEN], const char * s,
+    const char * what)
+{
+	uint8_t expected[CRYPTO_X25519_KEYLEN];
+
+	if (unhexify(s, expected, sizeof(expected))) {
+		warn0("Invalid test vector for %s", what);
+		goto err0;
+	}
+	if (memcmp(buf, expected, sizeof(expected))) {
+		warn0("Wrong answer for %s", what);
+		goto err0;
+	}
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* Check crypto_x25519_compute against the RFC 7748 function test vectors. */
+static int
+test_vectors(void)
+{
+	const struct x25519_kat * kat;
+	uint8_t priv[CRYPTO_X25519_PRIVLEN];
+	uint8_t pub[CRYPTO_X25519_PUBLEN];
+	uint8_t key[CRYPTO_X25519_KEYLEN];
+	size_t i;
+
+	for (i = 0; i < sizeof(x25519_kats) / sizeof(x25519_kats[0]); i++) {
+		kat = &x25519_kats[i];
+
+		/* Parse the test vector. */
+		if (unhexify(kat->priv, priv, sizeof(priv)) ||
+		    unhexify(kat->pub, pub, sizeof(pub))) {
+			warn0("Invalid test vector %zu", i);
+			goto err0;
+		}
+
+		/* Compute the key and check it. */
+		crypto_x25519_compute(pub, priv, key);
+		if (check(key, kat->key, "test vector"))
+			goto err0;
+	}
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* Run the RFC 7748 iterated test for 1000 iterations. */
+static int
+test_iterated(void)
+{
+	uint8_t k[CRYPTO_X25519_KEYLEN];
+	uint8_t u[CRYPTO_X25519_PUBLEN];
+	uint8_t r[CRYPTO_X25519_KEYLEN];
+	size_t i;
+
+	/* Start with k = u = 9. */
+	memset(k, 0, sizeof(k));
+	k[0] = 9;
+	memcpy(u, k, sizeof(u));
+
+	/* Iterate, checking after 1 and 1000 iterations. */
+	for (i = 1; i <= 1000; i++) {
+		crypto_x25519_compute(u, k, r);
+		memcpy(u, k, sizeof(u));
+		memcpy(k, r, sizeof(k));
+		if ((i == 1) && check(k, iter_1, "1 iteration"))
+			goto err0;
+	}
+	if (check(k, iter_1000, "1000 iterations"))
+		goto err0;
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* Run the RFC 7748 Diffie-Hellman test. */
+static int
+test_dh(void)
+{
+	uint8_t base[CRYPTO_X25519_PUBLEN];
+	uint8_t alice_priv[CRYPTO_X25519_PRIVLEN];
+	uint8_t alice_pub[CRYPTO_X25519_PUBLEN];
+	uint8_t bob_priv[CRYPTO_X25519_PRIVLEN];
+	uint8_t bob_pub[CRYPTO_X25519_PUBLEN];
+	uint8_t key[CRYPTO_X25519_KEYLEN];
+
+	/* The base point is u = 9. */
+	memset(base, 0, sizeof(base));
+	base[0] = 9;
+
+	/* Parse the private keys. */
+	if (unhexify(dh_alice_priv, alice_priv, sizeof(alice_priv)) ||
+	    unhexify(dh_bob_priv, bob_priv, sizeof(bob_priv))) {
+		warn0("Invalid test vector");
+		goto err0;
+	}
+
+	/* Compute and check the public keys. */
+	crypto_x25519_compute(base, alice_priv, alice_pub);
+	if (check(alice_pub, dh_alice_pub, "Alice's public key"))
+		goto err0;
+	crypto_x25519_compute(base, bob_priv, bob_pub);
+	if (check(bob_pub, dh_bob_pub, "Bob's public key"))
+		goto err0;
+
+	/* Both sides should compute the same shared secret. */
+	crypto_x25519_compute(bob_pub, alice_priv, key);
+	if (check(key, dh_key, "Alice's shared secret"))
+		goto err0;
+	crypto_x25519_compute(alice_pub, bob_priv, key);
+	if (check(key, dh_key, "Bob's shared secret"))
+		goto err0;
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+int
+main(int argc, char ** argv)
+{
+
+	WARNP_INIT;
+	(void)argc; /* UNUSED */
+
+	/* Run the tests. */
+	if (test_vectors())
+		goto err0;
+	if (test_iterated())
+		goto err0;
+	if (test_dh())
+		goto err0;
+
+	/* Success! */
+	exit(0);
+
+err0:
+	/* Failure! */
+	exit(1);
+}
@@ -0,0 +1,860 @@
+#include <sys/socket.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "events.h"
+#include "network.h"
+#include "sock.h"
+#include "sock_util.h"
+#include "warnp.h"
+
+#include "dispatch.h"
+#include "proto_conn.h"
+#include "proto_crypt.h"
+
+/* Limits on what we test. */
+#define NTARGETS_MAX 4
+#define NCONN_MAX 64
+
+/* Seconds to allow for connecting or handshaking. */
+#define TIMEO 5.0
+#define HEALTH_TIMEO 2.0
+
+/* Connections to make to the dead address to fill its listen queue. */
+#define NFILL 3
+
+/* Connections to keep in the pool. */
+#define NPOOL 2
+
+/* What a target which speaks first sends before closing the connection. */
+#define BANNER "220 test_dispatch ready\r\n"
+
+/* A target address, and the connections which spiped made to it. */
+struct target {
+	int s;
+	int banner;
+	void * accept_cookie;
+	int conns[NCONN_MAX];
+	size_t nconn;
+};
+
+static struct target targets[NTARGETS_MAX];
+static size_t ntargets = 0;
+static size_t naccepted = 0;
+static size_t nwanted = 0;
+static int done = 0;
+static int timedout = 0;
+
+/* Connections to spiped. */
+static int clients[NCONN_MAX];
+static size_t nclients = 0;
+
+static int callback_accepted(void *, int);
+
+/* Accept a connection to the target ${T}, if we have room for it. */
+static int
+target_accept(struct target * T)
+{
+
+	/* Don't accept more connections than we can keep track of. */
+	if (T->nconn == NCONN_MAX)
+		return (0);
+
+	/* Wait for a connection. */
+	if ((T->accept_cookie =
+	    network_accept(T->s, callback_accepted, T)) == NULL) {
+		warnp("network_accept");
+		goto err0;
+	}
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* spiped has connected to a target. */
+static int
+callback_accepted(void * cookie, int s)
+{
+	struct target * T = cookie;
+
+	/* This accept is no longer in progress. */
+	T->accept_cookie = NULL;
+
+	/* Did we get a connection? */
+	if (s == -1) {
+		warnp("accept");
+		goto err0;
+	}
+
+	/* If this target speaks first, send a banner and hang up. */
+	if (T->banner) {
+		if (write(s, BANNER, strlen(BANNER)) == -1) {
+			warnp("write");
+			goto err1;
+		}
+		if (close(s))
+			warnp("close");
+		s = -1;
+	}
+
+	/* Otherwise keep it open, so that spiped doesn't see it close. */
+	T->conns[T->nconn++] = s;
+
+	/* Stop the event loop if we have as many as we want. */
+	if (++naccepted >= nwanted)
+		done = 1;
+
+	/* Accept another connection. */
+	return (target_accept(T));
+
+err1:
+	if (close(s))
+		warnp("close");
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* We've waited too long. */
+static int
+callback_timeout(void * cookie)
+{
+
+	(void)cookie; /* UNUSED */
+
+	/* Give up. */
+	timedout = done = 1;
+
+	/* Success! */
+	return (0);
+}
+
+/* A connection to spiped is readable. */
+static int
+callback_readable(void * cookie)
+{
+
+	(void)cookie; /* UNUSED */
+
+	/* Stop the event loop. */
+	done = 1;
+
+	/* Success! */
+	return (0);
+}
+
+/*
+ * Run the event loop until ${done} is set, or until ${timeo} seconds have
+ * passed.  Return -1 on error or time out.
+ */
+static int
+spin(double timeo)
+{
+	void * timer_cookie;
+
+	/* Don't wait forever. */
+	if ((timer_cookie = events_timer_register_double(callback_timeout,
+	    NULL, timeo)) == NULL) {
+		warnp("events_timer_register_double");
+		goto err0;
+	}
+
+	/* Wait. */
+	timedout = 0;
+	if (events_spin(&done)) {
+		warnp("events_spin");
+		goto err1;
+	}
+
+	/* Did we time out? */
+	if (timedout)
+		goto err0;
+	events_timer_cancel(timer_cookie);
+
+	/* Success! */
+	return (0);
+
+err1:
+	events_timer_cancel(timer_cookie);
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/*
+ * Run the event loop until the targets have accepted a total of ${n}
+ * connections, or until ${timeo} seconds have passed.  Return -1 on error or
+ * time out.
+ */
+static int
+wait_accepted(size_t n, double timeo)
+{
+
+	/* Nothing to wait for if we already have enough. */
+	if (naccepted >= n)
+		return (0);
+
+	/* Wait. */
+	nwanted = n;
+	done = 0;
+	if (spin(timeo)) {
+		warn0("Only %zu of %zu connections reached the targets",
+		    naccepted, n);
+		goto err0;
+	}
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/*
+ * Run the event loop until spiped closes the connection ${s}, or until
+ * ${timeo} seconds have passed.  Return -1 on error or time out.
+ */
+static int
+wait_closed(int s, double timeo)
+{
+	char ch;
+
+	/* Wait until the connection is readable. */
+	if (events_network_register(callback_readable, NULL, s,
+	    EVENTS_NETWORK_OP_READ)) {
+		warnp("events_network_register");
+		goto err0;
+	}
+	done = 0;
+	if (spin(timeo)) {
+		events_network_cancel(s, EVENTS_NETWORK_OP_READ);
+		goto err1;
+	}
+
+	/* We should have reached EOF. */
+	if (read(s, &ch, 1) != 0)
+		goto err1;
+
+	/* Success! */
+	return (0);
+
+err1:
+	warn0("spiped did not close the connection");
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/*
+ * Read from the connection ${s} until spiped closes it, or until ${timeo}
+ * seconds have passed without anything arriving, and check that we received
+ * the target's banner.  Return -1 on error or time out.
+ */
+static int
+wait_banner(int s, double timeo)
+{
+	char buf[sizeof(BANNER)];
+	size_t len = 0;
+	ssize_t lenread;
+
+	do {
+		/* Wait until the connection is readable. */
+		if (events_network_register(callback_readable, NULL, s,
+		    EVENTS_NETWORK_OP_READ)) {
+			warnp("events_network_register");
+			goto err0;
+		}
+		done = 0;
+		if (spin(timeo)) {
+			events_network_cancel(s, EVENTS_NETWORK_OP_READ);
+			warn0("spiped did not close the connection");
+			goto err0;
+		}
+
+		/* Read what we can, leaving room to spot excess data. */
+		if ((lenread = read(s, &buf[len], sizeof(buf) - len)) == -1) {
+			warnp("read");
+			goto err0;
+		}
+		len += (size_t)lenread;
+	} while ((lenread > 0) && (len < sizeof(buf)));
+
+	/* Did we get the banner, and nothing else? */
+	if ((len != strlen(BANNER)) || memcmp(buf, BANNER, len)) {
+		warn0("Did not receive the target's banner");
+		goto err0;
+	}
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* Make a connection to spiped at ${sas}. */
+static int
+client_connect(struct sock_addr * const * sas)
+{
+
+	/* Sanity check. */
+	if (nclients == NCONN_MAX) {
+		warn0("Too many connections");
+		goto err0;
+	}
+
+	/* Connect; spiped's socket is listening, so this won't block. */
+	if ((clients[nclients] = sock_connect(sas)) == -1) {
+		warnp("sock_connect");
+		goto err0;
+	}
+	nclients++;
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* Listen on the target address ${addr}, and add it to the list ${sas}. */
+static int
+target_listen(const char * addr, struct sock_addr ** sas)
+{
+	struct target * T = &targets[ntargets];
+
+	/* Sanity check. */
+	if (ntargets == NTARGETS_MAX) {
+		warn0("Too many target addresses");
+		goto err0;
+	}
+
+	/* Resolve the address. */
+	if ((sas[ntargets] = sock_resolve_one(addr, 0)) == NULL) {
+		warnp("sock_resolve_one(%s)", addr);
+		goto err0;
+	}
+	sas[ntargets + 1] = NULL;
+
+	/* Listen on it. */
+	if ((T->s = sock_listener(sas[ntargets])) == -1) {
+		warnp("sock_listener(%s)", addr);
+		goto err1;
+	}
+	T->banner = 0;
+	T->nconn = 0;
+	ntargets++;
+
+	/* Accept connections. */
+	if (target_accept(T))
+		goto err0;
+
+	/* Success! */
+	return (0);
+
+err1:
+	sock_addr_free(sas[ntargets]);
+	sas[ntargets] = NULL;
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* Close all the connections and listening sockets. */
+static void
+cleanup(void)
+{
+	size_t i, j;
+
+	/* Close the connections to spiped. */
+	for (i = 0; i < nclients; i++) {
+		if (close(clients[i]))
+			warnp("close");
+	}
+
+	/* Close the targets. */
+	for (i = 0; i < ntargets; i++) {
+		if (targets[i].accept_cookie != NULL)
+			network_accept_cancel(targets[i].accept_cookie);
+		for (j = 0; j < targets[i].nconn; j++) {
+			if ((targets[i].conns[j] != -1) &&
+			    close(targets[i].conns[j]))
+				warnp("close");
+		}
+		if (close(targets[i].s))
+			warnp("close");
+	}
+}
+
+/*
+ * Start spiped listening on ${src}, encrypting connections to the addresses
+ * ${sas} (or decrypting them if ${decr} is non-zero), keeping ${npool}
+ * connections in a pool, picking addresses according to ${balance}, and
+ * giving up on connections after ${timeo} seconds.  Return the dispatch
+ * cookie.
+ */
+static void *
+start_spiped(const char * src, struct sock_addr * const * sas,
+    const struct proto_secret * K, int decr, size_t npool, int balance,
+    double timeo, int * conndone)
+{
+	struct proto_conn_opts opts;
+	struct dispatch_opts dopts;
+	struct sock_addr ** sas_t;
+	struct sock_addr * sa;
+	void * dispatch_cookie;
+	int s;
+
+	/* Listen for connections. */
+	if ((sa = sock_resolve_one(src, 0)) == NULL) {
+		warnp("sock_resolve_one(%s)", src);
+		goto err0;
+	}
+	s = sock_listener(sa);
+	sock_addr_free(sa);
+	if (s == -1) {
+		warnp("sock_listener(%s)", src);
+		goto err0;
+	}
+
+	/* The dispatcher takes ownership of its list of target addresses. */
+	if ((sas_t = sock_addr_duplist(sas)) == NULL) {
+		warnp("sock_addr_duplist");
+		goto err1;
+	}
+
+	/* Use the default options, apart from those we were given. */
+	opts.decr = decr;
+	opts.nopfs = 0;
+	opts.requirepfs = 0;
+	opts.jumbo = 0;
+	opts.x25519 = 0;
+	opts.early = 0;
+	opts.nokeepalive = 0;
+	opts.K = K;
+	opts.timeo = timeo;
+	opts.race = 0.0;
+	opts.coalesce = 0.0;
+	dopts.npool = npool;
+	dopts.mux = 0;
+	dopts.balance = balance;
+	dopts.health = 0.0;
+
+	/* Start accepting connections. */
+	if ((dispatch_cookie = dispatch_accept(s, "target", 0.0, sas_t, NULL,
+	    &opts, NCONN_MAX, &dopts, conndone)) == NULL) {
+		warnp("dispatch_accept");
+		goto err2;
+	}
+
+	/* Success! */
+	return (dispatch_cookie);
+
+err2:
+	sock_addr_freelist(sas_t);
+err1:
+	if (close(s))
+		warnp("close");
+err0:
+	/* Failure! */
+	return (NULL);
+}
+
+/*
+ * Connect through spiped at ${src} to the target addresses ${addrs}, using
+ * the balancing policy ${policy}, and check that connections are spread
+ * across the targets as that policy should spread them.
+ */
+static int
+balance(const char * policy, const char * src, char ** addrs, size_t naddrs)
+{
+	struct sock_addr * sas[NTARGETS_MAX + 1];
+	struct sock_addr ** sas_src;
+	struct proto_secret * K;
+	void * dispatch_cookie;
+	int conndone = 0;
+	int policy_num;
+	size_t nconn;
+	size_t i;
+
+	/* Parse the policy, and decide how many connections to make. */
+	if (strcmp(policy, "first") == 0) {
+		policy_num = DISPATCH_BALANCE_FIRST;
+		nconn = 2 * naddrs;
+	} else if (strcmp(policy, "round-robin") == 0) {
+		policy_num = DISPATCH_BALANCE_RR;
+		nconn = 2 * naddrs;
+	} else if (strcmp(policy, "least-conn") == 0) {
+		policy_num = DISPATCH_BALANCE_LEAST;
+		nconn = 2 * naddrs;
+	} else if (strcmp(policy, "two-choice") == 0) {
+		policy_num = DISPATCH_BALANCE_P2C;
+		nconn = 10 * naddrs;
+	} else {
+		warn0("Unknown balancing policy: %s", policy);
+		goto err0;
+	}
+
+	/* Listen on the target addresses. */
+	sas[0] = NULL;
+	for (i = 0; i < naddrs; i++) {
+		if (target_listen(addrs[i], sas))
+			goto err1;
+	}
+
+	/* Start spiped. */
+	if ((K = proto_crypt_secret("/dev/null")) == NULL) {
+		warnp("proto_crypt_secret");
+		goto err1;
+	}
+	if ((dispatch_cookie = start_spiped(src, sas, K, 0, 0, policy_num,
+	    TIMEO, &conndone)) == NULL)
+		goto err2;
+	if ((sas_src = sock_resolve(src)) == NULL) {
+		warnp("sock_resolve(%s)", src);
+		goto err3;
+	}
+
+	/*
+	 * Connect one at a time, waiting until each connection reaches a
+	 * target so that spiped has counted it before it picks the next one.
+	 */
+	for (i = 0; i < nconn; i++) {
+		if (client_connect(sas_src))
+			goto err4;
+		if (wait_accepted(i + 1, TIMEO))
+			goto err4;
+	}
+
+	/* Check how the connections were spread. */
+	for (i = 0; i < ntargets; i++) {
+		switch (policy_num) {
+		case DISPATCH_BALANCE_FIRST:
+			/* Everything goes to the first address. */
+			if (targets[i].nconn != ((i == 0) ? nconn : 0))
+				goto bad;
+			break;
+		case DISPATCH_BALANCE_RR:
+		case DISPATCH_BALANCE_LEAST:
+			/* Every address gets the same number. */
+			if (targets[i].nconn != nconn / ntargets)
+				goto bad;
+			break;
+		default:
+			/* Every address gets some. */
+			if (targets[i].nconn == 0)
+				goto bad;
+			break;
+		}
+	}
+
+	/* Clean up. */
+	sock_addr_freelist(sas_src);
+	dispatch_shutdown(dispatch_cookie);
+	proto_crypt_secret_free(K);
+	cleanup();
+	for (i = 0; i < ntargets; i++)
+		sock_addr_free(sas[i]);
+
+	/* Success! */
+	return (0);
+
+bad:
+	for (i = 0; i < ntargets; i++)
+		warn0("Target %s got %zu connections", addrs[i],
+		    targets[i].nconn);
+	warn0("Connections were not spread as %s should spread them", policy);
+err4:
+	sock_addr_freelist(sas_src);
+err3:
+	dispatch_shutdown(dispatch_cookie);
+err2:
+	proto_crypt_secret_free(K);
+err1:
+	cleanup();
+	for (i = 0; i < ntargets; i++)
+		sock_addr_free(sas[i]);
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/*
+ * Connect through spiped at ${src} to a target with a dead address ${dead}
+ * (to which connections hang) and a live address ${live}, and check that
+ * after spiped fails to connect to the dead address once, it skips that
+ * address and connects straight to the live one.
+ */
+static int
+health(const char * src, const char * dead, const char * live)
+{
+	struct sock_addr * sas[3];
+	struct sock_addr ** sas_src;
+	struct proto_secret * K;
+	void * dispatch_cookie;
+	int conndone = 0;
+	int fill[NFILL];
+	size_t nfill;
+	size_t i;
+	int s;
+
+	/*
+	 * Listen on the dead address without accepting connections, and fill
+	 * up its listen queue so that further connections to it hang.
+	 */
+	if ((sas[0] = sock_resolve_one(dead, 0)) == NULL) {
+		warnp("sock_resolve_one(%s)", dead);
+		goto err0;
+	}
+	sas[1] = NULL;
+	if ((s = sock_listener(sas[0])) == -1) {
+		warnp("sock_listener(%s)", dead);
+		goto err1;
+	}
+	if (listen(s, 0)) {
+		warnp("listen");
+		goto err2;
+	}
+	for (nfill = 0; nfill < NFILL; nfill++) {
+		if ((fill[nfill] = sock_connect_nb(sas[0])) == -1) {
+			warnp("sock_connect_nb(%s)", dead);
+			goto err3;
+		}
+	}
+
+	/* Listen on the live address, which we'll try second. */
+	if (target_listen(live, &sas[1]))
+		goto err4;
+
+	/* Start spiped. */
+	if ((K = proto_crypt_secret("/dev/null")) == NULL) {
+		warnp("proto_crypt_secret");
+		goto err4;
+	}
+	if ((dispatch_cookie = start_spiped(src, sas, K, 0, 0,
+	    DISPATCH_BALANCE_FIRST, HEALTH_TIMEO, &conndone)) == NULL)
+		goto err5;
+	if ((sas_src = sock_resolve(src)) == NULL) {
+		warnp("sock_resolve(%s)", src);
+		goto err6;
+	}
+
+	/*
+	 * The first connection should hang trying to connect to the dead
+	 * address until spiped gives up on it.
+	 */
+	if (client_connect(sas_src))
+		goto err7;
+	if (wait_closed(clients[0], 2 * HEALTH_TIMEO))
+		goto err7;
+
+	/*
+	 * The next connections should go straight to the live address; if
+	 * spiped tried the dead address again, they would hang instead.
+	 */
+	for (i = 1; i < 5; i++) {
+		if (client_connect(sas_src))
+			goto err7;
+		if (wait_accepted(i, HEALTH_TIMEO / 2)) {
+			warn0("spiped tried the dead address again");
+			goto err7;
+		}
+	}
+
+	/* Clean up. */
+	sock_addr_freelist(sas_src);
+	dispatch_shutdown(dispatch_cookie);
+	proto_crypt_secret_free(K);
+	cleanup();
+	sock_addr_free(sas[1]);
+	for (i = 0; i < nfill; i++) {
+		if (close(fill[i]))
+			warnp("close");
+	}
+	if (close(s))
+		warnp("close");
+	sock_addr_free(sas[0]);
+
+	/* Success! */
+	return (0);
+
+err7:
+	sock_addr_freelist(sas_src);
+err6:
+	dispatch_shutdown(dispatch_cookie);
+err5:
+	proto_crypt_secret_free(K);
+err4:
+	cleanup();
+	sock_addr_free(sas[1]);
+err3:
+	for (i = 0; i < nfill; i++) {
+		if (close(fill[i]))
+			warnp("close");
+	}
+err2:
+	if (close(s))
+		warnp("close");
+err1:
+	sock_addr_free(sas[0]);
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/*
+ * Run a decrypting spiped at ${mid} in front of a target at ${tgt} which
+ * sends a banner and hangs up as soon as a connection arrives, and an
+ * encrypting spiped at ${src} which keeps a pool of connections to ${mid}.
+ * Check that spiped replaces pooled connections which have received the
+ * banner, and that a connection through spiped receives the banner.
+ */
+static int
+pool(const char * src, const char * mid, const char * tgt)
+{
+	struct sock_addr * sas[2];
+	struct sock_addr * sas_mid[2];
+	struct sock_addr ** sas_src;
+	struct proto_secret * K;
+	void * dispatch_cookie_d;
+	void * dispatch_cookie_e;
+	int conndone_d = 0;
+	int conndone_e = 0;
+
+	/* Listen on the target address, and send a banner to connections. */
+	sas[0] = NULL;
+	if (target_listen(tgt, sas))
+		goto err0;
+	targets[0].banner = 1;
+
+	/* Start the decrypting spiped. */
+	if ((K = proto_crypt_secret("/dev/null")) == NULL) {
+		warnp("proto_crypt_secret");
+		goto err1;
+	}
+	if ((dispatch_cookie_d = start_spiped(mid, sas, K, 1, 0,
+	    DISPATCH_BALANCE_FIRST, TIMEO, &conndone_d)) == NULL)
+		goto err2;
+
+	/* Start the encrypting spiped, with a pool of connections. */
+	if ((sas_mid[0] = sock_resolve_one(mid, 0)) == NULL) {
+		warnp("sock_resolve_one(%s)", mid);
+		goto err3;
+	}
+	sas_mid[1] = NULL;
+	if ((dispatch_cookie_e = start_spiped(src, sas_mid, K, 0, NPOOL,
+	    DISPATCH_BALANCE_FIRST, TIMEO, &conndone_e)) == NULL)
+		goto err4;
+	if ((sas_src = sock_resolve(src)) == NULL) {
+		warnp("sock_resolve(%s)", src);
+		goto err5;
+	}
+
+	/*
+	 * The pooled connections reach the target, which sends its banner
+	 * and hangs up.  spiped should drop them and connect again (after a
+	 * second); if it kept them in the pool, nothing would replace them.
+	 */
+	if (wait_accepted(NPOOL, TIMEO))
+		goto err6;
+	if (wait_accepted(2 * NPOOL, TIMEO)) {
+		warn0("spiped did not replace the pooled connections");
+		goto err6;
+	}
+
+	/* A connection through spiped should receive the banner. */
+	if (client_connect(sas_src))
+		goto err6;
+	if (wait_banner(clients[0], TIMEO))
+		goto err6;
+
+	/* Clean up. */
+	sock_addr_freelist(sas_src);
+	dispatch_shutdown(dispatch_cookie_e);
+	sock_addr_free(sas_mid[0]);
+	dispatch_shutdown(dispatch_cookie_d);
+	proto_crypt_secret_free(K);
+	cleanup();
+	sock_addr_free(sas[0]);
+
+	/* Success! */
+	return (0);
+
+err6:
+	sock_addr_freelist(sas_src);
+err5:
+	dispatch_shutdown(dispatch_cookie_e);
+err4:
+	sock_addr_free(sas_mid[0]);
+err3:
+	dispatch_shutdown(dispatch_cookie_d);
+err2:
+	proto_crypt_secret_free(K);
+err1:
+	cleanup();
+	sock_addr_free(sas[0]);
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+static void
+usage(void)
+{
+
+	fprintf(stderr, "usage: test_dispatch balance POLICY SOURCE"
+	    " TARGET ...\n");
+	fprintf(stderr, "       test_dispatch health SOURCE DEAD LIVE\n");
+	fprintf(stderr, "       test_dispatch pool SOURCE MIDDLE TARGET\n");
+	exit(1);
+}
+
+int
+main(int argc, char ** argv)
+{
+
+	WARNP_INIT;
+
+	/* Parse the command line. */
+	if (argc < 2)
+		usage();
+	if (strcmp(argv[1], "balance") == 0) {
+		if ((argc < 5) || (argc > 4 + NTARGETS_MAX))
+			usage();
+		if (balance(argv[2], argv[3], &argv[4], (size_t)(argc - 4)))
+			goto err0;
+	} else if (strcmp(argv[1], "health") == 0) {
+		if (argc != 5)
+			usage();
+		if (health(argv[2], argv[3], argv[4]))
+			goto err0;
+	} else if (strcmp(argv[1], "pool") == 0) {
+		if (argc != 5)
+			usage();
+		if (pool(argv[2], argv[3], argv[4]))
+			goto err0;
+	} else {
+		usage();
+	}
+
+	/* Clean up the event loop. */
+	events_shutdown();
+
+	/* Success! */
+	exit(0);
+
+err0:
+	/* Failure! */
+	events_shutdown();
+	exit(1);
+}
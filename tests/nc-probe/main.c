@@ -0,0 +1,221 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "events.h"
+#include "network.h"
+#include "parsenum.h"
+#include "sock.h"
+#include "warnp.h"
+
+/* Most bytes we will send or wait for. */
+#define MAXLEN 4096
+
+struct probe {
+	int socket;
+	size_t nsend;
+	size_t nrecv;
+	size_t nread;
+	int conndone;
+	void * connect_cookie;
+	void * write_cookie;
+	void * read_cookie;
+	uint8_t buf[MAXLEN];
+};
+
+/* Forward declaration. */
+static int callback_read(void *, ssize_t);
+
+/* Wait for more data, unless we have everything we want. */
+static int
+readmore(struct probe * P)
+{
+
+	/* Are we done? */
+	if (P->nread == P->nrecv) {
+		P->conndone = 1;
+		return (0);
+	}
+
+	/* Read at least one more byte. */
+	if ((P->read_cookie = network_read(P->socket, &P->buf[P->nread],
+	    P->nrecv - P->nread, 1, callback_read, P)) == NULL) {
+		warn0("network_read");
+		goto err0;
+	}
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* We've read some data, or the other end closed the connection. */
+static int
+callback_read(void * cookie, ssize_t lenread)
+{
+	struct probe * P = cookie;
+
+	/* We are no longer reading. */
+	P->read_cookie = NULL;
+
+	/* Check results. */
+	if (lenread == -1) {
+		warnp("network_read received");
+		goto err0;
+	} else if (lenread == 0) {
+		/* The other end closed the connection. */
+		P->conndone = 1;
+		return (0);
+	}
+
+	/* Record what we got, and look for more. */
+	P->nread += (size_t)lenread;
+	return (readmore(P));
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* Finished writing data; see what comes back. */
+static int
+callback_wrote(void * cookie, ssize_t lenwrit)
+{
+	struct probe * P = cookie;
+
+	/* We are no longer writing. */
+	P->write_cookie = NULL;
+
+	/* Check results. */
+	if (lenwrit == -1) {
+		warnp("network_write send");
+		goto err0;
+	}
+
+	/* Read what the other end sends. */
+	return (readmore(P));
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* Got a connection; send our data. */
+static int
+callback_connected(void * cookie, int socket)
+{
+	struct probe * P = cookie;
+
+	/* We are no longer connecting. */
+	P->connect_cookie = NULL;
+
+	/* Check that the connection did not fail. */
+	if (socket == -1) {
+		warn0("failed to connect");
+		goto err0;
+	}
+
+	/* Record socket for future use. */
+	P->socket = socket;
+
+	/* Send NSEND zero bytes. */
+	if ((P->write_cookie = network_write(P->socket, P->buf, P->nsend,
+	    P->nsend, callback_wrote, P)) == NULL) {
+		warn0("network_write failure");
+		goto err0;
+	}
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+int
+main(int argc, char ** argv)
+{
+	/* Command-line parameter. */
+	const char * addr;
+
+	/* Working variables. */
+	struct sock_addr ** sas_t;
+	struct probe probe_allocated;
+	struct probe * P = &probe_allocated;
+
+	WARNP_INIT;
+
+	/* Parse command-line arguments. */
+	if (argc != 4) {
+		fprintf(stderr, "usage: %s ADDRESS NSEND NRECV\n", argv[0]);
+		goto err0;
+	}
+	addr = argv[1];
+	if (PARSENUM(&P->nsend, argv[2], 0, MAXLEN) ||
+	    PARSENUM(&P->nrecv, argv[3], 0, MAXLEN)) {
+		warnp("parsenum");
+		goto err0;
+	}
+
+	/* Initialize cookie. */
+	memset(P->buf, 0, MAXLEN);
+	P->socket = -1;
+	P->nread = 0;
+	P->conndone = 0;
+	P->connect_cookie = NULL;
+	P->write_cookie = NULL;
+	P->read_cookie = NULL;
+
+	/* Resolve target address. */
+	if ((sas_t = sock_resolve(addr)) == NULL) {
+		warnp("Error resolving socket address: %s", addr);
+		goto err0;
+	}
+	if (sas_t[0] == NULL) {
+		warn0("No addresses found for %s", addr);
+		goto err1;
+	}
+
+	/* Connect to target. */
+	if ((P->connect_cookie = network_connect(sas_t, callback_connected,
+	    P)) == NULL) {
+		warn0("Error connecting");
+		goto err1;
+	}
+
+	/* Loop until we have what we want or the connection is closed. */
+	if (events_spin(&P->conndone)) {
+		warn0("Error running event loop");
+		goto err2;
+	}
+
+	/* Report how much we received. */
+	printf("%zu\n", P->nread);
+
+	/* Clean up. */
+	if ((P->socket != -1) && close(P->socket))
+		warnp("close");
+	sock_addr_freelist(sas_t);
+
+	/* Success! */
+	exit(0);
+
+err2:
+	if (P->connect_cookie != NULL)
+		network_connect_cancel(P->connect_cookie);
+	if (P->write_cookie != NULL)
+		network_write_cancel(P->write_cookie);
+	if (P->read_cookie != NULL)
+		network_read_cancel(P->read_cookie);
+err1:
+	sock_addr_freelist(sas_t);
+err0:
+	/* Failure! */
+	exit(1);
+}
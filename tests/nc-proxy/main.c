@@ -0,0 +1,314 @@
+#include <sys/socket.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "asprintf.h"
+#include "parsenum.h"
+#include "sock.h"
+#include "warnp.h"
+
+/* Most connections we will forward. */
+#define MAX_CONNECTIONS 8
+
+/* Size of buffer used to forward data. */
+#define BUFLEN 4096
+
+/* Make the socket ${s} blocking. */
+static int
+setblocking(int s)
+{
+	int flags;
+
+	if (((flags = fcntl(s, F_GETFL, 0)) == -1) ||
+	    (fcntl(s, F_SETFL, flags & ~O_NONBLOCK) == -1)) {
+		warnp("fcntl");
+		goto err0;
+	}
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* Write the number ${count} to ${countfile}, replacing it atomically. */
+static int
+writecount(const char * countfile, size_t count)
+{
+	char * tmpname;
+	FILE * f;
+
+	/* Write the count to a temporary file. */
+	if (asprintf(&tmpname, "%s.tmp", countfile) == -1) {
+		warnp("asprintf");
+		goto err0;
+	}
+	if ((f = fopen(tmpname, "w")) == NULL) {
+		warnp("fopen(%s)", tmpname);
+		goto err1;
+	}
+	if (fprintf(f, "%zu\n", count) < 0) {
+		warnp("fprintf");
+		goto err2;
+	}
+	if (fclose(f)) {
+		warnp("fclose");
+		goto err1;
+	}
+
+	/* Move it into place. */
+	if (rename(tmpname, countfile)) {
+		warnp("rename(%s)", countfile);
+		goto err1;
+	}
+	free(tmpname);
+
+	/* Success! */
+	return (0);
+
+err2:
+	if (fclose(f))
+		warnp("fclose");
+err1:
+	free(tmpname);
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/*
+ * Read some data from ${from} and write it to ${to}.  On EOF, shut down
+ * writing on ${to} and set ${eof} to 1.  Add the number of bytes forwarded
+ * to ${count}.
+ */
+static int
+forward(int from, int to, int * eof, size_t * count)
+{
+	uint8_t buf[BUFLEN];
+	ssize_t lenread;
+	ssize_t lenwrit;
+	ssize_t pos;
+
+	/* Read some data. */
+	if ((lenread = read(from, buf, BUFLEN)) == -1) {
+		/* A reset connection is an EOF as far as we're concerned. */
+		if (errno != ECONNRESET) {
+			warnp("read");
+			goto err0;
+		}
+		lenread = 0;
+	}
+
+	/* Pass on an EOF. */
+	if (lenread == 0) {
+		*eof = 1;
+		if (shutdown(to, SHUT_WR) && (errno != ENOTCONN)) {
+			warnp("shutdown");
+			goto err0;
+		}
+		return (0);
+	}
+
+	/* Write all of the data. */
+	for (pos = 0; pos < lenread; pos += lenwrit) {
+		if ((lenwrit = write(to, &buf[pos],
+		    (size_t)(lenread - pos))) == -1) {
+			warnp("write");
+			goto err0;
+		}
+	}
+	*count += (size_t)lenread;
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* Forward data between ${s_c} and ${s_t} until both have sent EOF. */
+static int
+proxy(int s_c, int s_t, const char * countfile)
+{
+	struct pollfd fds[2];
+	int eof_c = 0;
+	int eof_t = 0;
+	size_t count_c = 0;
+	size_t count_t = 0;
+
+	/* Nothing has been sent yet. */
+	if (writecount(countfile, count_c))
+		goto err0;
+
+	/* Forward data until both sides are finished. */
+	while (!eof_c || !eof_t) {
+		/* Wait for data from whichever sides are still sending. */
+		fds[0].fd = eof_c ? -1 : s_c;
+		fds[0].events = POLLIN;
+		fds[1].fd = eof_t ? -1 : s_t;
+		fds[1].events = POLLIN;
+		if (poll(fds, 2, -1) == -1) {
+			if (errno == EINTR)
+				continue;
+			warnp("poll");
+			goto err0;
+		}
+
+		/* Forward data from the client, and record how much. */
+		if (fds[0].revents) {
+			if (forward(s_c, s_t, &eof_c, &count_c))
+				goto err0;
+			if (writecount(countfile, count_c))
+				goto err0;
+		}
+
+		/* Forward data from the target. */
+		if (fds[1].revents) {
+			if (forward(s_t, s_c, &eof_t, &count_t))
+				goto err0;
+		}
+	}
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+int
+main(int argc, char ** argv)
+{
+	/* Command-line parameters. */
+	const char * addr_l;
+	const char * addr_t;
+	const char * countfile;
+	size_t nconn;
+
+	/* Working variables. */
+	struct sock_addr ** sas_l;
+	struct sock_addr ** sas_t;
+	struct pollfd fd;
+	char * name;
+	size_t i;
+	int s_l;
+	int s_c;
+	int s_t;
+
+	WARNP_INIT;
+
+	/* Parse command-line arguments. */
+	if (argc != 5) {
+		fprintf(stderr, "usage: %s ADDRESS TARGET COUNTFILE NCONN\n",
+		    argv[0]);
+		goto err0;
+	}
+	addr_l = argv[1];
+	addr_t = argv[2];
+	countfile = argv[3];
+	if (PARSENUM(&nconn, argv[4], 1, MAX_CONNECTIONS)) {
+		warnp("parsenum");
+		goto err0;
+	}
+
+	/* Resolve the addresses. */
+	if ((sas_l = sock_resolve(addr_l)) == NULL) {
+		warnp("Error resolving socket address: %s", addr_l);
+		goto err0;
+	}
+	if (sas_l[0] == NULL) {
+		warn0("No addresses found for %s", addr_l);
+		goto err1;
+	}
+	if ((sas_t = sock_resolve(addr_t)) == NULL) {
+		warnp("Error resolving socket address: %s", addr_t);
+		goto err1;
+	}
+	if (sas_t[0] == NULL) {
+		warn0("No addresses found for %s", addr_t);
+		goto err2;
+	}
+
+	/* Listen for connections. */
+	if ((s_l = sock_listener(sas_l[0])) == -1)
+		goto err2;
+
+	/*
+	 * Forward NCONN connections one at a time, writing the number of
+	 * bytes sent by the Nth client so far to COUNTFILE-N.
+	 */
+	for (i = 0; i < nconn; i++) {
+		/* Wait for a connection and accept it. */
+		fd.fd = s_l;
+		fd.events = POLLIN;
+		if (poll(&fd, 1, -1) == -1) {
+			warnp("poll");
+			goto err3;
+		}
+		if ((s_c = accept(s_l, NULL, NULL)) == -1) {
+			warnp("accept");
+			goto err3;
+		}
+
+		/* Connect to the target. */
+		if ((s_t = sock_connect(sas_t)) == -1)
+			goto err4;
+
+		/* We want blocking reads and writes. */
+		if (setblocking(s_c) || setblocking(s_t))
+			goto err5;
+
+		/* Forward data for this connection. */
+		if (asprintf(&name, "%s-%zu", countfile, i) == -1) {
+			warnp("asprintf");
+			goto err5;
+		}
+		if (proxy(s_c, s_t, name))
+			goto err6;
+		free(name);
+
+		/* Close the connection. */
+		if (close(s_t))
+			warnp("close");
+		if (close(s_c))
+			warnp("close");
+	}
+
+	/* Clean up. */
+	if (close(s_l))
+		warnp("close");
+	sock_addr_freelist(sas_t);
+	sock_addr_freelist(sas_l);
+
+	/* Success! */
+	exit(0);
+
+err6:
+	free(name);
+err5:
+	if (close(s_t))
+		warnp("close");
+err4:
+	if (close(s_c))
+		warnp("close");
+err3:
+	if (close(s_l))
+		warnp("close");
+err2:
+	sock_addr_freelist(sas_t);
+err1:
+	sock_addr_freelist(sas_l);
+err0:
+	/* Failure! */
+	exit(1);
+}
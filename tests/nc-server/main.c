@@ -5,6 +5,7 @@
 #include <stdlib.h>
 #include <unistd.h>
 
+#include "asprintf.h"
 #include "millisleep.h"
 #include "monoclock.h"
 #include "parsenum.h"
@@ -15,9 +16,17 @@
 #define MAX_CONNECTIONS 2
 #define SHUTDOWN_AFTER 1
 
+/* Most connections which can be written to separate files. */
+#define MAX_SEPARATE 8
+
 struct nc_cookie {
 	FILE * out;
 	size_t bps;		/* Average bytes per second to send. */
+	const char * filename;
+	size_t nsep;		/* Connections to write to separate files. */
+	size_t nout;		/* Separate files opened so far. */
+	int socks[MAX_SEPARATE];
+	FILE * outs[MAX_SEPARATE];
 };
 
 /* Send a message, limited to bytes per second.  Send in bursts of 10ms. */
@@ -76,14 +85,65 @@ err0:
 	return (-1);
 }
 
+/*
+ * Return the file to which data from ${sock} should be written, opening
+ * ${filename}-N for the Nth connection if we're keeping connections separate.
+ */
+static FILE *
+getout(struct nc_cookie * C, int sock)
+{
+	char * name;
+	size_t i;
+
+	/* Everything goes to one file unless we're keeping them separate. */
+	if (C->nsep == 0)
+		return (C->out);
+
+	/* Have we seen this connection before? */
+	for (i = 0; i < C->nout; i++) {
+		if (C->socks[i] == sock)
+			return (C->outs[i]);
+	}
+
+	/* Open a file for this connection. */
+	if (C->nout == C->nsep) {
+		warn0("Too many connections");
+		goto err0;
+	}
+	if (asprintf(&name, "%s-%zu", C->filename, C->nout) == -1) {
+		warnp("asprintf");
+		goto err0;
+	}
+	if ((C->outs[C->nout] = fopen(name, "wb")) == NULL) {
+		warnp("fopen(%s)", name);
+		goto err1;
+	}
+	free(name);
+	C->socks[C->nout] = sock;
+
+	/* Success! */
+	return (C->outs[C->nout++]);
+
+err1:
+	free(name);
+err0:
+	/* Failure! */
+	return (NULL);
+}
+
 /* A client sent a message. */
 static int
 callback_snc_response(void * cookie, uint8_t * buf, size_t buflen, int sock)
 {
 	struct nc_cookie * C = cookie;
+	FILE * out;
+
+	/* Find the file for this connection. */
+	if ((out = getout(C, sock)) == NULL)
+		goto err0;
 
 	/* Write buffer to the previously-opened file. */
-	if (fwrite(buf, sizeof(uint8_t), buflen, C->out) != buflen) {
+	if (fwrite(buf, sizeof(uint8_t), buflen, out) != buflen) {
 		warnp("fwrite");
 		goto err0;
 	}
@@ -107,17 +167,22 @@ main(int argc, char ** argv)
 	struct nc_cookie * C = &cookie;
 	const char * sockname;
 	const char * filename;
+	size_t nconn_max = MAX_CONNECTIONS;
+	size_t shutdown_after = SHUTDOWN_AFTER;
+	size_t i;
 
 	WARNP_INIT;
 
 	/* Parse command-line arguments. */
 	if (argc < 3) {
-		fprintf(stderr, "usage: %s ADDRESS FILENAME [ECHO_BPS]\n",
+		fprintf(stderr, "usage: %s ADDRESS FILENAME [ECHO_BPS [NCONN]]\n",
 		    argv[0]);
 		goto err0;
 	}
 	sockname = argv[1];
 	filename = argv[2];
+	C->filename = filename;
+	C->nout = 0;
 	if (argc > 3) {
 		/* Allow up to 1 MB per second of echoing. */
 		if (PARSENUM(&C->bps, argv[3], 0, 1000000)) {
@@ -131,6 +196,19 @@ main(int argc, char ** argv)
 	} else
 		C->bps = 0;
 
+	/*
+	 * If asked to, accept NCONN connections at once, and write the data
+	 * from each to FILENAME-N, in the order in which they send data.
+	 */
+	if (argc > 4) {
+		if (PARSENUM(&C->nsep, argv[4], 1, MAX_SEPARATE)) {
+			warnp("parsenum");
+			goto err0;
+		}
+		nconn_max = shutdown_after = C->nsep;
+	} else
+		C->nsep = 0;
+
 	/* Open the output file; can be /dev/null. */
 	if ((C->out = fopen(filename, "wb")) == NULL) {
 		warnp("fopen");
@@ -138,13 +216,19 @@ main(int argc, char ** argv)
 	}
 
 	/* Run the server. */
-	if (simple_server(sockname, MAX_CONNECTIONS, SHUTDOWN_AFTER,
+	if (simple_server(sockname, nconn_max, shutdown_after,
 	    &callback_snc_response, C)) {
 		warn0("simple_server failed");
 		goto err1;
 	}
 
-	/* Write the output file. */
+	/* Write the output files. */
+	for (i = 0; i < C->nout; i++) {
+		if (fclose(C->outs[i]) != 0) {
+			warnp("fclose");
+			goto err1;
+		}
+	}
 	if (fclose(C->out) != 0) {
 		warnp("fclose");
 		goto err0;
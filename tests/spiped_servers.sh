@@ -29,19 +29,21 @@ check_leftover_servers() {
 }
 
 ## setup_spiped_decryption_server(nc_output=/dev/null, use_system_spiped=0,
-#      use_nc=1, nc_bps=0):
+#      use_nc=1, nc_bps=0, extra_args=""):
 # Set up a spiped decryption server, translating from ${mid_sock}
 # to ${dst_sock}, saving the exit code to ${c_exitfile}.  Also set
 # up a nc-server listening to ${dst_sock}, saving output to
 # ${nc_output}, unless ${use_nc} is 0.  Uses the system's spiped (instead of
 # the version in this source tree) if ${use_system_spiped} is 1.
 # If ${nc_bps} is non-zero, run nc as an echo server which is
-# limited to ${nc_bps} bytes per second.
+# limited to ${nc_bps} bytes per second.  Pass the (space-separated)
+# options ${extra_args} to spiped.
 setup_spiped_decryption_server () {
 	nc_output=${1:-/dev/null}
 	use_system_spiped=${2:-0}
 	use_nc=${3:-1}
 	nc_bps=${4:-0}
+	extra_args=${5:-}
 	check_leftover_servers
 
 	# We need to set this up here so that ${c_valgrind_cmd} is set.
@@ -68,25 +70,170 @@ setup_spiped_decryption_server () {
 		-s "${mid_sock}"		\
 		-t "${dst_sock}"		\
 		-p "${s_basename}-spiped-d.pid"	\
-		-k /dev/null -o 1
+		-k /dev/null -o 1 ${extra_args}
 	echo "$?" > "${c_exitfile}"
 }
 
-## setup_spiped_decryption_server(basename):
+## setup_spiped_encryption_server(extra_args="", target=${mid_sock}):
 # Set up a spiped encryption server, translating from ${src_sock}
-# to ${mid_sock}, saving the exit code to ${c_exitfile}.
+# to ${target}, saving the exit code to ${c_exitfile}.  Pass the
+# (space-separated) options ${extra_args} to spiped.
 setup_spiped_encryption_server () {
+	extra_args=${1:-}
+	target=${2:-${mid_sock}}
+
 	# Start spiped to connect source port to middle.
 	setup_check "setup_spiped_encryption_server"
 	${c_valgrind_cmd}			\
 	"${spiped_binary}" -e			\
 		-s "${src_sock}"		\
-		-t "${mid_sock}"		\
+		-t "${target}"			\
 		-p "${s_basename}-spiped-e.pid"	\
-		-k /dev/null -o 1
+		-k /dev/null -o 1 ${extra_args}
 	echo "$?" > "${c_exitfile}"
 }
 
+## send_file(sendfile):
+# Open a connection to ${src_sock}, send ${sendfile}, and close the
+# connection.
+send_file () {
+	sendfile=$1
+
+	# Open and close a connection.
+	setup_check "spiped send"
+	(
+		${nc_client_binary} "${src_sock}" < "${sendfile}"
+		echo $? > "${c_exitfile}"
+	)
+}
+
+## check_received(sendfile, nc_output):
+# Stop the servers, and check that the nc-server received output ${nc_output}
+# which matches ${sendfile}.
+check_received () {
+	sendfile=$1
+	nc_output=$2
+
+	# Wait for server(s) to quit.
+	servers_stop
+
+	setup_check "spiped send output"
+	if ! cmp -s "${nc_output}" "${sendfile}"; then
+		if [ "${VERBOSE}" -ne 0 ]; then
+			printf "Test output does not match input;" 1>&2
+			printf -- " output is:\n----\n" 1>&2
+			cat "${nc_output}" 1>&2
+			printf -- "----\n" 1>&2
+		fi
+		echo 1
+	else
+		echo 0
+	fi > "${c_exitfile}"
+}
+
+## send_file_check(sendfile, nc_output):
+# Open a connection to ${src_sock}, send ${sendfile}, and close the
+# connection.  Then stop the servers, and check that the nc-server received
+# output ${nc_output} which matches ${sendfile}.
+send_file_check () {
+	send_file "$1"
+	check_received "$1" "$2"
+}
+
+## make_sendfile(sendfile, ncopies=9):
+# Create a file ${sendfile} out of ${ncopies} copies of a test script; the
+# default size of around 100 kB is large enough to need several spiped
+# packets (and several jumbo packets).
+make_sendfile () {
+	i=0
+	while [ "${i}" -lt "${2:-9}" ]; do
+		cat "${scriptdir}/shared_test_functions.sh"
+		i=$((i + 1))
+	done > "$1"
+}
+
+## count_children(pidfile):
+# Print the number of child processes of the process whose pid is in
+# ${pidfile}.
+count_children () {
+	_count_children_pid=$(cat "$1")
+	ps -A -o ppid= | grep -c "^ *${_count_children_pid}\$" || true
+}
+
+## has_fewer_children(pidfile, n):
+# Return 0 if the process whose pid is in ${pidfile} has fewer than ${n}
+# child processes.
+has_fewer_children () {
+	[ "$(count_children "$1")" -lt "$2" ]
+}
+
+## wait_children(pidfile, n):
+# Wait up to 5 seconds for the process whose pid is in ${pidfile} to start
+# ${n} child processes, and return 0 if it has exactly that many.
+wait_children () {
+	wait_while 5000 has_fewer_children "$1" "$2" || true
+	[ "$(count_children "$1")" -eq "$2" ]
+}
+
+## count_listeners(sock):
+# Print the number of TCP sockets listening on the port of ${sock}, or
+# nothing if /proc/net/tcp is not available.
+count_listeners () {
+	if ! [ -r /proc/net/tcp ]; then
+		return
+	fi
+	_count_listeners_port=$(printf "%04X" "${1##*:}")
+	awk -v port=":${_count_listeners_port}" '
+	    substr($2, length($2) - 4) == port && $4 == "0A" { n++ }
+	    END { print n + 0 }' /proc/net/tcp
+}
+
+## has_fewer_listeners(sock, n):
+# Return 0 if fewer than ${n} TCP sockets are listening on the port of
+# ${sock}.
+has_fewer_listeners () {
+	[ "$(count_listeners "$1")" -lt "$2" ]
+}
+
+## thread_wakeups(pidfile):
+# Print the total number of voluntary context switches made by the threads,
+# other than the main thread, of the process whose pid is in ${pidfile}; or
+# nothing if /proc is not available.
+thread_wakeups () {
+	_thread_wakeups_pid=$(cat "$1")
+	if ! [ -d "/proc/${_thread_wakeups_pid}/task" ]; then
+		return
+	fi
+	for _thread_wakeups_task in "/proc/${_thread_wakeups_pid}/task"/*; do
+		if [ "${_thread_wakeups_task##*/}" = "${_thread_wakeups_pid}" ]
+		then
+			continue
+		fi
+		cat "${_thread_wakeups_task}/status" 2>/dev/null
+	done | awk '$1 == "voluntary_ctxt_switches:" { n += $2 }
+	    END { print n + 0 }'
+}
+
+## threads_busy(pidfile):
+# Return 0 if any thread, other than the main thread, of the process whose
+# pid is in ${pidfile} is running.
+threads_busy () {
+	_threads_busy_pid=$(cat "$1")
+	for _threads_busy_task in "/proc/${_threads_busy_pid}/task"/*; do
+		if [ "${_threads_busy_task##*/}" = "${_threads_busy_pid}" ]
+		then
+			continue
+		fi
+		_threads_busy_stat=$(cat "${_threads_busy_task}/stat"	\
+		    2>/dev/null) || continue
+		_threads_busy_state=${_threads_busy_stat##*) }
+		if [ "${_threads_busy_state%% *}" = "R" ]; then
+			return 0
+		fi
+	done
+	return 1
+}
+
 ## servers_stop():
 # Stops the various servers.
 servers_stop() {
@@ -19,6 +19,8 @@ dst_sock="[127.0.0.1]:8003"
 spiped_binary=${scriptdir}/../spiped/spiped
 spipe_binary=${scriptdir}/../spipe/spipe
 nc_client_binary=${scriptdir}/../tests/nc-client/nc-client
+nc_probe_binary=${scriptdir}/../tests/nc-probe/nc-probe
+nc_proxy_binary=${scriptdir}/../tests/nc-proxy/nc-proxy
 nc_server_binary=${scriptdir}/../tests/nc-server/nc-server
 dnsthread_resolve=${scriptdir}/../tests/dnsthread-resolve/dnsthread-resolve
 msleep=${scriptdir}/../tests/msleep/msleep
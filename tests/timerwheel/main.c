@@ -0,0 +1,253 @@
+#include <sys/time.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "parsenum.h"
+#include "warnp.h"
+
+#include "timerwheel.h"
+
+/* Number of timers, and number of random operations to perform. */
+#define NTIMERS 1000
+#define NOPS 100000
+
+/*
+ * A timer, as recorded by the brute-force model: its expiry time, whether it
+ * is in the timer wheel, and the timer wheel cookie if so.
+ */
+struct timer {
+	struct timeval tv;
+	int64_t t;
+	int live;
+	void * cookie;
+};
+
+static struct timer timers[NTIMERS];
+
+/* Current time, in microseconds. */
+static int64_t now = (int64_t)12345 * 1000000;
+
+/* Set ${tv} to ${t} microseconds. */
+static void
+settv(struct timeval * tv, int64_t t)
+{
+
+	tv->tv_sec = (time_t)(t / 1000000);
+	tv->tv_usec = (suseconds_t)(t % 1000000);
+}
+
+/* Return the least expiry time of a live timer, or -1 if there are none. */
+static int64_t
+model_min(void)
+{
+	int64_t min = -1;
+	size_t i;
+
+	for (i = 0; i < NTIMERS; i++) {
+		if (!timers[i].live)
+			continue;
+		if ((min == -1) || (timers[i].t < min))
+			min = timers[i].t;
+	}
+
+	return (min);
+}
+
+/* Pick a random delay, covering every level of the wheel and beyond. */
+static int64_t
+random_delay(void)
+{
+
+	switch (random() % 10) {
+	case 0:
+	case 1:
+		/* Less than 0.1 s: the next few ticks. */
+		return (random() % 100000);
+	case 2:
+		/* Up to about 28 hours: off the end of the wheel. */
+		return ((int64_t)(random() % 100000) * 1000000);
+	default:
+		/* Up to 20 s. */
+		return (random() % 20000000);
+	}
+}
+
+/* Check that timerwheel_getmin agrees with the model. */
+static int
+check_getmin(struct timerwheel * W)
+{
+	const struct timeval * tv;
+	int64_t min = model_min();
+
+	/* Ask the timer wheel. */
+	if (timerwheel_getmin(W, &tv)) {
+		warnp("timerwheel_getmin");
+		goto err0;
+	}
+
+	/* Compare. */
+	if ((tv == NULL) != (min == -1)) {
+		warn0("timerwheel_getmin: wrong emptiness");
+		goto err0;
+	}
+	if ((tv != NULL) &&
+	    ((int64_t)tv->tv_sec * 1000000 + tv->tv_usec != min)) {
+		warn0("timerwheel_getmin: wrong minimum");
+		goto err0;
+	}
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/*
+ * Advance the current time and remove expired timers from the timer wheel,
+ * checking that they come out in order and that none are missed.
+ */
+static int
+check_getptr(struct timerwheel * W)
+{
+	struct timeval tv;
+	struct timer * T;
+	void * ptr;
+
+	/* Usually move forward a little; occasionally move a long way. */
+	if (random() % 100 == 0)
+		now += random() % 1000000000;
+	else
+		now += random() % 200000;
+	settv(&tv, now);
+
+	/* Remove timers until none have expired. */
+	do {
+		if (timerwheel_getptr(W, &tv, &ptr)) {
+			warnp("timerwheel_getptr");
+			goto err0;
+		}
+		if ((T = ptr) == NULL)
+			break;
+
+		/* This must be an expired timer which is no later than any. */
+		if (!T->live || (T->t > now) || (T->t != model_min())) {
+			warn0("timerwheel_getptr: wrong timer");
+			goto err0;
+		}
+		T->live = 0;
+	} while (1);
+
+	/* There should be no expired timers left. */
+	if ((model_min() != -1) && (model_min() <= now)) {
+		warn0("timerwheel_getptr: missed a timer");
+		goto err0;
+	}
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/*
+ * Perform random operations on a timer wheel, and check that it agrees with
+ * a brute-force model.
+ */
+static int
+check_random(unsigned int seed)
+{
+	struct timerwheel * W;
+	struct timer * T;
+	size_t i;
+	int op;
+
+	/* Create a timer wheel. */
+	if ((W = timerwheel_init()) == NULL) {
+		warnp("timerwheel_init");
+		goto err0;
+	}
+
+	/* Make the test reproducible. */
+	srandom(seed);
+
+	for (i = 0; i < NOPS; i++) {
+		op = random() % 10;
+		T = &timers[random() % NTIMERS];
+
+		if ((op < 4) && !T->live) {
+			/* Add a timer. */
+			T->t = now + random_delay();
+			settv(&T->tv, T->t);
+			T->cookie = timerwheel_add(W, &T->tv, T);
+			if (T->cookie == NULL) {
+				warnp("timerwheel_add");
+				goto err1;
+			}
+			T->live = 1;
+		} else if ((op < 6) && T->live) {
+			/* Delete a timer. */
+			timerwheel_delete(W, T->cookie);
+			T->live = 0;
+		} else if ((op < 7) && T->live) {
+			/* Increase a timer. */
+			T->t += random() % 3000000;
+			settv(&T->tv, T->t);
+			timerwheel_increase(W, T->cookie, &T->tv);
+		} else if (op < 9) {
+			if (check_getmin(W))
+				goto err2;
+		} else {
+			if (check_getmin(W) || check_getptr(W))
+				goto err2;
+		}
+	}
+
+	/* Clean up. */
+	timerwheel_free(W);
+
+	/* Success! */
+	return (0);
+
+err2:
+	warn0("Operation %zu with seed %u", i, seed);
+err1:
+	timerwheel_free(W);
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+int
+main(int argc, char ** argv)
+{
+	unsigned int seed = 0;
+
+	WARNP_INIT;
+
+	/* Parse the command line. */
+	if (argc > 2) {
+		fprintf(stderr, "usage: test_timerwheel [SEED]\n");
+		exit(1);
+	}
+	if ((argc == 2) && PARSENUM(&seed, argv[1])) {
+		warnp("Invalid seed: %s", argv[1]);
+		goto err0;
+	}
+
+	/* Run the test. */
+	if (check_random(seed))
+		goto err0;
+
+	/* Success! */
+	exit(0);
+
+err0:
+	/* Failure! */
+	exit(1);
+}